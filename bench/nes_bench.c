@@ -0,0 +1,771 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <BLOCK.h>
+#include <BUS.h>
+#include <CPU.h>
+#include <JIT.h>
+#include <NES.h>
+#include <NTSC.h>
+#include <POOL.h>
+#include <PROFILE.h>
+#include <TEST_ROM.h>
+#include <TRACE.h>
+#include <VIDEO.h>
+
+// Microbenchmarks for CPU dispatch, addressing modes, BUS regions and whole
+// frames. Every benchmark runs a fixed synthetic workload so results are
+// comparable between versions, the output is JSON on stdout (or -o).
+
+#define BENCH_REPETITIONS 5
+#define BENCH_CPU_OPS 2000000
+#define BENCH_BUS_OPS 8000000
+#define BENCH_FRAMES 120
+#define BENCH_VIDEO_FRAMES 200
+
+#define BENCH_CODE_ORIGIN 0x8000
+#define BENCH_CODE_END 0xF000
+#define BENCH_SUBROUTINE 0x7F00
+#define BENCH_DATA 0x0300
+
+typedef enum {
+    BENCH_COUNTER_CYCLES,
+    BENCH_COUNTER_INSTRUCTIONS,
+    BENCH_COUNTER_BRANCH_MISSES,
+    BENCH_COUNTER_CACHE_MISSES,
+    BENCH_COUNTER_COUNT
+} BENCH_COUNTER;
+
+static const char *BENCH_COUNTER_NAMES[BENCH_COUNTER_COUNT] = {"cycles", "instructions", "branch_misses",
+                                                               "cache_misses"};
+
+// Hardware counters of the calling thread, fd is -1 where perf_event is unavailable
+typedef struct {
+    int fd[BENCH_COUNTER_COUNT];
+    bool available;
+} BENCH_COUNTERS;
+
+typedef struct {
+    const char *name;
+    const char *group;
+    size_t ops;
+    double ns_per_op;        // fastest repetition
+    double ns_per_op_median;
+    size_t emulated_cycles;  // per repetition
+    double emulated_cycles_per_sec;
+    bool has_counters;
+    double counters[BENCH_COUNTER_COUNT]; // per op, summed over all repetitions
+} BENCH_RESULT;
+
+typedef struct BENCH BENCH;
+// Runs ops operations, returns the number of emulated CPU cycles they took
+typedef size_t (*BENCH_RunFunc)(BENCH *bench, const void *arg, size_t ops);
+
+struct BENCH {
+    BENCH_COUNTERS counters;
+    double scale;
+    const char *filter;
+    FILE *out;
+    size_t result_count;
+    bool first_result;
+
+    BUS *flat_bus;
+    CPU *flat_cpu;
+    NES *nes;
+    VIDEO *video; // frames are also submitted here when set
+    NTSC *ntsc;
+    volatile uint8_t sink;
+};
+
+// Instruction streams: a unit of code is repeated over the code area followed by
+// a JMP back to the start. Linked units get the address of the next unit patched
+// into their operand, which keeps jump benchmarks running straight through.
+typedef struct {
+    const char *name;
+    const char *group;
+    uint8_t code[4];
+    uint8_t size;
+    bool linked;
+} BENCH_STREAM;
+
+static const BENCH_STREAM BENCH_STREAMS[] = {
+    // Addressing modes, each through the cheapest op that uses it
+    {"am_imp", "addressing_mode", {0xE8}, 1, false},                // INX
+    {"am_imm", "addressing_mode", {0xA9, 0x12}, 2, false},          // LDA #$12
+    {"am_zp0", "addressing_mode", {0xA5, 0x40}, 2, false},          // LDA $40
+    {"am_zpx", "addressing_mode", {0xB5, 0x40}, 2, false},          // LDA $40,X
+    {"am_zpy", "addressing_mode", {0xB6, 0x40}, 2, false},          // LDX $40,Y
+    {"am_abs", "addressing_mode", {0xAD, 0x00, 0x03}, 3, false},    // LDA $0300
+    {"am_abx", "addressing_mode", {0xBD, 0x00, 0x03}, 3, false},    // LDA $0300,X
+    {"am_abx_cross", "addressing_mode", {0xBD, 0xFE, 0x03}, 3, false}, // LDA $03FE,X
+    {"am_aby", "addressing_mode", {0xB9, 0x00, 0x03}, 3, false},    // LDA $0300,Y
+    {"am_izx", "addressing_mode", {0xA1, 0x20}, 2, false},          // LDA ($20,X)
+    {"am_izy", "addressing_mode", {0xB1, 0x30}, 2, false},          // LDA ($30),Y
+    {"am_rel", "addressing_mode", {0xD0, 0x00}, 2, false},          // BNE *+2
+    {"am_ind", "addressing_mode", {0x6C, 0x00, 0x04}, 3, false},    // JMP ($0400)
+
+    // Opcode families
+    {"op_load", "opcode_family", {0xAD, 0x00, 0x03}, 3, false},     // LDA abs
+    {"op_store", "opcode_family", {0x8D, 0x00, 0x03}, 3, false},    // STA abs
+    {"op_arith", "opcode_family", {0x69, 0x01}, 2, false},          // ADC #
+    {"op_logic", "opcode_family", {0x29, 0x7F}, 2, false},          // AND #
+    {"op_compare", "opcode_family", {0xC9, 0x40}, 2, false},        // CMP #
+    {"op_shift", "opcode_family", {0x0A}, 1, false},                // ASL A
+    {"op_rmw", "opcode_family", {0xE6, 0x40}, 2, false},            // INC zp
+    {"op_incdec", "opcode_family", {0xCA}, 1, false},               // DEX
+    {"op_transfer", "opcode_family", {0xAA}, 1, false},             // TAX
+    {"op_flag", "opcode_family", {0x18}, 1, false},                 // CLC
+    {"op_branch_taken", "opcode_family", {0xD0, 0x00}, 2, false},   // BNE *+2
+    {"op_branch_not_taken", "opcode_family", {0xF0, 0x00}, 2, false}, // BEQ *+2
+    {"op_stack", "opcode_family", {0x48, 0x68}, 2, false},          // PHA, PLA
+    {"op_jump", "opcode_family", {0x4C, 0x00, 0x00}, 3, true},      // JMP next
+    {"op_subroutine", "opcode_family", {0x20, 0x00, 0x7F}, 3, false}, // JSR to an RTS
+    {"op_unofficial", "opcode_family", {0xC7, 0x40}, 2, false},     // DCP zp
+};
+
+typedef struct {
+    const char *name;
+    uint16_t base;
+    uint16_t mask;
+    bool write;
+} BENCH_REGION;
+
+// Regions of the NES address space, accessed through the real handlers
+static const BENCH_REGION BENCH_REGIONS[] = {
+    {"bus_read_ram", 0x0000, 0x07FF, false},
+    {"bus_read_ram_mirror", 0x0800, 0x07FF, false},
+    {"bus_read_ppu", 0x2002, 0x0000, false},
+    {"bus_read_apu", 0x4015, 0x0000, false},
+    {"bus_read_prg_ram", 0x6000, 0x1FFF, false},
+    {"bus_read_prg_rom", 0x8000, 0x7FFF, false},
+    {"bus_write_ram", 0x0000, 0x07FF, true},
+    {"bus_write_ram_mirror", 0x0800, 0x07FF, true},
+    {"bus_write_ppu", 0x2005, 0x0000, true},
+    {"bus_write_apu", 0x4000, 0x0000, true},
+    {"bus_write_prg_ram", 0x6000, 0x1FFF, true},
+    {"bus_write_prg_rom", 0x8000, 0x7FFF, true},
+};
+
+typedef struct {
+    const char *name;
+    VIDEO_FORMAT format;
+    bool scalar;
+} BENCH_VIDEO_KERNEL;
+
+// Palette conversion of one frame, the scalar loop and the host's best variant
+static const BENCH_VIDEO_KERNEL BENCH_VIDEO_KERNELS[] = {
+    {"video_rgba32_scalar", VIDEO_FORMAT_RGBA32, true}, {"video_rgba32", VIDEO_FORMAT_RGBA32, false},
+    {"video_rgb24_scalar", VIDEO_FORMAT_RGB24, true},   {"video_rgb24", VIDEO_FORMAT_RGB24, false},
+    {"video_y4m_scalar", VIDEO_FORMAT_Y4M, true},       {"video_y4m", VIDEO_FORMAT_Y4M, false},
+};
+
+typedef struct {
+    const char *name;
+    bool scalar;
+    size_t threads; // 0 for one band per core
+} BENCH_NTSC_VARIANT;
+
+// NTSC filter over one frame into an RGBA frame
+static const BENCH_NTSC_VARIANT BENCH_NTSC_VARIANTS[] = {
+    {"ntsc_scalar", true, 1},
+    {"ntsc", false, 1},
+    {"ntsc_bands", false, 0},
+};
+
+typedef struct {
+    VIDEO_FORMAT format;
+    VIDEO_ConvertFunc convert;
+    VIDEO_PALETTE palette;
+    const uint8_t *src;
+    uint8_t *dst;
+} BENCH_VIDEO_RUN;
+
+// Synthetic NROM program: enables NMI, rendering and a pulse tone, then loops
+// over a page of RAM. The NMI handler does OAM DMA and scrolls.
+static const uint8_t BENCH_ROM_CODE[] = {
+    0x78,             // C000 SEI
+    0xD8,             // C001 CLD
+    0xA2, 0xFF,       // C002 LDX #$FF
+    0x9A,             // C004 TXS
+    0xA9, 0x80,       // C005 LDA #$80
+    0x8D, 0x00, 0x20, // C007 STA $2000
+    0xA9, 0x1E,       // C00A LDA #$1E
+    0x8D, 0x01, 0x20, // C00C STA $2001
+    0xA9, 0x0F,       // C00F LDA #$0F
+    0x8D, 0x15, 0x40, // C011 STA $4015
+    0xA9, 0xBF,       // C014 LDA #$BF
+    0x8D, 0x00, 0x40, // C016 STA $4000
+    0xA9, 0xFD,       // C019 LDA #$FD
+    0x8D, 0x02, 0x40, // C01B STA $4002
+    0xA9, 0x00,       // C01E LDA #$00
+    0x8D, 0x03, 0x40, // C020 STA $4003
+    0xA2, 0x00,       // C023 LDX #$00
+    0xBD, 0x00, 0x03, // C025 LDA $0300,X
+    0x69, 0x01,       // C028 ADC #$01
+    0x9D, 0x00, 0x03, // C02A STA $0300,X
+    0xE8,             // C02D INX
+    0xD0, 0xF5,       // C02E BNE $C025
+    0x4C, 0x23, 0xC0, // C030 JMP $C023
+    0x48,             // C033 PHA (NMI)
+    0xA9, 0x02,       // C034 LDA #$02
+    0x8D, 0x14, 0x40, // C036 STA $4014
+    0xE6, 0x10,       // C039 INC $10
+    0xA5, 0x10,       // C03B LDA $10
+    0x8D, 0x05, 0x20, // C03D STA $2005
+    0x8D, 0x05, 0x20, // C040 STA $2005
+    0x68,             // C043 PLA
+    0x40,             // C044 RTI
+    0x40,             // C045 RTI (IRQ)
+};
+#define BENCH_ROM_NMI 0xC033
+#define BENCH_ROM_RESET 0xC000
+#define BENCH_ROM_IRQ 0xC045
+
+static double BENCH_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void BENCH_counters_open(BENCH_COUNTERS *counters) {
+    counters->available = false;
+    for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) counters->fd[i] = -1;
+
+#ifdef __linux__
+    static const uint64_t configs[BENCH_COUNTER_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                          PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES};
+    for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters->fd[i] >= 0) counters->available = true;
+    }
+#endif
+}
+
+static void BENCH_counters_close(BENCH_COUNTERS *counters) {
+    for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        if (counters->fd[i] >= 0) close(counters->fd[i]);
+        counters->fd[i] = -1;
+    }
+}
+
+static void BENCH_counters_start(BENCH_COUNTERS *counters) {
+#ifdef __linux__
+    for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        if (counters->fd[i] < 0) continue;
+        ioctl(counters->fd[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counters->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+// Adds the counts since BENCH_counters_start to totals, NAN for missing counters
+static void BENCH_counters_stop(BENCH_COUNTERS *counters, double *totals) {
+    for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        uint64_t value = 0;
+#ifdef __linux__
+        if (counters->fd[i] >= 0) {
+            ioctl(counters->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(counters->fd[i], &value, sizeof(value)) == sizeof(value)) {
+                totals[i] += (double)value;
+                continue;
+            }
+        }
+#endif
+        totals[i] = -1.0;
+    }
+}
+
+static int BENCH_compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void BENCH_print_number(FILE *out, double value) {
+    if (value < 0.0) {
+        fprintf(out, "null");
+    } else {
+        fprintf(out, "%.4f", value);
+    }
+}
+
+static void BENCH_write_result(BENCH *bench, const BENCH_RESULT *result) {
+    FILE *out = bench->out;
+    fprintf(out, "%s\n    {\"name\": \"%s\", \"group\": \"%s\", \"ops\": %zu, \"ns_per_op\": ",
+            bench->first_result ? "" : ",", result->name, result->group, result->ops);
+    BENCH_print_number(out, result->ns_per_op);
+    fprintf(out, ", \"ns_per_op_median\": ");
+    BENCH_print_number(out, result->ns_per_op_median);
+    fprintf(out, ", \"emulated_cycles\": %zu, \"emulated_cycles_per_sec\": ", result->emulated_cycles);
+    BENCH_print_number(out, result->emulated_cycles ? result->emulated_cycles_per_sec : -1.0);
+    fprintf(out, ", \"counters\": ");
+    if (!result->has_counters) {
+        fprintf(out, "null}");
+    } else {
+        fprintf(out, "{");
+        for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) {
+            fprintf(out, "%s\"%s_per_op\": ", i ? ", " : "", BENCH_COUNTER_NAMES[i]);
+            BENCH_print_number(out, result->counters[i]);
+        }
+        fprintf(out, "}}");
+    }
+    bench->first_result = false;
+
+    fprintf(stderr, "%-24s %10.2f ns/op", result->name, result->ns_per_op);
+    if (result->emulated_cycles) fprintf(stderr, " %10.2f MHz", result->emulated_cycles_per_sec / 1e6);
+    fprintf(stderr, "\n");
+}
+
+static void BENCH_run(BENCH *bench, const char *name, const char *group, BENCH_RunFunc run, const void *arg,
+                      size_t ops) {
+    if (bench->filter && !strstr(name, bench->filter)) return;
+
+    ops = (size_t)((double)ops * bench->scale);
+    if (ops == 0) ops = 1;
+
+    BENCH_RESULT result = {.name = name, .group = group, .ops = ops};
+    double times[BENCH_REPETITIONS];
+    double totals[BENCH_COUNTER_COUNT] = {0};
+
+    // Warm up caches and branch predictors with a short run
+    run(bench, arg, ops / 10 + 1);
+
+    for (size_t rep = 0; rep < BENCH_REPETITIONS; rep++) {
+        BENCH_counters_start(&bench->counters);
+        double start = BENCH_now();
+        result.emulated_cycles = run(bench, arg, ops);
+        times[rep] = BENCH_now() - start;
+        BENCH_counters_stop(&bench->counters, totals);
+    }
+
+    qsort(times, BENCH_REPETITIONS, sizeof(double), BENCH_compare_double);
+    result.ns_per_op = times[0] * 1e9 / (double)ops;
+    result.ns_per_op_median = times[BENCH_REPETITIONS / 2] * 1e9 / (double)ops;
+    result.emulated_cycles_per_sec = (double)result.emulated_cycles / times[0];
+    result.has_counters = bench->counters.available;
+    for (size_t i = 0; i < BENCH_COUNTER_COUNT; i++) {
+        result.counters[i] = totals[i] < 0.0 ? -1.0 : totals[i] / (double)(ops * BENCH_REPETITIONS);
+    }
+
+    BENCH_write_result(bench, &result);
+    bench->result_count += 1;
+}
+
+// Flat machine running one instruction stream
+
+static void BENCH_load_stream(BENCH *bench, const BENCH_STREAM *stream) {
+    BUS *bus = bench->flat_bus;
+    CPU *cpu = bench->flat_cpu;
+
+    BUS_init(bus);
+    for (size_t i = 0; i < RAM_SIZE; i++) {
+        bus->ram[i] = (uint8_t)(i * 7 + 3);
+    }
+    // Pointers for the indirect modes all lead to the data page
+    bus->ram[0x24] = BENCH_DATA & 0xFF;
+    bus->ram[0x25] = BENCH_DATA >> 8;
+    bus->ram[0x30] = BENCH_DATA & 0xFF;
+    bus->ram[0x31] = BENCH_DATA >> 8;
+    bus->ram[0x0400] = BENCH_CODE_ORIGIN & 0xFF;
+    bus->ram[0x0401] = BENCH_CODE_ORIGIN >> 8;
+    bus->ram[BENCH_SUBROUTINE] = 0x60; // RTS
+
+    uint16_t addr = BENCH_CODE_ORIGIN;
+    while (addr + stream->size + 3 <= BENCH_CODE_END) {
+        memcpy(&bus->ram[addr], stream->code, stream->size);
+        if (stream->linked) {
+            uint16_t next = addr + stream->size;
+            bus->ram[addr + 1] = next & 0xFF;
+            bus->ram[addr + 2] = next >> 8;
+        }
+        addr += stream->size;
+    }
+    bus->ram[addr + 0] = 0x4C; // JMP origin
+    bus->ram[addr + 1] = BENCH_CODE_ORIGIN & 0xFF;
+    bus->ram[addr + 2] = BENCH_CODE_ORIGIN >> 8;
+
+    CPU_init(cpu, bus);
+    cpu->reg.PC = BENCH_CODE_ORIGIN;
+    cpu->reg.A = 0x40;
+    cpu->reg.X = 4;
+    cpu->reg.Y = 4;
+    // Z clear keeps BNE taken and BEQ not taken, nothing in a branch stream sets it
+    CPU_set_status(cpu, CPU_FLAGS_U | CPU_FLAGS_I);
+}
+
+static size_t BENCH_run_stream(BENCH *bench, const void *arg, size_t ops) {
+    CPU *cpu = bench->flat_cpu;
+    size_t start = cpu->clock_counter;
+    for (size_t i = 0; i < ops; i++) {
+        CPU_step(cpu);
+    }
+    return cpu->clock_counter - start;
+}
+
+static void BENCH_streams(BENCH *bench) {
+    for (size_t i = 0; i < sizeof(BENCH_STREAMS) / sizeof(BENCH_STREAMS[0]); i++) {
+        const BENCH_STREAM *stream = &BENCH_STREAMS[i];
+        if (bench->filter && !strstr(stream->name, bench->filter)) continue;
+        BENCH_load_stream(bench, stream);
+        BENCH_run(bench, stream->name, stream->group, BENCH_run_stream, stream, BENCH_CPU_OPS);
+    }
+}
+
+// The same streams again, run from the decoded block cache
+static void BENCH_block_cache(BENCH *bench) {
+    BLOCK_CACHE cache;
+    BLOCK_CACHE_init(&cache, BLOCK_DEFAULT_CAPACITY);
+    for (size_t i = 0; i < sizeof(BENCH_STREAMS) / sizeof(BENCH_STREAMS[0]); i++) {
+        const BENCH_STREAM *stream = &BENCH_STREAMS[i];
+        char name[64];
+        snprintf(name, sizeof(name), "block_%s", stream->name);
+        if (bench->filter && !strstr(name, bench->filter)) continue;
+        BENCH_load_stream(bench, stream);
+        CPU_set_block_cache(bench->flat_cpu, &cache);
+        BENCH_run(bench, name, "block_cache", BENCH_run_stream, stream, BENCH_CPU_OPS);
+        CPU_set_block_cache(bench->flat_cpu, NULL);
+    }
+    BLOCK_CACHE_free(&cache);
+}
+
+// Compiled code runs whole blocks, so ops are converted to the cycles the same
+// number of instructions take in the interpreter
+static size_t BENCH_run_jit_stream(BENCH *bench, const void *arg, size_t ops) {
+    const double *cycles_per_op = arg;
+    CPU *cpu = bench->flat_cpu;
+    size_t start = cpu->clock_counter;
+    size_t end = start + (size_t)((double)ops * *cycles_per_op);
+    while (cpu->clock_counter < end) {
+        CPU_step_until(cpu, end);
+    }
+    return cpu->clock_counter - start;
+}
+
+// The same streams again, run by the recompiler
+static void BENCH_jit(BENCH *bench) {
+    JIT jit;
+    if (!JIT_init(&jit, JIT_DEFAULT_ARENA_SIZE)) return;
+    for (size_t i = 0; i < sizeof(BENCH_STREAMS) / sizeof(BENCH_STREAMS[0]); i++) {
+        const BENCH_STREAM *stream = &BENCH_STREAMS[i];
+        char name[64];
+        snprintf(name, sizeof(name), "jit_%s", stream->name);
+        if (bench->filter && !strstr(name, bench->filter)) continue;
+        BENCH_load_stream(bench, stream);
+        double cycles_per_op = (double)BENCH_run_stream(bench, NULL, 1000) / 1000.0;
+        CPU_set_jit(bench->flat_cpu, &jit);
+        BENCH_run(bench, name, "jit", BENCH_run_jit_stream, &cycles_per_op, BENCH_CPU_OPS);
+        CPU_set_jit(bench->flat_cpu, NULL);
+    }
+    JIT_free(&jit);
+}
+
+static size_t BENCH_find_stream(const char *name) {
+    for (size_t i = 0; i < sizeof(BENCH_STREAMS) / sizeof(BENCH_STREAMS[0]); i++) {
+        if (strcmp(BENCH_STREAMS[i].name, name) == 0) return i;
+    }
+    PANIC_FMT("Unknown benchmark stream '%s'!", name);
+}
+
+// The load stream again with the execution tracer recording every instruction
+static void BENCH_trace(BENCH *bench) {
+    if (bench->filter && !strstr("trace_enabled", bench->filter)) return;
+
+    TRACE trace;
+    TRACE_init(&trace, TRACE_DEFAULT_CAPACITY);
+    BENCH_load_stream(bench, &BENCH_STREAMS[BENCH_find_stream("op_load")]);
+    CPU_set_trace(bench->flat_cpu, &trace);
+    BENCH_run(bench, "trace_enabled", "trace", BENCH_run_stream, NULL, BENCH_CPU_OPS);
+    CPU_set_trace(bench->flat_cpu, NULL);
+    TRACE_free(&trace);
+}
+
+// And with the profiler counting instructions and memory accesses
+static void BENCH_profile(BENCH *bench) {
+    if (bench->filter && !strstr("profile_enabled", bench->filter)) return;
+
+    PROFILE *profile = malloc(sizeof(PROFILE));
+    if (!profile) {
+        PANIC("Out of memory allocating the profile!");
+    }
+    PROFILE_init(profile);
+    BENCH_load_stream(bench, &BENCH_STREAMS[BENCH_find_stream("op_load")]);
+    CPU_set_profile(bench->flat_cpu, profile);
+    BENCH_run(bench, "profile_enabled", "profile", BENCH_run_stream, NULL, BENCH_CPU_OPS);
+    CPU_set_profile(bench->flat_cpu, NULL);
+    free(profile);
+}
+
+// NES machine on the synthetic ROM
+
+static size_t BENCH_run_region(BENCH *bench, const void *arg, size_t ops) {
+    const BENCH_REGION *region = arg;
+    BUS *bus = &bench->nes->bus;
+    uint8_t sum = 0;
+
+    if (region->write) {
+        for (size_t i = 0; i < ops; i++) {
+            BUS_write(bus, region->base + (i & region->mask), (uint8_t)i);
+        }
+    } else {
+        for (size_t i = 0; i < ops; i++) {
+            sum += BUS_read(bus, region->base + (i & region->mask), false);
+        }
+    }
+
+    bench->sink = sum;
+    return 0;
+}
+
+static size_t BENCH_run_frames(BENCH *bench, const void *arg, size_t ops) {
+    NES *nes = bench->nes;
+    size_t start = nes->cpu.clock_counter;
+    for (size_t i = 0; i < ops; i++) {
+        NES_run_frame(nes);
+        if (bench->video) VIDEO_submit(bench->video, &nes->ppu.framebuffer[0][0]);
+    }
+    return nes->cpu.clock_counter - start;
+}
+
+static bool BENCH_load_nes(BENCH *bench, const char *rom_path) {
+    char path[] = "/tmp/nes_bench_XXXXXX";
+    if (!rom_path) {
+        if (!TEST_ROM_write(path, BENCH_ROM_CODE, sizeof(BENCH_ROM_CODE), BENCH_ROM_NMI, BENCH_ROM_RESET,
+                            BENCH_ROM_IRQ)) {
+            fprintf(stderr, "Could not write the synthetic ROM\n");
+            return false;
+        }
+    }
+
+    bool ok = NES_init(bench->nes, rom_path ? rom_path : path);
+    // The cartridge keeps its own mapping of the file
+    if (!rom_path) unlink(path);
+    return ok;
+}
+
+static void BENCH_nes(BENCH *bench, const char *rom_path) {
+    if (!BENCH_load_nes(bench, NULL)) return;
+
+    for (size_t i = 0; i < sizeof(BENCH_REGIONS) / sizeof(BENCH_REGIONS[0]); i++) {
+        BENCH_run(bench, BENCH_REGIONS[i].name, "bus", BENCH_run_region, &BENCH_REGIONS[i], BENCH_BUS_OPS);
+    }
+
+    // Regions left the machine in an arbitrary state, frames start from power on
+    NES_power(bench->nes);
+    BENCH_run(bench, "frame_render", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+    NES_set_fast_forward(bench->nes, true);
+    BENCH_run(bench, "frame_fast_forward", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+
+    // What capturing costs the emulation thread: a copy into the pool per frame
+    VIDEO video;
+    if ((!bench->filter || strstr("frame_render_video", bench->filter)) &&
+        VIDEO_open(&video, "/dev/null", VIDEO_FORMAT_RGBA32, VIDEO_DEFAULT_BUFFERS, NULL)) {
+        NES_power(bench->nes);
+        NES_set_fast_forward(bench->nes, false);
+        bench->video = &video;
+        BENCH_run(bench, "frame_render_video", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        bench->video = NULL;
+        fprintf(stderr, "%-24s %10llu frames written, %llu dropped\n", "", (unsigned long long)video.frames,
+                (unsigned long long)video.dropped);
+        VIDEO_close(&video);
+    }
+
+    // The PPU thread needs a core of its own to mean anything
+    if (POOL_default_workers() > 1 && NES_set_ppu_thread(bench->nes, true)) {
+        NES_power(bench->nes);
+        NES_set_fast_forward(bench->nes, false);
+        BENCH_run(bench, "frame_render_ppu_thread", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        NES_set_ppu_thread(bench->nes, false);
+    }
+
+    JIT jit;
+    if (JIT_init(&jit, JIT_DEFAULT_ARENA_SIZE)) {
+        NES_power(bench->nes);
+        NES_set_fast_forward(bench->nes, false);
+        CPU_set_jit(&bench->nes->cpu, &jit);
+        BENCH_run(bench, "frame_render_jit", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        NES_set_fast_forward(bench->nes, true);
+        BENCH_run(bench, "frame_fast_forward_jit", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        CPU_set_jit(&bench->nes->cpu, NULL);
+        JIT_free(&jit);
+    }
+    NES_free(bench->nes);
+
+    if (rom_path && BENCH_load_nes(bench, rom_path)) {
+        BENCH_run(bench, "frame_render_rom", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        if (POOL_default_workers() > 1 && NES_set_ppu_thread(bench->nes, true)) {
+            BENCH_run(bench, "frame_render_rom_ppu_thread", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+            NES_set_ppu_thread(bench->nes, false);
+        }
+        NES_set_fast_forward(bench->nes, true);
+        BENCH_run(bench, "frame_fast_forward_rom", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        bench->nes->skip_idle_loops = false;
+        BENCH_run(bench, "frame_fast_forward_rom_busy", "frame", BENCH_run_frames, NULL, BENCH_FRAMES);
+        NES_free(bench->nes);
+    }
+}
+
+static size_t BENCH_run_video(BENCH *bench, const void *arg, size_t ops) {
+    const BENCH_VIDEO_RUN *run = arg;
+    for (size_t i = 0; i < ops; i++) {
+        run->convert(&run->palette, run->format, run->src, run->dst, VIDEO_FRAME_PIXELS);
+    }
+    bench->sink = run->dst[0];
+    return 0;
+}
+
+static void BENCH_video(BENCH *bench) {
+    uint8_t *src = malloc(VIDEO_FRAME_PIXELS);
+    uint8_t *dst = malloc(VIDEO_frame_size(VIDEO_FORMAT_RGBA32, PPU_WIDTH));
+    if (!src || !dst) {
+        PANIC("Out of memory allocating video frames!");
+    }
+    srand(1);
+    for (size_t i = 0; i < VIDEO_FRAME_PIXELS; i++) {
+        src[i] = (uint8_t)(rand() & 0x3F);
+    }
+
+    VIDEO_ConvertFunc best = VIDEO_select_convert();
+    for (size_t i = 0; i < sizeof(BENCH_VIDEO_KERNELS) / sizeof(BENCH_VIDEO_KERNELS[0]); i++) {
+        const BENCH_VIDEO_KERNEL *kernel = &BENCH_VIDEO_KERNELS[i];
+        BENCH_VIDEO_RUN run = {kernel->format, kernel->scalar ? VIDEO_convert_scalar : best, {{{0}}}, src, dst};
+        VIDEO_init_palette(&run.palette, kernel->format);
+        BENCH_run(bench, kernel->name, "video", BENCH_run_video, &run, BENCH_VIDEO_FRAMES);
+    }
+
+    free(dst);
+    free(src);
+}
+
+static void BENCH_ntsc_row(void *ctx, size_t y, const uint8_t *rgba) {
+    VIDEO_pack_row_scalar(VIDEO_FORMAT_RGBA32, rgba, ctx, y, NTSC_OUT_WIDTH);
+}
+
+static size_t BENCH_run_ntsc(BENCH *bench, const void *arg, size_t ops) {
+    const BENCH_VIDEO_RUN *run = arg;
+    // Helpers start once per stream, not per frame
+    NTSC_BANDS bands;
+    NTSC_BANDS_start(&bands, bench->ntsc);
+    for (size_t i = 0; i < ops; i++) {
+        NTSC_BANDS_filter(&bands, run->src, (unsigned)i, BENCH_ntsc_row, run->dst);
+    }
+    NTSC_BANDS_stop(&bands);
+    bench->sink = run->dst[0];
+    return 0;
+}
+
+static void BENCH_ntsc(BENCH *bench) {
+    bench->ntsc = malloc(sizeof(NTSC));
+    uint8_t *src = malloc(VIDEO_FRAME_PIXELS);
+    uint8_t *dst = malloc(VIDEO_frame_size(VIDEO_FORMAT_RGBA32, NTSC_OUT_WIDTH));
+    if (!bench->ntsc || !src || !dst) {
+        PANIC("Out of memory allocating the NTSC filter!");
+    }
+    srand(1);
+    for (size_t i = 0; i < VIDEO_FRAME_PIXELS; i++) {
+        src[i] = (uint8_t)(rand() & 0x3F);
+    }
+    NTSC_init(bench->ntsc, &NTSC_COMPOSITE);
+
+    NTSC_RowFunc best = bench->ntsc->row;
+    size_t cores = bench->ntsc->threads;
+    BENCH_VIDEO_RUN run = {VIDEO_FORMAT_RGBA32, NULL, {{{0}}}, src, dst};
+    for (size_t i = 0; i < sizeof(BENCH_NTSC_VARIANTS) / sizeof(BENCH_NTSC_VARIANTS[0]); i++) {
+        const BENCH_NTSC_VARIANT *variant = &BENCH_NTSC_VARIANTS[i];
+        // Bands only pay off with cores to run them on
+        if (!variant->threads && cores < 2) continue;
+        bench->ntsc->row = variant->scalar ? NTSC_row_scalar : best;
+        bench->ntsc->threads = variant->threads ? variant->threads : cores;
+        BENCH_run(bench, variant->name, "ntsc", BENCH_run_ntsc, &run, BENCH_VIDEO_FRAMES);
+    }
+
+    free(dst);
+    free(src);
+    free(bench->ntsc);
+    bench->ntsc = NULL;
+}
+
+static void BENCH_usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-o output.json] [-f name_filter] [-s scale] [-r rom]\n"
+            "  -s  multiplies the operation counts, e.g. 0.01 for a smoke run\n"
+            "  -r  additionally measures whole frames of a real ROM\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    BENCH bench = {.scale = 1.0, .out = stdout, .first_result = true};
+    const char *rom_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:f:s:r:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            bench.out = fopen(optarg, "w");
+            if (!bench.out) {
+                fprintf(stderr, "Could not open '%s' for writing\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'f':
+            bench.filter = optarg;
+            break;
+        case 's':
+            bench.scale = strtod(optarg, NULL);
+            break;
+        case 'r':
+            rom_path = optarg;
+            break;
+        default:
+            BENCH_usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (bench.scale <= 0.0) {
+        BENCH_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bench.flat_bus = malloc(sizeof(BUS));
+    bench.flat_cpu = malloc(sizeof(CPU));
+    bench.nes = malloc(sizeof(NES));
+    if (!bench.flat_bus || !bench.flat_cpu || !bench.nes) {
+        PANIC("Out of memory allocating the benchmark machines!");
+    }
+    BENCH_counters_open(&bench.counters);
+
+    fprintf(bench.out, "{\n  \"version\": 1,\n  \"scale\": %g,\n  \"perf_counters\": %s,\n  \"benchmarks\": [",
+            bench.scale, bench.counters.available ? "true" : "false");
+    BENCH_streams(&bench);
+    BENCH_block_cache(&bench);
+    BENCH_jit(&bench);
+    BENCH_trace(&bench);
+    BENCH_profile(&bench);
+    BENCH_video(&bench);
+    BENCH_ntsc(&bench);
+    BENCH_nes(&bench, rom_path);
+    fprintf(bench.out, "\n  ]\n}\n");
+
+    BENCH_counters_close(&bench.counters);
+    if (bench.out != stdout) fclose(bench.out);
+    free(bench.nes);
+    free(bench.flat_cpu);
+    free(bench.flat_bus);
+    return EXIT_SUCCESS;
+}
@@ -4,15 +4,190 @@
 #include <string.h>
 
 #include <BUS.h>
+#include <CALLGRAPH.h>
 #include <CPU.h>
+#include <JIT.h>
+#include <NES.h>
+#include <NTSC.h>
+#include <PROFILE.h>
+#include <TRACE.h>
+#include <VIDEO.h>
 
-int main() {
-    CPU cpu;
-    BUS bus;
+#define DEFAULT_FRAMES 60
 
-    CPU_init(&cpu, &bus);
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        CPU cpu;
+        BUS bus;
 
-    CPU_clock(&cpu);
+        BUS_init(&bus);
+        CPU_init(&cpu, &bus);
+
+        CPU_clock(&cpu);
+
+        return EXIT_SUCCESS;
+    }
+
+    NES *nes = malloc(sizeof(NES));
+    if (!nes) {
+        PANIC("Out of memory allocating the console!");
+    }
+    if (!NES_init(nes, argv[1])) {
+        free(nes);
+        return EXIT_FAILURE;
+    }
+    CART_print_info(&nes->cart);
+
+    // NES_TRACE=<file> keeps the last instructions in a ring buffer, written to
+    // the file on exit or PANIC
+    const char *trace_path = getenv("NES_TRACE");
+    TRACE trace;
+    if (trace_path) {
+        TRACE_init(&trace, TRACE_DEFAULT_CAPACITY);
+        TRACE_dump_on_panic(&trace, trace_path);
+        CPU_set_trace(&nes->cpu, &trace);
+    }
+
+    // NES_PROFILE=<prefix> writes <prefix>.json, .csv and .ppm on exit
+    const char *profile_prefix = getenv("NES_PROFILE");
+    PROFILE *profile = NULL;
+    if (profile_prefix) {
+        profile = malloc(sizeof(PROFILE));
+        if (!profile) {
+            PANIC("Out of memory allocating the profile!");
+        }
+        PROFILE_init(profile);
+        CPU_set_profile(&nes->cpu, profile);
+    }
+
+    // NES_CALLGRIND=<file> writes a guest call graph for KCachegrind on exit,
+    // NES_LABELS=<.nl|.dbg> names the functions in it
+    const char *callgrind_path = getenv("NES_CALLGRIND");
+    CALLGRAPH *callgraph = NULL;
+    if (callgrind_path) {
+        callgraph = malloc(sizeof(CALLGRAPH));
+        if (!callgraph) {
+            PANIC("Out of memory allocating the call graph!");
+        }
+        CALLGRAPH_init(callgraph);
+        const char *labels_path = getenv("NES_LABELS");
+        if (labels_path) CALLGRAPH_load_labels(callgraph, labels_path);
+        CPU_set_callgraph(&nes->cpu, callgraph);
+    }
+
+    // NES_JIT=1 runs hot code through the x86-64 recompiler when it is built in
+    const char *jit_env = getenv("NES_JIT");
+    JIT *jit = NULL;
+    if (jit_env && strcmp(jit_env, "0") != 0) {
+        jit = malloc(sizeof(JIT));
+        if (!jit) {
+            PANIC("Out of memory allocating the recompiler!");
+        }
+        if (JIT_init(jit, JIT_DEFAULT_ARENA_SIZE)) {
+            CPU_set_jit(&nes->cpu, jit);
+        } else {
+            fprintf(stderr, "Recompiler not available, interpreting\n");
+            free(jit);
+            jit = NULL;
+        }
+    }
+
+    // NES_PPU_THREAD=1 runs the PPU on a thread of its own, for hosts with a
+    // core to spare
+    const char *ppu_thread_env = getenv("NES_PPU_THREAD");
+    if (ppu_thread_env && strcmp(ppu_thread_env, "0") != 0 && !NES_set_ppu_thread(nes, true)) {
+        fprintf(stderr, "PPU thread could not be started, running the PPU inline\n");
+    }
+
+    // NES_VIDEO=<file|fifo|"|command"|shm:/name> streams every frame from a
+    // worker thread, as NES_VIDEO_FORMAT=rgba32 (default), rgb24 or y4m.
+    // NES_NTSC=composite|svideo|monochrome runs the frames through the NTSC filter.
+    const char *video_target = getenv("NES_VIDEO");
+    const char *video_format_env = getenv("NES_VIDEO_FORMAT");
+    const char *ntsc_env = getenv("NES_NTSC");
+    VIDEO_FORMAT video_format = VIDEO_FORMAT_RGBA32;
+    VIDEO *video = NULL;
+    NTSC *ntsc = NULL;
+    NTSC_SETUP ntsc_setup;
+    if (video_format_env && !VIDEO_parse_format(video_format_env, &video_format)) {
+        fprintf(stderr, "Unknown video format '%s', using rgba32\n", video_format_env);
+    }
+    if (video_target && ntsc_env) {
+        if (NTSC_parse_setup(ntsc_env, &ntsc_setup)) {
+            ntsc = malloc(sizeof(NTSC));
+            if (!ntsc) {
+                PANIC("Out of memory allocating the NTSC filter!");
+            }
+            NTSC_init(ntsc, &ntsc_setup);
+        } else {
+            fprintf(stderr, "Unknown NTSC preset '%s', writing unfiltered frames\n", ntsc_env);
+        }
+    }
+    if (video_target) {
+        video = malloc(sizeof(VIDEO));
+        if (!video) {
+            PANIC("Out of memory allocating the video output!");
+        }
+        if (!VIDEO_open(video, video_target, video_format, VIDEO_DEFAULT_BUFFERS, ntsc)) {
+            free(video);
+            video = NULL;
+        }
+    }
+
+    size_t frames = (argc > 2) ? strtoul(argv[2], NULL, 10) : DEFAULT_FRAMES;
+    for (size_t i = 0; i < frames; i++) {
+        NES_run_frame(nes);
+        if (video) VIDEO_submit(video, &nes->ppu.framebuffer[0][0]);
+    }
+    CPU_print_registers(&nes->cpu);
+    const BLOCK_CACHE *blocks = &nes->block_cache;
+    if (blocks->lookups) {
+        printf("Block cache: %.2f%% of %llu block entries hit\n",
+               100.0 * (double)(blocks->lookups - blocks->decodes) / (double)blocks->lookups,
+               (unsigned long long)blocks->lookups);
+    }
+    if (nes->idle_cycles) {
+        printf("Idle loops: %.2f%% of cycles skipped\n",
+               100.0 * (double)nes->idle_cycles / (double)nes->cpu.clock_counter);
+    }
+    if (jit) {
+        printf("JIT: %.2f%% of %zu cycles in compiled code, %llu blocks compiled\n",
+               100.0 * (double)jit->cycles / (double)nes->cpu.clock_counter, nes->cpu.clock_counter,
+               (unsigned long long)jit->compiles);
+    }
+
+    if (video) {
+        VIDEO_close(video);
+        printf("Video: %llu frames written, %llu dropped\n", (unsigned long long)video->frames,
+               (unsigned long long)video->dropped);
+        free(video);
+    }
+    free(ntsc);
+
+    if (callgraph) {
+        CPU_set_callgraph(&nes->cpu, NULL);
+        CALLGRAPH_write_callgrind_file(callgraph, callgrind_path, argv[1]);
+        CALLGRAPH_free(callgraph);
+        free(callgraph);
+    }
+    if (profile) {
+        CPU_set_profile(&nes->cpu, NULL);
+        PROFILE_write_reports(profile, profile_prefix);
+        free(profile);
+    }
+    if (jit) {
+        CPU_set_jit(&nes->cpu, NULL);
+        JIT_free(jit);
+        free(jit);
+    }
+    if (trace_path) {
+        TRACE_dump_on_panic(&trace, NULL);
+        TRACE_dump_file(&trace, trace_path);
+        TRACE_free(&trace);
+    }
+
+    NES_free(nes);
+    free(nes);
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,106 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <POOL.h>
+#include <RUNNER.h>
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s <manifest> [-j workers] [-r render_interval] [-H hash_file] [-v video_prefix] [-F format]\n"
+            "       [-N ntsc_preset]\n",
+            name);
+    fprintf(stderr, "  -r N  render and hash every Nth frame plus the last, 0 only the last\n");
+    fprintf(stderr, "  -v P  write the rendered frames of job N to <P><N>.<ext>, or shm:<P><N>\n");
+    fprintf(stderr, "  -F F  video format: rgba32 (default), rgb24 or y4m\n");
+    fprintf(stderr, "  -N P  video through the NTSC filter: composite, svideo or monochrome\n");
+}
+
+int main(int argc, char **argv) {
+    const char *manifest = NULL;
+    const char *hash_path = NULL;
+    size_t workers = POOL_default_workers();
+    size_t render_interval = 1;
+    const char *video_prefix = NULL;
+    VIDEO_FORMAT video_format = VIDEO_FORMAT_RGBA32;
+    const char *ntsc_preset = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            workers = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            render_interval = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            hash_path = argv[++i];
+        } else if (strcmp(argv[i], "-v") == 0 && i + 1 < argc) {
+            video_prefix = argv[++i];
+        } else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc) {
+            ntsc_preset = argv[++i];
+        } else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc) {
+            if (!VIDEO_parse_format(argv[++i], &video_format)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (argv[i][0] != '-' && !manifest) {
+            manifest = argv[i];
+        } else {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!manifest) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    RUNNER runner;
+    if (!RUNNER_load_manifest(&runner, manifest)) {
+        return EXIT_FAILURE;
+    }
+
+    runner.render_interval = render_interval;
+
+    // Jobs already fill every worker, each filters its frames on one thread
+    NTSC *ntsc = NULL;
+    NTSC_SETUP ntsc_setup;
+    if (ntsc_preset) {
+        if (!NTSC_parse_setup(ntsc_preset, &ntsc_setup)) {
+            usage(argv[0]);
+            RUNNER_free(&runner);
+            return EXIT_FAILURE;
+        }
+        ntsc = malloc(sizeof(NTSC));
+        if (!ntsc) {
+            PANIC("Out of memory allocating the NTSC filter!");
+        }
+        NTSC_init(ntsc, &ntsc_setup);
+        ntsc->threads = 1;
+    }
+    if (video_prefix) RUNNER_set_video(&runner, video_prefix, video_format, ntsc);
+
+    FILE *hash_file = NULL;
+    if (hash_path && !(hash_file = fopen(hash_path, "w"))) {
+        fprintf(stderr, "Could not open '%s' for writing\n", hash_path);
+        RUNNER_free(&runner);
+        return EXIT_FAILURE;
+    }
+
+    RUNNER_run(&runner, workers);
+    RUNNER_print_results(&runner, stdout, hash_file);
+
+    bool ok = true;
+    for (size_t i = 0; i < runner.job_count; i++) {
+        ok = ok && runner.results[i].ok;
+        if (runner.results[i].video_dropped) {
+            fprintf(stderr, "Job %zu: %llu video frames dropped\n", i,
+                    (unsigned long long)runner.results[i].video_dropped);
+        }
+    }
+
+    if (hash_file) fclose(hash_file);
+    RUNNER_free(&runner);
+    free(ntsc);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,534 @@
+#include <APU.h>
+
+// Linear approximation of the mixer, amplitude per channel output level such
+// that all channels at full volume stay below INT16_MAX
+#define APU_PULSE_WEIGHT 246
+#define APU_TRIANGLE_WEIGHT 279
+#define APU_NOISE_WEIGHT 162
+#define APU_DMC_WEIGHT 110
+
+static const uint8_t APU_LENGTH_TABLE[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30};
+
+static const uint8_t APU_DUTY_TABLE[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0},
+    {0, 1, 1, 0, 0, 0, 0, 0},
+    {0, 1, 1, 1, 1, 0, 0, 0},
+    {1, 0, 0, 1, 1, 1, 1, 1}};
+
+static const uint8_t APU_TRIANGLE_TABLE[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+
+// Timer periods in CPU cycles (NTSC)
+static const uint16_t APU_NOISE_PERIODS[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+
+static const uint16_t APU_DMC_PERIODS[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+
+// Frame sequencer steps in CPU cycles after a restart
+static const size_t APU_FRAME_STEPS_4[4] = {7457, 14913, 22371, 29829};
+static const size_t APU_FRAME_STEPS_5[5] = {7457, 14913, 22371, 29829, 37281};
+#define APU_FRAME_PERIOD_4 29830
+#define APU_FRAME_PERIOD_5 37282
+
+// amp holds the level last sent to the blip buffer, it is left alone while
+// not synthesizing so the first delta afterwards lands on the right level
+static void APU_set_amp(APU *apu, int *amp, int value, size_t time) {
+    if (apu->synthesize && value != *amp) {
+        BLIP_add_delta(&apu->blip, time - apu->frame_start, value - *amp);
+        *amp = value;
+    }
+}
+
+static size_t APU_steps_until(size_t timer, size_t end, size_t period) {
+    return (end - timer + period - 1) / period;
+}
+
+// Envelope and length counter
+
+static uint8_t APU_envelope_volume(const APU_ENVELOPE *envelope) {
+    return envelope->constant ? envelope->volume : envelope->decay;
+}
+
+static void APU_envelope_clock(APU_ENVELOPE *envelope) {
+    if (envelope->start) {
+        envelope->start = false;
+        envelope->decay = 15;
+        envelope->divider = envelope->volume;
+    } else if (envelope->divider == 0) {
+        envelope->divider = envelope->volume;
+        if (envelope->decay) {
+            envelope->decay -= 1;
+        } else if (envelope->loop) {
+            envelope->decay = 15;
+        }
+    } else {
+        envelope->divider -= 1;
+    }
+}
+
+static void APU_length_clock(uint8_t *length, bool halt) {
+    if (!halt && *length) *length -= 1;
+}
+
+// Pulse
+
+static uint16_t APU_sweep_target(const APU_PULSE *pulse) {
+    int change = pulse->period >> pulse->sweep_shift;
+    if (pulse->sweep_negate) {
+        int target = pulse->period - change - (pulse->ones_complement ? 1 : 0);
+        return target < 0 ? 0 : target;
+    }
+    return pulse->period + change;
+}
+
+static bool APU_pulse_muted(const APU_PULSE *pulse) {
+    return !pulse->length || pulse->period < 8 || APU_sweep_target(pulse) > 0x7FF ||
+           !APU_envelope_volume(&pulse->envelope);
+}
+
+static int APU_pulse_output(const APU_PULSE *pulse) {
+    if (APU_pulse_muted(pulse) || !APU_DUTY_TABLE[pulse->duty][pulse->step]) return 0;
+    return APU_envelope_volume(&pulse->envelope) * APU_PULSE_WEIGHT;
+}
+
+static void APU_sweep_clock(APU_PULSE *pulse) {
+    uint16_t target = APU_sweep_target(pulse);
+    if (pulse->sweep_divider == 0 && pulse->sweep_enabled && pulse->sweep_shift && pulse->period >= 8 &&
+        target <= 0x7FF) {
+        pulse->period = target;
+    }
+
+    if (pulse->sweep_divider == 0 || pulse->sweep_reload) {
+        pulse->sweep_divider = pulse->sweep_period;
+        pulse->sweep_reload = false;
+    } else {
+        pulse->sweep_divider -= 1;
+    }
+}
+
+static void APU_pulse_run(APU *apu, APU_PULSE *pulse, size_t end) {
+    APU_set_amp(apu, &pulse->amp, APU_pulse_output(pulse), apu->time);
+    if (pulse->timer >= end) return;
+
+    size_t period = (pulse->period + 1) * 2;
+    if (APU_pulse_muted(pulse) || !apu->synthesize) {
+        size_t steps = APU_steps_until(pulse->timer, end, period);
+        pulse->step = (pulse->step + steps) & 0x07;
+        pulse->timer += steps * period;
+        return;
+    }
+
+    while (pulse->timer < end) {
+        pulse->step = (pulse->step + 1) & 0x07;
+        APU_set_amp(apu, &pulse->amp, APU_pulse_output(pulse), pulse->timer);
+        pulse->timer += period;
+    }
+}
+
+// Triangle
+
+static void APU_triangle_run(APU *apu, APU_TRIANGLE *triangle, size_t end) {
+    APU_set_amp(apu, &triangle->amp, APU_TRIANGLE_TABLE[triangle->step] * APU_TRIANGLE_WEIGHT, apu->time);
+    if (triangle->timer >= end) return;
+
+    size_t period = triangle->period + 1;
+    // Halted or ultrasonic periods hold the current level
+    if (!triangle->length || !triangle->linear || triangle->period < 2) {
+        triangle->timer += APU_steps_until(triangle->timer, end, period) * period;
+        return;
+    }
+    if (!apu->synthesize) {
+        size_t steps = APU_steps_until(triangle->timer, end, period);
+        triangle->step = (triangle->step + steps) & 0x1F;
+        triangle->timer += steps * period;
+        return;
+    }
+
+    while (triangle->timer < end) {
+        triangle->step = (triangle->step + 1) & 0x1F;
+        APU_set_amp(apu, &triangle->amp, APU_TRIANGLE_TABLE[triangle->step] * APU_TRIANGLE_WEIGHT, triangle->timer);
+        triangle->timer += period;
+    }
+}
+
+static void APU_triangle_linear_clock(APU_TRIANGLE *triangle) {
+    if (triangle->linear_reload_flag) {
+        triangle->linear = triangle->linear_reload;
+    } else if (triangle->linear) {
+        triangle->linear -= 1;
+    }
+    if (!triangle->control) triangle->linear_reload_flag = false;
+}
+
+// Noise
+
+static int APU_noise_output(const APU_NOISE *noise) {
+    if (!noise->length || (noise->shift & 0x01)) return 0;
+    return APU_envelope_volume(&noise->envelope) * APU_NOISE_WEIGHT;
+}
+
+static void APU_noise_run(APU *apu, APU_NOISE *noise, size_t end) {
+    APU_set_amp(apu, &noise->amp, APU_noise_output(noise), apu->time);
+
+    // The shift register keeps running while silent, its state matters later
+    bool audible = apu->synthesize && noise->length && APU_envelope_volume(&noise->envelope);
+    size_t tap = noise->mode ? 6 : 1;
+    while (noise->timer < end) {
+        uint16_t feedback = (noise->shift ^ (noise->shift >> tap)) & 0x01;
+        noise->shift = (noise->shift >> 1) | (feedback << 14);
+        if (audible) APU_set_amp(apu, &noise->amp, APU_noise_output(noise), noise->timer);
+        noise->timer += noise->period;
+    }
+}
+
+// DMC
+
+static void APU_dmc_restart(APU_DMC *dmc) {
+    dmc->addr = dmc->sample_addr;
+    dmc->remaining = dmc->sample_length;
+}
+
+static void APU_dmc_fetch(APU *apu) {
+    APU_DMC *dmc = &apu->dmc;
+    if (dmc->buffer_full || !dmc->remaining) return;
+
+    dmc->buffer = BUS_read(apu->bus, dmc->addr, false);
+    dmc->buffer_full = true;
+    CPU_stall(apu->cpu, 4);
+
+    dmc->addr = (dmc->addr == 0xFFFF) ? 0x8000 : dmc->addr + 1;
+    dmc->remaining -= 1;
+    if (!dmc->remaining) {
+        if (dmc->loop) {
+            APU_dmc_restart(dmc);
+        } else if (dmc->irq_enabled) {
+            apu->dmc_irq = true;
+        }
+    }
+}
+
+static void APU_dmc_run(APU *apu, APU_DMC *dmc, size_t end) {
+    APU_set_amp(apu, &dmc->amp, dmc->level * APU_DMC_WEIGHT, apu->time);
+    APU_dmc_fetch(apu);
+
+    while (dmc->timer < end) {
+        if (!dmc->silence) {
+            if (dmc->shift & 0x01) {
+                if (dmc->level <= 125) dmc->level += 2;
+            } else {
+                if (dmc->level >= 2) dmc->level -= 2;
+            }
+            dmc->shift >>= 1;
+            APU_set_amp(apu, &dmc->amp, dmc->level * APU_DMC_WEIGHT, dmc->timer);
+        }
+
+        dmc->bits -= 1;
+        if (dmc->bits == 0) {
+            dmc->bits = 8;
+            dmc->silence = !dmc->buffer_full;
+            dmc->shift = dmc->buffer;
+            dmc->buffer_full = false;
+            APU_dmc_fetch(apu);
+        }
+
+        dmc->timer += dmc->period;
+    }
+}
+
+// Frame sequencer
+
+static void APU_quarter_frame(APU *apu) {
+    APU_envelope_clock(&apu->pulse[0].envelope);
+    APU_envelope_clock(&apu->pulse[1].envelope);
+    APU_envelope_clock(&apu->noise.envelope);
+    APU_triangle_linear_clock(&apu->triangle);
+}
+
+static void APU_half_frame(APU *apu) {
+    for (size_t i = 0; i < 2; i++) {
+        APU_length_clock(&apu->pulse[i].length, apu->pulse[i].envelope.loop);
+        APU_sweep_clock(&apu->pulse[i]);
+    }
+    APU_length_clock(&apu->triangle.length, apu->triangle.control);
+    APU_length_clock(&apu->noise.length, apu->noise.envelope.loop);
+}
+
+static void APU_update_frame_timer(APU *apu) {
+    const size_t *steps = apu->five_step ? APU_FRAME_STEPS_5 : APU_FRAME_STEPS_4;
+    apu->frame_timer = apu->frame_start_seq + steps[apu->frame_step];
+}
+
+static void APU_frame_step(APU *apu) {
+    if (apu->five_step) {
+        if (apu->frame_step != 3) APU_quarter_frame(apu);
+        if (apu->frame_step == 1 || apu->frame_step == 4) APU_half_frame(apu);
+    } else {
+        APU_quarter_frame(apu);
+        if (apu->frame_step == 1 || apu->frame_step == 3) APU_half_frame(apu);
+        if (apu->frame_step == 3 && !apu->irq_inhibit) apu->frame_irq = true;
+    }
+
+    apu->frame_step += 1;
+    if (apu->frame_step == (apu->five_step ? 5 : 4)) {
+        apu->frame_step = 0;
+        apu->frame_start_seq += apu->five_step ? APU_FRAME_PERIOD_5 : APU_FRAME_PERIOD_4;
+    }
+    APU_update_frame_timer(apu);
+}
+
+// Sample fetches are events too, whether or not they can raise the IRQ: they
+// read through the mapper's current banks and stall the CPU right then. The
+// next one happens when the output unit empties the buffer after its last bit.
+static void APU_update_next_event(APU *apu) {
+    apu->next_event = apu->frame_timer;
+    if (apu->dmc.remaining) {
+        size_t fetch = apu->dmc.timer + (apu->dmc.bits - 1) * apu->dmc.period;
+        if (fetch < apu->next_event) apu->next_event = fetch;
+    }
+}
+
+static void APU_run_channels(APU *apu, size_t end) {
+    APU_pulse_run(apu, &apu->pulse[0], end);
+    APU_pulse_run(apu, &apu->pulse[1], end);
+    APU_triangle_run(apu, &apu->triangle, end);
+    APU_noise_run(apu, &apu->noise, end);
+    APU_dmc_run(apu, &apu->dmc, end);
+    apu->time = end;
+}
+
+void APU_run_until(APU *apu, size_t time) {
+    while (apu->frame_timer <= time) {
+        APU_run_channels(apu, apu->frame_timer);
+        APU_frame_step(apu);
+
+        // Keep blip timestamps in range if nobody ends audio frames
+        if (apu->time - apu->frame_start > APU_MAX_FRAME_CYCLES / 2) {
+            if (apu->synthesize) BLIP_end_frame(&apu->blip, apu->time - apu->frame_start);
+            apu->frame_start = apu->time;
+        }
+    }
+
+    if (time > apu->time) {
+        APU_run_channels(apu, time);
+    }
+    APU_update_next_event(apu);
+}
+
+void APU_end_frame(APU *apu, size_t time) {
+    APU_run_until(apu, time);
+    if (apu->synthesize) {
+        BLIP_end_frame(&apu->blip, apu->time - apu->frame_start);
+    }
+    apu->frame_start = apu->time;
+}
+
+size_t APU_read_samples(APU *apu, int16_t *out, size_t count) {
+    return BLIP_read_samples(&apu->blip, out, count);
+}
+
+// Setup
+
+void APU_init(APU *apu, CPU *cpu, BUS *bus, double sample_rate) {
+    if (!apu || !cpu || !bus) {
+        PANIC("NULL POINTER in init!");
+    }
+
+    memset(apu, 0, sizeof(*apu));
+    apu->cpu = cpu;
+    apu->bus = bus;
+    apu->synthesize = true;
+    BLIP_init(&apu->blip, APU_CLOCK_RATE, sample_rate, APU_MAX_FRAME_CYCLES);
+
+    APU_reset(apu);
+}
+
+void APU_free(APU *apu) {
+    BLIP_free(&apu->blip);
+}
+
+void APU_reset(APU *apu) {
+    size_t now = apu->cpu->clock_counter;
+
+    memset(apu->pulse, 0, sizeof(apu->pulse));
+    memset(&apu->triangle, 0, sizeof(apu->triangle));
+    memset(&apu->noise, 0, sizeof(apu->noise));
+    memset(&apu->dmc, 0, sizeof(apu->dmc));
+
+    apu->pulse[0].ones_complement = true;
+    apu->pulse[0].timer = now;
+    apu->pulse[1].timer = now;
+    apu->triangle.timer = now;
+    apu->noise.shift = 1;
+    apu->noise.period = APU_NOISE_PERIODS[0];
+    apu->noise.timer = now;
+    apu->dmc.period = APU_DMC_PERIODS[0];
+    apu->dmc.bits = 8;
+    apu->dmc.silence = true;
+    apu->dmc.timer = now;
+
+    apu->five_step = false;
+    apu->irq_inhibit = false;
+    apu->frame_irq = false;
+    apu->dmc_irq = false;
+    apu->frame_step = 0;
+    apu->frame_start_seq = now;
+    APU_update_frame_timer(apu);
+
+    apu->time = now;
+    apu->frame_start = now;
+    BLIP_clear(&apu->blip);
+    APU_update_next_event(apu);
+}
+
+void APU_save_state(const APU *apu, STATE *state) {
+    STATE_write(state, apu->pulse, STATE_RANGE_SIZE(APU, pulse, blip));
+    BLIP_save_state(&apu->blip, state);
+}
+
+void APU_load_state(APU *apu, STATE *state) {
+    STATE_read(state, apu->pulse, STATE_RANGE_SIZE(APU, pulse, blip));
+    BLIP_load_state(&apu->blip, state);
+}
+
+// Registers
+
+uint8_t APU_read_register(APU *apu, uint16_t addr, bool read_only) {
+    if (addr != 0x4015) return addr >> 8;
+
+    APU_run_until(apu, apu->cpu->clock_counter);
+
+    uint8_t data = 0;
+    if (apu->pulse[0].length) data |= APU_STATUS_PULSE1;
+    if (apu->pulse[1].length) data |= APU_STATUS_PULSE2;
+    if (apu->triangle.length) data |= APU_STATUS_TRIANGLE;
+    if (apu->noise.length) data |= APU_STATUS_NOISE;
+    if (apu->dmc.remaining) data |= APU_STATUS_DMC;
+    if (apu->frame_irq) data |= APU_STATUS_FRAME_IRQ;
+    if (apu->dmc_irq) data |= APU_STATUS_DMC_IRQ;
+
+    if (!read_only) apu->frame_irq = false;
+    return data;
+}
+
+static void APU_write_pulse(APU_PULSE *pulse, uint16_t reg, uint8_t data) {
+    switch (reg) {
+    case 0:
+        pulse->duty = data >> 6;
+        pulse->envelope.loop = data & 0x20;
+        pulse->envelope.constant = data & 0x10;
+        pulse->envelope.volume = data & 0x0F;
+        break;
+    case 1:
+        pulse->sweep_enabled = data & 0x80;
+        pulse->sweep_period = (data >> 4) & 0x07;
+        pulse->sweep_negate = data & 0x08;
+        pulse->sweep_shift = data & 0x07;
+        pulse->sweep_reload = true;
+        break;
+    case 2:
+        pulse->period = (pulse->period & 0x0700) | data;
+        break;
+    case 3:
+        pulse->period = (pulse->period & 0x00FF) | ((data & 0x07) << 8);
+        if (pulse->enabled) pulse->length = APU_LENGTH_TABLE[data >> 3];
+        pulse->step = 0;
+        pulse->envelope.start = true;
+        break;
+    }
+}
+
+void APU_write_register(APU *apu, uint16_t addr, uint8_t data) {
+    APU_run_until(apu, apu->cpu->clock_counter);
+
+    switch (addr) {
+    case 0x4000:
+    case 0x4001:
+    case 0x4002:
+    case 0x4003:
+        APU_write_pulse(&apu->pulse[0], addr & 0x03, data);
+        break;
+    case 0x4004:
+    case 0x4005:
+    case 0x4006:
+    case 0x4007:
+        APU_write_pulse(&apu->pulse[1], addr & 0x03, data);
+        break;
+    case 0x4008:
+        apu->triangle.control = data & 0x80;
+        apu->triangle.linear_reload = data & 0x7F;
+        break;
+    case 0x400A:
+        apu->triangle.period = (apu->triangle.period & 0x0700) | data;
+        break;
+    case 0x400B:
+        apu->triangle.period = (apu->triangle.period & 0x00FF) | ((data & 0x07) << 8);
+        if (apu->triangle.enabled) apu->triangle.length = APU_LENGTH_TABLE[data >> 3];
+        apu->triangle.linear_reload_flag = true;
+        break;
+    case 0x400C:
+        apu->noise.envelope.loop = data & 0x20;
+        apu->noise.envelope.constant = data & 0x10;
+        apu->noise.envelope.volume = data & 0x0F;
+        break;
+    case 0x400E:
+        apu->noise.mode = data & 0x80;
+        apu->noise.period = APU_NOISE_PERIODS[data & 0x0F];
+        break;
+    case 0x400F:
+        if (apu->noise.enabled) apu->noise.length = APU_LENGTH_TABLE[data >> 3];
+        apu->noise.envelope.start = true;
+        break;
+    case 0x4010:
+        apu->dmc.irq_enabled = data & 0x80;
+        apu->dmc.loop = data & 0x40;
+        apu->dmc.period = APU_DMC_PERIODS[data & 0x0F];
+        if (!apu->dmc.irq_enabled) apu->dmc_irq = false;
+        break;
+    case 0x4011:
+        apu->dmc.level = data & 0x7F;
+        break;
+    case 0x4012:
+        apu->dmc.sample_addr = 0xC000 | (data << 6);
+        break;
+    case 0x4013:
+        apu->dmc.sample_length = (data << 4) | 0x0001;
+        break;
+    case 0x4015:
+        apu->pulse[0].enabled = data & APU_STATUS_PULSE1;
+        apu->pulse[1].enabled = data & APU_STATUS_PULSE2;
+        apu->triangle.enabled = data & APU_STATUS_TRIANGLE;
+        apu->noise.enabled = data & APU_STATUS_NOISE;
+        if (!apu->pulse[0].enabled) apu->pulse[0].length = 0;
+        if (!apu->pulse[1].enabled) apu->pulse[1].length = 0;
+        if (!apu->triangle.enabled) apu->triangle.length = 0;
+        if (!apu->noise.enabled) apu->noise.length = 0;
+
+        apu->dmc_irq = false;
+        if (!(data & APU_STATUS_DMC)) {
+            apu->dmc.remaining = 0;
+        } else if (!apu->dmc.remaining) {
+            APU_dmc_restart(&apu->dmc);
+            APU_dmc_fetch(apu);
+        }
+        break;
+    case 0x4017:
+        apu->five_step = data & 0x80;
+        apu->irq_inhibit = data & 0x40;
+        if (apu->irq_inhibit) apu->frame_irq = false;
+
+        apu->frame_step = 0;
+        apu->frame_start_seq = apu->time;
+        APU_update_frame_timer(apu);
+        if (apu->five_step) {
+            APU_quarter_frame(apu);
+            APU_half_frame(apu);
+        }
+        break;
+    }
+
+    APU_update_next_event(apu);
+}
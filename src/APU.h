@@ -0,0 +1,151 @@
+#ifndef APU_H
+#define APU_H
+
+#include <BLIP.h>
+#include <BUS.h>
+#include <CPU.h>
+#include <STATE.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define APU_CLOCK_RATE 1789773.0 // NTSC CPU clock
+#define APU_DEFAULT_SAMPLE_RATE 48000.0
+#define APU_MAX_FRAME_CYCLES 40000 // longer than any frame handed to APU_end_frame
+
+typedef enum {
+    APU_STATUS_PULSE1 = (1 << 0),
+    APU_STATUS_PULSE2 = (1 << 1),
+    APU_STATUS_TRIANGLE = (1 << 2),
+    APU_STATUS_NOISE = (1 << 3),
+    APU_STATUS_DMC = (1 << 4),
+    APU_STATUS_FRAME_IRQ = (1 << 6),
+    APU_STATUS_DMC_IRQ = (1 << 7)
+} APU_STATUS;
+
+typedef struct {
+    bool start;
+    bool loop; // also halts the length counter
+    bool constant;
+    uint8_t volume; // constant volume or envelope period
+    uint8_t divider;
+    uint8_t decay;
+} APU_ENVELOPE;
+
+typedef struct {
+    APU_ENVELOPE envelope;
+    bool enabled;
+    uint8_t length;
+    uint8_t duty;
+    uint8_t step; // duty sequencer position
+    uint16_t period;
+    bool sweep_enabled;
+    bool sweep_negate;
+    bool sweep_reload;
+    uint8_t sweep_period;
+    uint8_t sweep_shift;
+    uint8_t sweep_divider;
+    bool ones_complement; // pulse 1 negates with one's complement
+    size_t timer;         // CPU time of the next sequencer step
+    int amp;
+} APU_PULSE;
+
+typedef struct {
+    bool enabled;
+    bool control; // also halts the length counter
+    uint8_t length;
+    uint8_t linear;
+    uint8_t linear_reload;
+    bool linear_reload_flag;
+    uint8_t step;
+    uint16_t period;
+    size_t timer;
+    int amp;
+} APU_TRIANGLE;
+
+typedef struct {
+    APU_ENVELOPE envelope;
+    bool enabled;
+    uint8_t length;
+    bool mode;
+    uint16_t shift;
+    uint16_t period;
+    size_t timer;
+    int amp;
+} APU_NOISE;
+
+typedef struct {
+    bool irq_enabled;
+    bool loop;
+    uint16_t period;
+    uint8_t level;
+    uint16_t sample_addr;
+    uint16_t sample_length;
+    uint16_t addr;
+    uint16_t remaining; // bytes left to fetch
+    uint8_t buffer;
+    bool buffer_full;
+    uint8_t shift;
+    uint8_t bits;
+    bool silence;
+    size_t timer;
+    int amp;
+} APU_DMC;
+
+// The APU is run lazily: nothing happens per CPU cycle, instead APU_run_until
+// catches all channels up to a CPU timestamp whenever a register is accessed,
+// an event is due or a frame ends. Channels jump from timer reload to timer
+// reload and only emit amplitude changes into the blip buffer, samples are
+// generated in one batch by APU_end_frame.
+typedef struct {
+    CPU *cpu; // time base, IRQ line and DMC stalls
+    BUS *bus; // DMC sample fetches
+    // When false channels keep exact timing, length counters and IRQs but no
+    // deltas are generated and APU_end_frame produces no samples
+    bool synthesize;
+
+    // Everything from pulse up to blip is saved as one block
+    APU_PULSE pulse[2];
+    APU_TRIANGLE triangle;
+    APU_NOISE noise;
+    APU_DMC dmc;
+
+    bool five_step;
+    bool irq_inhibit;
+    bool frame_irq;
+    bool dmc_irq;
+    uint8_t frame_step;
+    size_t frame_start_seq; // CPU time the frame sequencer was last restarted
+    size_t frame_timer;     // CPU time of the next frame sequencer step
+
+    size_t time;        // CPU time the APU has been run up to
+    size_t frame_start; // CPU time of the start of the current audio frame
+    size_t next_event;  // earliest CPU time of a frame step or DMC fetch
+
+    BLIP blip;
+} APU;
+
+void APU_init(APU *apu, CPU *cpu, BUS *bus, double sample_rate);
+void APU_free(APU *apu);
+void APU_reset(APU *apu);
+
+void APU_run_until(APU *apu, size_t time);
+// Catches up to time and turns everything since the last call into samples
+void APU_end_frame(APU *apu, size_t time);
+size_t APU_read_samples(APU *apu, int16_t *out, size_t count);
+
+static inline bool APU_irq(APU *apu) {
+    return apu->frame_irq || apu->dmc_irq;
+}
+
+// Channel, sequencer and blip state, samples not yet read are dropped on load
+void APU_save_state(const APU *apu, STATE *state);
+void APU_load_state(APU *apu, STATE *state);
+
+// $4000-$4013, $4015 and $4017
+uint8_t APU_read_register(APU *apu, uint16_t addr, bool read_only);
+void APU_write_register(APU *apu, uint16_t addr, uint8_t data);
+
+#endif // APU_H
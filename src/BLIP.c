@@ -0,0 +1,115 @@
+#include <BLIP.h>
+#include <math.h>
+
+// Blackman windowed sinc with a cutoff a bit below Nyquist, one row per
+// sub-sample phase, each row normalised to sum to 1 << BLIP_SAMPLE_BITS so a
+// delta integrates to exactly its amplitude
+static void BLIP_build_kernel(BLIP *blip) {
+    const double cutoff = 0.45;
+    const double pi = 3.14159265358979323846;
+
+    for (size_t phase = 0; phase < BLIP_PHASES; phase++) {
+        double taps[BLIP_TAPS];
+        double sum = 0.0;
+
+        for (size_t i = 0; i < BLIP_TAPS; i++) {
+            double x = (double)i - (BLIP_TAPS / 2 - 1) - (double)phase / BLIP_PHASES;
+            double sinc = (x == 0.0) ? 1.0 : sin(2.0 * pi * cutoff * x) / (2.0 * pi * cutoff * x);
+            double w = (x + BLIP_TAPS / 2) / BLIP_TAPS;
+            double window = 0.42 - 0.5 * cos(2.0 * pi * w) + 0.08 * cos(4.0 * pi * w);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+
+        int32_t total = 0;
+        for (size_t i = 0; i < BLIP_TAPS; i++) {
+            blip->kernel[phase][i] = (int16_t)lround(taps[i] / sum * (1 << BLIP_SAMPLE_BITS));
+            total += blip->kernel[phase][i];
+        }
+        // Put the rounding error into the centre tap
+        blip->kernel[phase][BLIP_TAPS / 2] += (1 << BLIP_SAMPLE_BITS) - total;
+    }
+}
+
+void BLIP_init(BLIP *blip, double clock_rate, double sample_rate, size_t max_frame_clocks) {
+    memset(blip, 0, sizeof(*blip));
+    blip->factor = (uint64_t)(sample_rate / clock_rate * (double)((uint64_t)1 << BLIP_FRAC_BITS));
+
+    // Room for two unread frames plus the tail of the kernel
+    blip->size = (size_t)(max_frame_clocks * sample_rate / clock_rate + 1) * 2 + BLIP_TAPS;
+    blip->buffer = calloc(blip->size, sizeof(int32_t));
+    if (!blip->buffer) {
+        PANIC("Out of memory allocating the blip buffer!");
+    }
+
+    BLIP_build_kernel(blip);
+}
+
+void BLIP_free(BLIP *blip) {
+    free(blip->buffer);
+    blip->buffer = NULL;
+}
+
+void BLIP_clear(BLIP *blip) {
+    blip->offset = 0;
+    blip->integrator = 0;
+    memset(blip->buffer, 0, blip->size * sizeof(int32_t));
+}
+
+void BLIP_end_frame(BLIP *blip, uint32_t time) {
+    blip->offset += (uint64_t)time * blip->factor;
+
+    // Nobody read the last frames, drop the oldest samples instead of overflowing
+    size_t limit = blip->size / 2;
+    size_t available = BLIP_samples_available(blip);
+    if (available > limit) {
+        size_t drop = available - limit;
+        memmove(blip->buffer, blip->buffer + drop, (blip->size - drop) * sizeof(int32_t));
+        memset(blip->buffer + blip->size - drop, 0, drop * sizeof(int32_t));
+        blip->offset -= (uint64_t)drop << BLIP_FRAC_BITS;
+    }
+}
+
+size_t BLIP_samples_available(BLIP *blip) {
+    return blip->offset >> BLIP_FRAC_BITS;
+}
+
+size_t BLIP_read_samples(BLIP *blip, int16_t *out, size_t count) {
+    size_t available = BLIP_samples_available(blip);
+    if (count > available) count = available;
+
+    int32_t sum = blip->integrator;
+    for (size_t i = 0; i < count; i++) {
+        sum += blip->buffer[i];
+        int32_t sample = sum >> BLIP_SAMPLE_BITS;
+        // Leaky integration doubles as a high-pass removing DC
+        sum -= sample << (BLIP_SAMPLE_BITS - 9);
+
+        if (sample > INT16_MAX) sample = INT16_MAX;
+        if (sample < INT16_MIN) sample = INT16_MIN;
+        out[i] = (int16_t)sample;
+    }
+    blip->integrator = sum;
+
+    size_t remaining = available + BLIP_TAPS - count;
+    if (remaining > blip->size - count) remaining = blip->size - count;
+    memmove(blip->buffer, blip->buffer + count, remaining * sizeof(int32_t));
+    memset(blip->buffer + remaining, 0, (blip->size - remaining) * sizeof(int32_t));
+    blip->offset -= (uint64_t)count << BLIP_FRAC_BITS;
+
+    return count;
+}
+
+void BLIP_save_state(const BLIP *blip, STATE *state) {
+    uint64_t fraction = blip->offset & (((uint64_t)1 << BLIP_FRAC_BITS) - 1);
+    STATE_write(state, &fraction, sizeof(fraction));
+    STATE_write(state, &blip->integrator, sizeof(blip->integrator));
+    STATE_write(state, blip->buffer + (blip->offset >> BLIP_FRAC_BITS), BLIP_TAPS * sizeof(int32_t));
+}
+
+void BLIP_load_state(BLIP *blip, STATE *state) {
+    memset(blip->buffer, 0, blip->size * sizeof(int32_t));
+    STATE_read(state, &blip->offset, sizeof(blip->offset));
+    STATE_read(state, &blip->integrator, sizeof(blip->integrator));
+    STATE_read(state, blip->buffer, BLIP_TAPS * sizeof(int32_t));
+}
@@ -0,0 +1,58 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <STATE.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLIP_PHASE_BITS 5
+#define BLIP_PHASES (1 << BLIP_PHASE_BITS) // sub-sample resolution of a step
+#define BLIP_TAPS 16   // width of the band-limited step in samples
+#define BLIP_FRAC_BITS 32
+#define BLIP_SAMPLE_BITS 14
+
+// Band-limited step synthesis in the style of blargg's blip_buf. Sources add
+// amplitude deltas at clock timestamps, each delta spreads a windowed sinc
+// impulse into the buffer. Samples are produced in one batch per frame by
+// integrating the buffer, so the cost scales with the number of amplitude
+// changes and output samples instead of with the input clock.
+typedef struct {
+    uint64_t factor;  // output samples per clock in 32.32 fixed point
+    uint64_t offset;  // position of the frame start in 32.32 fixed point
+    int32_t *buffer;
+    size_t size;
+    int32_t integrator;
+    int16_t kernel[BLIP_PHASES][BLIP_TAPS];
+} BLIP;
+
+// max_frame_clocks is the longest frame that will be passed to BLIP_end_frame
+void BLIP_init(BLIP *blip, double clock_rate, double sample_rate, size_t max_frame_clocks);
+void BLIP_free(BLIP *blip);
+void BLIP_clear(BLIP *blip);
+
+// Adds an amplitude change of delta at time clocks after the frame start
+static inline void BLIP_add_delta(BLIP *blip, uint32_t time, int32_t delta) {
+    uint64_t fixed = blip->offset + (uint64_t)time * blip->factor;
+    int32_t *out = blip->buffer + (fixed >> BLIP_FRAC_BITS);
+    const int16_t *kernel = blip->kernel[(fixed >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & (BLIP_PHASES - 1)];
+
+    for (size_t i = 0; i < BLIP_TAPS; i++) {
+        out[i] += kernel[i] * delta;
+    }
+}
+
+// Ends the frame at time clocks, making its samples available
+void BLIP_end_frame(BLIP *blip, uint32_t time);
+size_t BLIP_samples_available(BLIP *blip);
+// Reads up to count samples, returns the number read
+size_t BLIP_read_samples(BLIP *blip, int16_t *out, size_t count);
+
+// Saves the integrator and the kernel tails reaching into the next frame, so
+// output continues exactly after a load. Samples not yet read are dropped.
+void BLIP_save_state(const BLIP *blip, STATE *state);
+void BLIP_load_state(BLIP *blip, STATE *state);
+
+#endif // BLIP_H
@@ -0,0 +1,28 @@
+#include <BLOCK.h>
+
+void BLOCK_CACHE_init(BLOCK_CACHE *cache, size_t capacity) {
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+
+    cache->blocks = calloc(rounded, sizeof(BLOCK));
+    if (!cache->blocks) {
+        PANIC("Out of memory allocating the block cache!");
+    }
+    cache->capacity = rounded;
+    cache->lookups = 0;
+    cache->decodes = 0;
+}
+
+void BLOCK_CACHE_free(BLOCK_CACHE *cache) {
+    free(cache->blocks);
+    cache->blocks = NULL;
+    cache->capacity = 0;
+}
+
+void BLOCK_CACHE_flush(BLOCK_CACHE *cache) {
+    for (size_t i = 0; i < cache->capacity; i++) {
+        cache->blocks[i].count = 0;
+    }
+    cache->lookups = 0;
+    cache->decodes = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK_MAX_INSNS 16
+#define BLOCK_DEFAULT_CAPACITY 4096
+
+struct CPU;
+typedef struct BLOCK_INSN BLOCK_INSN;
+
+// Executes one decoded instruction, returns its cycles like CPU_execute
+typedef uint16_t (*BLOCK_HandlerFunc)(struct CPU *cpu, const BLOCK_INSN *insn);
+
+// One pre-decoded instruction. operand is what the addressing mode resolves
+// without looking at registers or memory: the address for IMM/ZP0/ABS, the base
+// address for the indexed modes, the pointer for the indirect ones and the
+// sign extended offset for branches.
+struct BLOCK_INSN {
+    BLOCK_HandlerFunc handler;
+    uint16_t pc;
+    uint16_t next_pc;
+    uint16_t operand;
+    uint8_t opcode;
+    bool last;
+};
+
+// A straight-line run of instructions from one page, ending after the first
+// jump, call, return or BRK, at the page end or at BLOCK_MAX_INSNS. It is valid
+// while the page's write generation still matches the one it was decoded at.
+typedef struct {
+    uint16_t pc;
+    uint8_t count; // 0 for an empty slot
+    const uint64_t *generation;
+    uint64_t decoded_generation;
+    BLOCK_INSN insns[BLOCK_MAX_INSNS];
+} BLOCK;
+
+// Direct mapped cache of blocks keyed by their start address, attached to a
+// CPU with CPU_set_block_cache
+typedef struct {
+    BLOCK *blocks;
+    size_t capacity;
+    uint64_t lookups; // block entries
+    uint64_t decodes; // entries that had to decode, new or stale
+} BLOCK_CACHE;
+
+// Capacity is rounded up to a power of two
+void BLOCK_CACHE_init(BLOCK_CACHE *cache, size_t capacity);
+void BLOCK_CACHE_free(BLOCK_CACHE *cache);
+// Empties every slot and resets the statistics
+void BLOCK_CACHE_flush(BLOCK_CACHE *cache);
+
+static inline BLOCK *BLOCK_CACHE_slot(BLOCK_CACHE *cache, uint16_t pc) {
+    return &cache->blocks[((pc * 2654435761u) >> 16) & (cache->capacity - 1)];
+}
+
+static inline bool BLOCK_valid(const BLOCK *block) {
+    return *block->generation == block->decoded_generation;
+}
+
+#endif // BLOCK_H
@@ -6,31 +6,107 @@
 
 #include <UTIL.h>
 
+// Unmapped reads return the high byte of the address, which is what the data
+// bus usually still holds after the operand fetch
+static uint8_t BUS_open_bus_read(void *ctx, uint16_t addr, bool read_only) {
+    return addr >> 8;
+}
+
+static void BUS_open_bus_write(void *ctx, uint16_t addr, uint8_t data) {
+}
+
+static void BUS_check_range(uint16_t addr, size_t size) {
+    if ((addr % BUS_PAGE_SIZE) != 0 || (size % BUS_PAGE_SIZE) != 0 || addr + size > RAM_SIZE) {
+        PANIC_FMT("Invalid bus mapping, addr = 0x%04X, size = 0x%zX", addr, size);
+    }
+}
+
+// Every page starts with its own generation counter, and no sync hook is set
+static void BUS_init_pages(BUS *bus) {
+    bus->sync = NULL;
+    bus->sync_ctx = NULL;
+    for (size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+        bus->generations[i] = 0;
+        bus->pages[i].generation = &bus->generations[i];
+    }
+}
+
+// A remapped page invalidates what was decoded through its old mapping and starts
+// a new generation for the new one
+static void BUS_remap_page(BUS *bus, BUS_PAGE *page, size_t generation_page) {
+    *page->generation += 1;
+    page->generation = &bus->generations[generation_page];
+    *page->generation += 1;
+}
+
 void BUS_init(BUS *bus) {
     for (size_t i = 0; i < RAM_SIZE; i++) {
         bus->ram[i] = 0;
     }
+
+    bus->ram_size = RAM_SIZE;
+    BUS_init_pages(bus);
+    BUS_unmap(bus, 0x0000, RAM_SIZE);
+    BUS_map_memory(bus, 0x0000, RAM_SIZE, bus->ram, RAM_SIZE, true);
 }
 
-void BUS_write(BUS *bus, uint16_t addr, uint8_t data) {
-    if (addr >= 0x0000 && addr <= 0xFFFF) {
-        bus->ram[addr] = data;
-    } else {
-        PANIC_FMT("ACCESS VIOLATION WRITE, addr = %d, data = %d", addr, data);
+void BUS_init_nes(BUS *bus) {
+    for (size_t i = 0; i < RAM_SIZE; i++) {
+        bus->ram[i] = 0;
     }
+
+    bus->ram_size = INTERNAL_RAM_SIZE;
+    BUS_init_pages(bus);
+    BUS_unmap(bus, 0x0000, RAM_SIZE);
+    BUS_map_memory(bus, 0x0000, 0x2000, bus->ram, INTERNAL_RAM_SIZE, true);
 }
 
-uint8_t BUS_read(BUS *bus, uint16_t addr, bool read_only) {
-    if (addr >= 0x0000 && addr <= 0xFFFF) {
-        return bus->ram[addr];
-    } else {
-        PANIC_FMT("ACCESS VIOLATION READ, addr = %d", addr);
+void BUS_map_memory(BUS *bus, uint16_t addr, size_t size, uint8_t *mem, size_t mem_size, bool writable) {
+    BUS_check_range(addr, size);
+    if (!mem || mem_size == 0 || (mem_size % BUS_PAGE_SIZE) != 0) {
+        PANIC("NULL memory in BUS_map_memory!");
+    }
+
+    for (size_t offset = 0; offset < size; offset += BUS_PAGE_SIZE) {
+        BUS_PAGE *page = &bus->pages[(addr + offset) >> 8];
+        BUS_remap_page(bus, page, (addr + offset % mem_size) >> 8);
+        page->read = mem + (offset % mem_size);
+        page->write = writable ? page->read : NULL;
+    }
+}
+
+void BUS_map_io(BUS *bus, uint16_t addr, size_t size, BUS_ReadFunc read_fn, BUS_WriteFunc write_fn, void *ctx) {
+    BUS_check_range(addr, size);
+
+    for (size_t offset = 0; offset < size; offset += BUS_PAGE_SIZE) {
+        BUS_PAGE *page = &bus->pages[(addr + offset) >> 8];
+        BUS_remap_page(bus, page, (addr + offset) >> 8);
+        page->read = NULL;
+        page->write = NULL;
+        page->read_fn = read_fn ? read_fn : BUS_open_bus_read;
+        page->write_fn = write_fn ? write_fn : BUS_open_bus_write;
+        page->ctx = ctx;
+    }
+}
+
+void BUS_unmap(BUS *bus, uint16_t addr, size_t size) {
+    BUS_map_io(bus, addr, size, NULL, NULL, NULL);
+}
+
+void BUS_set_sync(BUS *bus, BUS_SyncFunc sync, void *ctx) {
+    bus->sync = sync;
+    bus->sync_ctx = ctx;
+}
+
+void BUS_invalidate(BUS *bus) {
+    for (size_t i = 0; i < BUS_PAGE_COUNT; i++) {
+        bus->generations[i] += 1;
     }
 }
 
 void BUS_dump_memory(BUS *bus, size_t num_bytes) {
     if (num_bytes > RAM_SIZE) {
-        PANIC_FMT("Requested bytes of %zu exceeds RAM size of %d\n", num_bytes, RAM_SIZE);
+        PANIC_FMT("Requested bytes of %zu exceeds address space of %d\n", num_bytes, RAM_SIZE);
     }
 
     size_t bytes_per_line = 16; // Standard for memory dumps
@@ -39,7 +115,7 @@ void BUS_dump_memory(BUS *bus, size_t num_bytes) {
 
         for (size_t j = 0; j < bytes_per_line; j++) {
             if (i + j < num_bytes) {
-                printf("%02X ", bus->ram[i + j]);
+                printf("%02X ", BUS_read(bus, i + j, true));
             } else {
                 printf("   ");
             }
@@ -48,7 +124,7 @@ void BUS_dump_memory(BUS *bus, size_t num_bytes) {
         printf(" |");
         for (size_t j = 0; j < bytes_per_line; j++) {
             if (i + j < num_bytes) {
-                uint8_t byte = bus->ram[i + j];
+                uint8_t byte = BUS_read(bus, i + j, true);
                 printf("%c", (byte >= 32 && byte <= 126) ? byte : '.');
             } else {
                 printf(" ");
@@ -56,4 +132,11 @@ void BUS_dump_memory(BUS *bus, size_t num_bytes) {
         }
         printf("|\n");
     }
-}
\ No newline at end of file
+}
+void BUS_save_state(const BUS *bus, STATE *state) {
+    STATE_write(state, bus->ram, bus->ram_size);
+}
+
+void BUS_load_state(BUS *bus, STATE *state) {
+    STATE_read(state, bus->ram, bus->ram_size);
+}
@@ -6,18 +6,92 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <STATE.h>
 #include <UTIL.h>
 
 #define RAM_SIZE 65536 // 64 * 1024
+#define INTERNAL_RAM_SIZE 2048
+
+#define BUS_PAGE_SIZE 256
+#define BUS_PAGE_COUNT (RAM_SIZE / BUS_PAGE_SIZE)
+
+// Handlers for memory mapped I/O, receive the full CPU address.
+// read_only reads come from debugging tools and must not cause side effects.
+typedef uint8_t (*BUS_ReadFunc)(void *ctx, uint16_t addr, bool read_only);
+typedef void (*BUS_WriteFunc)(void *ctx, uint16_t addr, uint8_t data);
+// Runs before any access that reaches a handler, so whoever owns the devices
+// behind them can catch those up with the CPU first
+typedef void (*BUS_SyncFunc)(void *ctx, uint16_t addr, bool write);
+
+// One 256 byte page of the CPU address space. Plain memory is accessed through
+// the host pointers directly, a NULL pointer routes the access to the handler.
+// generation changes whenever the memory seen through read may have changed, so
+// code decoded from it can be checked for staleness with one compare.
+typedef struct {
+    uint8_t *read;
+    uint8_t *write;
+    BUS_ReadFunc read_fn;
+    BUS_WriteFunc write_fn;
+    void *ctx;
+    uint64_t *generation;
+} BUS_PAGE;
 
 typedef struct {
+    BUS_PAGE pages[BUS_PAGE_COUNT];
+    // Write generations, mirrors of one mapping share the counter of its first
+    // page so a write through any of them is seen by all
+    uint64_t generations[BUS_PAGE_COUNT];
     uint8_t ram[RAM_SIZE];
+    size_t ram_size; // bytes of ram in use, only these are saved
+    BUS_SyncFunc sync;
+    void *sync_ctx;
 } BUS;
 
+// Maps the whole address space flat onto bus->ram
 void BUS_init(BUS *bus);
-void BUS_write(BUS *bus, uint16_t addr, uint8_t data);
-uint8_t BUS_read(BUS *bus, uint16_t addr, bool read_only);
+// Maps the NES layout: 2KB internal RAM mirrored up to $1FFF, $2000-$401F left
+// to I/O handlers and everything above unmapped until a cartridge is attached
+void BUS_init_nes(BUS *bus);
+
+// Maps [addr, addr + size) directly onto mem, mirroring every mem_size bytes.
+// addr, size and mem_size must be multiples of BUS_PAGE_SIZE. Read-only mappings
+// keep the page's write handler, which lets mappers see writes to their ROM area.
+void BUS_map_memory(BUS *bus, uint16_t addr, size_t size, uint8_t *mem, size_t mem_size, bool writable);
+// Routes [addr, addr + size) to handlers, NULL handlers fall back to open bus
+void BUS_map_io(BUS *bus, uint16_t addr, size_t size, BUS_ReadFunc read_fn, BUS_WriteFunc write_fn, void *ctx);
+void BUS_unmap(BUS *bus, uint16_t addr, size_t size);
+// Sets (or with NULL clears) the hook run before handler accesses, read_only
+// reads skip it
+void BUS_set_sync(BUS *bus, BUS_SyncFunc sync, void *ctx);
+// Bumps every write generation, needed after memory was changed behind the
+// bus' back (state loads, power on)
+void BUS_invalidate(BUS *bus);
+
+// Hot path, kept inline so plain memory costs a table load plus an indexed access
+static inline uint8_t BUS_read(BUS *bus, uint16_t addr, bool read_only) {
+    const BUS_PAGE *page = &bus->pages[addr >> 8];
+    if (page->read) {
+        return page->read[addr & 0xFF];
+    }
+    if (bus->sync && !read_only) bus->sync(bus->sync_ctx, addr, false);
+    return page->read_fn(page->ctx, addr, read_only);
+}
+
+static inline void BUS_write(BUS *bus, uint16_t addr, uint8_t data) {
+    const BUS_PAGE *page = &bus->pages[addr >> 8];
+    if (page->write) {
+        page->write[addr & 0xFF] = data;
+        *page->generation += 1;
+        return;
+    }
+    if (bus->sync) bus->sync(bus->sync_ctx, addr, true);
+    page->write_fn(page->ctx, addr, data);
+}
 
 void BUS_dump_memory(BUS *bus, size_t num_bytes);
 
-#endif // BUS_H
\ No newline at end of file
+// RAM contents only, the page table belongs to whoever mapped it
+void BUS_save_state(const BUS *bus, STATE *state);
+void BUS_load_state(BUS *bus, STATE *state);
+
+#endif // BUS_H
@@ -0,0 +1,271 @@
+#include <CALLGRAPH.h>
+
+#define CALLGRAPH_INITIAL_EDGES 1024
+#define CALLGRAPH_LINE_SIZE 1024
+
+#define CALLGRAPH_OP_BRK 0x00
+#define CALLGRAPH_OP_JSR 0x20
+#define CALLGRAPH_OP_RTI 0x40
+#define CALLGRAPH_OP_RTS 0x60
+
+void CALLGRAPH_init(CALLGRAPH *graph) {
+    memset(graph->labels, 0, sizeof(graph->labels));
+    graph->edge_capacity = CALLGRAPH_INITIAL_EDGES;
+    graph->edges = calloc(graph->edge_capacity, sizeof(CALLGRAPH_EDGE));
+    if (!graph->edges) {
+        PANIC("Out of memory allocating call graph edges!");
+    }
+    CALLGRAPH_start(graph, 0x0000);
+}
+
+void CALLGRAPH_free(CALLGRAPH *graph) {
+    for (size_t i = 0; i < RAM_SIZE; i++) {
+        free(graph->labels[i]);
+        graph->labels[i] = NULL;
+    }
+    free(graph->edges);
+    graph->edges = NULL;
+    graph->edge_capacity = 0;
+}
+
+void CALLGRAPH_start(CALLGRAPH *graph, uint16_t entry_pc) {
+    memset(graph->self_cycles, 0, sizeof(graph->self_cycles));
+    memset(graph->self_instructions, 0, sizeof(graph->self_instructions));
+    memset(graph->is_function, 0, sizeof(graph->is_function));
+    memset(graph->edges, 0, graph->edge_capacity * sizeof(CALLGRAPH_EDGE));
+    graph->edge_count = 0;
+    graph->cycles = 0;
+    graph->instructions = 0;
+    graph->dropped_calls = 0;
+
+    graph->is_function[entry_pc] = true;
+    graph->stack[0] = (CALLGRAPH_FRAME){.fn = entry_pc, .call_site = entry_pc, .caller = entry_pc,
+                                        .sp = CALLGRAPH_ROOT_SP};
+    graph->depth = 1;
+}
+
+static size_t CALLGRAPH_edge_slot(uint16_t caller, uint16_t call_site, uint16_t callee, size_t capacity) {
+    uint64_t key = ((uint64_t)caller << 32) | ((uint64_t)call_site << 16) | callee;
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+static CALLGRAPH_EDGE *CALLGRAPH_find_edge(CALLGRAPH_EDGE *edges, size_t capacity, uint16_t caller,
+                                           uint16_t call_site, uint16_t callee) {
+    size_t slot = CALLGRAPH_edge_slot(caller, call_site, callee, capacity);
+    while (edges[slot].used &&
+           (edges[slot].caller != caller || edges[slot].call_site != call_site || edges[slot].callee != callee)) {
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return &edges[slot];
+}
+
+// Keeps the table at most half full
+static void CALLGRAPH_grow_edges(CALLGRAPH *graph) {
+    size_t capacity = graph->edge_capacity * 2;
+    CALLGRAPH_EDGE *edges = calloc(capacity, sizeof(CALLGRAPH_EDGE));
+    if (!edges) {
+        PANIC("Out of memory growing call graph edges!");
+    }
+    for (size_t i = 0; i < graph->edge_capacity; i++) {
+        const CALLGRAPH_EDGE *edge = &graph->edges[i];
+        if (!edge->used) continue;
+        *CALLGRAPH_find_edge(edges, capacity, edge->caller, edge->call_site, edge->callee) = *edge;
+    }
+    free(graph->edges);
+    graph->edges = edges;
+    graph->edge_capacity = capacity;
+}
+
+static void CALLGRAPH_close(CALLGRAPH *graph, const CALLGRAPH_FRAME *frame) {
+    CALLGRAPH_EDGE *edge =
+        CALLGRAPH_find_edge(graph->edges, graph->edge_capacity, frame->caller, frame->call_site, frame->fn);
+    if (!edge->used) {
+        if ((graph->edge_count + 1) * 2 > graph->edge_capacity) {
+            CALLGRAPH_grow_edges(graph);
+            edge = CALLGRAPH_find_edge(graph->edges, graph->edge_capacity, frame->caller, frame->call_site,
+                                       frame->fn);
+        }
+        *edge = (CALLGRAPH_EDGE){.caller = frame->caller, .call_site = frame->call_site, .callee = frame->fn,
+                                 .used = true};
+        graph->edge_count += 1;
+    }
+    edge->count += 1;
+    edge->cycles += graph->cycles - frame->start_cycles;
+    edge->instructions += graph->instructions - frame->start_instructions;
+}
+
+static void CALLGRAPH_enter(CALLGRAPH *graph, uint16_t fn, uint16_t call_site, uint8_t sp_before) {
+    if (graph->depth == CALLGRAPH_MAX_DEPTH) {
+        graph->dropped_calls += 1;
+        return;
+    }
+    uint16_t caller = graph->stack[graph->depth - 1].fn;
+    graph->is_function[fn] = true;
+    graph->stack[graph->depth++] = (CALLGRAPH_FRAME){
+        .fn = fn,
+        .call_site = call_site,
+        .caller = caller,
+        .sp = sp_before,
+        .start_cycles = graph->cycles,
+        .start_instructions = graph->instructions,
+    };
+}
+
+// Closes every call the stack pointer has been unwound past
+static void CALLGRAPH_unwind(CALLGRAPH *graph, uint8_t sp) {
+    while (graph->depth > 1 && graph->stack[graph->depth - 1].sp <= sp) {
+        CALLGRAPH_close(graph, &graph->stack[--graph->depth]);
+    }
+}
+
+void CALLGRAPH_instruction(CALLGRAPH *graph, uint16_t pc, uint8_t opcode, size_t cycles, uint16_t next_pc,
+                           uint8_t sp_before, uint8_t sp_after) {
+    uint16_t fn = graph->stack[graph->depth - 1].fn;
+    graph->self_cycles[fn] += cycles;
+    graph->self_instructions[fn] += 1;
+    graph->cycles += cycles;
+    graph->instructions += 1;
+
+    switch (opcode) {
+    case CALLGRAPH_OP_JSR:
+    case CALLGRAPH_OP_BRK:
+        CALLGRAPH_enter(graph, next_pc, pc, sp_before);
+        break;
+    case CALLGRAPH_OP_RTS:
+    case CALLGRAPH_OP_RTI:
+        CALLGRAPH_unwind(graph, sp_after);
+        break;
+    }
+}
+
+void CALLGRAPH_interrupt(CALLGRAPH *graph, uint16_t handler, uint16_t interrupted_pc, uint8_t sp_before) {
+    CALLGRAPH_enter(graph, handler, interrupted_pc, sp_before);
+}
+
+static void CALLGRAPH_set_label(CALLGRAPH *graph, unsigned long addr, const char *name, size_t length) {
+    if (addr >= RAM_SIZE || length == 0) return;
+    char *label = malloc(length + 1);
+    if (!label) {
+        PANIC("Out of memory reading labels!");
+    }
+    memcpy(label, name, length);
+    label[length] = '\0';
+    free(graph->labels[addr]);
+    graph->labels[addr] = label;
+}
+
+// $C000#name#comment
+static bool CALLGRAPH_parse_nl(CALLGRAPH *graph, const char *line) {
+    if (line[0] != '$') return false;
+    char *end;
+    unsigned long addr = strtoul(line + 1, &end, 16);
+    if (*end != '#') return false;
+    const char *name = end + 1;
+    size_t length = strcspn(name, "#\r\n");
+    CALLGRAPH_set_label(graph, addr, name, length);
+    return length > 0;
+}
+
+// sym	id=3,name="reset",addrsize=absolute,scope=0,def=5,ref=9,val=0xC000,type=lab
+static bool CALLGRAPH_parse_dbg(CALLGRAPH *graph, const char *line) {
+    if (strncmp(line, "sym", 3) != 0 || !strstr(line, "type=lab")) return false;
+    const char *name = strstr(line, "name=\"");
+    const char *val = strstr(line, "val=");
+    if (!name || !val) return false;
+    name += 6;
+    size_t length = strcspn(name, "\"");
+    CALLGRAPH_set_label(graph, strtoul(val + 4, NULL, 0), name, length);
+    return length > 0;
+}
+
+int CALLGRAPH_load_labels(CALLGRAPH *graph, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open label file '%s'\n", path);
+        return -1;
+    }
+
+    const char *extension = strrchr(path, '.');
+    bool dbg = extension && strcmp(extension, ".dbg") == 0;
+
+    char line[CALLGRAPH_LINE_SIZE];
+    int count = 0;
+    while (fgets(line, sizeof(line), file)) {
+        count += dbg ? CALLGRAPH_parse_dbg(graph, line) : CALLGRAPH_parse_nl(graph, line);
+    }
+    fclose(file);
+    return count;
+}
+
+// Callgrind name compression, the full name is written on first use only
+static void CALLGRAPH_write_name(CALLGRAPH *graph, FILE *file, const char *key, uint16_t fn) {
+    if (graph->named[fn]) {
+        fprintf(file, "%s=(%u)\n", key, fn + 1);
+        return;
+    }
+    graph->named[fn] = true;
+    if (graph->labels[fn]) {
+        fprintf(file, "%s=(%u) %s\n", key, fn + 1, graph->labels[fn]);
+    } else {
+        fprintf(file, "%s=(%u) sub_%04X\n", key, fn + 1, fn);
+    }
+}
+
+bool CALLGRAPH_write_callgrind(CALLGRAPH *graph, FILE *file, const char *command) {
+    // Close the calls still in progress, then restore them so recording can continue
+    CALLGRAPH_FRAME saved[CALLGRAPH_MAX_DEPTH];
+    size_t depth = graph->depth;
+    memcpy(saved, graph->stack, depth * sizeof(CALLGRAPH_FRAME));
+    while (graph->depth > 1) {
+        CALLGRAPH_close(graph, &graph->stack[--graph->depth]);
+    }
+
+    fprintf(file, "# callgrind format\nversion: 1\ncreator: NES-Emulator\n");
+    if (command) fprintf(file, "cmd: %s\n", command);
+    fprintf(file, "positions: instr\nevents: Cycles Instructions\nsummary: %llu %llu\n\n",
+            (unsigned long long)graph->cycles, (unsigned long long)graph->instructions);
+
+    memset(graph->named, 0, sizeof(graph->named));
+    for (size_t fn = 0; fn < RAM_SIZE; fn++) {
+        if (!graph->is_function[fn]) continue;
+        CALLGRAPH_write_name(graph, file, "fn", (uint16_t)fn);
+        fprintf(file, "0x%04zX %llu %llu\n", fn, (unsigned long long)graph->self_cycles[fn],
+                (unsigned long long)graph->self_instructions[fn]);
+
+        for (size_t i = 0; i < graph->edge_capacity; i++) {
+            const CALLGRAPH_EDGE *edge = &graph->edges[i];
+            // Edges of calls only ever seen in progress are left with no count
+            if (!edge->used || edge->caller != fn || edge->count == 0) continue;
+            CALLGRAPH_write_name(graph, file, "cfn", edge->callee);
+            fprintf(file, "calls=%llu 0x%04X\n0x%04X %llu %llu\n", (unsigned long long)edge->count, edge->callee,
+                    edge->call_site, (unsigned long long)edge->cycles, (unsigned long long)edge->instructions);
+        }
+        fprintf(file, "\n");
+    }
+
+    // Undo the closing, the costs of calls in progress must not be counted twice
+    for (size_t i = depth; i-- > 1;) {
+        const CALLGRAPH_FRAME *frame = &saved[i];
+        CALLGRAPH_EDGE *edge =
+            CALLGRAPH_find_edge(graph->edges, graph->edge_capacity, frame->caller, frame->call_site, frame->fn);
+        edge->count -= 1;
+        edge->cycles -= graph->cycles - frame->start_cycles;
+        edge->instructions -= graph->instructions - frame->start_instructions;
+    }
+    memcpy(graph->stack, saved, depth * sizeof(CALLGRAPH_FRAME));
+    graph->depth = depth;
+
+    return !ferror(file);
+}
+
+bool CALLGRAPH_write_callgrind_file(CALLGRAPH *graph, const char *path, const char *command) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open callgrind file '%s'\n", path);
+        return false;
+    }
+    bool ok = CALLGRAPH_write_callgrind(graph, file, command);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) fprintf(stderr, "Could not write callgrind file '%s'\n", path);
+    return ok;
+}
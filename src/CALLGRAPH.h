@@ -0,0 +1,79 @@
+#ifndef CALLGRAPH_H
+#define CALLGRAPH_H
+
+#include <BUS.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CALLGRAPH_MAX_DEPTH 256
+#define CALLGRAPH_ROOT_SP 0x100 // above any real stack pointer, never unwound
+
+// One active call. sp is the stack pointer before the return address was
+// pushed, the call has returned once an RTS/RTI brings SP back up to it. This
+// survives RTS jump tables and stack resets, which a plain push/pop would not.
+typedef struct {
+    uint16_t fn;
+    uint16_t call_site;
+    uint16_t caller;
+    int16_t sp;
+    uint64_t start_cycles;
+    uint64_t start_instructions;
+} CALLGRAPH_FRAME;
+
+// Calls from one function to another at one call site
+typedef struct {
+    uint16_t caller;
+    uint16_t call_site;
+    uint16_t callee;
+    bool used;
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t instructions;
+} CALLGRAPH_EDGE;
+
+// Guest call graph built from JSR/RTS, BRK, IRQ/NMI entry and RTI. Functions are
+// identified by their entry address and costs are kept in flat arrays indexed
+// by it, the sparse call edges live in an open addressing table.
+typedef struct {
+    uint64_t self_cycles[RAM_SIZE];
+    uint64_t self_instructions[RAM_SIZE];
+    bool is_function[RAM_SIZE];
+    char *labels[RAM_SIZE];
+    bool named[RAM_SIZE]; // scratch of CALLGRAPH_write_callgrind, names already written
+
+    CALLGRAPH_EDGE *edges;
+    size_t edge_capacity;
+    size_t edge_count;
+
+    CALLGRAPH_FRAME stack[CALLGRAPH_MAX_DEPTH];
+    size_t depth;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t dropped_calls; // calls deeper than CALLGRAPH_MAX_DEPTH
+} CALLGRAPH;
+
+void CALLGRAPH_init(CALLGRAPH *graph);
+void CALLGRAPH_free(CALLGRAPH *graph);
+// Clears all costs and makes entry_pc the root function
+void CALLGRAPH_start(CALLGRAPH *graph, uint16_t entry_pc);
+
+// Reads labels from an FCEUX .nl file ("$C000#name#comment") or a ca65 .dbg
+// file, chosen by extension. Returns the number of labels read, -1 on error.
+int CALLGRAPH_load_labels(CALLGRAPH *graph, const char *path);
+
+// Called by the CPU after every instruction with the stack pointer from before it
+void CALLGRAPH_instruction(CALLGRAPH *graph, uint16_t pc, uint8_t opcode, size_t cycles, uint16_t next_pc,
+                           uint8_t sp_before, uint8_t sp_after);
+// Called by the CPU once an IRQ or NMI has pushed its return address
+void CALLGRAPH_interrupt(CALLGRAPH *graph, uint16_t handler, uint16_t interrupted_pc, uint8_t sp_before);
+
+// Writes a callgrind profile loadable by KCachegrind, costs are cycles and
+// instructions. Calls still active are closed at the current cycle first.
+bool CALLGRAPH_write_callgrind(CALLGRAPH *graph, FILE *file, const char *command);
+bool CALLGRAPH_write_callgrind_file(CALLGRAPH *graph, const char *path, const char *command);
+
+#endif // CALLGRAPH_H
@@ -0,0 +1,199 @@
+#include <CART.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint8_t CART_MAGIC[4] = {'N', 'E', 'S', 0x1A};
+
+// NES 2.0 stores sizes either as a bank count with a 4 bit MSB nibble or, if
+// that nibble is 0xF, as 2^exponent * (multiplier * 2 + 1) bytes
+static size_t CART_nes2_rom_size(uint8_t lsb, uint8_t msb_nibble, size_t bank_size) {
+    if (msb_nibble == 0x0F) {
+        size_t exponent = lsb >> 2;
+        size_t multiplier = (lsb & 0x03) * 2 + 1;
+        // Too large for any file, SIZE_MAX fails the truncation check
+        if (exponent > sizeof(size_t) * 8 - 4) return SIZE_MAX;
+        return ((size_t)1 << exponent) * multiplier;
+    }
+    return (((size_t)msb_nibble << 8) | lsb) * bank_size;
+}
+
+static size_t CART_round_up(size_t size, size_t unit) {
+    return (size + unit - 1) / unit * unit;
+}
+
+static size_t CART_nes2_ram_size(uint8_t shift_count) {
+    return shift_count ? ((size_t)64 << shift_count) : 0;
+}
+
+static bool CART_parse_header(CART *cart, const uint8_t *header) {
+    if (memcmp(header, CART_MAGIC, sizeof(CART_MAGIC)) != 0) {
+        fprintf(stderr, "Not an iNES file, bad magic\n");
+        return false;
+    }
+
+    uint8_t flags6 = header[6];
+    uint8_t flags7 = header[7];
+
+    cart->nes2 = (flags7 & 0x0C) == 0x08;
+    cart->battery = flags6 & 0x02;
+
+    if (flags6 & 0x08) {
+        cart->mirroring = CART_MIRRORING_FOUR_SCREEN;
+    } else {
+        cart->mirroring = (flags6 & 0x01) ? CART_MIRRORING_VERTICAL : CART_MIRRORING_HORIZONTAL;
+    }
+
+    if (cart->nes2) {
+        cart->mapper_id = (flags6 >> 4) | (flags7 & 0xF0) | ((uint16_t)(header[8] & 0x0F) << 8);
+        cart->submapper = header[8] >> 4;
+        cart->prg_rom_size = CART_nes2_rom_size(header[4], header[9] & 0x0F, CART_PRG_BANK_SIZE);
+        cart->chr_rom_size = CART_nes2_rom_size(header[5], header[9] >> 4, CART_CHR_BANK_SIZE);
+        cart->prg_ram_size = CART_nes2_ram_size(header[10] & 0x0F) + CART_nes2_ram_size(header[10] >> 4);
+        cart->chr_ram_size = CART_nes2_ram_size(header[11] & 0x0F) + CART_nes2_ram_size(header[11] >> 4);
+    } else {
+        // Old dumps with garbage like "DiskDude!" in bytes 7-15 only have a
+        // valid lower mapper nibble
+        bool dirty = header[12] || header[13] || header[14] || header[15];
+        cart->mapper_id = (flags6 >> 4) | (dirty ? 0 : (flags7 & 0xF0));
+        cart->submapper = 0;
+        cart->prg_rom_size = (size_t)header[4] * CART_PRG_BANK_SIZE;
+        cart->chr_rom_size = (size_t)header[5] * CART_CHR_BANK_SIZE;
+        cart->prg_ram_size = CART_PRG_RAM_DEFAULT_SIZE;
+        cart->chr_ram_size = cart->chr_rom_size ? 0 : CART_CHR_BANK_SIZE;
+    }
+
+    // Carts without CHR-ROM always get at least one bank of CHR-RAM
+    if (cart->chr_rom_size == 0 && cart->chr_ram_size == 0) {
+        cart->chr_ram_size = CART_CHR_BANK_SIZE;
+    }
+
+    return true;
+}
+
+bool CART_load(CART *cart, const char *path) {
+    memset(cart, 0, sizeof(*cart));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open ROM '%s'\n", path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < CART_HEADER_SIZE) {
+        fprintf(stderr, "ROM '%s' is too small\n", path);
+        close(fd);
+        return false;
+    }
+
+    void *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) {
+        fprintf(stderr, "Could not mmap ROM '%s'\n", path);
+        return false;
+    }
+
+    cart->file = file;
+    cart->file_size = st.st_size;
+
+    if (!CART_parse_header(cart, cart->file)) {
+        fprintf(stderr, "ROM '%s' has an invalid header\n", path);
+        CART_unload(cart);
+        return false;
+    }
+
+    size_t offset = CART_HEADER_SIZE;
+    bool trainer = cart->file[6] & 0x04;
+    if (trainer) {
+        offset += CART_TRAINER_SIZE;
+    }
+
+    // Each size on its own against what is left, a sum could wrap
+    size_t left = offset < cart->file_size ? cart->file_size - offset : 0;
+    if (cart->prg_rom_size == 0 || cart->prg_rom_size > left || cart->chr_rom_size > left - cart->prg_rom_size) {
+        fprintf(stderr, "ROM '%s' is truncated\n", path);
+        CART_unload(cart);
+        return false;
+    }
+    // ROM is switched in whole mapper windows straight from the file mapping
+    if (cart->prg_rom_size % CART_PRG_WINDOW_SIZE || cart->chr_rom_size % CART_CHR_WINDOW_SIZE) {
+        fprintf(stderr, "ROM '%s' has PRG-ROM or CHR-ROM that is not a whole number of banks\n", path);
+        CART_unload(cart);
+        return false;
+    }
+
+    cart->prg_rom = cart->file + offset;
+    offset += cart->prg_rom_size;
+    cart->chr_rom = cart->chr_rom_size ? cart->file + offset : NULL;
+    cart->hash = hash_fnv1a(HASH_FNV_OFFSET, cart->prg_rom, cart->prg_rom_size);
+    cart->hash = hash_fnv1a(cart->hash, cart->chr_rom, cart->chr_rom_size);
+
+    // iNES 1.0 carts already got the default, a NES 2.0 header that says
+    // there is no PRG-RAM is taken at its word unless the trainer needs it
+    if (cart->prg_ram_size < CART_PRG_RAM_DEFAULT_SIZE && trainer) {
+        cart->prg_ram_size = CART_PRG_RAM_DEFAULT_SIZE;
+    }
+    // RAM is allocated here, so odd sizes round up: PRG-RAM to whole bus pages
+    // for BUS_map_memory, CHR-RAM to whole mapper windows
+    cart->prg_ram_size = CART_round_up(cart->prg_ram_size, BUS_PAGE_SIZE);
+    cart->chr_ram_size = CART_round_up(cart->chr_ram_size, CART_CHR_WINDOW_SIZE);
+    if (cart->prg_ram_size) {
+        cart->prg_ram = calloc(cart->prg_ram_size, 1);
+    }
+    if (cart->chr_ram_size) {
+        cart->chr_ram = calloc(cart->chr_ram_size, 1);
+    }
+    if ((cart->prg_ram_size && !cart->prg_ram) || (cart->chr_ram_size && !cart->chr_ram)) {
+        PANIC("Out of memory allocating cartridge RAM!");
+    }
+
+    CART_power(cart);
+
+    return true;
+}
+
+void CART_power(CART *cart) {
+    if (cart->prg_ram && !cart->battery) {
+        memset(cart->prg_ram, 0, cart->prg_ram_size);
+    }
+    if (cart->chr_ram) {
+        memset(cart->chr_ram, 0, cart->chr_ram_size);
+    }
+
+    // The trainer is loaded to $7000
+    if (cart->file[6] & 0x04) {
+        memcpy(cart->prg_ram + 0x1000, cart->file + CART_HEADER_SIZE, CART_TRAINER_SIZE);
+    }
+}
+
+void CART_unload(CART *cart) {
+    if (cart->file) {
+        munmap((void *)cart->file, cart->file_size);
+    }
+    free(cart->prg_ram);
+    free(cart->chr_ram);
+    memset(cart, 0, sizeof(*cart));
+}
+
+void CART_print_info(CART *cart) {
+    printf("=== Cartridge ===\n");
+    printf("Format:     %s\n", cart->nes2 ? "NES 2.0" : "iNES");
+    printf("Mapper:     %d.%d\n", cart->mapper_id, cart->submapper);
+    printf("PRG-ROM:    %zu KB\n", cart->prg_rom_size / 1024);
+    printf("CHR-ROM:    %zu KB\n", cart->chr_rom_size / 1024);
+    printf("PRG-RAM:    %zu KB%s\n", cart->prg_ram_size / 1024, cart->battery ? " (battery)" : "");
+    printf("CHR-RAM:    %zu KB\n", cart->chr_ram_size / 1024);
+    printf("Mirroring:  %d\n", cart->mirroring);
+    printf("=================\n");
+}
+
+void CART_save_state(const CART *cart, STATE *state) {
+    STATE_write(state, cart->prg_ram, cart->prg_ram_size);
+    STATE_write(state, cart->chr_ram, cart->chr_ram_size);
+}
+
+void CART_load_state(CART *cart, STATE *state) {
+    STATE_read(state, cart->prg_ram, cart->prg_ram_size);
+    STATE_read(state, cart->chr_ram, cart->chr_ram_size);
+}
@@ -0,0 +1,66 @@
+#ifndef CART_H
+#define CART_H
+
+#include <BUS.h>
+#include <STATE.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CART_HEADER_SIZE 16
+#define CART_TRAINER_SIZE 512
+#define CART_PRG_BANK_SIZE 16384 // 16 * 1024
+#define CART_CHR_BANK_SIZE 8192  // 8 * 1024
+#define CART_PRG_RAM_DEFAULT_SIZE 8192
+// Smallest banks any mapper switches, ROM sizes have to be a multiple of them
+#define CART_PRG_WINDOW_SIZE 8192
+#define CART_CHR_WINDOW_SIZE 1024
+
+typedef enum {
+    CART_MIRRORING_HORIZONTAL,
+    CART_MIRRORING_VERTICAL,
+    CART_MIRRORING_FOUR_SCREEN,
+    CART_MIRRORING_SINGLE_LOW,
+    CART_MIRRORING_SINGLE_HIGH
+} CART_MIRRORING;
+
+typedef struct {
+    // Read-only private mapping of the whole .nes file, PRG and CHR ROM point
+    // into it so the page cache is shared between every process using the ROM
+    const uint8_t *file;
+    size_t file_size;
+
+    const uint8_t *prg_rom;
+    size_t prg_rom_size;
+    const uint8_t *chr_rom;
+    size_t chr_rom_size;
+
+    uint8_t *prg_ram;
+    size_t prg_ram_size;
+    uint8_t *chr_ram;
+    size_t chr_ram_size;
+
+    uint16_t mapper_id;
+    uint8_t submapper;
+    CART_MIRRORING mirroring;
+    bool battery;
+    bool nes2;
+    uint64_t hash; // FNV-1a of PRG and CHR ROM, identifies the ROM in savestates
+} CART;
+
+// Maps the file and parses its iNES / NES 2.0 header, returns false and prints
+// the reason to stderr if the file is not a usable ROM
+bool CART_load(CART *cart, const char *path);
+void CART_unload(CART *cart);
+
+void CART_print_info(CART *cart);
+// Power cycle: clears RAM without battery backup and reloads the trainer
+void CART_power(CART *cart);
+
+// Cartridge RAM only, ROM contents are referenced by cart->hash
+void CART_save_state(const CART *cart, STATE *state);
+void CART_load_state(CART *cart, STATE *state);
+
+#endif // CART_H
@@ -6,6 +6,15 @@ void CPU_init(CPU *cpu, BUS *bus) {
     }
 
     cpu->bus = bus;
+    cpu->decimal_mode = false;
+    cpu->instrumented = false;
+    cpu->trace = NULL;
+    cpu->profile = NULL;
+    cpu->callgraph = NULL;
+    cpu->block_cache = NULL;
+    cpu->block = NULL;
+    cpu->next_insn = NULL;
+    cpu->jit = NULL;
 
     cpu->clock_counter = 0;
     cpu->fetched = 0x00;
@@ -13,50 +22,74 @@ void CPU_init(CPU *cpu, BUS *bus) {
     cpu->addr_rel = 0x0000;
     cpu->opcode = 0x00;
     cpu->cycles = 0x00;
+    cpu->run_end = 0;
+    cpu->nmi_pending = false;
+    cpu->irq_lines = 0;
 
     cpu->reg.A = 0x00;
     cpu->reg.X = 0x00;
     cpu->reg.Y = 0x00;
     cpu->reg.SP = 0xFD;
     cpu->reg.PC = 0x0000;
-    cpu->reg.STATUS = 0x00;
+    CPU_set_status(cpu, 0x00);
 }
 
-uint8_t CPU_read(CPU *cpu, uint16_t addr) {
+// The interpreter and the block handlers both expand every operation, which is
+// more than GCC will inline the shared accessors into by itself
+#define CPU_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+CPU_ALWAYS_INLINE uint8_t CPU_bus_read(CPU *cpu, uint16_t addr) {
     return BUS_read(cpu->bus, addr, false);
 }
 
+CPU_ALWAYS_INLINE void CPU_bus_write(CPU *cpu, uint16_t addr, uint8_t data) {
+    BUS_write(cpu->bus, addr, data);
+}
+
+// Also increments the PC
+CPU_ALWAYS_INLINE uint8_t CPU_bus_read_pc(CPU *cpu) {
+    uint8_t val = CPU_bus_read(cpu, cpu->reg.PC);
+    cpu->reg.PC += 1;
+    return val;
+}
+
+uint8_t CPU_read(CPU *cpu, uint16_t addr) {
+    return CPU_bus_read(cpu, addr);
+}
+
 uint8_t CPU_read_from_stack(CPU *cpu) {
     cpu->reg.SP += 1;
-    return CPU_read(cpu, STACK_ORIGIN + cpu->reg.SP);
+    return CPU_bus_read(cpu, STACK_ORIGIN + cpu->reg.SP);
 }
 
 uint8_t CPU_read_pc(CPU *cpu) {
-    // Also increments the PC
-    uint8_t val = CPU_read(cpu, cpu->reg.PC);
-    cpu->reg.PC += 1;
-    return val;
+    return CPU_bus_read_pc(cpu);
 }
 
 void CPU_write(CPU *cpu, uint16_t addr, uint8_t data) {
-    BUS_write(cpu->bus, addr, data);
+    CPU_bus_write(cpu, addr, data);
+}
+
+// Implied mode operands were already loaded from the accumulator by CPU_AM_IMP
+static inline uint8_t CPU_fetch_operand(CPU *cpu, const bool implied) {
+    if (!implied) {
+        cpu->fetched = CPU_bus_read(cpu, cpu->addr_abs);
+    }
+    return cpu->fetched;
 }
 
 void CPU_write_to_stack(CPU *cpu, uint8_t data) {
-    CPU_write(cpu, STACK_ORIGIN + cpu->reg.SP, data);
+    CPU_bus_write(cpu, STACK_ORIGIN + cpu->reg.SP, data);
     cpu->reg.SP -= 1;
 }
 
 uint8_t CPU_get_flag(CPU *cpu, CPU_FLAGS flag) {
-    return cpu->reg.STATUS & flag;
+    return CPU_get_status(cpu) & flag;
 }
 
 void CPU_set_flag(CPU *cpu, CPU_FLAGS flag, bool activate) {
-    if (activate) {
-        cpu->reg.STATUS |= flag;
-    } else {
-        cpu->reg.STATUS &= ~flag;
-    }
+    uint8_t status = CPU_get_status(cpu);
+    CPU_set_status(cpu, activate ? (status | flag) : (status & ~flag));
 }
 
 void CPU_print_registers(CPU *cpu) {
@@ -73,7 +106,7 @@ void CPU_print_registers(CPU *cpu) {
     printf("CYLCES: 0x%02X    | Remaining Cycles\n", cpu->reg.Y);
     printf("SP:     0x%02X    | Stack Pointer\n", cpu->reg.SP);
     printf("PC:     0x%04X  | Program Counter\n", cpu->reg.PC);
-    printf("STATUS: 0x%02X    | [ ", cpu->reg.STATUS);
+    printf("STATUS: 0x%02X    | [ ", CPU_get_status(cpu));
 
     printf("N:%d ", (CPU_get_flag(cpu, CPU_FLAGS_N)) ? 1 : 0);
     printf("V:%d ", (CPU_get_flag(cpu, CPU_FLAGS_V)) ? 1 : 0);
@@ -87,19 +120,179 @@ void CPU_print_registers(CPU *cpu) {
     printf("=====================\n");
 }
 
-void CPU_clock(CPU *cpu) {
-    if (cpu->cycles == 0) {
-        cpu->opcode = CPU_read_pc(cpu);
+// Decodes and executes the instruction at PC, leaves its cycle count in cpu->cycles
+static inline uint16_t CPU_execute(CPU *cpu);
+// Same, but from the block cache where the code is in plain memory
+static inline uint16_t CPU_execute_cached(CPU *cpu);
+static void CPU_poll_interrupts(CPU *cpu);
+
+#ifdef NES_INSTRUMENT
+// Operand bytes are read without side effects, whatever the opcode turns out to
+// be. Fields are stored straight into the slot, assembling the record on the
+// stack first costs a store forwarding stall on the final copy.
+static void CPU_trace(CPU *cpu) {
+    TRACE_RECORD *record = TRACE_next(cpu->trace);
+    uint16_t pc = cpu->reg.PC;
+    uint64_t cycle = cpu->clock_counter + cpu->cycles;
+
+    record->cycle_low = (uint32_t)cycle;
+    record->cycle_high = (uint16_t)(cycle >> 32);
+    record->pc = pc;
+    record->a = cpu->reg.A;
+    record->x = cpu->reg.X;
+    record->y = cpu->reg.Y;
+    record->sp = cpu->reg.SP;
+    record->status = CPU_get_status(cpu);
+
+    // Code almost always runs from plain memory with the operands on the same page
+    const uint8_t *mem = cpu->bus->pages[pc >> 8].read;
+    if (mem && (pc & 0xFF) < 0xFE) {
+        mem += pc & 0xFF;
+        record->opcode = mem[0];
+        record->operand[0] = mem[1];
+        record->operand[1] = mem[2];
+    } else {
+        record->opcode = BUS_read(cpu->bus, pc, true);
+        record->operand[0] = BUS_read(cpu->bus, pc + 1, true);
+        record->operand[1] = BUS_read(cpu->bus, pc + 2, true);
+    }
+}
+
+// Kept out of line so the plain dispatch loop stays as small as without hooks
+__attribute__((noinline)) static uint16_t CPU_execute_instrumented(CPU *cpu) {
+    if (cpu->trace) CPU_trace(cpu);
+
+    uint16_t pc = cpu->reg.PC;
+    uint16_t pending = cpu->cycles;
+    uint8_t sp = cpu->reg.SP;
+    uint16_t cycles = CPU_execute(cpu);
+
+    if (cpu->profile) PROFILE_instruction(cpu->profile, pc, cpu->opcode, cycles, pending);
+    if (cpu->callgraph) {
+        CALLGRAPH_instruction(cpu->callgraph, pc, cpu->opcode, cycles + pending, cpu->reg.PC, sp, cpu->reg.SP);
+    }
+    return cycles;
+}
+#endif
+
+static inline uint16_t CPU_dispatch(CPU *cpu) {
+#ifdef NES_INSTRUMENT
+    // The only cost of compiled in but detached instrumentation
+    if (cpu->instrumented) return CPU_execute_instrumented(cpu);
+#endif
+    if (cpu->block_cache) return CPU_execute_cached(cpu);
+    return CPU_execute(cpu);
+}
+
+// An interrupt is taken before the next instruction, the cycles it takes are
+// part of that instruction's step
+static inline bool CPU_interrupt_pending(const CPU *cpu) {
+    return cpu->nmi_pending || (cpu->irq_lines && !(cpu->reg.STATUS & CPU_FLAGS_I));
+}
+
+size_t CPU_step(CPU *cpu) {
+    if (CPU_interrupt_pending(cpu)) CPU_poll_interrupts(cpu);
+    size_t cycles = cpu->cycles;
+    cycles += CPU_dispatch(cpu);
+    cpu->cycles = 0;
+    cpu->clock_counter += cycles;
+    return cycles;
+}
+
+size_t CPU_step_until(CPU *cpu, size_t deadline) {
+    size_t start = cpu->clock_counter + cpu->cycles;
+    if (cpu->jit && !cpu->instrumented && start < deadline && !CPU_interrupt_pending(cpu)) {
+        size_t cycles = JIT_execute(cpu->jit, cpu, deadline - start);
+        if (cycles) {
+            cycles += cpu->cycles;
+            cpu->cycles = 0;
+            cpu->clock_counter += cycles;
+            cpu->next_insn = NULL;
+            return cycles;
+        }
+    }
+    return CPU_step(cpu);
+}
+
+size_t CPU_run(CPU *cpu, size_t cycle_budget) {
+    size_t start = cpu->clock_counter;
+    cpu->run_end = start + cycle_budget;
+
+    while (cpu->clock_counter < cpu->run_end) {
+        CPU_step_until(cpu, cpu->run_end);
+    }
+
+    return cpu->clock_counter - start;
+}
 
-        OP_CODE_MATRIX_ENTRY op_code_matrix_entry = OP_CODE_MATRIX[cpu->opcode];
-        cpu->cycles = op_code_matrix_entry.cycles;
-        uint8_t cycle_add1 = op_code_matrix_entry.am(cpu);
-        uint8_t cycle_add2 = op_code_matrix_entry.op(cpu);
+void CPU_end_run(CPU *cpu) {
+    cpu->run_end = cpu->clock_counter;
+}
 
-        cpu->cycles += (cycle_add1 & cycle_add2);
+void CPU_stall(CPU *cpu, uint16_t cycles) {
+    cpu->cycles += cycles;
+}
+
+void CPU_clock(CPU *cpu) {
+    if (cpu->cycles == 0 && CPU_interrupt_pending(cpu)) {
+        CPU_poll_interrupts(cpu);
+    } else if (cpu->cycles == 0) {
+        CPU_dispatch(cpu);
     }
 
     cpu->cycles -= 1;
+    cpu->clock_counter += 1;
+}
+
+void CPU_set_trace(CPU *cpu, TRACE *trace) {
+#ifndef NES_INSTRUMENT
+    if (trace) PANIC("Built without NES_INSTRUMENT, tracing is not available!");
+#endif
+    cpu->trace = trace;
+    cpu->instrumented = cpu->trace || cpu->profile || cpu->callgraph;
+}
+
+void CPU_set_profile(CPU *cpu, PROFILE *profile) {
+#ifndef NES_INSTRUMENT
+    if (profile) PANIC("Built without NES_INSTRUMENT, profiling is not available!");
+#endif
+    if (cpu->profile) {
+        cpu->bus = cpu->profile->target;
+    }
+    cpu->profile = profile;
+    if (profile) {
+        cpu->bus = PROFILE_attach(profile, cpu->bus);
+    }
+    cpu->instrumented = cpu->trace || cpu->profile || cpu->callgraph;
+}
+
+void CPU_set_callgraph(CPU *cpu, CALLGRAPH *callgraph) {
+#ifndef NES_INSTRUMENT
+    if (callgraph) PANIC("Built without NES_INSTRUMENT, call graphs are not available!");
+#endif
+    cpu->callgraph = callgraph;
+    if (callgraph) CALLGRAPH_start(callgraph, cpu->reg.PC);
+    cpu->instrumented = cpu->trace || cpu->profile || cpu->callgraph;
+}
+
+void CPU_set_block_cache(CPU *cpu, BLOCK_CACHE *cache) {
+    if (cache) BLOCK_CACHE_flush(cache);
+    cpu->block_cache = cache;
+    cpu->block = NULL;
+    cpu->next_insn = NULL;
+}
+
+void CPU_set_jit(CPU *cpu, JIT *jit) {
+    if (jit) JIT_flush(jit);
+    cpu->jit = jit;
+}
+
+void CPU_save_state(const CPU *cpu, STATE *state) {
+    STATE_write(state, &cpu->reg, STATE_BLOCK_SIZE(CPU, reg));
+}
+
+void CPU_load_state(CPU *cpu, STATE *state) {
+    STATE_read(state, &cpu->reg, STATE_BLOCK_SIZE(CPU, reg));
 }
 
 void CPU_reset(CPU *cpu) {
@@ -107,209 +300,226 @@ void CPU_reset(CPU *cpu) {
     cpu->reg.X = 0;
     cpu->reg.Y = 0;
     cpu->reg.SP = 0xFD;
-    cpu->reg.STATUS = 0x00 | CPU_FLAGS_U;
+    CPU_set_status(cpu, CPU_FLAGS_U | CPU_FLAGS_I);
 
     cpu->addr_abs = 0xFFFC;
-    uint16_t low = CPU_read(cpu, cpu->addr_abs + 0);
-    uint16_t high = CPU_read(cpu, cpu->addr_abs + 1);
+    uint16_t low = CPU_bus_read(cpu, cpu->addr_abs + 0);
+    uint16_t high = CPU_bus_read(cpu, cpu->addr_abs + 1);
 
     cpu->reg.PC = (high << 8) | low;
 
     cpu->addr_rel = 0x0000;
     cpu->addr_abs = 0x0000;
     cpu->fetched = 0x00;
+    cpu->nmi_pending = false;
+    cpu->irq_lines = 0;
 
-    cpu->cycles = 8;
+    cpu->cycles = 7;
 }
-void CPU_irq(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_I) == 0) return;
-
+// Pushes PC and status and jumps through vector, before the next instruction
+static void CPU_interrupt(CPU *cpu, uint16_t vector) {
+    uint16_t interrupted_pc = cpu->reg.PC;
+    uint8_t sp_before = cpu->reg.SP;
     CPU_write_to_stack(cpu, (cpu->reg.PC >> 8) & 0x00FF);
     CPU_write_to_stack(cpu, cpu->reg.PC & 0x00FF);
 
-    CPU_set_flag(cpu, CPU_FLAGS_B, false);
-    CPU_set_flag(cpu, CPU_FLAGS_U, true);
-    CPU_set_flag(cpu, CPU_FLAGS_I, true);
-    CPU_write_to_stack(cpu, cpu->reg.STATUS);
+    // The pushed copy has B clear, I is only set afterwards
+    CPU_write_to_stack(cpu, (CPU_get_status(cpu) & ~CPU_FLAGS_B) | CPU_FLAGS_U);
+    cpu->reg.STATUS |= CPU_FLAGS_I;
 
-    cpu->addr_abs = 0xFFFE;
-    uint16_t low = CPU_read(cpu, cpu->addr_abs + 0);
-    uint16_t high = CPU_read(cpu, cpu->addr_abs + 1);
+    cpu->addr_abs = vector;
+    uint16_t low = CPU_bus_read(cpu, cpu->addr_abs + 0);
+    uint16_t high = CPU_bus_read(cpu, cpu->addr_abs + 1);
     cpu->reg.PC = (high << 8) | low;
 
+#ifdef NES_INSTRUMENT
+    if (cpu->callgraph) CALLGRAPH_interrupt(cpu->callgraph, cpu->reg.PC, interrupted_pc, sp_before);
+#endif
     cpu->cycles = 7;
 }
 
-void CPU_nmi(CPU *cpu) {
-    CPU_write_to_stack(cpu, (cpu->reg.PC) >> 8 & 0x00FF);
-    CPU_write_to_stack(cpu, (cpu->reg.PC) & 0x00FF);
-
-    CPU_set_flag(cpu, CPU_FLAGS_B, false);
-    CPU_set_flag(cpu, CPU_FLAGS_U, true);
-    CPU_set_flag(cpu, CPU_FLAGS_I, true);
-    CPU_write_to_stack(cpu, cpu->reg.STATUS);
+static void CPU_poll_interrupts(CPU *cpu) {
+    if (cpu->nmi_pending) {
+        cpu->nmi_pending = false;
+        CPU_interrupt(cpu, 0xFFFA);
+    } else if (cpu->irq_lines && !(cpu->reg.STATUS & CPU_FLAGS_I)) {
+        CPU_interrupt(cpu, 0xFFFE);
+    }
+}
 
-    cpu->addr_abs = 0xFFFE;
-    uint16_t low = CPU_read(cpu, cpu->addr_abs + 0);
-    uint16_t high = CPU_read(cpu, cpu->addr_abs + 1);
-    cpu->reg.PC = (high << 8) | low;
+void CPU_set_irq(CPU *cpu, CPU_IRQ_SOURCE source, bool asserted) {
+    if (asserted) {
+        cpu->irq_lines |= source;
+    } else {
+        cpu->irq_lines &= ~source;
+    }
+}
 
-    cpu->cycles = 8;
+void CPU_nmi(CPU *cpu) {
+    cpu->nmi_pending = true;
 }
 
-void CPU_fetch(CPU *cpu) {
-    if (OP_CODE_MATRIX[cpu->opcode].am == CPU_AM_IMP) {
-        cpu->fetched = CPU_read(cpu, cpu->addr_abs);
-    }
-    return cpu->fetched;
+uint8_t CPU_fetch(CPU *cpu) {
+    return CPU_fetch_operand(cpu, OP_CODE_MATRIX[cpu->opcode].am == CPU_AM_IMP);
 }
 
 // Addressing mode functions
-uint8_t CPU_AM_IMP(CPU *cpu) {
+// Each mode is split into reading its operand bytes and resolving them into
+// addr_abs, addr_rel or fetched. The block cache does the first part once when
+// decoding and only runs CPU_resolve_<AM> per execution.
+static inline uint8_t CPU_resolve_IMP(CPU *cpu, uint16_t operand) {
     cpu->fetched = cpu->reg.A; // Fetches accumulator value
     return 0;
 }
-uint8_t CPU_AM_ZP0(CPU *cpu) {
+static inline uint8_t CPU_resolve_IMM(CPU *cpu, uint16_t operand) {
+    // The operand is the address of the immediate byte
+    cpu->addr_abs = operand;
+    return 0;
+}
+static inline uint8_t CPU_resolve_ZP0(CPU *cpu, uint16_t operand) {
     // 0XABCD -> page 0xAB offset into that page 0xCD, have 255 pages w/ 255 entries each
-    cpu->addr_abs = CPU_read_pc(cpu);
-    cpu->addr_abs &= 0x00FF;
-
+    cpu->addr_abs = operand & 0x00FF;
     return 0;
 }
-uint8_t CPU_AM_ZPY(CPU *cpu) {
-    cpu->addr_abs = (CPU_read_pc(cpu) + cpu->reg.Y) & 0x00FF;
+static inline uint8_t CPU_resolve_ZPX(CPU *cpu, uint16_t operand) {
+    cpu->addr_abs = (operand + cpu->reg.X) & 0x00FF;
     return 0;
 }
-uint8_t CPU_AM_ABS(CPU *cpu) {
-    uint16_t low = CPU_read_pc(cpu);
-    uint16_t high = CPU_read_pc(cpu);
-
-    cpu->addr_abs = (high << 8) | low;
-
+static inline uint8_t CPU_resolve_ZPY(CPU *cpu, uint16_t operand) {
+    cpu->addr_abs = (operand + cpu->reg.Y) & 0x00FF;
     return 0;
 }
-uint8_t CPU_AM_ABY(CPU *cpu) {
-    uint16_t low = CPU_read_pc(cpu);
-    uint16_t high = CPU_read_pc(cpu);
+static inline uint8_t CPU_resolve_ABS(CPU *cpu, uint16_t operand) {
+    cpu->addr_abs = operand;
+    return 0;
+}
+static inline uint8_t CPU_resolve_ABX(CPU *cpu, uint16_t operand) {
+    cpu->addr_abs = operand + cpu->reg.X;
 
-    cpu->addr_abs = (high << 8) | low;
-    cpu->addr_abs += cpu->reg.Y;
+    // Deals with overflows
+    return (cpu->addr_abs & 0xFF00) != (operand & 0xFF00);
+}
+static inline uint8_t CPU_resolve_ABY(CPU *cpu, uint16_t operand) {
+    cpu->addr_abs = operand + cpu->reg.Y;
 
     // Deals with overflows
-    if ((cpu->addr_abs & 0xFF00) != (high << 8)) {
-        return 1;
+    return (cpu->addr_abs & 0xFF00) != (operand & 0xFF00);
+}
+static inline uint8_t CPU_resolve_IND(CPU *cpu, uint16_t ptr) {
+    // There is a hardware bug in the NES CPUs, this introduces this bug here to
+    // align with the hardware behaviour, see also:
+    // http://wiki.nesdev.com/w/index.php/CPU_addressing_modes
+    if ((ptr & 0x00FF) == 0x00FF) {
+        cpu->addr_abs = (CPU_bus_read(cpu, ptr & 0xFF00) << 8) | CPU_bus_read(cpu, ptr + 0);
     } else {
-        return 0;
+        cpu->addr_abs = (CPU_bus_read(cpu, ptr + 1) << 8) | CPU_bus_read(cpu, ptr + 0);
     }
+    return 0;
 }
-uint8_t CPU_AM_IZX(CPU *cpu) {
-    uint16_t addr = CPU_read_pc(cpu);
-
+static inline uint8_t CPU_resolve_IZX(CPU *cpu, uint16_t addr) {
     uint16_t low_addr = (uint16_t)(addr + (uint16_t)cpu->reg.X) & 0x00FF;
-    uint16_t low = CPU_read(cpu, low_addr);
+    uint16_t low = CPU_bus_read(cpu, low_addr);
     uint16_t high_addr = (uint16_t)(addr + (uint16_t)cpu->reg.X + 1) & 0x00FF;
-    uint16_t high = CPU_read(cpu, high_addr);
+    uint16_t high = CPU_bus_read(cpu, high_addr);
 
     cpu->addr_abs = (high << 8) | low;
+    return 0;
+}
+static inline uint8_t CPU_resolve_IZY(CPU *cpu, uint16_t addr) {
+    uint16_t low = CPU_bus_read(cpu, addr & 0x00FF);
+    uint16_t high = CPU_bus_read(cpu, (addr + 1) & 0x00FF);
+
+    cpu->addr_abs = ((high << 8) | low) + cpu->reg.Y;
 
+    return (cpu->addr_abs & 0xFF00) != (high << 8);
+}
+static inline uint8_t CPU_resolve_REL(CPU *cpu, uint16_t offset) {
+    cpu->addr_rel = offset;
     return 0;
 }
+
+static inline uint16_t CPU_read_pc_word(CPU *cpu) {
+    uint16_t low = CPU_bus_read_pc(cpu);
+    uint16_t high = CPU_bus_read_pc(cpu);
+    return (high << 8) | low;
+}
+
+static inline uint16_t CPU_sign_extend(uint8_t offset) {
+    return (offset & 0x80) ? (offset | 0xFF00) : offset;
+}
+
+uint8_t CPU_AM_IMP(CPU *cpu) {
+    return CPU_resolve_IMP(cpu, 0);
+}
+uint8_t CPU_AM_ZP0(CPU *cpu) {
+    return CPU_resolve_ZP0(cpu, CPU_bus_read_pc(cpu));
+}
+uint8_t CPU_AM_ZPY(CPU *cpu) {
+    return CPU_resolve_ZPY(cpu, CPU_bus_read_pc(cpu));
+}
+uint8_t CPU_AM_ABS(CPU *cpu) {
+    return CPU_resolve_ABS(cpu, CPU_read_pc_word(cpu));
+}
+uint8_t CPU_AM_ABY(CPU *cpu) {
+    return CPU_resolve_ABY(cpu, CPU_read_pc_word(cpu));
+}
+uint8_t CPU_AM_IZX(CPU *cpu) {
+    return CPU_resolve_IZX(cpu, CPU_bus_read_pc(cpu));
+}
 uint8_t CPU_AM_IMM(CPU *cpu) {
-    cpu->addr_abs += cpu->reg.PC;
+    uint16_t addr = cpu->reg.PC;
     cpu->reg.PC += 1;
-    return 0;
+    return CPU_resolve_IMM(cpu, addr);
 }
 uint8_t CPU_AM_ZPX(CPU *cpu) {
-    cpu->addr_abs = (cpu) + cpu->reg.X;
-    cpu->addr_abs &= 0x00FF;
-
-    return 0;
+    return CPU_resolve_ZPX(cpu, CPU_bus_read_pc(cpu));
 }
 uint8_t CPU_AM_REL(CPU *cpu) {
-    cpu->addr_rel = CPU_read_pc(cpu);
-    if (cpu->addr_rel & 0x80) {
-        cpu->addr_rel |= 0xFF00;
-    }
-    return 0;
+    return CPU_resolve_REL(cpu, CPU_sign_extend(CPU_bus_read_pc(cpu)));
 }
-
 uint8_t CPU_AM_ABX(CPU *cpu) {
-    uint16_t low = CPU_read_pc(cpu);
-    uint16_t high = CPU_read_pc(cpu);
-
-    cpu->addr_abs = (high << 8) | low;
-    cpu->addr_abs += cpu->reg.X;
-
-    // Deals with overflows
-    if ((cpu->addr_abs & 0xFF00) != (high << 8)) {
-        return 1;
-    } else {
-        return 0;
-    }
+    return CPU_resolve_ABX(cpu, CPU_read_pc_word(cpu));
 }
-
 uint8_t CPU_AM_IND(CPU *cpu) {
-    uint16_t ptr_low = CPU_read_pc(cpu);
-    uint16_t ptr_high = CPU_read_pc(cpu);
-
-    uint16_t ptr = (ptr_high << 8) | ptr_low;
-    // There is a hardware bug in the NES CPUs, this introduces this bug here to
-    // align with the hardware behaviour, see also:
-    // http://wiki.nesdev.com/w/index.php/CPU_addressing_modes
-    if (ptr_low == 0x00FF) {
-        cpu->addr_abs = (CPU_read(cpu, ptr & 0xFF0) << 8) | CPU_read(cpu, ptr + 0);
-    } else {
-        cpu->addr_abs = (CPU_read(cpu, ptr + 1) << 8) | CPU_read(cpu, ptr + 0);
-    }
-
-    return 0;
+    return CPU_resolve_IND(cpu, CPU_read_pc_word(cpu));
 }
-
 uint8_t CPU_AM_IZY(CPU *cpu) {
-    uint16_t addr = CPU_read_pc(cpu);
-
-    uint16_t low = CPU_read(cpu, addr & 0x00FF);
-    uint16_t high = CPU_read(cpu, (addr + 1) & 0x00FF);
-
-    cpu->addr_abs = (high << 8) | low + cpu->reg.Y;
-
-    if ((cpu->addr_abs & 0xFF00) != (high << 8)) {
-        return 1;
-    } else {
-        return 0;
-    }
+    return CPU_resolve_IZY(cpu, CPU_bus_read_pc(cpu));
 }
 uint8_t CPU_AM_XXX(CPU *cpu) {
     return 0;
 }
 
 // opcode functions
-uint8_t CPU_ADC(CPU *cpu) {
-    CPU_fetch(cpu);
-
-    uint16_t tmp = (uint16_t)cpu->reg.A + (uint16_t)cpu->fetched + (uint16_t)CPU_get_flag(cpu, CPU_FLAGS_C);
-    CPU_set_flag(cpu, CPU_FLAGS_C, tmp > 255);
-    CPU_set_flag(cpu, CPU_FLAGS_Z, (tmp & 0x00FF) == 0);
-    CPU_set_flag(cpu, CPU_FLAGS_N, 0x80);
-    CPU_set_flag(
-        cpu,
-        CPU_FLAGS_V,
-        (~((uint16_t)cpu->reg.A ^ (uint16_t)cpu->fetched) & ((uint16_t)cpu->reg.A ^ (uint16_t)tmp)));
-    cpu->reg.A = tmp & 0x00FF;
-    return 1;
-}
-uint8_t CPU_AND(CPU *cpu) {
-    CPU_fetch(cpu);
-    cpu->reg.A &= cpu->fetched;
-    if (cpu->reg.A == 0x00) CPU_set_flag(cpu, CPU_FLAGS_Z, true);
-    if (cpu->reg.A & 0x80) CPU_set_flag(cpu, CPU_FLAGS_N, true);
-    return 1;
-}
-uint8_t CPU_ASL(CPU *cpu) {
-    return 0;
+// Every operation body is written once against a compile time 'implied' flag,
+// so the fused handlers know at compile time whether the operand comes from
+// the accumulator or from addr_abs. The exported CPU_<OP> wrappers used by
+// OP_CODE_MATRIX resolve the flag at runtime instead.
+#define CPU_DEFINE_OP(name)                                                  \
+    static inline uint8_t CPU_##name##_impl(CPU *cpu, const bool implied);   \
+    uint8_t CPU_##name(CPU *cpu) {                                           \
+        return CPU_##name##_impl(cpu, OP_CODE_MATRIX[cpu->opcode].am == CPU_AM_IMP); \
+    }                                                                        \
+    static inline uint8_t CPU_##name##_impl(CPU *cpu, const bool implied)
+
+// Shared operation helpers
+
+static inline void CPU_set_zn(CPU *cpu, uint8_t value) {
+    cpu->flag_n = value;
+    cpu->flag_z = value;
+}
+
+// Read-modify-write results go back to the accumulator or to memory
+static inline void CPU_write_result(CPU *cpu, const bool implied, uint8_t value) {
+    if (implied) {
+        cpu->reg.A = value;
+    } else {
+        CPU_bus_write(cpu, cpu->addr_abs, value);
+    }
 }
-uint8_t CPU_BCC(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_C) == 0) {
+
+static inline void CPU_branch(CPU *cpu, bool taken) {
+    if (taken) {
         cpu->cycles += 1;
         cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
 
@@ -317,249 +527,692 @@ uint8_t CPU_BCC(CPU *cpu) {
 
         cpu->reg.PC = cpu->addr_abs;
     }
-    return 0;
 }
-uint8_t CPU_BCS(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_C)) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
 
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
-
-        cpu->reg.PC = cpu->addr_abs;
-    }
-    return 0;
+static inline void CPU_compare(CPU *cpu, uint8_t reg, uint8_t value) {
+    cpu->flag_c = reg >= value;
+    CPU_set_zn(cpu, (uint8_t)(reg - value));
 }
-uint8_t CPU_BEQ(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_Z)) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
 
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
+// Decimal mode follows the NMOS 6502: Z comes from the binary sum, N and V
+// from the sum before the high nibble is adjusted
+static inline void CPU_add(CPU *cpu, uint8_t value) {
+    uint8_t a = cpu->reg.A;
+    uint16_t carry = cpu->flag_c;
+    uint16_t tmp = (uint16_t)a + (uint16_t)value + carry;
 
-        cpu->reg.PC = cpu->addr_abs;
-    }
-    return 0;
-}
-uint8_t CPU_BIT(CPU *cpu) {
-    return 0;
-}
-uint8_t CPU_BMI(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_N)) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
+    if (cpu->decimal_mode && (cpu->reg.STATUS & CPU_FLAGS_D)) {
+        uint16_t low = (a & 0x0F) + (value & 0x0F) + carry;
+        if (low > 0x09) low += 0x06;
+        uint16_t high = (a >> 4) + (value >> 4) + (low > 0x0F);
 
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
+        cpu->flag_z = (uint8_t)tmp;
+        cpu->flag_n = (uint8_t)(high << 4);
+        cpu->flag_v = ~(a ^ value) & (a ^ (high << 4));
+        if (high > 0x09) high += 0x06;
+        cpu->flag_c = high > 0x0F;
+        cpu->reg.A = (uint8_t)((high << 4) | (low & 0x0F));
+        return;
+    }
 
-        cpu->reg.PC = cpu->addr_abs;
+    cpu->flag_c = tmp >> 8;
+    cpu->flag_v = ~(a ^ value) & (a ^ tmp);
+    cpu->reg.A = tmp & 0x00FF;
+    CPU_set_zn(cpu, cpu->reg.A);
+}
+
+// All flags come from the binary difference, also in decimal mode
+static inline void CPU_subtract(CPU *cpu, uint8_t value) {
+    uint8_t a = cpu->reg.A;
+    uint16_t carry = cpu->flag_c;
+    uint16_t inverted = value ^ 0x00FF;
+    uint16_t tmp = (uint16_t)a + inverted + carry;
+
+    cpu->flag_c = tmp >> 8;
+    cpu->flag_v = (tmp ^ a) & (tmp ^ inverted);
+    CPU_set_zn(cpu, tmp & 0x00FF);
+
+    if (cpu->decimal_mode && (cpu->reg.STATUS & CPU_FLAGS_D)) {
+        int16_t low = (a & 0x0F) - (value & 0x0F) - (1 - carry);
+        int16_t high = (a >> 4) - (value >> 4);
+        if (low & 0x10) {
+            low -= 0x06;
+            high -= 1;
+        }
+        if (high & 0x10) high -= 0x06;
+        cpu->reg.A = (uint8_t)(((high & 0x0F) << 4) | (low & 0x0F));
+        return;
     }
-    return 0;
+
+    cpu->reg.A = tmp & 0x00FF;
 }
-uint8_t CPU_BNE(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_Z) == 0) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
 
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
+static inline uint8_t CPU_shift_left(CPU *cpu, uint8_t value, bool carry_in) {
+    cpu->flag_c = value >> 7;
+    value = (uint8_t)(value << 1) | (carry_in ? 0x01 : 0x00);
+    CPU_set_zn(cpu, value);
+    return value;
+}
 
-        cpu->reg.PC = cpu->addr_abs;
-    }
-    return 0;
+static inline uint8_t CPU_shift_right(CPU *cpu, uint8_t value, bool carry_in) {
+    cpu->flag_c = value & 0x01;
+    value = (value >> 1) | (carry_in ? 0x80 : 0x00);
+    CPU_set_zn(cpu, value);
+    return value;
 }
-uint8_t CPU_BPL(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_N) == 0) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
 
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
+// B only exists on the stack, pulled values never set it and U always reads 1
+static inline void CPU_pull_status(CPU *cpu) {
+    CPU_set_status(cpu, (CPU_read_from_stack(cpu) & ~CPU_FLAGS_B) | CPU_FLAGS_U);
+}
 
-        cpu->reg.PC = cpu->addr_abs;
-    }
+CPU_DEFINE_OP(ADC) {
+    CPU_add(cpu, CPU_fetch_operand(cpu, implied));
+    return 1;
+}
+CPU_DEFINE_OP(AND) {
+    cpu->reg.A &= CPU_fetch_operand(cpu, implied);
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 1;
+}
+CPU_DEFINE_OP(ASL) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    CPU_write_result(cpu, implied, CPU_shift_left(cpu, value, false));
     return 0;
 }
-uint8_t CPU_BRK(CPU *cpu) {
-    printf("BRK!");
+CPU_DEFINE_OP(BCC) {
+    CPU_branch(cpu, !cpu->flag_c);
     return 0;
 }
-uint8_t CPU_BVC(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_V) == 0) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
-
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
-
-        cpu->reg.PC = cpu->addr_abs;
-    }
+CPU_DEFINE_OP(BCS) {
+    CPU_branch(cpu, cpu->flag_c);
     return 0;
 }
-uint8_t CPU_BVS(CPU *cpu) {
-    if (CPU_get_flag(cpu, CPU_FLAGS_V)) {
-        cpu->cycles += 1;
-        cpu->addr_abs = cpu->reg.PC + cpu->addr_rel;
-
-        if ((cpu->addr_abs & 0xFF00) != (cpu->reg.PC & 0xFF00)) cpu->cycles += 1;
-
-        cpu->reg.PC = cpu->addr_abs;
-    }
+CPU_DEFINE_OP(BEQ) {
+    CPU_branch(cpu, !cpu->flag_z);
     return 0;
 }
-uint8_t CPU_CLC(CPU *cpu) {
-    CPU_set_flag(cpu, CPU_FLAGS_C, false);
+CPU_DEFINE_OP(BIT) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    cpu->flag_z = cpu->reg.A & value;
+    cpu->flag_n = value;
+    cpu->flag_v = (uint8_t)(value << 1);
     return 0;
 }
-uint8_t CPU_CLD(CPU *cpu) {
-    CPU_set_flag(cpu, CPU_FLAGS_D, false);
+CPU_DEFINE_OP(BMI) {
+    CPU_branch(cpu, cpu->flag_n & 0x80);
     return 0;
 }
-uint8_t CPU_CLI(CPU *cpu) {
+CPU_DEFINE_OP(BNE) {
+    CPU_branch(cpu, cpu->flag_z);
     return 0;
 }
-uint8_t CPU_CLV(CPU *cpu) {
+CPU_DEFINE_OP(BPL) {
+    CPU_branch(cpu, !(cpu->flag_n & 0x80));
     return 0;
 }
-uint8_t CPU_CMP(CPU *cpu) {
+CPU_DEFINE_OP(BRK) {
+    // The IMM addressing mode already skipped the padding byte
+    CPU_write_to_stack(cpu, (cpu->reg.PC >> 8) & 0x00FF);
+    CPU_write_to_stack(cpu, cpu->reg.PC & 0x00FF);
+    CPU_write_to_stack(cpu, CPU_get_status(cpu) | CPU_FLAGS_B | CPU_FLAGS_U);
+    cpu->reg.STATUS |= CPU_FLAGS_I;
+
+    uint16_t low = CPU_bus_read(cpu, 0xFFFE);
+    uint16_t high = CPU_bus_read(cpu, 0xFFFF);
+    cpu->reg.PC = (high << 8) | low;
     return 0;
 }
-uint8_t CPU_CPX(CPU *cpu) {
+CPU_DEFINE_OP(BVC) {
+    CPU_branch(cpu, !(cpu->flag_v & 0x80));
     return 0;
 }
-uint8_t CPU_CPY(CPU *cpu) {
+CPU_DEFINE_OP(BVS) {
+    CPU_branch(cpu, cpu->flag_v & 0x80);
     return 0;
 }
-uint8_t CPU_DEC(CPU *cpu) {
+CPU_DEFINE_OP(CLC) {
+    cpu->flag_c = 0;
     return 0;
 }
-uint8_t CPU_DEX(CPU *cpu) {
+CPU_DEFINE_OP(CLD) {
+    cpu->reg.STATUS &= ~CPU_FLAGS_D;
     return 0;
 }
-uint8_t CPU_DEY(CPU *cpu) {
+CPU_DEFINE_OP(CLI) {
+    cpu->reg.STATUS &= ~CPU_FLAGS_I;
     return 0;
 }
-uint8_t CPU_EOR(CPU *cpu) {
+CPU_DEFINE_OP(CLV) {
+    cpu->flag_v = 0;
     return 0;
 }
-uint8_t CPU_INC(CPU *cpu) {
+CPU_DEFINE_OP(CMP) {
+    CPU_compare(cpu, cpu->reg.A, CPU_fetch_operand(cpu, implied));
+    return 1;
+}
+CPU_DEFINE_OP(CPX) {
+    CPU_compare(cpu, cpu->reg.X, CPU_fetch_operand(cpu, implied));
     return 0;
 }
-uint8_t CPU_INX(CPU *cpu) {
+CPU_DEFINE_OP(CPY) {
+    CPU_compare(cpu, cpu->reg.Y, CPU_fetch_operand(cpu, implied));
     return 0;
 }
-uint8_t CPU_INY(CPU *cpu) {
+CPU_DEFINE_OP(DEC) {
+    uint8_t value = CPU_fetch_operand(cpu, implied) - 1;
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    CPU_set_zn(cpu, value);
     return 0;
 }
-uint8_t CPU_JMP(CPU *cpu) {
+CPU_DEFINE_OP(DEX) {
+    cpu->reg.X -= 1;
+    CPU_set_zn(cpu, cpu->reg.X);
     return 0;
 }
-uint8_t CPU_JSR(CPU *cpu) {
+CPU_DEFINE_OP(DEY) {
+    cpu->reg.Y -= 1;
+    CPU_set_zn(cpu, cpu->reg.Y);
     return 0;
 }
-uint8_t CPU_LDA(CPU *cpu) {
+CPU_DEFINE_OP(EOR) {
+    cpu->reg.A ^= CPU_fetch_operand(cpu, implied);
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 1;
+}
+CPU_DEFINE_OP(INC) {
+    uint8_t value = CPU_fetch_operand(cpu, implied) + 1;
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    CPU_set_zn(cpu, value);
     return 0;
 }
-uint8_t CPU_LDX(CPU *cpu) {
+CPU_DEFINE_OP(INX) {
+    cpu->reg.X += 1;
+    CPU_set_zn(cpu, cpu->reg.X);
     return 0;
 }
-uint8_t CPU_LDY(CPU *cpu) {
+CPU_DEFINE_OP(INY) {
+    cpu->reg.Y += 1;
+    CPU_set_zn(cpu, cpu->reg.Y);
     return 0;
 }
-uint8_t CPU_LSR(CPU *cpu) {
+CPU_DEFINE_OP(JMP) {
+    cpu->reg.PC = cpu->addr_abs;
     return 0;
 }
-uint8_t CPU_NOP(CPU *cpu) {
+CPU_DEFINE_OP(JSR) {
+    // Pushes the address of the last byte of the instruction
+    cpu->reg.PC -= 1;
+    CPU_write_to_stack(cpu, (cpu->reg.PC >> 8) & 0x00FF);
+    CPU_write_to_stack(cpu, cpu->reg.PC & 0x00FF);
+    cpu->reg.PC = cpu->addr_abs;
     return 0;
 }
-uint8_t CPU_ORA(CPU *cpu) {
+CPU_DEFINE_OP(LDA) {
+    cpu->reg.A = CPU_fetch_operand(cpu, implied);
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 1;
+}
+CPU_DEFINE_OP(LDX) {
+    cpu->reg.X = CPU_fetch_operand(cpu, implied);
+    CPU_set_zn(cpu, cpu->reg.X);
+    return 1;
+}
+CPU_DEFINE_OP(LDY) {
+    cpu->reg.Y = CPU_fetch_operand(cpu, implied);
+    CPU_set_zn(cpu, cpu->reg.Y);
+    return 1;
+}
+CPU_DEFINE_OP(LSR) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    CPU_write_result(cpu, implied, CPU_shift_right(cpu, value, false));
     return 0;
 }
-uint8_t CPU_PHA(CPU *cpu) {
+CPU_DEFINE_OP(NOP) {
+    // Unofficial NOPs with an operand still perform the read
+    if (!implied) CPU_fetch_operand(cpu, implied);
+    return 1;
+}
+CPU_DEFINE_OP(ORA) {
+    cpu->reg.A |= CPU_fetch_operand(cpu, implied);
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 1;
+}
+CPU_DEFINE_OP(PHA) {
     // Push on stack
     CPU_write_to_stack(cpu, cpu->reg.A);
     return 0;
 }
-uint8_t CPU_PHP(CPU *cpu) {
+CPU_DEFINE_OP(PHP) {
+    CPU_write_to_stack(cpu, CPU_get_status(cpu) | CPU_FLAGS_B | CPU_FLAGS_U);
     return 0;
 }
-uint8_t CPU_PLA(CPU *cpu) {
+CPU_DEFINE_OP(PLA) {
     // Pop off stack
     cpu->reg.A = CPU_read_from_stack(cpu);
-    CPU_set_flag(cpu, CPU_FLAGS_Z, cpu->reg.A == 0x00);
-    CPU_set_flag(cpu, CPU_FLAGS_N, cpu->reg.A & 0x80);
+    CPU_set_zn(cpu, cpu->reg.A);
     return 0;
 }
-uint8_t CPU_PLP(CPU *cpu) {
+CPU_DEFINE_OP(PLP) {
+    CPU_pull_status(cpu);
     return 0;
 }
-uint8_t CPU_ROL(CPU *cpu) {
+CPU_DEFINE_OP(ROL) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    CPU_write_result(cpu, implied, CPU_shift_left(cpu, value, cpu->flag_c));
     return 0;
 }
-uint8_t CPU_ROR(CPU *cpu) {
+CPU_DEFINE_OP(ROR) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    CPU_write_result(cpu, implied, CPU_shift_right(cpu, value, cpu->flag_c));
     return 0;
 }
-uint8_t CPU_RTI(CPU *cpu) {
-    cpu->reg.STATUS = CPU_read_from_stack(cpu);
-    CPU_set_flag(cpu, CPU_FLAGS_B, false);
-    CPU_set_flag(cpu, CPU_FLAGS_U, false);
+CPU_DEFINE_OP(RTI) {
+    CPU_pull_status(cpu);
 
     cpu->reg.PC = CPU_read_from_stack(cpu);
     cpu->reg.PC |= CPU_read_from_stack(cpu) << 8;
 
     return 0;
 }
-uint8_t CPU_RTS(CPU *cpu) {
+CPU_DEFINE_OP(RTS) {
+    cpu->reg.PC = CPU_read_from_stack(cpu);
+    cpu->reg.PC |= CPU_read_from_stack(cpu) << 8;
+    cpu->reg.PC += 1;
     return 0;
 }
-uint8_t CPU_SBC(CPU *cpu) {
-    CPU_fetch(cpu);
-
-    uint16_t fetched_inv = ((uint16_t)cpu->fetched) ^ 0x00FF;
-
-    uint16_t tmp = (uint16_t)cpu->reg.A + fetched_inv + (uint16_t)CPU_get_flag(cpu, CPU_FLAGS_C);
-    CPU_set_flag(cpu, CPU_FLAGS_C, tmp & 0xFF00);
-    CPU_set_flag(cpu, CPU_FLAGS_Z, (tmp & 0x00FF) == 0);
-    CPU_set_flag(cpu, CPU_FLAGS_N, 0x0080);
-    CPU_set_flag(
-        cpu,
-        CPU_FLAGS_V,
-        (tmp ^ (uint16_t)cpu->reg.A) & (tmp ^ fetched_inv) & 0x0080);
-    cpu->reg.A = tmp & 0x00FF;
+CPU_DEFINE_OP(SBC) {
+    CPU_subtract(cpu, CPU_fetch_operand(cpu, implied));
+    return 1;
+}
+CPU_DEFINE_OP(SEC) {
+    cpu->flag_c = 1;
     return 0;
 }
-uint8_t CPU_SEC(CPU *cpu) {
+CPU_DEFINE_OP(SED) {
+    cpu->reg.STATUS |= CPU_FLAGS_D;
     return 0;
 }
-uint8_t CPU_SED(CPU *cpu) {
+CPU_DEFINE_OP(SEI) {
+    cpu->reg.STATUS |= CPU_FLAGS_I;
     return 0;
 }
-uint8_t CPU_SEI(CPU *cpu) {
+CPU_DEFINE_OP(STA) {
+    CPU_bus_write(cpu, cpu->addr_abs, cpu->reg.A);
     return 0;
 }
-uint8_t CPU_STA(CPU *cpu) {
+CPU_DEFINE_OP(STX) {
+    CPU_bus_write(cpu, cpu->addr_abs, cpu->reg.X);
     return 0;
 }
-uint8_t CPU_STX(CPU *cpu) {
+CPU_DEFINE_OP(STY) {
+    CPU_bus_write(cpu, cpu->addr_abs, cpu->reg.Y);
     return 0;
 }
-uint8_t CPU_STY(CPU *cpu) {
+CPU_DEFINE_OP(TAX) {
+    cpu->reg.X = cpu->reg.A;
+    CPU_set_zn(cpu, cpu->reg.X);
     return 0;
 }
-uint8_t CPU_TAX(CPU *cpu) {
+CPU_DEFINE_OP(TAY) {
+    cpu->reg.Y = cpu->reg.A;
+    CPU_set_zn(cpu, cpu->reg.Y);
     return 0;
 }
-uint8_t CPU_TAY(CPU *cpu) {
+CPU_DEFINE_OP(TSX) {
+    cpu->reg.X = cpu->reg.SP;
+    CPU_set_zn(cpu, cpu->reg.X);
     return 0;
 }
-uint8_t CPU_TSX(CPU *cpu) {
+CPU_DEFINE_OP(TXA) {
+    cpu->reg.A = cpu->reg.X;
+    CPU_set_zn(cpu, cpu->reg.A);
     return 0;
 }
-uint8_t CPU_TXA(CPU *cpu) {
+CPU_DEFINE_OP(TXS) {
+    cpu->reg.SP = cpu->reg.X;
     return 0;
 }
-uint8_t CPU_TXS(CPU *cpu) {
+CPU_DEFINE_OP(TYA) {
+    cpu->reg.A = cpu->reg.Y;
+    CPU_set_zn(cpu, cpu->reg.A);
     return 0;
 }
-uint8_t CPU_TYA(CPU *cpu) {
+
+// Stable unofficial opcodes, used by a number of games and by nestest
+CPU_DEFINE_OP(LAX) {
+    cpu->reg.A = CPU_fetch_operand(cpu, implied);
+    cpu->reg.X = cpu->reg.A;
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 1;
+}
+CPU_DEFINE_OP(SAX) {
+    CPU_bus_write(cpu, cpu->addr_abs, cpu->reg.A & cpu->reg.X);
+    return 0;
+}
+CPU_DEFINE_OP(DCP) {
+    uint8_t value = CPU_fetch_operand(cpu, implied) - 1;
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    CPU_compare(cpu, cpu->reg.A, value);
+    return 0;
+}
+CPU_DEFINE_OP(ISB) {
+    uint8_t value = CPU_fetch_operand(cpu, implied) + 1;
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    CPU_subtract(cpu, value);
     return 0;
 }
-uint8_t CPU_XXX(CPU *cpu) {
+CPU_DEFINE_OP(SLO) {
+    uint8_t value = CPU_shift_left(cpu, CPU_fetch_operand(cpu, implied), false);
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    cpu->reg.A |= value;
+    CPU_set_zn(cpu, cpu->reg.A);
     return 0;
 }
+CPU_DEFINE_OP(RLA) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    value = CPU_shift_left(cpu, value, cpu->flag_c);
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    cpu->reg.A &= value;
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 0;
+}
+CPU_DEFINE_OP(SRE) {
+    uint8_t value = CPU_shift_right(cpu, CPU_fetch_operand(cpu, implied), false);
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    cpu->reg.A ^= value;
+    CPU_set_zn(cpu, cpu->reg.A);
+    return 0;
+}
+CPU_DEFINE_OP(RRA) {
+    uint8_t value = CPU_fetch_operand(cpu, implied);
+    value = CPU_shift_right(cpu, value, cpu->flag_c);
+    CPU_bus_write(cpu, cpu->addr_abs, value);
+    CPU_add(cpu, value);
+    return 0;
+}
+
+// Jams and unstable opcodes, executed as NOPs
+CPU_DEFINE_OP(XXX) {
+    return 0;
+}
+
+// Dispatch engine, one fused handler per opcode generated from
+// CPU_OP_CODE_LIST with the addressing mode and operation inlined into a single
+// switch case. Whether an operand is implied is known per case at compile time.
+#define CPU_AM_IMPLIED_IMP true
+#define CPU_AM_IMPLIED_ZP0 false
+#define CPU_AM_IMPLIED_ZPY false
+#define CPU_AM_IMPLIED_ABS false
+#define CPU_AM_IMPLIED_ABY false
+#define CPU_AM_IMPLIED_IZX false
+#define CPU_AM_IMPLIED_IMM false
+#define CPU_AM_IMPLIED_ZPX false
+#define CPU_AM_IMPLIED_REL false
+#define CPU_AM_IMPLIED_ABX false
+#define CPU_AM_IMPLIED_IND false
+#define CPU_AM_IMPLIED_IZY false
+
+#define CPU_FUSED_HANDLER(code, op, am, cyc)                                 \
+    case code: {                                                             \
+        cpu->cycles = cyc;                                                   \
+        uint8_t cycle_add1 = CPU_AM_##am(cpu);                               \
+        uint8_t cycle_add2 = CPU_##op##_impl(cpu, CPU_AM_IMPLIED_##am);      \
+        cpu->cycles += (cycle_add1 & cycle_add2);                            \
+        break;                                                               \
+    }
+
+static inline uint16_t CPU_execute(CPU *cpu) {
+    cpu->opcode = CPU_bus_read_pc(cpu);
+
+    switch (cpu->opcode) {
+        CPU_OP_CODE_LIST(CPU_FUSED_HANDLER)
+    }
+
+    return cpu->cycles;
+}
+
+// Block cache
+// Every opcode gets a handler that runs the fused operation on a pre-decoded
+// operand, the decoder strings them together into blocks that CPU_step walks
+// one instruction at a time without fetching or decoding anything.
+
+#define CPU_BLOCK_HANDLER(code, op, am, cyc)                                 \
+    static uint16_t CPU_block_##code(CPU *cpu, const BLOCK_INSN *insn) {     \
+        cpu->opcode = code;                                                  \
+        cpu->reg.PC = insn->next_pc;                                         \
+        cpu->cycles = cyc;                                                   \
+        uint8_t cycle_add1 = CPU_resolve_##am(cpu, insn->operand);           \
+        uint8_t cycle_add2 = CPU_##op##_impl(cpu, CPU_AM_IMPLIED_##am);      \
+        cpu->cycles += (cycle_add1 & cycle_add2);                            \
+        return cpu->cycles;                                                  \
+    }
+
+CPU_OP_CODE_LIST(CPU_BLOCK_HANDLER)
+
+// clang-format off
+#define CPU_BLOCK_HANDLER_ENTRY(code, op, am, cyc) [code] = CPU_block_##code,
+static const BLOCK_HandlerFunc CPU_BLOCK_HANDLERS[256] = {CPU_OP_CODE_LIST(CPU_BLOCK_HANDLER_ENTRY)};
+// clang-format on
+
+static size_t CPU_operand_size(CPU_AMFunc am) {
+    if (am == CPU_AM_IMP) return 0;
+    if (am == CPU_AM_ABS || am == CPU_AM_ABX || am == CPU_AM_ABY || am == CPU_AM_IND) return 2;
+    return 1;
+}
+
+// Unconditional control flow. Blocks run on past branches, a taken one simply
+// leaves the block as the next PC no longer matches.
+static bool CPU_ends_block(const OP_CODE_MATRIX_ENTRY *entry) {
+    return entry->op == CPU_JMP || entry->op == CPU_JSR || entry->op == CPU_RTS ||
+           entry->op == CPU_RTI || entry->op == CPU_BRK;
+}
+
+// Decodes the run starting at pc into block, which is left empty when not even
+// the first instruction lies wholly in plain memory
+static void CPU_decode_block(CPU *cpu, BLOCK *block, uint16_t pc) {
+    const BUS_PAGE *page = &cpu->bus->pages[pc >> 8];
+    block->pc = pc;
+    block->count = 0;
+    block->generation = page->generation;
+    block->decoded_generation = *page->generation;
+    if (!page->read) return;
+
+    size_t offset = pc & 0xFF;
+    while (block->count < BLOCK_MAX_INSNS) {
+        const uint8_t *mem = page->read + offset;
+        const OP_CODE_MATRIX_ENTRY *entry = &OP_CODE_MATRIX[mem[0]];
+        size_t operand_size = CPU_operand_size(entry->am);
+        if (offset + 1 + operand_size > BUS_PAGE_SIZE) break;
+
+        BLOCK_INSN *insn = &block->insns[block->count++];
+        insn->handler = CPU_BLOCK_HANDLERS[mem[0]];
+        insn->pc = (pc & 0xFF00) | offset;
+        insn->next_pc = insn->pc + 1 + operand_size;
+        insn->opcode = mem[0];
+        insn->last = false;
+        if (entry->am == CPU_AM_IMM) {
+            insn->operand = insn->pc + 1;
+        } else if (entry->am == CPU_AM_REL) {
+            insn->operand = CPU_sign_extend(mem[1]);
+        } else if (operand_size == 2) {
+            insn->operand = mem[1] | (mem[2] << 8);
+        } else {
+            insn->operand = operand_size ? mem[1] : 0;
+        }
+
+        offset += 1 + operand_size;
+        if (CPU_ends_block(entry) || offset == BUS_PAGE_SIZE) break;
+    }
+    if (block->count) block->insns[block->count - 1].last = true;
+}
+
+// Out of line like the instrumented path, CPU_step only inlines the cursor check
+__attribute__((noinline)) static const BLOCK_INSN *CPU_enter_block(CPU *cpu) {
+    BLOCK_CACHE *cache = cpu->block_cache;
+    uint16_t pc = cpu->reg.PC;
+    BLOCK *block = BLOCK_CACHE_slot(cache, pc);
+
+    cache->lookups += 1;
+    if (!block->count || block->pc != pc || !BLOCK_valid(block)) {
+        cache->decodes += 1;
+        CPU_decode_block(cpu, block, pc);
+        if (!block->count) return NULL;
+    }
+    cpu->block = block;
+    return block->insns;
+}
+
+// Follows the current block as long as execution does, a jump elsewhere, an
+// interrupt or a write to the block's page sends it back to the cache
+static inline uint16_t CPU_execute_cached(CPU *cpu) {
+    const BLOCK_INSN *insn = cpu->next_insn;
+    if (!insn || insn->pc != cpu->reg.PC || !BLOCK_valid(cpu->block)) {
+        insn = CPU_enter_block(cpu);
+        if (!insn) {
+            cpu->next_insn = NULL;
+            return CPU_execute(cpu);
+        }
+    }
+    cpu->next_insn = insn->last ? NULL : insn + 1;
+    return insn->handler(cpu, insn);
+}
+
+// Polling loops
+// Per operation: 0 never in a polling loop (stores, stack, I flag, jams), 1
+// always, 2 only on the accumulator (read-modify-write), 3 jumps
+#define CPU_POLL_ADC 1
+#define CPU_POLL_AND 1
+#define CPU_POLL_ASL 2
+#define CPU_POLL_BCC 1
+#define CPU_POLL_BCS 1
+#define CPU_POLL_BEQ 1
+#define CPU_POLL_BIT 1
+#define CPU_POLL_BMI 1
+#define CPU_POLL_BNE 1
+#define CPU_POLL_BPL 1
+#define CPU_POLL_BRK 0
+#define CPU_POLL_BVC 1
+#define CPU_POLL_BVS 1
+#define CPU_POLL_CLC 1
+#define CPU_POLL_CLD 1
+#define CPU_POLL_CLI 0
+#define CPU_POLL_CLV 1
+#define CPU_POLL_CMP 1
+#define CPU_POLL_CPX 1
+#define CPU_POLL_CPY 1
+#define CPU_POLL_DCP 2
+#define CPU_POLL_DEC 2
+#define CPU_POLL_DEX 1
+#define CPU_POLL_DEY 1
+#define CPU_POLL_EOR 1
+#define CPU_POLL_INC 2
+#define CPU_POLL_INX 1
+#define CPU_POLL_INY 1
+#define CPU_POLL_ISB 2
+#define CPU_POLL_JMP 3
+#define CPU_POLL_JSR 0
+#define CPU_POLL_LAX 1
+#define CPU_POLL_LDA 1
+#define CPU_POLL_LDX 1
+#define CPU_POLL_LDY 1
+#define CPU_POLL_LSR 2
+#define CPU_POLL_NOP 1
+#define CPU_POLL_ORA 1
+#define CPU_POLL_PHA 0
+#define CPU_POLL_PHP 0
+#define CPU_POLL_PLA 0
+#define CPU_POLL_PLP 0
+#define CPU_POLL_RLA 2
+#define CPU_POLL_ROL 2
+#define CPU_POLL_ROR 2
+#define CPU_POLL_RRA 2
+#define CPU_POLL_RTI 0
+#define CPU_POLL_RTS 0
+#define CPU_POLL_SAX 0
+#define CPU_POLL_SBC 1
+#define CPU_POLL_SEC 1
+#define CPU_POLL_SED 1
+#define CPU_POLL_SEI 0
+#define CPU_POLL_SLO 2
+#define CPU_POLL_SRE 2
+#define CPU_POLL_STA 0
+#define CPU_POLL_STX 0
+#define CPU_POLL_STY 0
+#define CPU_POLL_TAX 1
+#define CPU_POLL_TAY 1
+#define CPU_POLL_TSX 1
+#define CPU_POLL_TXA 1
+#define CPU_POLL_TXS 0
+#define CPU_POLL_TYA 1
+#define CPU_POLL_XXX 0
+
+// Instruction bytes per addressing mode, CPU_POLL_FLOW marks branches
+#define CPU_POLL_FLOW 0x80
+#define CPU_POLL_BYTES_IMP 1
+#define CPU_POLL_BYTES_ZP0 2
+#define CPU_POLL_BYTES_ZPY 2
+#define CPU_POLL_BYTES_ABS 3
+#define CPU_POLL_BYTES_ABY 3
+#define CPU_POLL_BYTES_IZX 2
+#define CPU_POLL_BYTES_IMM 2
+#define CPU_POLL_BYTES_ZPX 2
+#define CPU_POLL_BYTES_REL (2 | CPU_POLL_FLOW)
+#define CPU_POLL_BYTES_ABX 3
+#define CPU_POLL_BYTES_IND 3
+#define CPU_POLL_BYTES_IZY 2
+
+// Bytes of every instruction that may be part of a polling loop plus
+// CPU_POLL_FLOW for branches and jumps, 0 for the others
+// clang-format off
+#define CPU_POLL_ENTRY(code, op, am, cyc)                                                              \
+    [code] = (CPU_POLL_##op == 1 || CPU_POLL_##op == 3 || (CPU_POLL_##op == 2 && CPU_AM_IMPLIED_##am)) \
+                 ? CPU_POLL_BYTES_##am | (CPU_POLL_##op == 3 ? CPU_POLL_FLOW : 0)                      \
+                 : 0,
+static const uint8_t CPU_POLL_INFO[256] = {CPU_OP_CODE_LIST(CPU_POLL_ENTRY)};
+// clang-format on
+
+bool CPU_poll_safe(uint8_t opcode) {
+    return CPU_POLL_INFO[opcode] != 0;
+}
+
+// Instruction bytes at pc when they lie wholly in plain memory, else NULL
+static const uint8_t *CPU_code_at(const CPU *cpu, uint16_t pc) {
+    const uint8_t *mem = cpu->bus->pages[pc >> 8].read;
+    if (!mem || (pc & 0xFF) > BUS_PAGE_SIZE - 3) return NULL;
+    return mem + (pc & 0xFF);
+}
+
+bool CPU_at_poll_loop(const CPU *cpu) {
+    // Forward from PC to the branch or jump back to it
+    uint16_t pc = cpu->reg.PC, start = 0;
+    bool found = false;
+    for (size_t i = 0; i < CPU_POLL_LOOP_MAX_INSNS && !found; i++) {
+        const uint8_t *mem = CPU_code_at(cpu, pc);
+        uint8_t info = mem ? CPU_POLL_INFO[mem[0]] : 0;
+        if (!info) return false;
+
+        uint16_t next = pc + (info & ~CPU_POLL_FLOW);
+        if (info & CPU_POLL_FLOW) {
+            if (OP_CODE_MATRIX[mem[0]].am == CPU_AM_REL) {
+                start = next + CPU_sign_extend(mem[1]);
+            } else if (OP_CODE_MATRIX[mem[0]].am == CPU_AM_ABS) {
+                next = start = mem[1] | (mem[2] << 8);
+            } else {
+                return false;
+            }
+            found = start <= cpu->reg.PC && cpu->reg.PC - start <= CPU_POLL_LOOP_MAX_BYTES;
+        }
+        pc = next;
+    }
+    if (!found) return false;
+
+    // and the rest of the loop, from where it starts up to PC
+    for (pc = start; pc < cpu->reg.PC;) {
+        const uint8_t *mem = CPU_code_at(cpu, pc);
+        uint8_t info = mem ? CPU_POLL_INFO[mem[0]] : 0;
+        if (!info || ((info & CPU_POLL_FLOW) && OP_CODE_MATRIX[mem[0]].am != CPU_AM_REL)) return false;
+        pc += info & ~CPU_POLL_FLOW;
+    }
+    return pc == cpu->reg.PC;
+}
@@ -1,7 +1,13 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <BLOCK.h>
 #include <BUS.h>
+#include <CALLGRAPH.h>
+#include <JIT.h>
+#include <PROFILE.h>
+#include <STATE.h>
+#include <TRACE.h>
 #include <UTIL.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -21,41 +27,127 @@ typedef enum {
     CPU_FLAGS_N = (1 << 7)  // Negative
 } CPU_FLAGS;
 
+// Level triggered IRQ sources, the CPU sees the OR of all of them
+typedef enum {
+    CPU_IRQ_APU = (1 << 0),    // frame counter and DMC
+    CPU_IRQ_MAPPER = (1 << 1), // cartridge
+} CPU_IRQ_SOURCE;
+
+#define CPU_FLAGS_LAZY (CPU_FLAGS_N | CPU_FLAGS_Z | CPU_FLAGS_C | CPU_FLAGS_V)
+
 typedef struct {
     uint8_t A;
     uint8_t X;
     uint8_t Y;
     uint8_t SP;
-    uint8_t PC;
-    uint8_t STATUS;
+    uint16_t PC;
+    uint8_t STATUS; // without the CPU_FLAGS_LAZY bits, see CPU_get_status
 } REG;
 
-typedef struct {
+// Everything from reg on is plain state and saved as one block
+typedef struct CPU {
     BUS *bus;
+    bool decimal_mode; // NMOS BCD arithmetic, the 2A03 has it wired off
+    bool instrumented; // trace, profile or call graph attached, see CPU_step
+    TRACE *trace;
+    PROFILE *profile;
+    CALLGRAPH *callgraph;
+    BLOCK_CACHE *block_cache;
+    BLOCK *block;               // block of next_insn
+    const BLOCK_INSN *next_insn; // the instruction following the last one executed from a block
+    JIT *jit;
     REG reg;
+    // N, Z, C and V are evaluated lazily, instructions only store what they
+    // follow from and the status register is put together when it is read
+    uint8_t flag_n; // bit 7 is N
+    uint8_t flag_z; // zero when Z is set
+    uint8_t flag_c; // 0 or 1
+    uint8_t flag_v; // bit 7 is V
     size_t clock_counter;
     uint8_t fetched;
     uint16_t addr_abs;
     uint16_t addr_rel; // Relative address for jump instr.
     uint8_t opcode;
-    uint8_t cycles; // cylcles remaining for current instruction
+    uint16_t cycles;   // cylcles remaining for current instruction
+    size_t run_end;    // clock_counter value at which CPU_run returns
+    bool nmi_pending;  // edge latched by CPU_nmi
+    uint8_t irq_lines; // CPU_IRQ_SOURCE bits asserted
 } CPU;
 
 void CPU_init(CPU *cpu, BUS *bus);
 
+// The whole status register, use these instead of reg.STATUS
+static inline uint8_t CPU_get_status(const CPU *cpu) {
+    return cpu->reg.STATUS | (cpu->flag_n & CPU_FLAGS_N) | (cpu->flag_z ? 0 : CPU_FLAGS_Z) | cpu->flag_c |
+           ((cpu->flag_v >> 1) & CPU_FLAGS_V);
+}
+
+static inline void CPU_set_status(CPU *cpu, uint8_t status) {
+    cpu->reg.STATUS = status & ~CPU_FLAGS_LAZY;
+    cpu->flag_n = status;
+    cpu->flag_z = ~status & CPU_FLAGS_Z;
+    cpu->flag_c = status & CPU_FLAGS_C;
+    cpu->flag_v = (uint8_t)(status << 1);
+}
+
 uint8_t CPU_read(CPU *cpu, uint16_t addr);
 void CPU_write(CPU *cpu, uint16_t addr, uint8_t data);
 uint8_t CPU_get_flag(CPU *cpu, CPU_FLAGS flag);
-void CPU_set_flag(CPU *cpu, CPU_FLAGS flag);
-void CPU_unset_flag(CPU *cpu, CPU_FLAGS flag);
+void CPU_set_flag(CPU *cpu, CPU_FLAGS flag, bool activate);
 void CPU_print_registers(CPU *cpu);
-void CPU_read_pc(CPU *cpu);
+uint8_t CPU_read_pc(CPU *cpu);
+
+// Executes one whole instruction (plus any cycles still pending from reset or
+// a partially clocked instruction, and an interrupt taken before it), returns
+// the cycles used
+size_t CPU_step(CPU *cpu);
+// Like CPU_step, but with a JIT attached runs a whole compiled block instead
+// when it is sure to end by cycle deadline
+size_t CPU_step_until(CPU *cpu, size_t deadline);
+// Executes whole instructions until at least cycle_budget cycles have passed
+// or CPU_end_run was called, returns the exact number of cycles consumed
+size_t CPU_run(CPU *cpu, size_t cycle_budget);
+// Makes a running CPU_run return after the current instruction
+void CPU_end_run(CPU *cpu);
+// Adds cycles the CPU is halted for (e.g. OAM DMA) to the current instruction
+void CPU_stall(CPU *cpu, uint16_t cycles);
+// Per cycle compatibility wrapper, executes the instruction on its first cycle
 void CPU_clock(CPU *cpu);
 
+// Attach (or with NULL detach) an execution trace, profile or call graph. A
+// profile routes the CPU's memory accesses through its counting bus while
+// attached, a call graph starts over with the current PC as its root.
+void CPU_set_trace(CPU *cpu, TRACE *trace);
+void CPU_set_profile(CPU *cpu, PROFILE *profile);
+void CPU_set_callgraph(CPU *cpu, CALLGRAPH *callgraph);
+// Attach (or with NULL detach) a decoded block cache, which is flushed. Code from
+// plain memory then runs from pre-decoded blocks, anything else and all
+// instrumented execution still goes through the interpreter.
+void CPU_set_block_cache(CPU *cpu, BLOCK_CACHE *cache);
+// Attach (or with NULL detach) a recompiler, which is flushed. It is only used
+// by CPU_step_until and never while instrumented.
+void CPU_set_jit(CPU *cpu, JIT *jit);
+
+// Polling loops: a few instructions through PC that at most read memory and
+// branch back. Another pass leaves the machine as it was unless what the loop
+// reads changed, see NES_run_frame.
+#define CPU_POLL_LOOP_MAX_INSNS 8
+#define CPU_POLL_LOOP_MAX_BYTES 32
+// No stores, read-modify-write on memory, stack accesses or I flag changes
+bool CPU_poll_safe(uint8_t opcode);
+// Whether the code from PC on looks like such a loop, nothing is executed
+bool CPU_at_poll_loop(const CPU *cpu);
+
+void CPU_save_state(const CPU *cpu, STATE *state);
+void CPU_load_state(CPU *cpu, STATE *state);
+
 void CPU_reset(CPU *cpu);
-void CPU_irq(CPU *cpu);
+// Interrupt lines, both are looked at before every instruction. An NMI edge
+// stays latched until it is taken, an IRQ source is taken whenever I is clear
+// for as long as it is asserted.
+void CPU_set_irq(CPU *cpu, CPU_IRQ_SOURCE source, bool asserted);
 void CPU_nmi(CPU *cpu);
-void CPU_fetch(CPU *cpu);
+uint8_t CPU_fetch(CPU *cpu);
 
 // Addressing mode functions
 uint8_t CPU_AM_IMP(CPU *cpu);
@@ -131,6 +223,16 @@ uint8_t CPU_TXS(CPU *cpu);
 uint8_t CPU_TYA(CPU *cpu);
 uint8_t CPU_XXX(CPU *cpu);
 
+// Stable unofficial opcodes
+uint8_t CPU_LAX(CPU *cpu);
+uint8_t CPU_SAX(CPU *cpu);
+uint8_t CPU_DCP(CPU *cpu);
+uint8_t CPU_ISB(CPU *cpu);
+uint8_t CPU_SLO(CPU *cpu);
+uint8_t CPU_RLA(CPU *cpu);
+uint8_t CPU_SRE(CPU *cpu);
+uint8_t CPU_RRA(CPU *cpu);
+
 typedef uint8_t (*CPU_OpFunc)(CPU *cpu);
 typedef uint8_t (*CPU_AMFunc)(CPU *cpu);
 
@@ -138,26 +240,36 @@ typedef struct {
     CPU_OpFunc op;
     CPU_AMFunc am;
     uint8_t cycles;
+    const char *name;
+    const char *am_name;
 } OP_CODE_MATRIX_ENTRY;
 
+// Single source of truth for the instruction set, X(opcode, op, am, cycles)
+// expands once per opcode. OP_CODE_MATRIX and the fused handlers in CPU.c are
+// both generated from it.
 // clang-format off
+#define CPU_OP_CODE_LIST(X) \
+    X(0x00, BRK, IMM, 7) X(0x01, ORA, IZX, 6) X(0x02, XXX, IMP, 2) X(0x03, SLO, IZX, 8) X(0x04, NOP, ZP0, 3) X(0x05, ORA, ZP0, 3) X(0x06, ASL, ZP0, 5) X(0x07, SLO, ZP0, 5) X(0x08, PHP, IMP, 3) X(0x09, ORA, IMM, 2) X(0x0A, ASL, IMP, 2) X(0x0B, XXX, IMP, 2) X(0x0C, NOP, ABS, 4) X(0x0D, ORA, ABS, 4) X(0x0E, ASL, ABS, 6) X(0x0F, SLO, ABS, 6) \
+    X(0x10, BPL, REL, 2) X(0x11, ORA, IZY, 5) X(0x12, XXX, IMP, 2) X(0x13, SLO, IZY, 8) X(0x14, NOP, ZPX, 4) X(0x15, ORA, ZPX, 4) X(0x16, ASL, ZPX, 6) X(0x17, SLO, ZPX, 6) X(0x18, CLC, IMP, 2) X(0x19, ORA, ABY, 4) X(0x1A, NOP, IMP, 2) X(0x1B, SLO, ABY, 7) X(0x1C, NOP, ABX, 4) X(0x1D, ORA, ABX, 4) X(0x1E, ASL, ABX, 7) X(0x1F, SLO, ABX, 7) \
+    X(0x20, JSR, ABS, 6) X(0x21, AND, IZX, 6) X(0x22, XXX, IMP, 2) X(0x23, RLA, IZX, 8) X(0x24, BIT, ZP0, 3) X(0x25, AND, ZP0, 3) X(0x26, ROL, ZP0, 5) X(0x27, RLA, ZP0, 5) X(0x28, PLP, IMP, 4) X(0x29, AND, IMM, 2) X(0x2A, ROL, IMP, 2) X(0x2B, XXX, IMP, 2) X(0x2C, BIT, ABS, 4) X(0x2D, AND, ABS, 4) X(0x2E, ROL, ABS, 6) X(0x2F, RLA, ABS, 6) \
+    X(0x30, BMI, REL, 2) X(0x31, AND, IZY, 5) X(0x32, XXX, IMP, 2) X(0x33, RLA, IZY, 8) X(0x34, NOP, ZPX, 4) X(0x35, AND, ZPX, 4) X(0x36, ROL, ZPX, 6) X(0x37, RLA, ZPX, 6) X(0x38, SEC, IMP, 2) X(0x39, AND, ABY, 4) X(0x3A, NOP, IMP, 2) X(0x3B, RLA, ABY, 7) X(0x3C, NOP, ABX, 4) X(0x3D, AND, ABX, 4) X(0x3E, ROL, ABX, 7) X(0x3F, RLA, ABX, 7) \
+    X(0x40, RTI, IMP, 6) X(0x41, EOR, IZX, 6) X(0x42, XXX, IMP, 2) X(0x43, SRE, IZX, 8) X(0x44, NOP, ZP0, 3) X(0x45, EOR, ZP0, 3) X(0x46, LSR, ZP0, 5) X(0x47, SRE, ZP0, 5) X(0x48, PHA, IMP, 3) X(0x49, EOR, IMM, 2) X(0x4A, LSR, IMP, 2) X(0x4B, XXX, IMP, 2) X(0x4C, JMP, ABS, 3) X(0x4D, EOR, ABS, 4) X(0x4E, LSR, ABS, 6) X(0x4F, SRE, ABS, 6) \
+    X(0x50, BVC, REL, 2) X(0x51, EOR, IZY, 5) X(0x52, XXX, IMP, 2) X(0x53, SRE, IZY, 8) X(0x54, NOP, ZPX, 4) X(0x55, EOR, ZPX, 4) X(0x56, LSR, ZPX, 6) X(0x57, SRE, ZPX, 6) X(0x58, CLI, IMP, 2) X(0x59, EOR, ABY, 4) X(0x5A, NOP, IMP, 2) X(0x5B, SRE, ABY, 7) X(0x5C, NOP, ABX, 4) X(0x5D, EOR, ABX, 4) X(0x5E, LSR, ABX, 7) X(0x5F, SRE, ABX, 7) \
+    X(0x60, RTS, IMP, 6) X(0x61, ADC, IZX, 6) X(0x62, XXX, IMP, 2) X(0x63, RRA, IZX, 8) X(0x64, NOP, ZP0, 3) X(0x65, ADC, ZP0, 3) X(0x66, ROR, ZP0, 5) X(0x67, RRA, ZP0, 5) X(0x68, PLA, IMP, 4) X(0x69, ADC, IMM, 2) X(0x6A, ROR, IMP, 2) X(0x6B, XXX, IMP, 2) X(0x6C, JMP, IND, 5) X(0x6D, ADC, ABS, 4) X(0x6E, ROR, ABS, 6) X(0x6F, RRA, ABS, 6) \
+    X(0x70, BVS, REL, 2) X(0x71, ADC, IZY, 5) X(0x72, XXX, IMP, 2) X(0x73, RRA, IZY, 8) X(0x74, NOP, ZPX, 4) X(0x75, ADC, ZPX, 4) X(0x76, ROR, ZPX, 6) X(0x77, RRA, ZPX, 6) X(0x78, SEI, IMP, 2) X(0x79, ADC, ABY, 4) X(0x7A, NOP, IMP, 2) X(0x7B, RRA, ABY, 7) X(0x7C, NOP, ABX, 4) X(0x7D, ADC, ABX, 4) X(0x7E, ROR, ABX, 7) X(0x7F, RRA, ABX, 7) \
+    X(0x80, NOP, IMM, 2) X(0x81, STA, IZX, 6) X(0x82, NOP, IMM, 2) X(0x83, SAX, IZX, 6) X(0x84, STY, ZP0, 3) X(0x85, STA, ZP0, 3) X(0x86, STX, ZP0, 3) X(0x87, SAX, ZP0, 3) X(0x88, DEY, IMP, 2) X(0x89, NOP, IMM, 2) X(0x8A, TXA, IMP, 2) X(0x8B, XXX, IMP, 2) X(0x8C, STY, ABS, 4) X(0x8D, STA, ABS, 4) X(0x8E, STX, ABS, 4) X(0x8F, SAX, ABS, 4) \
+    X(0x90, BCC, REL, 2) X(0x91, STA, IZY, 6) X(0x92, XXX, IMP, 2) X(0x93, XXX, IMP, 6) X(0x94, STY, ZPX, 4) X(0x95, STA, ZPX, 4) X(0x96, STX, ZPY, 4) X(0x97, SAX, ZPY, 4) X(0x98, TYA, IMP, 2) X(0x99, STA, ABY, 5) X(0x9A, TXS, IMP, 2) X(0x9B, XXX, IMP, 5) X(0x9C, NOP, IMP, 5) X(0x9D, STA, ABX, 5) X(0x9E, XXX, IMP, 5) X(0x9F, XXX, IMP, 5) \
+    X(0xA0, LDY, IMM, 2) X(0xA1, LDA, IZX, 6) X(0xA2, LDX, IMM, 2) X(0xA3, LAX, IZX, 6) X(0xA4, LDY, ZP0, 3) X(0xA5, LDA, ZP0, 3) X(0xA6, LDX, ZP0, 3) X(0xA7, LAX, ZP0, 3) X(0xA8, TAY, IMP, 2) X(0xA9, LDA, IMM, 2) X(0xAA, TAX, IMP, 2) X(0xAB, XXX, IMP, 2) X(0xAC, LDY, ABS, 4) X(0xAD, LDA, ABS, 4) X(0xAE, LDX, ABS, 4) X(0xAF, LAX, ABS, 4) \
+    X(0xB0, BCS, REL, 2) X(0xB1, LDA, IZY, 5) X(0xB2, XXX, IMP, 2) X(0xB3, LAX, IZY, 5) X(0xB4, LDY, ZPX, 4) X(0xB5, LDA, ZPX, 4) X(0xB6, LDX, ZPY, 4) X(0xB7, LAX, ZPY, 4) X(0xB8, CLV, IMP, 2) X(0xB9, LDA, ABY, 4) X(0xBA, TSX, IMP, 2) X(0xBB, XXX, IMP, 4) X(0xBC, LDY, ABX, 4) X(0xBD, LDA, ABX, 4) X(0xBE, LDX, ABY, 4) X(0xBF, LAX, ABY, 4) \
+    X(0xC0, CPY, IMM, 2) X(0xC1, CMP, IZX, 6) X(0xC2, NOP, IMM, 2) X(0xC3, DCP, IZX, 8) X(0xC4, CPY, ZP0, 3) X(0xC5, CMP, ZP0, 3) X(0xC6, DEC, ZP0, 5) X(0xC7, DCP, ZP0, 5) X(0xC8, INY, IMP, 2) X(0xC9, CMP, IMM, 2) X(0xCA, DEX, IMP, 2) X(0xCB, XXX, IMP, 2) X(0xCC, CPY, ABS, 4) X(0xCD, CMP, ABS, 4) X(0xCE, DEC, ABS, 6) X(0xCF, DCP, ABS, 6) \
+    X(0xD0, BNE, REL, 2) X(0xD1, CMP, IZY, 5) X(0xD2, XXX, IMP, 2) X(0xD3, DCP, IZY, 8) X(0xD4, NOP, ZPX, 4) X(0xD5, CMP, ZPX, 4) X(0xD6, DEC, ZPX, 6) X(0xD7, DCP, ZPX, 6) X(0xD8, CLD, IMP, 2) X(0xD9, CMP, ABY, 4) X(0xDA, NOP, IMP, 2) X(0xDB, DCP, ABY, 7) X(0xDC, NOP, ABX, 4) X(0xDD, CMP, ABX, 4) X(0xDE, DEC, ABX, 7) X(0xDF, DCP, ABX, 7) \
+    X(0xE0, CPX, IMM, 2) X(0xE1, SBC, IZX, 6) X(0xE2, NOP, IMM, 2) X(0xE3, ISB, IZX, 8) X(0xE4, CPX, ZP0, 3) X(0xE5, SBC, ZP0, 3) X(0xE6, INC, ZP0, 5) X(0xE7, ISB, ZP0, 5) X(0xE8, INX, IMP, 2) X(0xE9, SBC, IMM, 2) X(0xEA, NOP, IMP, 2) X(0xEB, SBC, IMM, 2) X(0xEC, CPX, ABS, 4) X(0xED, SBC, ABS, 4) X(0xEE, INC, ABS, 6) X(0xEF, ISB, ABS, 6) \
+    X(0xF0, BEQ, REL, 2) X(0xF1, SBC, IZY, 5) X(0xF2, XXX, IMP, 2) X(0xF3, ISB, IZY, 8) X(0xF4, NOP, ZPX, 4) X(0xF5, SBC, ZPX, 4) X(0xF6, INC, ZPX, 6) X(0xF7, ISB, ZPX, 6) X(0xF8, SED, IMP, 2) X(0xF9, SBC, ABY, 4) X(0xFA, NOP, IMP, 2) X(0xFB, ISB, ABY, 7) X(0xFC, NOP, ABX, 4) X(0xFD, SBC, ABX, 4) X(0xFE, INC, ABX, 7) X(0xFF, ISB, ABX, 7)
+
+#define CPU_OP_CODE_MATRIX_ENTRY(code, op, am, cycles) { CPU_##op, CPU_AM_##am, cycles, #op, #am },
+
 static const OP_CODE_MATRIX_ENTRY OP_CODE_MATRIX[] = {
-	{ CPU_BRK, CPU_AM_IMM, 7 },{ CPU_ORA, CPU_AM_IZX, 6 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 3 },{ CPU_ORA, CPU_AM_ZP0, 3 },{ CPU_ASL, CPU_AM_ZP0, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_PHP, CPU_AM_IMP, 3 },{ CPU_ORA, CPU_AM_IMM, 2 },{ CPU_ASL, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_ORA, CPU_AM_ABS, 4 },{ CPU_ASL, CPU_AM_ABS, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },
-	{ CPU_BPL, CPU_AM_REL, 2 },{ CPU_ORA, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_ORA, CPU_AM_ZPX, 4 },{ CPU_ASL, CPU_AM_ZPX, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_CLC, CPU_AM_IMP, 2 },{ CPU_ORA, CPU_AM_ABY, 4 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 7 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_ORA, CPU_AM_ABX, 4 },{ CPU_ASL, CPU_AM_ABX, 7 },{ CPU_XXX, CPU_AM_IMP, 7 },
-	{ CPU_JSR, CPU_AM_ABS, 6 },{ CPU_AND, CPU_AM_IZX, 6 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_BIT, CPU_AM_ZP0, 3 },{ CPU_AND, CPU_AM_ZP0, 3 },{ CPU_ROL, CPU_AM_ZP0, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_PLP, CPU_AM_IMP, 4 },{ CPU_AND, CPU_AM_IMM, 2 },{ CPU_ROL, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_BIT, CPU_AM_ABS, 4 },{ CPU_AND, CPU_AM_ABS, 4 },{ CPU_ROL, CPU_AM_ABS, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },
-	{ CPU_BMI, CPU_AM_REL, 2 },{ CPU_AND, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_AND, CPU_AM_ZPX, 4 },{ CPU_ROL, CPU_AM_ZPX, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_SEC, CPU_AM_IMP, 2 },{ CPU_AND, CPU_AM_ABY, 4 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 7 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_AND, CPU_AM_ABX, 4 },{ CPU_ROL, CPU_AM_ABX, 7 },{ CPU_XXX, CPU_AM_IMP, 7 },
-	{ CPU_RTI, CPU_AM_IMP, 6 },{ CPU_EOR, CPU_AM_IZX, 6 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 3 },{ CPU_EOR, CPU_AM_ZP0, 3 },{ CPU_LSR, CPU_AM_ZP0, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_PHA, CPU_AM_IMP, 3 },{ CPU_EOR, CPU_AM_IMM, 2 },{ CPU_LSR, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_JMP, CPU_AM_ABS, 3 },{ CPU_EOR, CPU_AM_ABS, 4 },{ CPU_LSR, CPU_AM_ABS, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },
-	{ CPU_BVC, CPU_AM_REL, 2 },{ CPU_EOR, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_EOR, CPU_AM_ZPX, 4 },{ CPU_LSR, CPU_AM_ZPX, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_CLI, CPU_AM_IMP, 2 },{ CPU_EOR, CPU_AM_ABY, 4 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 7 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_EOR, CPU_AM_ABX, 4 },{ CPU_LSR, CPU_AM_ABX, 7 },{ CPU_XXX, CPU_AM_IMP, 7 },
-	{ CPU_RTS, CPU_AM_IMP, 6 },{ CPU_ADC, CPU_AM_IZX, 6 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 3 },{ CPU_ADC, CPU_AM_ZP0, 3 },{ CPU_ROR, CPU_AM_ZP0, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_PLA, CPU_AM_IMP, 4 },{ CPU_ADC, CPU_AM_IMM, 2 },{ CPU_ROR, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_JMP, CPU_AM_IND, 5 },{ CPU_ADC, CPU_AM_ABS, 4 },{ CPU_ROR, CPU_AM_ABS, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },
-	{ CPU_BVS, CPU_AM_REL, 2 },{ CPU_ADC, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_ADC, CPU_AM_ZPX, 4 },{ CPU_ROR, CPU_AM_ZPX, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_SEI, CPU_AM_IMP, 2 },{ CPU_ADC, CPU_AM_ABY, 4 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 7 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_ADC, CPU_AM_ABX, 4 },{ CPU_ROR, CPU_AM_ABX, 7 },{ CPU_XXX, CPU_AM_IMP, 7 },
-	{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_STA, CPU_AM_IZX, 6 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_STY, CPU_AM_ZP0, 3 },{ CPU_STA, CPU_AM_ZP0, 3 },{ CPU_STX, CPU_AM_ZP0, 3 },{ CPU_XXX, CPU_AM_IMP, 3 },{ CPU_DEY, CPU_AM_IMP, 2 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_TXA, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_STY, CPU_AM_ABS, 4 },{ CPU_STA, CPU_AM_ABS, 4 },{ CPU_STX, CPU_AM_ABS, 4 },{ CPU_XXX, CPU_AM_IMP, 4 },
-	{ CPU_BCC, CPU_AM_REL, 2 },{ CPU_STA, CPU_AM_IZY, 6 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_STY, CPU_AM_ZPX, 4 },{ CPU_STA, CPU_AM_ZPX, 4 },{ CPU_STX, CPU_AM_ZPY, 4 },{ CPU_XXX, CPU_AM_IMP, 4 },{ CPU_TYA, CPU_AM_IMP, 2 },{ CPU_STA, CPU_AM_ABY, 5 },{ CPU_TXS, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_NOP, CPU_AM_IMP, 5 },{ CPU_STA, CPU_AM_ABX, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },
-	{ CPU_LDY, CPU_AM_IMM, 2 },{ CPU_LDA, CPU_AM_IZX, 6 },{ CPU_LDX, CPU_AM_IMM, 2 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_LDY, CPU_AM_ZP0, 3 },{ CPU_LDA, CPU_AM_ZP0, 3 },{ CPU_LDX, CPU_AM_ZP0, 3 },{ CPU_XXX, CPU_AM_IMP, 3 },{ CPU_TAY, CPU_AM_IMP, 2 },{ CPU_LDA, CPU_AM_IMM, 2 },{ CPU_TAX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_LDY, CPU_AM_ABS, 4 },{ CPU_LDA, CPU_AM_ABS, 4 },{ CPU_LDX, CPU_AM_ABS, 4 },{ CPU_XXX, CPU_AM_IMP, 4 },
-	{ CPU_BCS, CPU_AM_REL, 2 },{ CPU_LDA, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_LDY, CPU_AM_ZPX, 4 },{ CPU_LDA, CPU_AM_ZPX, 4 },{ CPU_LDX, CPU_AM_ZPY, 4 },{ CPU_XXX, CPU_AM_IMP, 4 },{ CPU_CLV, CPU_AM_IMP, 2 },{ CPU_LDA, CPU_AM_ABY, 4 },{ CPU_TSX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 4 },{ CPU_LDY, CPU_AM_ABX, 4 },{ CPU_LDA, CPU_AM_ABX, 4 },{ CPU_LDX, CPU_AM_ABY, 4 },{ CPU_XXX, CPU_AM_IMP, 4 },
-	{ CPU_CPY, CPU_AM_IMM, 2 },{ CPU_CMP, CPU_AM_IZX, 6 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_CPY, CPU_AM_ZP0, 3 },{ CPU_CMP, CPU_AM_ZP0, 3 },{ CPU_DEC, CPU_AM_ZP0, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_INY, CPU_AM_IMP, 2 },{ CPU_CMP, CPU_AM_IMM, 2 },{ CPU_DEX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_CPY, CPU_AM_ABS, 4 },{ CPU_CMP, CPU_AM_ABS, 4 },{ CPU_DEC, CPU_AM_ABS, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },
-	{ CPU_BNE, CPU_AM_REL, 2 },{ CPU_CMP, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_CMP, CPU_AM_ZPX, 4 },{ CPU_DEC, CPU_AM_ZPX, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_CLD, CPU_AM_IMP, 2 },{ CPU_CMP, CPU_AM_ABY, 4 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 7 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_CMP, CPU_AM_ABX, 4 },{ CPU_DEC, CPU_AM_ABX, 7 },{ CPU_XXX, CPU_AM_IMP, 7 },
-	{ CPU_CPX, CPU_AM_IMM, 2 },{ CPU_SBC, CPU_AM_IZX, 6 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_CPX, CPU_AM_ZP0, 3 },{ CPU_SBC, CPU_AM_ZP0, 3 },{ CPU_INC, CPU_AM_ZP0, 5 },{ CPU_XXX, CPU_AM_IMP, 5 },{ CPU_INX, CPU_AM_IMP, 2 },{ CPU_SBC, CPU_AM_IMM, 2 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_SBC, CPU_AM_IMP, 2 },{ CPU_CPX, CPU_AM_ABS, 4 },{ CPU_SBC, CPU_AM_ABS, 4 },{ CPU_INC, CPU_AM_ABS, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },
-	{ CPU_BEQ, CPU_AM_REL, 2 },{ CPU_SBC, CPU_AM_IZY, 5 },{ CPU_XXX, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 8 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_SBC, CPU_AM_ZPX, 4 },{ CPU_INC, CPU_AM_ZPX, 6 },{ CPU_XXX, CPU_AM_IMP, 6 },{ CPU_SED, CPU_AM_IMP, 2 },{ CPU_SBC, CPU_AM_ABY, 4 },{ CPU_NOP, CPU_AM_IMP, 2 },{ CPU_XXX, CPU_AM_IMP, 7 },{ CPU_NOP, CPU_AM_IMP, 4 },{ CPU_SBC, CPU_AM_ABX, 4 },{ CPU_INC, CPU_AM_ABX, 7 },{ CPU_XXX, CPU_AM_IMP, 7 },
+    CPU_OP_CODE_LIST(CPU_OP_CODE_MATRIX_ENTRY)
 };
 // clang-format on
 
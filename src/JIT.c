@@ -0,0 +1,1241 @@
+#include <CPU.h>
+#include <JIT.h>
+
+#ifdef NES_JIT
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+// Room one block may take up in the arena, the arena is flushed when less is left
+#define JIT_MAX_BLOCK_SIZE 32768
+#define JIT_MAX_EXITS (JIT_MAX_INSNS * 4 + 1)
+// Blocks whose code keeps being rewritten are left to the interpreter
+#define JIT_MAX_RECOMPILES 8
+// Side exits before a block is judged by its side exit rate
+#define JIT_MIN_SIDE_EXITS 16
+
+// Host registers. The 6502 registers, the page table and the cycle count live
+// in registers for the whole block, generated code never calls out.
+enum {
+    JIT_RAX, JIT_RCX, JIT_RDX, JIT_RBX, JIT_RSP, JIT_RBP, JIT_RSI, JIT_RDI,
+    JIT_R8, JIT_R9, JIT_R10, JIT_R11, JIT_R12, JIT_R13, JIT_R14, JIT_R15,
+};
+
+#define JIT_CPU JIT_RBX
+#define JIT_A JIT_R12
+#define JIT_X JIT_R13
+#define JIT_Y JIT_R14
+#define JIT_S JIT_R15
+#define JIT_P JIT_RBP
+#define JIT_BUDGET JIT_R8
+#define JIT_PAGES JIT_R9
+#define JIT_NZ_TABLE JIT_R10
+#define JIT_CYCLES JIT_R11
+#define JIT_NONE -1
+
+// Group 1 ALU operations, the /digit of the immediate forms
+enum { JIT_ADD = 0, JIT_OR = 1, JIT_ADC = 2, JIT_AND = 4, JIT_SUB = 5, JIT_XOR = 6, JIT_CMP = 7 };
+enum { JIT_SHL = 4, JIT_SHR = 5 };
+enum { JIT_CC_B = 0x2, JIT_CC_E = 0x4, JIT_CC_NE = 0x5, JIT_CC_A = 0x7 };
+
+typedef enum {
+    JIT_OP_ADC, JIT_OP_AND, JIT_OP_ASL, JIT_OP_BCC, JIT_OP_BCS, JIT_OP_BEQ, JIT_OP_BIT, JIT_OP_BMI,
+    JIT_OP_BNE, JIT_OP_BPL, JIT_OP_BRK, JIT_OP_BVC, JIT_OP_BVS, JIT_OP_CLC, JIT_OP_CLD, JIT_OP_CLI,
+    JIT_OP_CLV, JIT_OP_CMP, JIT_OP_CPX, JIT_OP_CPY, JIT_OP_DEC, JIT_OP_DEX, JIT_OP_DEY, JIT_OP_EOR,
+    JIT_OP_INC, JIT_OP_INX, JIT_OP_INY, JIT_OP_JMP, JIT_OP_JSR, JIT_OP_LDA, JIT_OP_LDX, JIT_OP_LDY,
+    JIT_OP_LSR, JIT_OP_NOP, JIT_OP_ORA, JIT_OP_PHA, JIT_OP_PHP, JIT_OP_PLA, JIT_OP_PLP, JIT_OP_ROL,
+    JIT_OP_ROR, JIT_OP_RTI, JIT_OP_RTS, JIT_OP_SBC, JIT_OP_SEC, JIT_OP_SED, JIT_OP_SEI, JIT_OP_STA,
+    JIT_OP_STX, JIT_OP_STY, JIT_OP_TAX, JIT_OP_TAY, JIT_OP_TSX, JIT_OP_TXA, JIT_OP_TXS, JIT_OP_TYA,
+    JIT_OP_XXX, JIT_OP_LAX, JIT_OP_SAX, JIT_OP_DCP, JIT_OP_ISB, JIT_OP_SLO, JIT_OP_RLA, JIT_OP_SRE,
+    JIT_OP_RRA,
+} JIT_OP;
+
+typedef enum {
+    JIT_AM_IMP, JIT_AM_IMM, JIT_AM_ZP0, JIT_AM_ZPX, JIT_AM_ZPY, JIT_AM_ABS,
+    JIT_AM_ABX, JIT_AM_ABY, JIT_AM_IND, JIT_AM_IZX, JIT_AM_IZY, JIT_AM_REL,
+} JIT_AM;
+
+typedef struct {
+    uint8_t op;
+    uint8_t am;
+    uint8_t cycles;
+} JIT_OPCODE;
+
+// clang-format off
+#define JIT_OPCODE_ENTRY(code, op, am, cyc) [code] = {JIT_OP_##op, JIT_AM_##am, cyc},
+static const JIT_OPCODE JIT_OPCODES[256] = {CPU_OP_CODE_LIST(JIT_OPCODE_ENTRY)};
+// clang-format on
+
+// N and Z of every value, or'ed into the status register
+static uint8_t JIT_NZ[256];
+
+typedef struct {
+    uint16_t pc;
+    uint16_t next_pc;
+    uint16_t operand; // the raw operand bytes
+    uint8_t op;
+    uint8_t am;
+    uint8_t cycles;
+    bool target; // a jump or branch inside the block lands here
+    size_t label;
+} JIT_INSN;
+
+// Leaves the block through a stub that adds cycles and stores pc
+typedef struct {
+    size_t patch;
+    uint16_t pc;
+    uint16_t cycles;
+    bool side_exit; // counted towards the block's side exit rate
+} JIT_EXIT;
+
+typedef struct {
+    size_t patch;
+    size_t insn;
+    uint16_t cycles; // extra cycles of a taken branch, added on the way
+    bool backward;
+} JIT_JUMP;
+
+// Where a memory operand ends up: its page is either known or held in rdi as an
+// offset into the page table, the low byte is known or held in a register
+typedef struct {
+    int page;
+    int low;
+    uint8_t low_byte;
+} JIT_ADDR;
+
+typedef struct {
+    uint8_t *code;
+    size_t size;
+    CPU *cpu;
+    JIT_BLOCK *block;
+    JIT_INSN insns[JIT_MAX_INSNS];
+    size_t count;
+    size_t current;   // instruction being emitted
+    uint16_t pending; // fixed cycles not yet added to the cycle register
+    JIT_EXIT exits[JIT_MAX_EXITS];
+    size_t exit_count;
+    JIT_JUMP jumps[JIT_MAX_INSNS];
+    size_t jump_count;
+    size_t epilogue_jumps[JIT_MAX_INSNS + 1];
+    size_t epilogue_jump_count;
+} JIT_COMPILER;
+
+// Encoding
+
+static void JIT_byte(JIT_COMPILER *c, uint8_t value) {
+    c->code[c->size++] = value;
+}
+
+static void JIT_u16(JIT_COMPILER *c, uint16_t value) {
+    memcpy(c->code + c->size, &value, sizeof(value));
+    c->size += sizeof(value);
+}
+
+static void JIT_u32(JIT_COMPILER *c, uint32_t value) {
+    memcpy(c->code + c->size, &value, sizeof(value));
+    c->size += sizeof(value);
+}
+
+static void JIT_u64(JIT_COMPILER *c, uint64_t value) {
+    memcpy(c->code + c->size, &value, sizeof(value));
+    c->size += sizeof(value);
+}
+
+// A REX prefix when any register needs one, byte_reg is a register used as a
+// byte operand, 4 to 7 then mean spl to dil instead of ah to bh
+static void JIT_rex(JIT_COMPILER *c, bool w, int reg, int index, int base, int byte_reg) {
+    uint8_t rex = 0x40 | (w << 3) | ((reg >> 3) & 1) << 2 | ((index >> 3) & 1) << 1 | ((base >> 3) & 1);
+    if (rex != 0x40 || (byte_reg >= 4 && byte_reg < 8)) JIT_byte(c, rex);
+}
+
+static void JIT_opcode(JIT_COMPILER *c, uint32_t op) {
+    if (op > 0xFF) JIT_byte(c, op >> 8);
+    JIT_byte(c, op & 0xFF);
+}
+
+// op reg, rm with both operands registers
+static void JIT_rr(JIT_COMPILER *c, bool w, uint32_t op, int reg, int rm, int byte_reg) {
+    JIT_rex(c, w, reg, 0, rm, byte_reg);
+    JIT_opcode(c, op);
+    JIT_byte(c, 0xC0 | (reg & 7) << 3 | (rm & 7));
+}
+
+// op reg, [base + index + disp], always with a 32 bit displacement
+static void JIT_rm(JIT_COMPILER *c, bool w, uint32_t op, int reg, int base, int index, int32_t disp, int byte_reg) {
+    JIT_rex(c, w, reg, index == JIT_NONE ? 0 : index, base, byte_reg);
+    JIT_opcode(c, op);
+    if (index == JIT_NONE && (base & 7) != JIT_RSP) {
+        JIT_byte(c, 0x80 | (reg & 7) << 3 | (base & 7));
+    } else {
+        JIT_byte(c, 0x84 | (reg & 7) << 3);
+        JIT_byte(c, (index == JIT_NONE ? 4 : index & 7) << 3 | (base & 7));
+    }
+    JIT_u32(c, (uint32_t)disp);
+}
+
+static void JIT_mov(JIT_COMPILER *c, int dst, int src) {
+    JIT_rr(c, false, 0x89, src, dst, JIT_NONE);
+}
+
+static void JIT_mov_imm(JIT_COMPILER *c, int dst, uint32_t imm) {
+    JIT_rex(c, false, 0, 0, dst, JIT_NONE);
+    JIT_byte(c, 0xB8 + (dst & 7));
+    JIT_u32(c, imm);
+}
+
+static void JIT_mov_imm64(JIT_COMPILER *c, int dst, uint64_t imm) {
+    JIT_rex(c, true, 0, 0, dst, JIT_NONE);
+    JIT_byte(c, 0xB8 + (dst & 7));
+    JIT_u64(c, imm);
+}
+
+static void JIT_alu(JIT_COMPILER *c, int ext, int dst, int src) {
+    JIT_rr(c, false, ext * 8 + 1, src, dst, JIT_NONE);
+}
+
+static void JIT_alu_imm(JIT_COMPILER *c, int ext, int dst, int32_t imm) {
+    if (imm >= -128 && imm <= 127) {
+        JIT_rr(c, false, 0x83, ext, dst, JIT_NONE);
+        JIT_byte(c, (uint8_t)imm);
+    } else {
+        JIT_rr(c, false, 0x81, ext, dst, JIT_NONE);
+        JIT_u32(c, (uint32_t)imm);
+    }
+}
+
+static void JIT_shift(JIT_COMPILER *c, int ext, int dst, uint8_t count) {
+    JIT_rr(c, false, 0xC1, ext, dst, JIT_NONE);
+    JIT_byte(c, count);
+}
+
+static void JIT_test_imm(JIT_COMPILER *c, int reg, uint32_t imm) {
+    JIT_rr(c, false, 0xF7, 0, reg, JIT_NONE);
+    JIT_u32(c, imm);
+}
+
+// movzx dst, src8
+static void JIT_zero_extend(JIT_COMPILER *c, int dst, int src) {
+    JIT_rr(c, false, 0x0FB6, dst, src, src);
+}
+
+static void JIT_load_byte(JIT_COMPILER *c, int dst, int base, int index, int32_t disp) {
+    JIT_rm(c, false, 0x0FB6, dst, base, index, disp, JIT_NONE);
+}
+
+static void JIT_store_byte(JIT_COMPILER *c, int src, int base, int index, int32_t disp) {
+    JIT_rm(c, false, 0x88, src, base, index, disp, src);
+}
+
+static void JIT_load_pointer(JIT_COMPILER *c, int dst, int base, int index, int32_t disp) {
+    JIT_rm(c, true, 0x8B, dst, base, index, disp, JIT_NONE);
+}
+
+// Returns the position of the rel32 to patch
+static size_t JIT_jcc(JIT_COMPILER *c, int cc) {
+    JIT_byte(c, 0x0F);
+    JIT_byte(c, 0x80 | cc);
+    JIT_u32(c, 0);
+    return c->size - 4;
+}
+
+static size_t JIT_jmp(JIT_COMPILER *c) {
+    JIT_byte(c, 0xE9);
+    JIT_u32(c, 0);
+    return c->size - 4;
+}
+
+static void JIT_patch(JIT_COMPILER *c, size_t at, size_t target) {
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(c->code + at, &rel, sizeof(rel));
+}
+
+static void JIT_host_push(JIT_COMPILER *c, int reg) {
+    if (reg >= 8) JIT_byte(c, 0x41);
+    JIT_byte(c, 0x50 + (reg & 7));
+}
+
+static void JIT_host_pop(JIT_COMPILER *c, int reg) {
+    if (reg >= 8) JIT_byte(c, 0x41);
+    JIT_byte(c, 0x58 + (reg & 7));
+}
+
+// cpu->reg.PC = reg, or imm when reg is JIT_NONE
+static void JIT_store_pc(JIT_COMPILER *c, int reg, uint16_t imm) {
+    JIT_byte(c, 0x66);
+    if (reg == JIT_NONE) {
+        JIT_rm(c, false, 0xC7, 0, JIT_CPU, JIT_NONE, offsetof(CPU, reg.PC), JIT_NONE);
+        JIT_u16(c, imm);
+    } else {
+        JIT_rm(c, false, 0x89, reg, JIT_CPU, JIT_NONE, offsetof(CPU, reg.PC), JIT_NONE);
+    }
+}
+
+static uint16_t JIT_sign_extend(uint16_t offset) {
+    return (offset & 0x80) ? (offset | 0xFF00) : offset;
+}
+
+// Exits
+
+static void JIT_flush_cycles(JIT_COMPILER *c) {
+    if (c->pending) JIT_alu_imm(c, JIT_ADD, JIT_CYCLES, c->pending);
+    c->pending = 0;
+}
+
+static void JIT_exit_to(JIT_COMPILER *c, size_t patch, uint16_t pc, uint16_t cycles, bool side_exit) {
+    if (c->exit_count == JIT_MAX_EXITS) PANIC("JIT block has too many exits!");
+    c->exits[c->exit_count++] = (JIT_EXIT){.patch = patch, .pc = pc, .cycles = cycles, .side_exit = side_exit};
+}
+
+// Leaves before the current instruction changed anything, for memory the
+// compiled code cannot access itself
+static void JIT_side_exit_if(JIT_COMPILER *c, int cc) {
+    JIT_exit_to(c, JIT_jcc(c, cc), c->insns[c->current].pc, c->pending, true);
+}
+
+// Leaves after the current instruction, once it wrote to the block's own code
+static void JIT_exit_after_if(JIT_COMPILER *c, int cc) {
+    const JIT_INSN *insn = &c->insns[c->current];
+    JIT_exit_to(c, JIT_jcc(c, cc), insn->next_pc, c->pending + insn->cycles, false);
+}
+
+static void JIT_exit_to_epilogue(JIT_COMPILER *c) {
+    JIT_flush_cycles(c);
+    c->epilogue_jumps[c->epilogue_jump_count++] = JIT_jmp(c);
+}
+
+static void JIT_exit_static(JIT_COMPILER *c, uint16_t pc) {
+    JIT_store_pc(c, JIT_NONE, pc);
+    JIT_exit_to_epilogue(c);
+}
+
+// Memory
+
+static int32_t JIT_page_field(const JIT_ADDR *addr, size_t field) {
+    return (int32_t)(addr->page == JIT_NONE ? field : addr->page * sizeof(BUS_PAGE) + field);
+}
+
+// dst = the page's read or write pointer, side exiting when it goes to a handler
+static void JIT_page_pointer(JIT_COMPILER *c, const JIT_ADDR *addr, size_t field, int dst) {
+    JIT_load_pointer(c, dst, JIT_PAGES, addr->page == JIT_NONE ? JIT_RDI : JIT_NONE, JIT_page_field(addr, field));
+    JIT_rr(c, true, 0x85, dst, dst, JIT_NONE);
+    JIT_side_exit_if(c, JIT_CC_E);
+}
+
+static void JIT_access(JIT_COMPILER *c, const JIT_ADDR *addr, int value, int ptr, bool write) {
+    int index = addr->low;
+    int32_t disp = addr->low == JIT_NONE ? addr->low_byte : 0;
+    if (write) {
+        JIT_store_byte(c, value, ptr, index, disp);
+    } else {
+        JIT_load_byte(c, value, ptr, index, disp);
+    }
+}
+
+// Bumps the page's write generation like BUS_write, then leaves the block if
+// that was the generation of the block's own page
+static void JIT_written(JIT_COMPILER *c, const JIT_ADDR *addr, size_t count) {
+    JIT_load_pointer(c, JIT_RDX, JIT_PAGES, addr->page == JIT_NONE ? JIT_RDI : JIT_NONE,
+                     JIT_page_field(addr, offsetof(BUS_PAGE, generation)));
+    for (size_t i = 0; i < count; i++) {
+        JIT_rm(c, true, 0xFF, 0, JIT_RDX, JIT_NONE, 0, JIT_NONE);
+    }
+    JIT_mov_imm64(c, JIT_RAX, (uint64_t)(uintptr_t)c->block->generation);
+    JIT_rr(c, true, 0x39, JIT_RAX, JIT_RDX, JIT_NONE);
+    JIT_exit_after_if(c, JIT_CC_E);
+}
+
+// Turns the full address in ecx into a page table offset in rdi and the low
+// byte in esi
+static void JIT_dynamic_address(JIT_COMPILER *c, JIT_ADDR *addr) {
+    JIT_mov(c, JIT_RDI, JIT_RCX);
+    JIT_shift(c, JIT_SHR, JIT_RDI, 8);
+    JIT_rr(c, false, 0x69, JIT_RDI, JIT_RDI, JIT_NONE);
+    JIT_u32(c, sizeof(BUS_PAGE));
+    JIT_zero_extend(c, JIT_RSI, JIT_RCX);
+    addr->page = JIT_NONE;
+    addr->low = JIT_RSI;
+}
+
+// Reads the 16 bit pointer at ptr and ptr + 1 within page 0 into ecx
+static void JIT_zero_page_pointer(JIT_COMPILER *c, int ptr_reg, uint8_t ptr) {
+    JIT_ADDR zero_page = {.page = 0, .low = JIT_NONE};
+    JIT_page_pointer(c, &zero_page, offsetof(BUS_PAGE, read), JIT_RDX);
+    if (ptr_reg == JIT_NONE) {
+        JIT_load_byte(c, JIT_RAX, JIT_RDX, JIT_NONE, ptr);
+        JIT_load_byte(c, JIT_RCX, JIT_RDX, JIT_NONE, (uint8_t)(ptr + 1));
+    } else {
+        JIT_load_byte(c, JIT_RAX, JIT_RDX, ptr_reg, 0);
+        JIT_alu_imm(c, JIT_ADD, ptr_reg, 1);
+        JIT_alu_imm(c, JIT_AND, ptr_reg, 0xFF);
+        JIT_load_byte(c, JIT_RCX, JIT_RDX, ptr_reg, 0);
+    }
+    JIT_shift(c, JIT_SHL, JIT_RCX, 8);
+    JIT_alu(c, JIT_OR, JIT_RCX, JIT_RAX);
+}
+
+// Emits the address computation of a memory operand, side exiting if the
+// zero page pointers of the indirect modes are not plain memory
+static void JIT_address(JIT_COMPILER *c, const JIT_INSN *insn, JIT_ADDR *addr) {
+    addr->low = JIT_NONE;
+    addr->low_byte = insn->operand & 0xFF;
+    switch (insn->am) {
+    case JIT_AM_ZP0:
+        addr->page = 0;
+        break;
+    case JIT_AM_ZPX:
+    case JIT_AM_ZPY:
+        JIT_mov(c, JIT_RSI, insn->am == JIT_AM_ZPX ? JIT_X : JIT_Y);
+        JIT_alu_imm(c, JIT_ADD, JIT_RSI, insn->operand & 0xFF);
+        JIT_alu_imm(c, JIT_AND, JIT_RSI, 0xFF);
+        addr->page = 0;
+        addr->low = JIT_RSI;
+        break;
+    case JIT_AM_ABS:
+        addr->page = insn->operand >> 8;
+        break;
+    case JIT_AM_ABX:
+    case JIT_AM_ABY: {
+        int index = insn->am == JIT_AM_ABX ? JIT_X : JIT_Y;
+        if ((insn->operand & 0xFF) == 0) {
+            // Page aligned bases never cross into the next page
+            addr->page = insn->operand >> 8;
+            addr->low = index;
+            break;
+        }
+        JIT_mov(c, JIT_RCX, index);
+        JIT_alu_imm(c, JIT_ADD, JIT_RCX, insn->operand);
+        JIT_alu_imm(c, JIT_AND, JIT_RCX, 0xFFFF);
+        JIT_dynamic_address(c, addr);
+        break;
+    }
+    case JIT_AM_IZX:
+        JIT_mov(c, JIT_RSI, JIT_X);
+        JIT_alu_imm(c, JIT_ADD, JIT_RSI, insn->operand & 0xFF);
+        JIT_alu_imm(c, JIT_AND, JIT_RSI, 0xFF);
+        JIT_zero_page_pointer(c, JIT_RSI, 0);
+        JIT_dynamic_address(c, addr);
+        break;
+    case JIT_AM_IZY:
+        JIT_zero_page_pointer(c, JIT_NONE, insn->operand & 0xFF);
+        JIT_alu(c, JIT_ADD, JIT_RCX, JIT_Y);
+        JIT_alu_imm(c, JIT_AND, JIT_RCX, 0xFFFF);
+        JIT_dynamic_address(c, addr);
+        break;
+    default:
+        PANIC("JIT addressing mode without a memory operand!");
+    }
+}
+
+// Operations that take a cycle more when indexing crosses a page
+static bool JIT_page_penalty(uint8_t op) {
+    switch (op) {
+    case JIT_OP_ADC: case JIT_OP_AND: case JIT_OP_CMP: case JIT_OP_EOR: case JIT_OP_LAX:
+    case JIT_OP_LDA: case JIT_OP_LDX: case JIT_OP_LDY: case JIT_OP_NOP: case JIT_OP_ORA: case JIT_OP_SBC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// eax = the operand, immediates are constants as the block's code cannot change
+static void JIT_load_operand(JIT_COMPILER *c, const JIT_INSN *insn) {
+    if (insn->am == JIT_AM_IMM) {
+        JIT_mov_imm(c, JIT_RAX, insn->operand);
+        return;
+    }
+    JIT_ADDR addr;
+    JIT_address(c, insn, &addr);
+    JIT_page_pointer(c, &addr, offsetof(BUS_PAGE, read), JIT_RDX);
+    JIT_access(c, &addr, JIT_RAX, JIT_RDX, false);
+
+    // The low byte wrapped below the index exactly when a page was crossed
+    if (addr.page == JIT_NONE && insn->am != JIT_AM_IZX && JIT_page_penalty(insn->op)) {
+        JIT_alu(c, JIT_CMP, JIT_RSI, insn->am == JIT_AM_ABX ? JIT_X : JIT_Y);
+        JIT_alu_imm(c, JIT_ADC, JIT_CYCLES, 0);
+    }
+}
+
+// Stores the register value to the operand
+static void JIT_store_operand(JIT_COMPILER *c, const JIT_INSN *insn, int value) {
+    JIT_ADDR addr;
+    JIT_address(c, insn, &addr);
+    JIT_page_pointer(c, &addr, offsetof(BUS_PAGE, write), JIT_RDX);
+    if (value != JIT_RAX) JIT_mov(c, JIT_RAX, value);
+    if (insn->op == JIT_OP_SAX) JIT_alu(c, JIT_AND, JIT_RAX, JIT_X);
+    JIT_access(c, &addr, JIT_RAX, JIT_RDX, true);
+    JIT_written(c, &addr, 1);
+}
+
+// Flags
+
+static void JIT_set_nz(JIT_COMPILER *c, int value) {
+    JIT_alu_imm(c, JIT_AND, JIT_P, (uint8_t)~(CPU_FLAGS_N | CPU_FLAGS_Z));
+    JIT_load_byte(c, JIT_RDX, JIT_NZ_TABLE, value, 0);
+    JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+}
+
+// C = reg >= eax, N and Z from reg - eax
+static void JIT_compare(JIT_COMPILER *c, int reg) {
+    JIT_alu_imm(c, JIT_AND, JIT_P, (uint8_t)~(CPU_FLAGS_N | CPU_FLAGS_Z | CPU_FLAGS_C));
+    JIT_mov(c, JIT_RCX, reg);
+    JIT_alu(c, JIT_SUB, JIT_RCX, JIT_RAX);
+    JIT_rr(c, false, 0x0F93, 0, JIT_RDX, JIT_RDX); // setae dl
+    JIT_zero_extend(c, JIT_RDX, JIT_RDX);
+    JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+    JIT_zero_extend(c, JIT_RCX, JIT_RCX);
+    JIT_load_byte(c, JIT_RDX, JIT_NZ_TABLE, JIT_RCX, 0);
+    JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+}
+
+// Binary ADC of eax, SBC adds the inverted operand
+static void JIT_add(JIT_COMPILER *c, bool subtract) {
+    if (subtract) JIT_alu_imm(c, JIT_XOR, JIT_RAX, 0xFF);
+    // ecx = A + value + C
+    JIT_mov(c, JIT_RCX, JIT_P);
+    JIT_alu_imm(c, JIT_AND, JIT_RCX, CPU_FLAGS_C);
+    JIT_alu(c, JIT_ADD, JIT_RCX, JIT_A);
+    JIT_alu(c, JIT_ADD, JIT_RCX, JIT_RAX);
+    // V = ~(A ^ value) & (A ^ sum) & 0x80, moved down to bit 6
+    JIT_mov(c, JIT_RDX, JIT_A);
+    JIT_alu(c, JIT_XOR, JIT_RDX, JIT_RAX);
+    JIT_rr(c, false, 0xF7, 2, JIT_RDX, JIT_NONE); // not edx
+    JIT_mov(c, JIT_RSI, JIT_A);
+    JIT_alu(c, JIT_XOR, JIT_RSI, JIT_RCX);
+    JIT_alu(c, JIT_AND, JIT_RDX, JIT_RSI);
+    JIT_alu_imm(c, JIT_AND, JIT_RDX, 0x80);
+    JIT_shift(c, JIT_SHR, JIT_RDX, 1);
+    JIT_alu_imm(c, JIT_AND, JIT_P, (uint8_t)~(CPU_FLAGS_N | CPU_FLAGS_V | CPU_FLAGS_Z | CPU_FLAGS_C));
+    JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+    JIT_mov(c, JIT_RDX, JIT_RCX);
+    JIT_shift(c, JIT_SHR, JIT_RDX, 8);
+    JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+    JIT_zero_extend(c, JIT_A, JIT_RCX);
+    JIT_set_nz(c, JIT_A);
+}
+
+// Shifts eax in place, C from the bit shifted out
+static void JIT_shift_value(JIT_COMPILER *c, uint8_t op) {
+    switch (op) {
+    case JIT_OP_ASL:
+    case JIT_OP_ROL:
+        JIT_alu(c, JIT_ADD, JIT_RAX, JIT_RAX);
+        if (op == JIT_OP_ROL) {
+            JIT_mov(c, JIT_RDX, JIT_P);
+            JIT_alu_imm(c, JIT_AND, JIT_RDX, CPU_FLAGS_C);
+            JIT_alu(c, JIT_OR, JIT_RAX, JIT_RDX);
+        }
+        JIT_alu_imm(c, JIT_AND, JIT_P, (uint8_t)~CPU_FLAGS_C);
+        JIT_mov(c, JIT_RDX, JIT_RAX);
+        JIT_shift(c, JIT_SHR, JIT_RDX, 8);
+        JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+        JIT_zero_extend(c, JIT_RAX, JIT_RAX);
+        break;
+    case JIT_OP_LSR:
+    case JIT_OP_ROR:
+        if (op == JIT_OP_ROR) {
+            // The old carry goes in above bit 7 and is shifted down into it
+            JIT_mov(c, JIT_RDX, JIT_P);
+            JIT_alu_imm(c, JIT_AND, JIT_RDX, CPU_FLAGS_C);
+            JIT_shift(c, JIT_SHL, JIT_RDX, 8);
+            JIT_alu(c, JIT_OR, JIT_RAX, JIT_RDX);
+        }
+        JIT_alu_imm(c, JIT_AND, JIT_P, (uint8_t)~CPU_FLAGS_C);
+        JIT_mov(c, JIT_RDX, JIT_RAX);
+        JIT_alu_imm(c, JIT_AND, JIT_RDX, CPU_FLAGS_C);
+        JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+        JIT_shift(c, JIT_SHR, JIT_RAX, 1);
+        break;
+    case JIT_OP_INC:
+        JIT_alu_imm(c, JIT_ADD, JIT_RAX, 1);
+        JIT_zero_extend(c, JIT_RAX, JIT_RAX);
+        break;
+    case JIT_OP_DEC:
+        JIT_alu_imm(c, JIT_SUB, JIT_RAX, 1);
+        JIT_zero_extend(c, JIT_RAX, JIT_RAX);
+        break;
+    }
+    JIT_set_nz(c, JIT_RAX);
+}
+
+// Read-modify-write on memory, both page pointers are checked before anything
+// is changed
+static void JIT_modify(JIT_COMPILER *c, const JIT_INSN *insn) {
+    JIT_ADDR addr;
+    JIT_address(c, insn, &addr);
+    JIT_page_pointer(c, &addr, offsetof(BUS_PAGE, read), JIT_RDX);
+    JIT_page_pointer(c, &addr, offsetof(BUS_PAGE, write), JIT_RCX);
+    JIT_access(c, &addr, JIT_RAX, JIT_RDX, false);
+    JIT_shift_value(c, insn->op);
+    JIT_access(c, &addr, JIT_RAX, JIT_RCX, true);
+    JIT_written(c, &addr, 1);
+}
+
+// Stack
+
+static const JIT_ADDR JIT_STACK = {.page = STACK_ORIGIN >> 8, .low = JIT_S};
+
+static void JIT_stack_decrement(JIT_COMPILER *c) {
+    JIT_alu_imm(c, JIT_SUB, JIT_S, 1);
+    JIT_alu_imm(c, JIT_AND, JIT_S, 0xFF);
+}
+
+static void JIT_push(JIT_COMPILER *c, int value) {
+    JIT_page_pointer(c, &JIT_STACK, offsetof(BUS_PAGE, write), JIT_RDX);
+    JIT_access(c, &JIT_STACK, value, JIT_RDX, true);
+    JIT_stack_decrement(c);
+    JIT_written(c, &JIT_STACK, 1);
+}
+
+// eax = the pulled byte, esi = the new stack pointer which the caller commits
+static void JIT_pull(JIT_COMPILER *c) {
+    JIT_mov(c, JIT_RSI, JIT_S);
+    JIT_alu_imm(c, JIT_ADD, JIT_RSI, 1);
+    JIT_alu_imm(c, JIT_AND, JIT_RSI, 0xFF);
+    JIT_page_pointer(c, &JIT_STACK, offsetof(BUS_PAGE, read), JIT_RDX);
+    JIT_load_byte(c, JIT_RAX, JIT_RDX, JIT_RSI, 0);
+}
+
+// Control flow
+
+static int JIT_find_insn(const JIT_COMPILER *c, uint16_t pc) {
+    for (size_t i = 0; i < c->count; i++) {
+        if (c->insns[i].pc == pc) return (int)i;
+    }
+    return JIT_NONE;
+}
+
+// Jumps to pc with cycles added on the way, staying in the block when pc starts
+// one of its instructions. Going backwards first checks the budget still
+// covers another pass.
+static void JIT_jump(JIT_COMPILER *c, size_t patch, uint16_t pc, uint16_t cycles) {
+    int target = JIT_find_insn(c, pc);
+    if (target == JIT_NONE) {
+        JIT_exit_to(c, patch, pc, cycles, false);
+        return;
+    }
+    c->jumps[c->jump_count++] =
+        (JIT_JUMP){.patch = patch, .insn = (size_t)target, .cycles = cycles, .backward = (size_t)target <= c->current};
+}
+
+static void JIT_branch(JIT_COMPILER *c, const JIT_INSN *insn) {
+    static const struct {
+        uint8_t flag;
+        bool set;
+    } conditions[] = {
+        [JIT_OP_BCC] = {CPU_FLAGS_C, false}, [JIT_OP_BCS] = {CPU_FLAGS_C, true},
+        [JIT_OP_BNE] = {CPU_FLAGS_Z, false}, [JIT_OP_BEQ] = {CPU_FLAGS_Z, true},
+        [JIT_OP_BPL] = {CPU_FLAGS_N, false}, [JIT_OP_BMI] = {CPU_FLAGS_N, true},
+        [JIT_OP_BVC] = {CPU_FLAGS_V, false}, [JIT_OP_BVS] = {CPU_FLAGS_V, true},
+    };
+    uint16_t target = insn->next_pc + JIT_sign_extend(insn->operand);
+    uint16_t extra = 1 + ((target & 0xFF00) != (insn->next_pc & 0xFF00));
+
+    c->pending += insn->cycles;
+    JIT_flush_cycles(c);
+    JIT_test_imm(c, JIT_P, conditions[insn->op].flag);
+    JIT_jump(c, JIT_jcc(c, conditions[insn->op].set ? JIT_CC_NE : JIT_CC_E), target, extra);
+}
+
+static void JIT_emit_insn(JIT_COMPILER *c, const JIT_INSN *insn) {
+    switch (insn->op) {
+    case JIT_OP_LDA:
+    case JIT_OP_LDX:
+    case JIT_OP_LDY:
+    case JIT_OP_LAX: {
+        JIT_load_operand(c, insn);
+        int reg = insn->op == JIT_OP_LDX ? JIT_X : insn->op == JIT_OP_LDY ? JIT_Y : JIT_A;
+        JIT_mov(c, reg, JIT_RAX);
+        if (insn->op == JIT_OP_LAX) JIT_mov(c, JIT_X, JIT_RAX);
+        JIT_set_nz(c, JIT_RAX);
+        break;
+    }
+    case JIT_OP_STA:
+    case JIT_OP_SAX:
+        JIT_store_operand(c, insn, JIT_A);
+        break;
+    case JIT_OP_STX:
+        JIT_store_operand(c, insn, JIT_X);
+        break;
+    case JIT_OP_STY:
+        JIT_store_operand(c, insn, JIT_Y);
+        break;
+    case JIT_OP_AND:
+    case JIT_OP_ORA:
+    case JIT_OP_EOR:
+        JIT_load_operand(c, insn);
+        JIT_alu(c, insn->op == JIT_OP_AND ? JIT_AND : insn->op == JIT_OP_ORA ? JIT_OR : JIT_XOR, JIT_A, JIT_RAX);
+        JIT_set_nz(c, JIT_A);
+        break;
+    case JIT_OP_ADC:
+    case JIT_OP_SBC:
+        // Decimal mode is left to the interpreter
+        if (c->cpu->decimal_mode) {
+            JIT_test_imm(c, JIT_P, CPU_FLAGS_D);
+            JIT_side_exit_if(c, JIT_CC_NE);
+        }
+        JIT_load_operand(c, insn);
+        JIT_add(c, insn->op == JIT_OP_SBC);
+        break;
+    case JIT_OP_CMP:
+    case JIT_OP_CPX:
+    case JIT_OP_CPY:
+        JIT_load_operand(c, insn);
+        JIT_compare(c, insn->op == JIT_OP_CPX ? JIT_X : insn->op == JIT_OP_CPY ? JIT_Y : JIT_A);
+        break;
+    case JIT_OP_BIT:
+        JIT_load_operand(c, insn);
+        JIT_alu_imm(c, JIT_AND, JIT_P, (uint8_t)~(CPU_FLAGS_N | CPU_FLAGS_V | CPU_FLAGS_Z));
+        JIT_mov(c, JIT_RDX, JIT_RAX);
+        JIT_alu_imm(c, JIT_AND, JIT_RDX, CPU_FLAGS_N | CPU_FLAGS_V);
+        JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+        JIT_alu(c, JIT_AND, JIT_RAX, JIT_A);
+        JIT_load_byte(c, JIT_RDX, JIT_NZ_TABLE, JIT_RAX, 0);
+        JIT_alu_imm(c, JIT_AND, JIT_RDX, CPU_FLAGS_Z);
+        JIT_alu(c, JIT_OR, JIT_P, JIT_RDX);
+        break;
+    case JIT_OP_NOP:
+        // Unofficial NOPs with an operand still perform the read
+        if (insn->am != JIT_AM_IMP && insn->am != JIT_AM_IMM) JIT_load_operand(c, insn);
+        break;
+    case JIT_OP_ASL:
+    case JIT_OP_LSR:
+    case JIT_OP_ROL:
+    case JIT_OP_ROR:
+    case JIT_OP_INC:
+    case JIT_OP_DEC:
+        if (insn->am != JIT_AM_IMP) {
+            JIT_modify(c, insn);
+            break;
+        }
+        JIT_mov(c, JIT_RAX, JIT_A);
+        JIT_shift_value(c, insn->op);
+        JIT_mov(c, JIT_A, JIT_RAX);
+        break;
+    case JIT_OP_INX:
+    case JIT_OP_INY:
+    case JIT_OP_DEX:
+    case JIT_OP_DEY: {
+        int reg = (insn->op == JIT_OP_INX || insn->op == JIT_OP_DEX) ? JIT_X : JIT_Y;
+        JIT_alu_imm(c, (insn->op == JIT_OP_INX || insn->op == JIT_OP_INY) ? JIT_ADD : JIT_SUB, reg, 1);
+        JIT_zero_extend(c, reg, reg);
+        JIT_set_nz(c, reg);
+        break;
+    }
+    case JIT_OP_TAX:
+    case JIT_OP_TAY:
+    case JIT_OP_TXA:
+    case JIT_OP_TYA:
+    case JIT_OP_TSX: {
+        static const int moves[][2] = {
+            [JIT_OP_TAX] = {JIT_X, JIT_A}, [JIT_OP_TAY] = {JIT_Y, JIT_A}, [JIT_OP_TXA] = {JIT_A, JIT_X},
+            [JIT_OP_TYA] = {JIT_A, JIT_Y}, [JIT_OP_TSX] = {JIT_X, JIT_S},
+        };
+        JIT_mov(c, moves[insn->op][0], moves[insn->op][1]);
+        JIT_set_nz(c, moves[insn->op][0]);
+        break;
+    }
+    case JIT_OP_TXS:
+        JIT_mov(c, JIT_S, JIT_X);
+        break;
+    case JIT_OP_CLC:
+    case JIT_OP_CLD:
+    case JIT_OP_CLI:
+    case JIT_OP_CLV:
+        JIT_alu_imm(c, JIT_AND, JIT_P,
+                    (uint8_t)~(insn->op == JIT_OP_CLC   ? CPU_FLAGS_C
+                               : insn->op == JIT_OP_CLD ? CPU_FLAGS_D
+                               : insn->op == JIT_OP_CLI ? CPU_FLAGS_I
+                                                        : CPU_FLAGS_V));
+        break;
+    case JIT_OP_SEC:
+    case JIT_OP_SED:
+    case JIT_OP_SEI:
+        JIT_alu_imm(c, JIT_OR, JIT_P,
+                    insn->op == JIT_OP_SEC ? CPU_FLAGS_C : insn->op == JIT_OP_SED ? CPU_FLAGS_D : CPU_FLAGS_I);
+        break;
+    case JIT_OP_PHA:
+        JIT_push(c, JIT_A);
+        break;
+    case JIT_OP_PHP:
+        JIT_mov(c, JIT_RAX, JIT_P);
+        JIT_alu_imm(c, JIT_OR, JIT_RAX, CPU_FLAGS_B | CPU_FLAGS_U);
+        JIT_push(c, JIT_RAX);
+        break;
+    case JIT_OP_PLA:
+        JIT_pull(c);
+        JIT_mov(c, JIT_S, JIT_RSI);
+        JIT_mov(c, JIT_A, JIT_RAX);
+        JIT_set_nz(c, JIT_A);
+        break;
+    case JIT_OP_PLP:
+        JIT_pull(c);
+        JIT_mov(c, JIT_S, JIT_RSI);
+        JIT_alu_imm(c, JIT_AND, JIT_RAX, (uint8_t)~CPU_FLAGS_B);
+        JIT_alu_imm(c, JIT_OR, JIT_RAX, CPU_FLAGS_U);
+        JIT_mov(c, JIT_P, JIT_RAX);
+        break;
+    case JIT_OP_BCC:
+    case JIT_OP_BCS:
+    case JIT_OP_BEQ:
+    case JIT_OP_BMI:
+    case JIT_OP_BNE:
+    case JIT_OP_BPL:
+    case JIT_OP_BVC:
+    case JIT_OP_BVS:
+        JIT_branch(c, insn);
+        return;
+    case JIT_OP_JMP:
+        if (insn->am == JIT_AM_ABS) {
+            c->pending += insn->cycles;
+            JIT_flush_cycles(c);
+            JIT_jump(c, JIT_jmp(c), insn->operand, 0);
+            return;
+        }
+        {
+            // The pointer's high byte comes from the start of its page when the
+            // low byte is at its end
+            JIT_ADDR addr = {.page = insn->operand >> 8, .low = JIT_NONE};
+            JIT_page_pointer(c, &addr, offsetof(BUS_PAGE, read), JIT_RDX);
+            JIT_load_byte(c, JIT_RAX, JIT_RDX, JIT_NONE, insn->operand & 0xFF);
+            JIT_load_byte(c, JIT_RCX, JIT_RDX, JIT_NONE, (insn->operand + 1) & 0xFF);
+            JIT_shift(c, JIT_SHL, JIT_RCX, 8);
+            JIT_alu(c, JIT_OR, JIT_RAX, JIT_RCX);
+            JIT_store_pc(c, JIT_RAX, 0);
+            c->pending += insn->cycles;
+            JIT_exit_to_epilogue(c);
+        }
+        return;
+    case JIT_OP_JSR: {
+        // Pushes the address of the last byte of the instruction
+        uint16_t ret = insn->next_pc - 1;
+        JIT_page_pointer(c, &JIT_STACK, offsetof(BUS_PAGE, write), JIT_RDX);
+        JIT_rm(c, false, 0xC6, 0, JIT_RDX, JIT_S, 0, JIT_NONE);
+        JIT_byte(c, ret >> 8);
+        JIT_stack_decrement(c);
+        JIT_rm(c, false, 0xC6, 0, JIT_RDX, JIT_S, 0, JIT_NONE);
+        JIT_byte(c, ret & 0xFF);
+        JIT_stack_decrement(c);
+        JIT_load_pointer(c, JIT_RDX, JIT_PAGES, JIT_NONE, JIT_page_field(&JIT_STACK, offsetof(BUS_PAGE, generation)));
+        JIT_rm(c, true, 0xFF, 0, JIT_RDX, JIT_NONE, 0, JIT_NONE);
+        JIT_rm(c, true, 0xFF, 0, JIT_RDX, JIT_NONE, 0, JIT_NONE);
+        c->pending += insn->cycles;
+        JIT_exit_static(c, insn->operand);
+        return;
+    }
+    case JIT_OP_RTS:
+        JIT_pull(c);
+        JIT_mov(c, JIT_RCX, JIT_RAX);
+        JIT_alu_imm(c, JIT_ADD, JIT_RSI, 1);
+        JIT_alu_imm(c, JIT_AND, JIT_RSI, 0xFF);
+        JIT_load_byte(c, JIT_RAX, JIT_RDX, JIT_RSI, 0);
+        JIT_mov(c, JIT_S, JIT_RSI);
+        JIT_shift(c, JIT_SHL, JIT_RAX, 8);
+        JIT_alu(c, JIT_OR, JIT_RAX, JIT_RCX);
+        JIT_alu_imm(c, JIT_ADD, JIT_RAX, 1);
+        JIT_store_pc(c, JIT_RAX, 0);
+        c->pending += insn->cycles;
+        JIT_exit_to_epilogue(c);
+        return;
+    default:
+        PANIC_FMT("JIT cannot compile operation %d!", insn->op);
+    }
+    c->pending += insn->cycles;
+}
+
+// Decoding
+
+static size_t JIT_operand_size(uint8_t am) {
+    switch (am) {
+    case JIT_AM_IMP:
+        return 0;
+    case JIT_AM_ABS:
+    case JIT_AM_ABX:
+    case JIT_AM_ABY:
+    case JIT_AM_IND:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+static bool JIT_ends_block(uint8_t op) {
+    // CLI and PLP may enable a pending IRQ, which is taken after them
+    return op == JIT_OP_JMP || op == JIT_OP_JSR || op == JIT_OP_RTS || op == JIT_OP_CLI || op == JIT_OP_PLP;
+}
+
+// Operations with an access to a page that is I/O right now, or that the
+// compiler does not handle at all, end the block before them
+static bool JIT_compilable(const CPU *cpu, const JIT_OPCODE *opcode, uint16_t operand) {
+    switch (opcode->op) {
+    case JIT_OP_BRK:
+    case JIT_OP_RTI:
+    case JIT_OP_XXX:
+    case JIT_OP_DCP:
+    case JIT_OP_ISB:
+    case JIT_OP_SLO:
+    case JIT_OP_RLA:
+    case JIT_OP_SRE:
+    case JIT_OP_RRA:
+        return false;
+    }
+    const BUS_PAGE *pages = cpu->bus->pages;
+    bool store = opcode->op == JIT_OP_STA || opcode->op == JIT_OP_STX || opcode->op == JIT_OP_STY ||
+                 opcode->op == JIT_OP_SAX;
+    bool modify = opcode->op == JIT_OP_ASL || opcode->op == JIT_OP_LSR || opcode->op == JIT_OP_ROL ||
+                  opcode->op == JIT_OP_ROR || opcode->op == JIT_OP_INC || opcode->op == JIT_OP_DEC;
+    switch (opcode->am) {
+    case JIT_AM_ABS:
+        if (opcode->op == JIT_OP_JMP || opcode->op == JIT_OP_JSR) return true;
+        if (store || modify) {
+            if (!pages[operand >> 8].write) return false;
+            if (store) return true;
+        }
+        return pages[operand >> 8].read != NULL;
+    case JIT_AM_IND:
+        return pages[operand >> 8].read != NULL;
+    case JIT_AM_ZP0:
+    case JIT_AM_ZPX:
+    case JIT_AM_ZPY:
+    case JIT_AM_IZX:
+    case JIT_AM_IZY:
+        return pages[0].read != NULL;
+    default:
+        return true;
+    }
+}
+
+// Decodes the run of instructions at pc into the compiler, returns their size
+// in bytes
+static size_t JIT_decode(JIT_COMPILER *c, uint16_t pc) {
+    const BUS_PAGE *page = &c->cpu->bus->pages[pc >> 8];
+    c->count = 0;
+    if (!page->read) return 0;
+
+    size_t offset = pc & 0xFF;
+    while (c->count < JIT_MAX_INSNS) {
+        const uint8_t *mem = page->read + offset;
+        const JIT_OPCODE *opcode = &JIT_OPCODES[mem[0]];
+        size_t operand_size = JIT_operand_size(opcode->am);
+        if (offset + 1 + operand_size > BUS_PAGE_SIZE) break;
+        uint16_t operand = operand_size == 2 ? (mem[1] | (mem[2] << 8)) : operand_size ? mem[1] : 0;
+        if (!JIT_compilable(c->cpu, opcode, operand)) break;
+
+        JIT_INSN *insn = &c->insns[c->count++];
+        insn->pc = (pc & 0xFF00) | offset;
+        insn->next_pc = insn->pc + 1 + operand_size;
+        insn->operand = operand;
+        insn->op = opcode->op;
+        insn->am = opcode->am;
+        insn->cycles = opcode->cycles;
+        insn->target = false;
+
+        offset += 1 + operand_size;
+        if (JIT_ends_block(opcode->op) || offset == BUS_PAGE_SIZE) break;
+    }
+    return offset - (pc & 0xFF);
+}
+
+static bool JIT_is_branch(uint8_t am) {
+    return am == JIT_AM_REL;
+}
+
+// Most cycles one pass over the block can take
+static uint16_t JIT_max_cycles(const JIT_COMPILER *c) {
+    uint16_t cycles = 0;
+    for (size_t i = 0; i < c->count; i++) {
+        const JIT_INSN *insn = &c->insns[i];
+        cycles += insn->cycles;
+        if (JIT_is_branch(insn->am)) cycles += 2;
+        if ((insn->am == JIT_AM_ABX || insn->am == JIT_AM_ABY || insn->am == JIT_AM_IZY) &&
+            JIT_page_penalty(insn->op)) {
+            cycles += 1;
+        }
+    }
+    return cycles;
+}
+
+// Code generation
+
+static void JIT_prologue(JIT_COMPILER *c) {
+    JIT_host_push(c, JIT_RBX);
+    JIT_host_push(c, JIT_RBP);
+    JIT_host_push(c, JIT_R12);
+    JIT_host_push(c, JIT_R13);
+    JIT_host_push(c, JIT_R14);
+    JIT_host_push(c, JIT_R15);
+    JIT_rr(c, true, 0x89, JIT_RDI, JIT_CPU, JIT_NONE);
+    JIT_rr(c, true, 0x89, JIT_RSI, JIT_BUDGET, JIT_NONE);
+    JIT_load_byte(c, JIT_A, JIT_CPU, JIT_NONE, offsetof(CPU, reg.A));
+    JIT_load_byte(c, JIT_X, JIT_CPU, JIT_NONE, offsetof(CPU, reg.X));
+    JIT_load_byte(c, JIT_Y, JIT_CPU, JIT_NONE, offsetof(CPU, reg.Y));
+    JIT_load_byte(c, JIT_S, JIT_CPU, JIT_NONE, offsetof(CPU, reg.SP));
+    JIT_load_byte(c, JIT_P, JIT_CPU, JIT_NONE, offsetof(CPU, reg.STATUS));
+    JIT_load_pointer(c, JIT_PAGES, JIT_CPU, JIT_NONE, offsetof(CPU, bus));
+    JIT_mov_imm64(c, JIT_NZ_TABLE, (uint64_t)(uintptr_t)JIT_NZ);
+    JIT_alu(c, JIT_XOR, JIT_CYCLES, JIT_CYCLES);
+}
+
+static void JIT_epilogue(JIT_COMPILER *c) {
+    JIT_store_byte(c, JIT_A, JIT_CPU, JIT_NONE, offsetof(CPU, reg.A));
+    JIT_store_byte(c, JIT_X, JIT_CPU, JIT_NONE, offsetof(CPU, reg.X));
+    JIT_store_byte(c, JIT_Y, JIT_CPU, JIT_NONE, offsetof(CPU, reg.Y));
+    JIT_store_byte(c, JIT_S, JIT_CPU, JIT_NONE, offsetof(CPU, reg.SP));
+    JIT_store_byte(c, JIT_P, JIT_CPU, JIT_NONE, offsetof(CPU, reg.STATUS));
+    JIT_mov(c, JIT_RAX, JIT_CYCLES);
+    JIT_host_pop(c, JIT_R15);
+    JIT_host_pop(c, JIT_R14);
+    JIT_host_pop(c, JIT_R13);
+    JIT_host_pop(c, JIT_R12);
+    JIT_host_pop(c, JIT_RBP);
+    JIT_host_pop(c, JIT_RBX);
+    JIT_byte(c, 0xC3);
+}
+
+static void JIT_generate(JIT_COMPILER *c) {
+    // Branch targets inside the block become labels
+    for (size_t i = 0; i < c->count; i++) {
+        const JIT_INSN *insn = &c->insns[i];
+        uint16_t target;
+        if (JIT_is_branch(insn->am)) {
+            target = insn->next_pc + JIT_sign_extend(insn->operand);
+        } else if (insn->op == JIT_OP_JMP && insn->am == JIT_AM_ABS) {
+            target = insn->operand;
+        } else {
+            continue;
+        }
+        int index = JIT_find_insn(c, target);
+        if (index != JIT_NONE) c->insns[index].target = true;
+    }
+
+    JIT_prologue(c);
+    for (c->current = 0; c->current < c->count; c->current++) {
+        JIT_INSN *insn = &c->insns[c->current];
+        if (insn->target) JIT_flush_cycles(c);
+        insn->label = c->size;
+        JIT_emit_insn(c, insn);
+    }
+    const JIT_INSN *last = &c->insns[c->count - 1];
+    if (!JIT_ends_block(last->op) || last->op == JIT_OP_CLI || last->op == JIT_OP_PLP) {
+        JIT_exit_static(c, last->next_pc);
+    }
+
+    size_t epilogue = c->size;
+    JIT_epilogue(c);
+    for (size_t i = 0; i < c->epilogue_jump_count; i++) {
+        JIT_patch(c, c->epilogue_jumps[i], epilogue);
+    }
+
+    // Jumps inside the block, backward ones only while the budget allows a
+    // whole further pass
+    for (size_t i = 0; i < c->jump_count; i++) {
+        const JIT_JUMP *jump = &c->jumps[i];
+        const JIT_INSN *target = &c->insns[jump->insn];
+        JIT_patch(c, jump->patch, c->size);
+        if (jump->cycles) JIT_alu_imm(c, JIT_ADD, JIT_CYCLES, jump->cycles);
+        if (jump->backward) {
+            JIT_rm(c, true, 0x8D, JIT_RAX, JIT_CYCLES, JIT_NONE, c->block->max_cycles, JIT_NONE);
+            JIT_rr(c, true, 0x39, JIT_BUDGET, JIT_RAX, JIT_NONE);
+            JIT_exit_to(c, JIT_jcc(c, JIT_CC_A), target->pc, 0, false);
+        }
+        JIT_patch(c, JIT_jmp(c), target->label);
+    }
+
+    // Exit stubs
+    for (size_t i = 0; i < c->exit_count; i++) {
+        const JIT_EXIT *exit = &c->exits[i];
+        JIT_patch(c, exit->patch, c->size);
+        if (exit->cycles) JIT_alu_imm(c, JIT_ADD, JIT_CYCLES, exit->cycles);
+        JIT_store_pc(c, JIT_NONE, exit->pc);
+        if (exit->side_exit) {
+            JIT_mov_imm64(c, JIT_RAX, (uint64_t)(uintptr_t)&c->block->side_exits);
+            JIT_rm(c, false, 0xFF, 0, JIT_RAX, JIT_NONE, 0, JIT_NONE);
+        }
+        JIT_patch(c, JIT_jmp(c), epilogue);
+    }
+}
+
+// Blocks
+
+static JIT_BLOCK *JIT_slot(JIT *jit, uint16_t pc) {
+    return &jit->blocks[((pc * 2654435761u) >> 16) & (jit->capacity - 1)];
+}
+
+static void JIT_claim(const CPU *cpu, JIT_BLOCK *block, uint16_t pc) {
+    const BUS_PAGE *page = &cpu->bus->pages[pc >> 8];
+    memset(block, 0, sizeof(*block));
+    block->pc = pc;
+    block->used = true;
+    block->state = JIT_BLOCK_COLD;
+    block->generation = page->generation;
+    block->compiled_generation = *page->generation;
+}
+
+static bool JIT_compile(JIT *jit, CPU *cpu, JIT_BLOCK *block) {
+    if (jit->arena_size - jit->arena_used < JIT_MAX_BLOCK_SIZE) {
+        uint16_t pc = block->pc;
+        JIT_flush(jit);
+        jit->flushes += 1;
+        JIT_claim(cpu, block, pc);
+    }
+
+    static JIT_COMPILER compiler;
+    JIT_COMPILER *c = &compiler;
+    c->cpu = cpu;
+    c->block = block;
+    c->code = jit->arena + jit->arena_used;
+    c->size = 0;
+    c->pending = 0;
+    c->exit_count = 0;
+    c->jump_count = 0;
+    c->epilogue_jump_count = 0;
+
+    const BUS_PAGE *page = &cpu->bus->pages[block->pc >> 8];
+    block->generation = page->generation;
+    block->compiled_generation = *page->generation;
+    block->size = (uint16_t)JIT_decode(c, block->pc);
+    if (!c->count) return false;
+    block->max_cycles = JIT_max_cycles(c);
+
+    JIT_generate(c);
+    if (c->size + block->size > JIT_MAX_BLOCK_SIZE) PANIC("JIT block overflowed its arena space!");
+    // The 6502 code it was compiled from follows, to revalidate against
+    block->source = c->code + c->size;
+    memcpy(c->code + c->size, page->read + (block->pc & 0xFF), block->size);
+    c->size += block->size;
+
+    block->code = (JIT_BlockFunc)(void *)c->code;
+    block->state = JIT_BLOCK_COMPILED;
+    block->entries = 0;
+    block->side_exits = 0;
+    jit->arena_used += (c->size + 15) & ~(size_t)15;
+    jit->compiles += 1;
+    return true;
+}
+
+// The block's page was written to or remapped. Code whose bytes are unchanged
+// stays, as after a bank switch back and forth.
+static void JIT_revalidate(const CPU *cpu, JIT_BLOCK *block) {
+    const BUS_PAGE *page = &cpu->bus->pages[block->pc >> 8];
+    bool same_code = block->state == JIT_BLOCK_COMPILED && page->generation == block->generation && page->read &&
+                     memcmp(page->read + (block->pc & 0xFF), block->source, block->size) == 0;
+    block->generation = page->generation;
+    block->compiled_generation = *page->generation;
+    if (same_code || block->state == JIT_BLOCK_COLD) return;
+
+    if (block->recompiles == JIT_MAX_RECOMPILES) {
+        block->state = JIT_BLOCK_INTERPRET;
+        return;
+    }
+    block->recompiles += 1;
+    block->state = JIT_BLOCK_COLD;
+    block->entries = 0;
+}
+
+bool JIT_init(JIT *jit, size_t arena_size) {
+    memset(jit, 0, sizeof(*jit));
+    void *arena = mmap(NULL, arena_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        fprintf(stderr, "Could not map %zu bytes of executable memory for the JIT\n", arena_size);
+        return false;
+    }
+    jit->arena = arena;
+    jit->arena_size = arena_size;
+    jit->capacity = JIT_DEFAULT_CAPACITY;
+    jit->blocks = calloc(jit->capacity, sizeof(JIT_BLOCK));
+    if (!jit->blocks) {
+        PANIC("Out of memory allocating JIT blocks!");
+    }
+    jit->hot_threshold = JIT_DEFAULT_HOT_THRESHOLD;
+
+    for (size_t value = 0; value < 256; value++) {
+        JIT_NZ[value] = (value & CPU_FLAGS_N) | (value == 0 ? CPU_FLAGS_Z : 0);
+    }
+    return true;
+}
+
+void JIT_free(JIT *jit) {
+    if (jit->arena) munmap(jit->arena, jit->arena_size);
+    free(jit->blocks);
+    memset(jit, 0, sizeof(*jit));
+}
+
+void JIT_flush(JIT *jit) {
+    memset(jit->blocks, 0, jit->capacity * sizeof(JIT_BLOCK));
+    jit->arena_used = 0;
+    jit->fallthrough = false;
+}
+
+// Leaves the instruction at pc to the interpreter, returns 0 for JIT_execute.
+// Inside a block that is going to be compiled, the instructions it continues
+// with in a straight line are no block entries of their own.
+static size_t JIT_interpret(JIT *jit, const CPU *cpu, uint16_t pc, bool within_block) {
+    const BUS_PAGE *page = &cpu->bus->pages[pc >> 8];
+    jit->fallthrough = false;
+    if (!within_block || !page->read) return 0;
+
+    const JIT_OPCODE *opcode = &JIT_OPCODES[page->read[pc & 0xFF]];
+    uint16_t next_pc = pc + 1 + JIT_operand_size(opcode->am);
+    if (!JIT_ends_block(opcode->op) && (next_pc >> 8) == (pc >> 8)) {
+        jit->fallthrough = true;
+        jit->fallthrough_pc = next_pc;
+    }
+    return 0;
+}
+
+size_t JIT_execute(JIT *jit, CPU *cpu, size_t budget) {
+    uint16_t pc = cpu->reg.PC;
+    JIT_BLOCK *block = JIT_slot(jit, pc);
+    bool entry = !jit->fallthrough || pc != jit->fallthrough_pc;
+    if (!block->used || block->pc != pc) {
+        // Claiming every address of a straight run would only thrash the table
+        if (!entry) return JIT_interpret(jit, cpu, pc, true);
+        JIT_claim(cpu, block, pc);
+    }
+    if (*block->generation != block->compiled_generation) JIT_revalidate(cpu, block);
+
+    switch (block->state) {
+    case JIT_BLOCK_COLD:
+        if (!entry || ++block->entries < jit->hot_threshold) return JIT_interpret(jit, cpu, pc, true);
+        if (!JIT_compile(jit, cpu, block)) {
+            block->state = JIT_BLOCK_INTERPRET;
+            return JIT_interpret(jit, cpu, pc, false);
+        }
+        break;
+    case JIT_BLOCK_INTERPRET:
+        return JIT_interpret(jit, cpu, pc, false);
+    }
+    if (block->max_cycles > budget) return JIT_interpret(jit, cpu, pc, true);
+
+    jit->fallthrough = false;
+    block->entries += 1;
+    // Compiled code keeps the whole status register in a host register
+    cpu->reg.STATUS = CPU_get_status(cpu);
+    size_t cycles = block->code(cpu, budget);
+    CPU_set_status(cpu, cpu->reg.STATUS);
+    jit->cycles += cycles;
+
+    // Mostly leaving through I/O side exits is slower than interpreting
+    if (block->side_exits >= JIT_MIN_SIDE_EXITS && block->side_exits * 2 > block->entries) {
+        block->state = JIT_BLOCK_INTERPRET;
+    }
+    return cycles;
+}
+
+#else
+
+bool JIT_init(JIT *jit, size_t arena_size) {
+    memset(jit, 0, sizeof(*jit));
+    return false;
+}
+
+void JIT_free(JIT *jit) {
+}
+
+void JIT_flush(JIT *jit) {
+}
+
+size_t JIT_execute(JIT *jit, struct CPU *cpu, size_t budget) {
+    return 0;
+}
+
+#endif // NES_JIT
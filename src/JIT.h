@@ -0,0 +1,72 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JIT_DEFAULT_ARENA_SIZE (4 << 20)
+#define JIT_DEFAULT_CAPACITY 4096
+// Entries into a block before it is compiled
+#define JIT_DEFAULT_HOT_THRESHOLD 16
+#define JIT_MAX_INSNS 64
+
+struct CPU;
+
+// Runs compiled code for at most budget cycles, returns the cycles it consumed
+typedef uint32_t (*JIT_BlockFunc)(struct CPU *cpu, uint64_t budget);
+
+typedef enum {
+    JIT_BLOCK_COLD,      // counting entries towards the hot threshold
+    JIT_BLOCK_COMPILED,  // code is valid while the page generation matches
+    JIT_BLOCK_INTERPRET, // not worth compiling, left to the interpreter
+} JIT_BLOCK_STATE;
+
+// Code compiled from a run of instructions within one page, keyed by its start
+// address like the block cache
+typedef struct {
+    uint16_t pc;
+    bool used;
+    uint8_t state;
+    uint16_t max_cycles; // upper bound of one pass, checked against the budget
+    uint8_t recompiles;  // times the page was written to since first compiled
+    uint32_t entries;
+    uint32_t side_exits; // bumped by the compiled code on an I/O side exit
+    const uint64_t *generation;
+    uint64_t compiled_generation;
+    JIT_BlockFunc code;
+    const uint8_t *source; // copy of the 6502 code compiled, in the arena
+    uint16_t size;         // bytes of 6502 code compiled
+} JIT_BLOCK;
+
+typedef struct {
+    uint8_t *arena; // mapped read, write and execute
+    size_t arena_size;
+    size_t arena_used;
+    JIT_BLOCK *blocks;
+    size_t capacity;
+    uint32_t hot_threshold;
+    uint64_t compiles;
+    uint64_t flushes; // arena overflows, each throws away all code
+    uint64_t cycles;  // cycles run in compiled code
+    // Where the instruction left to the interpreter continues in a straight
+    // line, that is still inside its block and not a block entry
+    bool fallthrough;
+    uint16_t fallthrough_pc;
+} JIT;
+
+// Returns false when the recompiler is not built in (NES_JIT, x86-64 only) or
+// no executable memory could be mapped
+bool JIT_init(JIT *jit, size_t arena_size);
+void JIT_free(JIT *jit);
+// Throws away all compiled code
+void JIT_flush(JIT *jit);
+// Runs the block at the CPU's PC if it is compiled and fits in budget cycles,
+// compiling it once it is hot. Returns the cycles used, with the CPU state left
+// exactly as the interpreter would have it, or 0 when the interpreter has to
+// execute the next instruction instead.
+size_t JIT_execute(JIT *jit, struct CPU *cpu, size_t budget);
+
+#endif // JIT_H
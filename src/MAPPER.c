@@ -0,0 +1,272 @@
+#include <MAPPER.h>
+
+static void MAPPER_bus_write(void *ctx, uint16_t addr, uint8_t data) {
+    MAPPER *mapper = ctx;
+    mapper->write(mapper, addr, data);
+}
+
+static size_t MAPPER_prg_banks(MAPPER *mapper, size_t bank_size) {
+    size_t banks = mapper->cart->prg_rom_size / bank_size;
+    return banks ? banks : 1;
+}
+
+static size_t MAPPER_chr_size(MAPPER *mapper) {
+    return mapper->cart->chr_rom ? mapper->cart->chr_rom_size : mapper->cart->chr_ram_size;
+}
+
+static uint8_t *MAPPER_chr(MAPPER *mapper) {
+    return mapper->cart->chr_rom ? (uint8_t *)mapper->cart->chr_rom : mapper->cart->chr_ram;
+}
+
+// Maps 8KB PRG bank number bank into window (0-3 for $8000, $A000, $C000, $E000)
+static void MAPPER_map_prg_8k(MAPPER *mapper, size_t window, size_t bank) {
+    size_t banks = MAPPER_prg_banks(mapper, MAPPER_PRG_WINDOW_SIZE);
+    uint8_t *mem = (uint8_t *)mapper->cart->prg_rom + (bank % banks) * MAPPER_PRG_WINDOW_SIZE;
+    uint16_t addr = 0x8000 + window * MAPPER_PRG_WINDOW_SIZE;
+
+    if (mapper->bus->pages[addr >> 8].read == mem) return;
+    BUS_map_memory(mapper->bus, addr, MAPPER_PRG_WINDOW_SIZE, mem, MAPPER_PRG_WINDOW_SIZE, false);
+}
+
+static void MAPPER_map_prg_16k(MAPPER *mapper, size_t window, size_t bank) {
+    MAPPER_map_prg_8k(mapper, window * 2 + 0, bank * 2 + 0);
+    MAPPER_map_prg_8k(mapper, window * 2 + 1, bank * 2 + 1);
+}
+
+static void MAPPER_map_prg_32k(MAPPER *mapper, size_t bank) {
+    MAPPER_map_prg_16k(mapper, 0, bank * 2 + 0);
+    MAPPER_map_prg_16k(mapper, 1, bank * 2 + 1);
+}
+
+static void MAPPER_map_chr_1k(MAPPER *mapper, size_t window, size_t bank) {
+    size_t banks = MAPPER_chr_size(mapper) / MAPPER_CHR_WINDOW_SIZE;
+    mapper->chr_pages[window] = MAPPER_chr(mapper) + (bank % banks) * MAPPER_CHR_WINDOW_SIZE;
+}
+
+static void MAPPER_map_chr_4k(MAPPER *mapper, size_t window, size_t bank) {
+    for (size_t i = 0; i < 4; i++) {
+        MAPPER_map_chr_1k(mapper, window * 4 + i, bank * 4 + i);
+    }
+}
+
+static void MAPPER_map_chr_8k(MAPPER *mapper, size_t bank) {
+    MAPPER_map_chr_4k(mapper, 0, bank * 2 + 0);
+    MAPPER_map_chr_4k(mapper, 1, bank * 2 + 1);
+}
+
+// Mapper 0, NROM: fixed 16KB or 32KB PRG and 8KB CHR
+static void MAPPER_NROM_write(MAPPER *mapper, uint16_t addr, uint8_t data) {
+}
+
+static void MAPPER_NROM_sync(MAPPER *mapper) {
+    MAPPER_map_prg_32k(mapper, 0);
+    MAPPER_map_chr_8k(mapper, 0);
+}
+
+// Mapper 1, MMC1: 5 bit serial port, registers selected by address bits 13-14
+static void MAPPER_MMC1_sync(MAPPER *mapper) {
+    uint8_t control = mapper->regs[0];
+    uint8_t chr0 = mapper->regs[1];
+    uint8_t chr1 = mapper->regs[2];
+    uint8_t prg = mapper->regs[3] & 0x0F;
+
+    static const CART_MIRRORING mirroring[4] = {
+        CART_MIRRORING_SINGLE_LOW, CART_MIRRORING_SINGLE_HIGH, CART_MIRRORING_VERTICAL, CART_MIRRORING_HORIZONTAL};
+    mapper->mirroring = mirroring[control & 0x03];
+
+    // SUROM and friends use CHR bit 4 to select the 256KB half of PRG-ROM
+    size_t outer = (mapper->cart->prg_rom_size > 0x40000) ? (chr0 & 0x10) : 0;
+    size_t last = (MAPPER_prg_banks(mapper, CART_PRG_BANK_SIZE) - 1) & 0x0F;
+
+    switch ((control >> 2) & 0x03) {
+    case 0:
+    case 1:
+        MAPPER_map_prg_32k(mapper, (outer | prg) >> 1);
+        break;
+    case 2:
+        MAPPER_map_prg_16k(mapper, 0, outer);
+        MAPPER_map_prg_16k(mapper, 1, outer | prg);
+        break;
+    case 3:
+        MAPPER_map_prg_16k(mapper, 0, outer | prg);
+        MAPPER_map_prg_16k(mapper, 1, outer | last);
+        break;
+    }
+
+    if (control & 0x10) {
+        MAPPER_map_chr_4k(mapper, 0, chr0);
+        MAPPER_map_chr_4k(mapper, 1, chr1);
+    } else {
+        MAPPER_map_chr_8k(mapper, chr0 >> 1);
+    }
+}
+
+static void MAPPER_MMC1_write(MAPPER *mapper, uint16_t addr, uint8_t data) {
+    if (data & 0x80) {
+        mapper->shift = 0;
+        mapper->shift_count = 0;
+        mapper->regs[0] |= 0x0C;
+        MAPPER_MMC1_sync(mapper);
+        return;
+    }
+
+    mapper->shift |= (data & 0x01) << mapper->shift_count;
+    mapper->shift_count += 1;
+    if (mapper->shift_count < 5) return;
+
+    mapper->regs[(addr >> 13) & 0x03] = mapper->shift;
+    mapper->shift = 0;
+    mapper->shift_count = 0;
+    MAPPER_MMC1_sync(mapper);
+}
+
+// Mapper 2, UxROM: switchable 16KB at $8000, last bank fixed at $C000
+static void MAPPER_UXROM_sync(MAPPER *mapper) {
+    MAPPER_map_prg_16k(mapper, 0, mapper->bank_select);
+    MAPPER_map_prg_16k(mapper, 1, MAPPER_prg_banks(mapper, CART_PRG_BANK_SIZE) - 1);
+    MAPPER_map_chr_8k(mapper, 0);
+}
+
+static void MAPPER_UXROM_write(MAPPER *mapper, uint16_t addr, uint8_t data) {
+    mapper->bank_select = data;
+    MAPPER_map_prg_16k(mapper, 0, data);
+}
+
+// Mapper 3, CNROM: fixed PRG, switchable 8KB CHR
+static void MAPPER_CNROM_sync(MAPPER *mapper) {
+    MAPPER_map_prg_32k(mapper, 0);
+    MAPPER_map_chr_8k(mapper, mapper->bank_select);
+}
+
+static void MAPPER_CNROM_write(MAPPER *mapper, uint16_t addr, uint8_t data) {
+    mapper->bank_select = data;
+    MAPPER_map_chr_8k(mapper, data);
+}
+
+// Mapper 4, MMC3: 8KB PRG / 1KB and 2KB CHR banks and a scanline IRQ counter
+static void MAPPER_MMC3_sync(MAPPER *mapper) {
+    uint8_t *r = mapper->regs;
+    size_t second_last = MAPPER_prg_banks(mapper, MAPPER_PRG_WINDOW_SIZE) - 2;
+
+    if (mapper->bank_select & 0x40) {
+        MAPPER_map_prg_8k(mapper, 0, second_last);
+        MAPPER_map_prg_8k(mapper, 2, r[6]);
+    } else {
+        MAPPER_map_prg_8k(mapper, 0, r[6]);
+        MAPPER_map_prg_8k(mapper, 2, second_last);
+    }
+    MAPPER_map_prg_8k(mapper, 1, r[7]);
+    MAPPER_map_prg_8k(mapper, 3, second_last + 1);
+
+    // A12 inversion swaps the 2KB and 1KB halves of the pattern tables
+    size_t flip = (mapper->bank_select & 0x80) ? 4 : 0;
+    MAPPER_map_chr_1k(mapper, flip ^ 0, r[0] & 0xFE);
+    MAPPER_map_chr_1k(mapper, flip ^ 1, r[0] | 0x01);
+    MAPPER_map_chr_1k(mapper, flip ^ 2, r[1] & 0xFE);
+    MAPPER_map_chr_1k(mapper, flip ^ 3, r[1] | 0x01);
+    MAPPER_map_chr_1k(mapper, flip ^ 4, r[2]);
+    MAPPER_map_chr_1k(mapper, flip ^ 5, r[3]);
+    MAPPER_map_chr_1k(mapper, flip ^ 6, r[4]);
+    MAPPER_map_chr_1k(mapper, flip ^ 7, r[5]);
+}
+
+static void MAPPER_MMC3_write(MAPPER *mapper, uint16_t addr, uint8_t data) {
+    bool odd = addr & 0x0001;
+
+    switch (addr & 0xE000) {
+    case 0x8000:
+        if (odd) {
+            mapper->regs[mapper->bank_select & 0x07] = data;
+        } else {
+            mapper->bank_select = data;
+        }
+        MAPPER_MMC3_sync(mapper);
+        break;
+    case 0xA000:
+        if (!odd && mapper->cart->mirroring != CART_MIRRORING_FOUR_SCREEN) {
+            mapper->mirroring = (data & 0x01) ? CART_MIRRORING_HORIZONTAL : CART_MIRRORING_VERTICAL;
+        }
+        break;
+    case 0xC000:
+        if (odd) {
+            mapper->irq_counter = 0;
+            mapper->irq_reload = true;
+        } else {
+            mapper->irq_latch = data;
+        }
+        break;
+    case 0xE000:
+        mapper->irq_enabled = odd;
+        if (!odd) mapper->irq_pending = false;
+        break;
+    }
+}
+
+static void MAPPER_MMC3_scanline(MAPPER *mapper) {
+    if (mapper->irq_counter == 0 || mapper->irq_reload) {
+        mapper->irq_counter = mapper->irq_latch;
+        mapper->irq_reload = false;
+    } else {
+        mapper->irq_counter -= 1;
+    }
+
+    if (mapper->irq_counter == 0 && mapper->irq_enabled) {
+        mapper->irq_pending = true;
+    }
+}
+
+bool MAPPER_init(MAPPER *mapper, CART *cart, BUS *bus) {
+    memset(mapper, 0, sizeof(*mapper));
+    mapper->id = cart->mapper_id;
+    mapper->cart = cart;
+    mapper->bus = bus;
+    mapper->chr_writable = cart->chr_rom == NULL;
+    mapper->mirroring = cart->mirroring;
+
+    switch (mapper->id) {
+    case 0:
+        mapper->write = MAPPER_NROM_write;
+        mapper->sync = MAPPER_NROM_sync;
+        break;
+    case 1:
+        mapper->write = MAPPER_MMC1_write;
+        mapper->sync = MAPPER_MMC1_sync;
+        mapper->regs[0] = 0x0C;
+        break;
+    case 2:
+        mapper->write = MAPPER_UXROM_write;
+        mapper->sync = MAPPER_UXROM_sync;
+        break;
+    case 3:
+        mapper->write = MAPPER_CNROM_write;
+        mapper->sync = MAPPER_CNROM_sync;
+        break;
+    case 4:
+        mapper->write = MAPPER_MMC3_write;
+        mapper->sync = MAPPER_MMC3_sync;
+        mapper->scanline = MAPPER_MMC3_scanline;
+        break;
+    default:
+        fprintf(stderr, "Unsupported mapper %d\n", mapper->id);
+        return false;
+    }
+
+    // Writes to the ROM area reach the board, reads go straight to the banks
+    BUS_map_io(bus, 0x8000, 0x8000, NULL, MAPPER_bus_write, mapper);
+    if (cart->prg_ram) {
+        BUS_map_memory(bus, 0x6000, 0x2000, cart->prg_ram, cart->prg_ram_size, true);
+    }
+
+    mapper->sync(mapper);
+
+    return true;
+}
+
+void MAPPER_save_state(const MAPPER *mapper, STATE *state) {
+    STATE_write(state, &mapper->mirroring, STATE_BLOCK_SIZE(MAPPER, mirroring));
+}
+
+void MAPPER_load_state(MAPPER *mapper, STATE *state) {
+    STATE_read(state, &mapper->mirroring, STATE_BLOCK_SIZE(MAPPER, mirroring));
+    mapper->sync(mapper);
+}
@@ -0,0 +1,73 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include <BUS.h>
+#include <CART.h>
+#include <STATE.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAPPER_PRG_WINDOW_SIZE 8192 // 8 * 1024, $8000-$FFFF is 4 windows
+#define MAPPER_PRG_WINDOWS 4
+#define MAPPER_CHR_WINDOW_SIZE 1024 // PPU $0000-$1FFF is 8 windows
+#define MAPPER_CHR_WINDOWS 8
+
+typedef struct MAPPER MAPPER;
+
+// Register writes to $8000-$FFFF
+typedef void (*MAPPER_WriteFunc)(MAPPER *mapper, uint16_t addr, uint8_t data);
+// Rebuilds every bank mapping from the board registers
+typedef void (*MAPPER_SyncFunc)(MAPPER *mapper);
+// Clocked once per rendered scanline by the PPU (PPU A12 rising edge)
+typedef void (*MAPPER_ScanlineFunc)(MAPPER *mapper);
+
+// Board logic on top of a CART. Bank switching only swaps the host pointers in
+// the BUS page table and chr_pages, bank contents are never copied. All board
+// state lives in the plain register fields below so it can be saved and the
+// mappings rebuilt through sync.
+struct MAPPER {
+    uint16_t id;
+    CART *cart;
+    BUS *bus;
+
+    MAPPER_WriteFunc write;
+    MAPPER_SyncFunc sync;
+    MAPPER_ScanlineFunc scanline; // NULL for boards without a scanline counter
+
+    // CHR address space of the PPU in 1KB windows
+    uint8_t *chr_pages[MAPPER_CHR_WINDOWS];
+    bool chr_writable;
+
+    // Everything from here on is saved as one block
+    CART_MIRRORING mirroring;
+
+    // Board registers, meaning depends on the board
+    uint8_t regs[8];      // MMC1 control/chr0/chr1/prg, MMC3 R0-R7
+    uint8_t bank_select;  // MMC3 $8000, UxROM and CNROM bank latch
+    uint8_t shift;        // MMC1 serial shift register
+    uint8_t shift_count;  // MMC1 bits written so far
+    uint8_t irq_latch;    // MMC3 scanline counter reload value
+    uint8_t irq_counter;  // MMC3 scanline counter
+    bool irq_reload;
+    bool irq_enabled;
+    bool irq_pending;     // IRQ line, polled by the console
+};
+
+// Sets up the board for cart->mapper_id and maps PRG/CHR into bus, returns
+// false and prints the reason to stderr for unsupported boards
+bool MAPPER_init(MAPPER *mapper, CART *cart, BUS *bus);
+
+// Board registers only, loading rebuilds the mappings through sync
+void MAPPER_save_state(const MAPPER *mapper, STATE *state);
+void MAPPER_load_state(MAPPER *mapper, STATE *state);
+
+static inline void MAPPER_clock_scanline(MAPPER *mapper) {
+    if (mapper->scanline) {
+        mapper->scanline(mapper);
+    }
+}
+
+#endif // MAPPER_H
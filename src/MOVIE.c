@@ -0,0 +1,126 @@
+#include <MOVIE.h>
+
+// FM2 writes the buttons as RLDUTSBA, the reverse of the shift order
+static const char MOVIE_BUTTON_CHARS[8] = {'R', 'L', 'D', 'U', 'T', 'S', 'B', 'A'};
+
+static uint8_t MOVIE_parse_pad(const char *field, size_t length) {
+    uint8_t buttons = 0;
+    for (size_t i = 0; i < length && i < 8; i++) {
+        if (field[i] != '.' && field[i] != ' ') {
+            buttons |= 1 << (7 - i);
+        }
+    }
+    return buttons;
+}
+
+static void MOVIE_parse_frame(MOVIE_FRAME *frame, const char *line) {
+    memset(frame, 0, sizeof(*frame));
+    frame->commands = strtoul(line + 1, NULL, 10);
+
+    // One field per port after the command field
+    const char *field = strchr(line + 1, '|');
+    for (size_t port = 0; field && port < NES_CONTROLLER_PORTS; port++) {
+        const char *end = strchr(field + 1, '|');
+        size_t length = end ? (size_t)(end - field - 1) : strcspn(field + 1, "\r\n");
+        frame->buttons[port] = MOVIE_parse_pad(field + 1, length);
+        field = end;
+    }
+}
+
+void MOVIE_append(MOVIE *movie, const uint8_t *buttons, uint8_t commands) {
+    if (movie->frame_count == movie->capacity) {
+        movie->capacity = movie->capacity ? movie->capacity * 2 : 1024;
+        movie->frames = realloc(movie->frames, movie->capacity * sizeof(MOVIE_FRAME));
+        if (!movie->frames) {
+            PANIC("Out of memory growing the movie!");
+        }
+    }
+
+    MOVIE_FRAME *frame = &movie->frames[movie->frame_count++];
+    memcpy(frame->buttons, buttons, sizeof(frame->buttons));
+    frame->commands = commands;
+}
+
+bool MOVIE_load(MOVIE *movie, const char *path) {
+    memset(movie, 0, sizeof(*movie));
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open movie '%s'\n", path);
+        return false;
+    }
+
+    char line[MOVIE_LINE_SIZE];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] != '|') continue;
+
+        MOVIE_FRAME frame;
+        MOVIE_parse_frame(&frame, line);
+        MOVIE_append(movie, frame.buttons, frame.commands);
+    }
+
+    fclose(file);
+    return true;
+}
+
+bool MOVIE_save(const MOVIE *movie, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "Could not open movie '%s' for writing\n", path);
+        return false;
+    }
+
+    fprintf(file, "version 3\n");
+    for (size_t i = 0; i < movie->frame_count; i++) {
+        const MOVIE_FRAME *frame = &movie->frames[i];
+        fprintf(file, "|%d|", frame->commands);
+        for (size_t port = 0; port < NES_CONTROLLER_PORTS; port++) {
+            for (size_t b = 0; b < 8; b++) {
+                fputc((frame->buttons[port] & (1 << (7 - b))) ? MOVIE_BUTTON_CHARS[b] : '.', file);
+            }
+            fputc('|', file);
+        }
+        fputc('\n', file);
+    }
+
+    bool ok = !ferror(file);
+    if (fclose(file) != 0) ok = false;
+    if (!ok) fprintf(stderr, "Could not write movie '%s'\n", path);
+    return ok;
+}
+
+void MOVIE_free(MOVIE *movie) {
+    free(movie->frames);
+    memset(movie, 0, sizeof(*movie));
+}
+
+void MOVIE_apply_frame(const MOVIE *movie, NES *nes, size_t frame) {
+    if (frame >= movie->frame_count) {
+        memset(nes->controller, 0, sizeof(nes->controller));
+        return;
+    }
+
+    const MOVIE_FRAME *input = &movie->frames[frame];
+    if (input->commands & MOVIE_COMMAND_POWER) {
+        NES_power(nes);
+    } else if (input->commands & MOVIE_COMMAND_RESET) {
+        NES_reset(nes);
+    }
+    memcpy(nes->controller, input->buttons, sizeof(nes->controller));
+}
+
+void MOVIE_play(const MOVIE *movie, NES *nes, size_t first, size_t count, size_t render_interval,
+                MOVIE_FrameFunc on_frame, void *ctx) {
+    for (size_t i = 0; i < count; i++) {
+        bool render = (i + 1 == count) || (render_interval && (i + 1) % render_interval == 0);
+        NES_set_fast_forward(nes, !render);
+
+        MOVIE_apply_frame(movie, nes, first + i);
+        NES_run_frame(nes);
+
+        if (render && on_frame) {
+            on_frame(ctx, nes, first + i);
+        }
+    }
+    NES_set_fast_forward(nes, false);
+}
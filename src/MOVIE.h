@@ -0,0 +1,56 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <NES.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOVIE_LINE_SIZE 256
+
+// Console commands issued at the start of a frame, same bits as FM2
+typedef enum {
+    MOVIE_COMMAND_RESET = (1 << 0),
+    MOVIE_COMMAND_POWER = (1 << 1)
+} MOVIE_COMMAND;
+
+typedef struct {
+    uint8_t buttons[NES_CONTROLLER_PORTS];
+    uint8_t commands;
+} MOVIE_FRAME;
+
+// Input per frame in the FM2 input log format: every line starting with '|'
+// is one frame "|commands|RLDUTSBA|RLDUTSBA|" where any character other than
+// '.' or ' ' marks a held button. Header lines are ignored when loading.
+typedef struct {
+    MOVIE_FRAME *frames;
+    size_t frame_count;
+    size_t capacity;
+} MOVIE;
+
+// Called after every fully rendered frame during MOVIE_play
+typedef void (*MOVIE_FrameFunc)(void *ctx, NES *nes, size_t frame);
+
+// Returns false and prints the reason to stderr if the file can not be read
+bool MOVIE_load(MOVIE *movie, const char *path);
+bool MOVIE_save(const MOVIE *movie, const char *path);
+void MOVIE_free(MOVIE *movie);
+
+// Appends one frame, for recording
+void MOVIE_append(MOVIE *movie, const uint8_t *buttons, uint8_t commands);
+
+// Issues the frame's commands and sets the controllers, nothing is held
+// after the end of the movie
+void MOVIE_apply_frame(const MOVIE *movie, NES *nes, size_t frame);
+
+// Plays frames [first, first + count). Only every render_interval-th frame
+// and the last one are rendered with audio, the rest run in fast-forward;
+// render_interval 0 renders only the last frame. The console ends up the same
+// either way, only the audio resampler remembers the skipped output.
+// on_frame may be NULL.
+void MOVIE_play(const MOVIE *movie, NES *nes, size_t first, size_t count, size_t render_interval,
+                MOVIE_FrameFunc on_frame, void *ctx);
+
+#endif // MOVIE_H
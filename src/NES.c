@@ -0,0 +1,411 @@
+#include <NES.h>
+
+static void NES_latch_controllers(NES *nes) {
+    for (size_t i = 0; i < NES_CONTROLLER_PORTS; i++) {
+        nes->controller_shift[i] = nes->controller[i];
+    }
+}
+
+// Serial controller port, after 8 reads only 1s are shifted out
+static uint8_t NES_read_controller(NES *nes, size_t port, bool read_only) {
+    if (nes->controller_strobe && !read_only) {
+        NES_latch_controllers(nes);
+    }
+
+    uint8_t data = (nes->controller_shift[port] & 0x01) | 0x40;
+    if (!read_only) {
+        nes->controller_shift[port] = (nes->controller_shift[port] >> 1) | 0x80;
+    }
+    return data;
+}
+
+// $4000-$40FF, APU registers, OAM DMA and controllers
+static uint8_t NES_io_read(void *ctx, uint16_t addr, bool read_only) {
+    NES *nes = ctx;
+
+    if (addr == 0x4015) {
+        return APU_read_register(&nes->apu, addr, read_only);
+    }
+    if (addr == 0x4016 || addr == 0x4017) {
+        return NES_read_controller(nes, addr - 0x4016, read_only);
+    }
+    return addr >> 8;
+}
+
+static void NES_io_write(void *ctx, uint16_t addr, uint8_t data) {
+    NES *nes = ctx;
+
+    if (addr <= 0x4013 || addr == 0x4015 || addr == 0x4017) {
+        APU_write_register(&nes->apu, addr, data);
+    } else if (addr == 0x4014) {
+        uint8_t page[BUS_PAGE_SIZE];
+        for (size_t i = 0; i < BUS_PAGE_SIZE; i++) {
+            page[i] = BUS_read(&nes->bus, (data << 8) | i, false);
+        }
+        if (nes->ppu_thread) {
+            PPU_THREAD_oam_dma(nes->ppu_thread, nes->cpu.clock_counter, page);
+        } else {
+            PPU_oam_dma(&nes->ppu, page);
+        }
+        CPU_stall(&nes->cpu, NES_OAM_DMA_CYCLES + (nes->cpu.clock_counter & 1));
+    } else if (addr == 0x4016) {
+        nes->controller_strobe = data & 0x01;
+        if (nes->controller_strobe) NES_latch_controllers(nes);
+    }
+}
+
+static void NES_schedule_ppu(NES *nes) {
+    nes->ppu_event = nes->ppu_clock + PPU_cycles_until_interrupt(&nes->ppu) + 1;
+}
+
+// The PPU is only run when something might see it: a register access or the
+// next event it scheduled. On its own thread it is waited for instead.
+static void NES_catch_up_ppu(NES *nes) {
+    size_t now = nes->cpu.clock_counter;
+    if (nes->ppu_thread) {
+        PPU_THREAD_sync(nes->ppu_thread, now);
+        nes->ppu_clock = now;
+    } else if (now > nes->ppu_clock) {
+        PPU_run(&nes->ppu, (now - nes->ppu_clock) * NES_PPU_DOTS_PER_CPU_CYCLE);
+        nes->ppu_clock = now;
+    }
+    NES_schedule_ppu(nes);
+}
+
+// $2002-$2007 writes change nothing the CPU or the scheduler looks at, the PPU
+// thread gets them queued. $2000 (NMI enable) and $2001 (rendering, which moves
+// the mapper clock) are written directly.
+static bool NES_is_queued_register(uint16_t addr) {
+    return addr >= 0x2000 && addr < 0x4000 && (addr & 0x0007) >= 0x0002;
+}
+
+// Bus hook, the CPU is about to touch a register. The PPU is brought up to the
+// start of the instruction and the burst ends after it, so whatever the access
+// changed is looked at before the next instruction. The PPU thread is left
+// running for queued writes and for the APU and controller ports.
+static void NES_bus_sync(void *ctx, uint16_t addr, bool write) {
+    NES *nes = ctx;
+    if (nes->ppu_thread) {
+        if (write && NES_is_queued_register(addr)) return;
+        if (addr >= 0x4000 && addr < 0x4000 + BUS_PAGE_SIZE) {
+            CPU_end_run(&nes->cpu);
+            return;
+        }
+        nes->ppu_dirty = true;
+    }
+    NES_catch_up_ppu(nes);
+    CPU_end_run(&nes->cpu);
+}
+
+// $2000-$3FFF, the PPU registers behind the queue while the PPU has a thread
+static uint8_t NES_ppu_read(void *ctx, uint16_t addr, bool read_only) {
+    NES *nes = ctx;
+    return PPU_read_register(&nes->ppu, addr, read_only);
+}
+
+static void NES_ppu_write(void *ctx, uint16_t addr, uint8_t data) {
+    NES *nes = ctx;
+    if (nes->ppu_thread && NES_is_queued_register(addr)) {
+        PPU_THREAD_write(nes->ppu_thread, nes->cpu.clock_counter, addr, data);
+    } else {
+        PPU_write_register(&nes->ppu, addr, data);
+    }
+}
+
+bool NES_init(NES *nes, const char *rom_path) {
+    if (!nes || !rom_path) {
+        PANIC("NULL POINTER in init!");
+    }
+
+    if (!CART_load(&nes->cart, rom_path)) {
+        return false;
+    }
+
+    BUS_init_nes(&nes->bus);
+    CPU_init(&nes->cpu, &nes->bus);
+    if (!MAPPER_init(&nes->mapper, &nes->cart, &nes->bus)) {
+        CART_unload(&nes->cart);
+        return false;
+    }
+    BLOCK_CACHE_init(&nes->block_cache, BLOCK_DEFAULT_CAPACITY);
+    CPU_set_block_cache(&nes->cpu, &nes->block_cache);
+    PPU_init(&nes->ppu, &nes->mapper, &nes->bus);
+    APU_init(&nes->apu, &nes->cpu, &nes->bus, APU_DEFAULT_SAMPLE_RATE);
+    nes->audio_samples = 0;
+    memset(nes->controller, 0, sizeof(nes->controller));
+    memset(nes->controller_shift, 0, sizeof(nes->controller_shift));
+    nes->controller_strobe = false;
+    nes->skip_idle_loops = true;
+    nes->idle_cycles = 0;
+    nes->ppu_thread = NULL;
+    nes->ppu_dirty = false;
+    BUS_map_io(&nes->bus, 0x4000, BUS_PAGE_SIZE, NES_io_read, NES_io_write, nes);
+    BUS_set_sync(&nes->bus, NES_bus_sync, nes);
+
+    NES_reset(nes);
+
+    return true;
+}
+
+void NES_free(NES *nes) {
+    NES_set_ppu_thread(nes, false);
+    APU_free(&nes->apu);
+    PPU_free(&nes->ppu);
+    BLOCK_CACHE_free(&nes->block_cache);
+    CART_unload(&nes->cart);
+}
+
+void NES_reset(NES *nes) {
+    // The PPU thread counts from the PPU's clock, it starts over with the new one
+    bool threaded = nes->ppu_thread != NULL;
+    NES_set_ppu_thread(nes, false);
+
+    PPU_reset(&nes->ppu);
+    CPU_reset(&nes->cpu);
+    APU_reset(&nes->apu);
+    nes->ppu_clock = nes->cpu.clock_counter;
+    NES_schedule_ppu(nes);
+
+    NES_set_ppu_thread(nes, threaded);
+}
+
+void NES_power(NES *nes) {
+    memset(nes->bus.ram, 0, nes->bus.ram_size);
+    CART_power(&nes->cart);
+    BUS_invalidate(&nes->bus);
+    // Can not fail, the board was accepted by NES_init
+    MAPPER_init(&nes->mapper, &nes->cart, &nes->bus);
+    PPU_power(&nes->ppu);
+
+    memset(nes->controller_shift, 0, sizeof(nes->controller_shift));
+    nes->controller_strobe = false;
+
+    NES_reset(nes);
+}
+
+void NES_set_fast_forward(NES *nes, bool enabled) {
+    nes->ppu.render = !enabled;
+    nes->apu.synthesize = !enabled;
+}
+
+bool NES_set_ppu_thread(NES *nes, bool enabled) {
+    if (enabled == (nes->ppu_thread != NULL)) {
+        return true;
+    }
+
+    if (!enabled) {
+        NES_catch_up_ppu(nes);
+        PPU_THREAD_stop(nes->ppu_thread);
+        free(nes->ppu_thread);
+        nes->ppu_thread = NULL;
+        return true;
+    }
+
+    PPU_THREAD *thread = malloc(sizeof(PPU_THREAD));
+    if (!thread) {
+        PANIC("Out of memory allocating the PPU thread!");
+    }
+    NES_catch_up_ppu(nes);
+    if (!PPU_THREAD_start(thread, &nes->ppu, nes->ppu_clock)) {
+        free(thread);
+        return false;
+    }
+    nes->ppu_thread = thread;
+    nes->ppu_dirty = false;
+    BUS_map_io(&nes->bus, 0x2000, 0x2000, NES_ppu_read, NES_ppu_write, nes);
+    return true;
+}
+
+// First CPU cycle at which the PPU or APU might interrupt or end the frame,
+// nothing else can change what the CPU sees without a register access
+static size_t NES_next_event(NES *nes) {
+    return nes->ppu_event < nes->apu.next_event ? nes->ppu_event : nes->apu.next_event;
+}
+
+// Catches everything up with the CPU and drives its interrupt lines. The PPU
+// thread is only waited for when one of its events is due or the CPU touched
+// the PPU or the mapper directly, otherwise it is told how far the CPU got:
+// until its next event it changes nothing read here.
+static void NES_sync(NES *nes) {
+    if (nes->ppu_thread && !nes->ppu_dirty && nes->cpu.clock_counter < nes->ppu_event) {
+        PPU_THREAD_run_to(nes->ppu_thread, nes->cpu.clock_counter);
+    } else {
+        NES_catch_up_ppu(nes);
+        nes->ppu_dirty = false;
+    }
+    if (nes->ppu.nmi) {
+        nes->ppu.nmi = false;
+        CPU_nmi(&nes->cpu);
+    }
+
+    // The APU catches itself up on register accesses, in between it only has
+    // to run when it might raise an IRQ
+    if (nes->cpu.clock_counter >= nes->apu.next_event) {
+        APU_run_until(&nes->apu, nes->cpu.clock_counter);
+    }
+    CPU_set_irq(&nes->cpu, CPU_IRQ_MAPPER, nes->mapper.irq_pending);
+    CPU_set_irq(&nes->cpu, CPU_IRQ_APU, APU_irq(&nes->apu));
+}
+
+size_t NES_step(NES *nes) {
+    size_t cycles = CPU_step_until(&nes->cpu, NES_next_event(nes));
+    NES_sync(nes);
+    // The caller may look at the PPU
+    if (nes->ppu_thread) NES_catch_up_ppu(nes);
+    return cycles;
+}
+
+// Idle loops
+// Games wait for VBlank or their NMI handler by polling $2002 or a flag in RAM.
+// One pass around such a loop is run for real, and when it changed nothing but
+// the clock the passes after it would do the same until the next event or the
+// next change of the PPU status flags. Those are skipped by only advancing the
+// clock.
+
+static bool NES_is_status_register(uint16_t addr) {
+    return addr >= 0x2000 && addr < 0x4000 && (addr & 0x0007) == 0x0002;
+}
+
+// Runs one pass around a polling loop at PC and skips the passes after it when
+// that is exact. Returns true when the console has to be synced before the CPU
+// goes on: passes were skipped, the deadline passed or the loop touched a
+// register other than $2002.
+static bool NES_skip_idle_loop(NES *nes, size_t deadline) {
+    CPU *cpu = &nes->cpu;
+    if (cpu->instrumented || cpu->nmi_pending || (cpu->irq_lines && !(cpu->reg.STATUS & CPU_FLAGS_I)) ||
+        !CPU_at_poll_loop(cpu)) {
+        return false;
+    }
+
+    REG reg = cpu->reg;
+    uint8_t status = CPU_get_status(cpu);
+    // The first step also pays for pending stalls such as DMC sample fetches,
+    // which are not part of a pass
+    size_t start = cpu->clock_counter + cpu->cycles;
+    size_t limit = deadline;
+    // Reading $2002 clears VBlank and the write toggle, a pass only repeats
+    // itself if those were already clear
+    bool quiet = true;
+    for (size_t i = 0; i < CPU_POLL_LOOP_MAX_INSNS; i++) {
+        uint8_t opcode = BUS_read(&nes->bus, cpu->reg.PC, true);
+        if (!CPU_poll_safe(opcode)) return false;
+
+        NES_catch_up_ppu(nes);
+        bool clear = !(nes->ppu.status & PPU_STATUS_VBLANK) && !nes->ppu.w;
+        size_t status_change = nes->ppu_clock + PPU_cycles_until_status_change(&nes->ppu) + 1;
+        CPU_step(cpu);
+
+        CPU_AMFunc am = OP_CODE_MATRIX[opcode].am;
+        if (am != CPU_AM_IMP && am != CPU_AM_IMM && am != CPU_AM_REL && !nes->bus.pages[cpu->addr_abs >> 8].read) {
+            if (!NES_is_status_register(cpu->addr_abs)) return true;
+            quiet = quiet && clear;
+            if (status_change < limit) limit = status_change;
+        }
+        if (cpu->clock_counter >= deadline) return true;
+        if (cpu->reg.PC == reg.PC) break;
+    }
+
+    bool same = cpu->reg.PC == reg.PC && cpu->reg.A == reg.A && cpu->reg.X == reg.X && cpu->reg.Y == reg.Y &&
+                cpu->reg.SP == reg.SP && CPU_get_status(cpu) == status;
+    size_t now = cpu->clock_counter;
+    if (!same || !quiet || limit <= now) return false;
+
+    // Every skipped instruction starts before the limit, like it would have
+    size_t pass = now - start;
+    size_t passes = (limit - now) / pass;
+    if (!passes) return false;
+    cpu->clock_counter += passes * pass;
+    nes->idle_cycles += passes * pass;
+    return true;
+}
+
+void NES_run_frame(NES *nes) {
+    nes->ppu.frame_complete = false;
+    while (!nes->ppu.frame_complete) {
+        size_t deadline = NES_next_event(nes);
+        if (nes->skip_idle_loops && NES_skip_idle_loop(nes, deadline)) {
+            NES_sync(nes);
+            continue;
+        }
+
+        size_t now = nes->cpu.clock_counter;
+        size_t budget = deadline > now ? deadline - now : 1;
+        // Reports progress to the PPU thread now and then so it renders
+        // alongside the CPU instead of after it
+        if (nes->ppu_thread && budget > NES_PPU_THREAD_SLICE) budget = NES_PPU_THREAD_SLICE;
+        CPU_run(&nes->cpu, budget);
+        NES_sync(nes);
+    }
+
+    APU_end_frame(&nes->apu, nes->cpu.clock_counter);
+    nes->audio_samples = APU_read_samples(&nes->apu, nes->audio, NES_AUDIO_BUFFER_SIZE);
+}
+
+static void NES_save_blocks(const NES *nes, STATE *state) {
+    CPU_save_state(&nes->cpu, state);
+    BUS_save_state(&nes->bus, state);
+    CART_save_state(&nes->cart, state);
+    MAPPER_save_state(&nes->mapper, state);
+    PPU_save_state(&nes->ppu, state);
+    APU_save_state(&nes->apu, state);
+    STATE_write(state, nes->controller, sizeof(nes->controller));
+    STATE_write(state, nes->controller_shift, sizeof(nes->controller_shift));
+    STATE_write(state, &nes->controller_strobe, sizeof(nes->controller_strobe));
+    STATE_write(state, &nes->ppu_clock, sizeof(nes->ppu_clock));
+}
+
+size_t NES_state_size(const NES *nes) {
+    STATE state = {NULL, 0, sizeof(NES_STATE_HEADER)};
+    NES_save_blocks(nes, &state);
+    return state.pos;
+}
+
+bool NES_save_state(const NES *nes, uint8_t *data, size_t size) {
+    size_t state_size = NES_state_size(nes);
+    if (size < state_size) {
+        return false;
+    }
+
+    NES_STATE_HEADER header = {NES_STATE_MAGIC, NES_STATE_VERSION, nes->cart.hash, state_size};
+    STATE state = {data, state_size, 0};
+    STATE_write(&state, &header, sizeof(header));
+    NES_save_blocks(nes, &state);
+    return true;
+}
+
+bool NES_load_state(NES *nes, const uint8_t *data, size_t size) {
+    NES_STATE_HEADER header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != NES_STATE_MAGIC || header.version != NES_STATE_VERSION || header.rom_hash != nes->cart.hash ||
+        header.size != size || size != NES_state_size(nes)) {
+        return false;
+    }
+
+    bool threaded = nes->ppu_thread != NULL;
+    NES_set_ppu_thread(nes, false);
+
+    // Loading never writes through data
+    STATE state = {(uint8_t *)data, size, sizeof(header)};
+    CPU_load_state(&nes->cpu, &state);
+    BUS_load_state(&nes->bus, &state);
+    CART_load_state(&nes->cart, &state);
+    MAPPER_load_state(&nes->mapper, &state);
+    PPU_load_state(&nes->ppu, &state);
+    APU_load_state(&nes->apu, &state);
+    STATE_read(&state, nes->controller, sizeof(nes->controller));
+    STATE_read(&state, nes->controller_shift, sizeof(nes->controller_shift));
+    STATE_read(&state, &nes->controller_strobe, sizeof(nes->controller_strobe));
+    STATE_read(&state, &nes->ppu_clock, sizeof(nes->ppu_clock));
+    // RAM was replaced without going through the bus
+    BUS_invalidate(&nes->bus);
+    NES_schedule_ppu(nes);
+    NES_set_ppu_thread(nes, threaded);
+    return true;
+}
+
+uint64_t NES_frame_hash(const NES *nes) {
+    return hash_fnv1a(HASH_FNV_OFFSET, &nes->ppu.framebuffer[0][0], sizeof(nes->ppu.framebuffer));
+}
@@ -0,0 +1,123 @@
+#ifndef NES_H
+#define NES_H
+
+#include <APU.h>
+#include <BLOCK.h>
+#include <BUS.h>
+#include <CART.h>
+#include <CPU.h>
+#include <MAPPER.h>
+#include <PPU.h>
+#include <PPU_THREAD.h>
+#include <STATE.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NES_PPU_DOTS_PER_CPU_CYCLE 3
+#define NES_OAM_DMA_CYCLES 513
+#define NES_CONTROLLER_PORTS 2
+#define NES_STATE_MAGIC 0x5353454EU // "NESS"
+#define NES_STATE_VERSION 3         // bump whenever a saved block changes layout
+#define NES_AUDIO_BUFFER_SIZE 2048 // samples, more than one frame at 96kHz
+// CPU cycles between progress reports to the PPU thread, three scanlines
+#define NES_PPU_THREAD_SLICE 341
+
+// Standard controller buttons in the order they are shifted out
+typedef enum {
+    NES_BUTTON_A = (1 << 0),
+    NES_BUTTON_B = (1 << 1),
+    NES_BUTTON_SELECT = (1 << 2),
+    NES_BUTTON_START = (1 << 3),
+    NES_BUTTON_UP = (1 << 4),
+    NES_BUTTON_DOWN = (1 << 5),
+    NES_BUTTON_LEFT = (1 << 6),
+    NES_BUTTON_RIGHT = (1 << 7)
+} NES_BUTTON;
+
+// A whole console. The BUS page table points into the other members, so an
+// initialised NES must not be moved or copied.
+typedef struct {
+    CPU cpu;
+    BUS bus;
+    BLOCK_CACHE block_cache;
+    CART cart;
+    MAPPER mapper;
+    PPU ppu;
+    APU apu;
+    // CPU cycle the PPU has been run up to, it only catches up when the CPU
+    // touches a register or one of its events is due
+    size_t ppu_clock;
+    size_t ppu_event; // CPU cycle of the PPU's next event, as of ppu_clock
+    // Set by NES_set_ppu_thread, NULL while the PPU runs on the CPU's thread
+    PPU_THREAD *ppu_thread;
+    bool ppu_dirty; // the CPU touched the PPU or the mapper since the last sync
+
+    // Buttons currently held per port, set by the frontend between frames
+    uint8_t controller[NES_CONTROLLER_PORTS];
+    uint8_t controller_shift[NES_CONTROLLER_PORTS];
+    bool controller_strobe;
+
+    // NES_run_frame skips passes around polling loops up to the next event,
+    // the outcome is exactly the same as running them
+    bool skip_idle_loops;
+    uint64_t idle_cycles; // CPU cycles skipped that way
+
+    // Samples of the last frame finished by NES_run_frame
+    int16_t audio[NES_AUDIO_BUFFER_SIZE];
+    size_t audio_samples;
+} NES;
+
+// Loads the ROM at rom_path and powers the console on, returns false and prints
+// the reason to stderr if the ROM can not be used
+bool NES_init(NES *nes, const char *rom_path);
+void NES_free(NES *nes);
+// Reset button
+void NES_reset(NES *nes);
+// Power cycle: RAM without battery backup and all board state are cleared
+void NES_power(NES *nes);
+
+// Fast-forward skips framebuffer composition and audio synthesis. Everything
+// the CPU can observe keeps exact timing: sprite 0 hit, sprite overflow,
+// VBlank NMI, mapper and APU IRQs.
+void NES_set_fast_forward(NES *nes, bool enabled);
+
+// Runs the PPU on a thread of its own. $2002-$2007 writes and OAM DMA are
+// queued with their CPU cycle and the CPU only waits for the PPU when it reads
+// a PPU register, writes $2000/$2001 or the mapper, or a PPU event is due, so
+// rendering overlaps with the CPU. The results are the same either way. Between
+// NES_step/NES_run_frame calls the PPU is always caught up. Returns false if the
+// thread could not be started.
+bool NES_set_ppu_thread(NES *nes, bool enabled);
+
+// Executes one CPU instruction (or a compiled block) and catches the rest of
+// the console up with it, returns the CPU cycles used
+size_t NES_step(NES *nes);
+// Runs until the PPU enters VBlank and collects the frame's audio. The CPU runs
+// freely up to the next PPU or APU event, or until it touches a register, and
+// only then is the rest of the console caught up. Polling loops are skipped
+// over, see skip_idle_loops.
+void NES_run_frame(NES *nes);
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t rom_hash;
+    uint64_t size;
+} NES_STATE_HEADER;
+
+// Savestates are a NES_STATE_HEADER followed by the blocks of every module.
+// The ROM is referenced by hash, a blob only loads into a console running the
+// same ROM and an emulator build with the same NES_STATE_VERSION.
+size_t NES_state_size(const NES *nes);
+// Returns false if size is smaller than NES_state_size
+bool NES_save_state(const NES *nes, uint8_t *data, size_t size);
+// Returns false and leaves nes untouched if the blob does not match
+bool NES_load_state(NES *nes, const uint8_t *data, size_t size);
+
+// FNV-1a over the framebuffer, for comparing runs
+uint64_t NES_frame_hash(const NES *nes);
+
+#endif // NES_H
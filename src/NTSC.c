@@ -0,0 +1,303 @@
+#include <NTSC.h>
+#include <math.h>
+
+// Kernels are built from a model of the 2C02's composite output and a TV's
+// decoder. Both are linear in the signal, so what a pixel adds to the picture
+// does not depend on its neighbours: one isolated pixel of each colour at each
+// chunk position and burst phase is encoded, decoded and resampled once here,
+// and a filtered row is the sum of its pixels' kernels.
+
+#define NTSC_CARRIER_SAMPLES 12
+#define NTSC_CHUNK_SAMPLES (NTSC_CHUNK_IN * NTSC_SAMPLES_PER_PIXEL)
+#define NTSC_PHASE_SAMPLES 4
+// Samples of the chunk before a pixel's own, its own and the one after
+#define NTSC_WINDOW (3 * NTSC_CHUNK_SAMPLES)
+#define NTSC_WINDOW_OUT (3 * NTSC_CHUNK_OUT)
+// Chroma is low passed by two boxes of a carrier cycle, which also keeps flat
+// luma from being decoded as colour
+#define NTSC_CHROMA_REACH (NTSC_CARRIER_SAMPLES - 1)
+#define NTSC_CHROMA_TOTAL (NTSC_CARRIER_SAMPLES * NTSC_CARRIER_SAMPLES)
+// Decoder hue and colour gain, fitted to the standard palette
+#define NTSC_HUE_OFFSET (2.0 * M_PI / 3.0)
+#define NTSC_CHROMA_GAIN 1.5
+
+// 2C02 output levels in volts, low and high half of the square wave for the
+// four luma levels
+static const double NTSC_LOW[4] = {0.350, 0.518, 0.962, 1.550};
+static const double NTSC_HIGH[4] = {1.094, 1.506, 1.962, 1.962};
+#define NTSC_BLACK 0.518
+#define NTSC_WHITE 1.962
+
+const NTSC_SETUP NTSC_COMPOSITE = {0.0, 0.0, 0.0, 0.0, 0.0};
+const NTSC_SETUP NTSC_SVIDEO = {0.0, 0.0, 0.2, -1.0, -1.0};
+const NTSC_SETUP NTSC_MONOCHROME = {0.0, -1.0, 0.2, -1.0, -1.0};
+
+typedef struct {
+    const char *name;
+    const NTSC_SETUP *setup;
+} NTSC_PRESET;
+
+static const NTSC_PRESET NTSC_PRESETS[] = {
+    {"composite", &NTSC_COMPOSITE},
+    {"svideo", &NTSC_SVIDEO},
+    {"monochrome", &NTSC_MONOCHROME},
+};
+
+bool NTSC_parse_setup(const char *name, NTSC_SETUP *setup) {
+    for (size_t i = 0; i < sizeof(NTSC_PRESETS) / sizeof(NTSC_PRESETS[0]); i++) {
+        if (strcmp(name, NTSC_PRESETS[i].name) == 0) {
+            *setup = *NTSC_PRESETS[i].setup;
+            return true;
+        }
+    }
+    return false;
+}
+
+static double NTSC_clamp(double value, double low, double high) {
+    return value < low ? low : value > high ? high : value;
+}
+
+// Signal of one pixel of color in the window, as luma (the square wave's mean)
+// and chroma (the rest). Sample n is at carrier phase (n + phase_offset) % 12.
+static void NTSC_encode(int color, int pixel, int phase_offset, double *luma, double *chroma) {
+    int hue = color & 0x0F;
+    int level = hue > 13 ? 1 : (color >> 4) & 3;
+    double low = NTSC_LOW[level], high = NTSC_HIGH[level];
+    if (hue == 0) low = high;
+    if (hue > 12) high = low;
+    low = (low - NTSC_BLACK) / (NTSC_WHITE - NTSC_BLACK);
+    high = (high - NTSC_BLACK) / (NTSC_WHITE - NTSC_BLACK);
+
+    memset(luma, 0, NTSC_WINDOW * sizeof(double));
+    memset(chroma, 0, NTSC_WINDOW * sizeof(double));
+    int first = NTSC_CHUNK_SAMPLES + pixel * NTSC_SAMPLES_PER_PIXEL;
+    for (int n = first; n < first + NTSC_SAMPLES_PER_PIXEL; n++) {
+        int phase = (n + phase_offset) % NTSC_CARRIER_SAMPLES;
+        double signal = (hue + phase) % NTSC_CARRIER_SAMPLES < 6 ? high : low;
+        luma[n] = (low + high) / 2.0;
+        chroma[n] = signal - luma[n];
+    }
+}
+
+static void NTSC_build_kernel(NTSC *ntsc, const NTSC_SETUP *setup, int phase, int color, int pixel,
+                              const double *luma_taps, int luma_reach) {
+    double luma[NTSC_WINDOW], chroma[NTSC_WINDOW];
+    double y[NTSC_WINDOW], i[NTSC_WINDOW], q[NTSC_WINDOW];
+    int phase_offset = phase * NTSC_PHASE_SAMPLES;
+    NTSC_encode(color, pixel, phase_offset, luma, chroma);
+
+    // Crosstalk: the decoder leaves part of the carrier in luma and takes luma
+    // edges for colour, -1 removes either
+    double artifacts = 1.0 + NTSC_clamp(setup->artifacts, -1.0, 1.0);
+    double fringing = 1.0 + NTSC_clamp(setup->fringing, -1.0, 1.0);
+    for (int m = 0; m < NTSC_WINDOW; m++) {
+        y[m] = i[m] = q[m] = 0.0;
+        for (int n = 0; n < NTSC_WINDOW; n++) {
+            if (luma[n] == 0.0 && chroma[n] == 0.0) continue;
+            int distance = abs(m - n);
+            if (distance <= luma_reach) {
+                y[m] += luma_taps[distance] * (luma[n] + artifacts * chroma[n]);
+            }
+            if (distance <= NTSC_CHROMA_REACH) {
+                double weight = (double)(NTSC_CARRIER_SAMPLES - distance) / NTSC_CHROMA_TOTAL;
+                double angle = 2.0 * M_PI * (n + phase_offset) / NTSC_CARRIER_SAMPLES + NTSC_HUE_OFFSET;
+                double carrier = weight * (chroma[n] + fringing * luma[n]);
+                i[m] += carrier * cos(angle);
+                q[m] += carrier * sin(angle);
+            }
+        }
+    }
+
+    double hue = NTSC_clamp(setup->hue, -1.0, 1.0) * M_PI;
+    double gain = NTSC_CHROMA_GAIN * (1.0 + NTSC_clamp(setup->saturation, -1.0, 1.0));
+    double hue_cos = cos(hue) * gain, hue_sin = sin(hue) * gain;
+
+    for (int o = 0; o < NTSC_WINDOW_OUT; o++) {
+        // Output pixel centres spread evenly over the window's samples
+        double x = (o + 0.5) * NTSC_CHUNK_SAMPLES / NTSC_CHUNK_OUT - 0.5;
+        int left = (int)floor(x);
+        double right_weight = x - left;
+        int right = left + 1 < NTSC_WINDOW ? left + 1 : left;
+        double luma_out = y[left] + (y[right] - y[left]) * right_weight;
+        double i_out = i[left] + (i[right] - i[left]) * right_weight;
+        double q_out = q[left] + (q[right] - q[left]) * right_weight;
+        double i_turned = i_out * hue_cos - q_out * hue_sin;
+        double q_turned = i_out * hue_sin + q_out * hue_cos;
+
+        double rgb[3] = {
+            luma_out + 0.956 * i_turned + 0.621 * q_turned,
+            luma_out - 0.272 * i_turned - 0.647 * q_turned,
+            luma_out - 1.106 * i_turned + 1.703 * q_turned,
+        };
+        NTSC_SEGMENT *segment = &ntsc->kernels[phase][NTSC_SEGMENT_INDEX(color, pixel, o / NTSC_CHUNK_OUT)];
+        for (int c = 0; c < 3; c++) {
+            double value = rgb[c] * 255.0 * (1 << NTSC_FRACTION_BITS);
+            segment->out[o % NTSC_CHUNK_OUT][c] = (int16_t)lround(NTSC_clamp(value, INT16_MIN, INT16_MAX));
+        }
+    }
+}
+
+void NTSC_init(NTSC *ntsc, const NTSC_SETUP *setup) {
+    if (!ntsc || !setup) {
+        PANIC("NULL POINTER in NTSC_init!");
+    }
+    memset(ntsc, 0, sizeof(*ntsc));
+
+    // Luma is low passed by a raised cosine, a third of a carrier cycle narrower
+    // or wider than one at full sharpness either way
+    double width = NTSC_CARRIER_SAMPLES * (1.0 - 0.5 * NTSC_clamp(setup->sharpness, -1.0, 1.0));
+    int luma_reach = (int)ceil(width / 2.0) - 1;
+    double luma_taps[NTSC_CARRIER_SAMPLES];
+    double total = 0.0;
+    for (int t = 0; t <= luma_reach; t++) {
+        double c = cos(M_PI * t / width);
+        luma_taps[t] = c * c;
+        total += t ? 2.0 * luma_taps[t] : luma_taps[t];
+    }
+    for (int t = 0; t <= luma_reach; t++) {
+        luma_taps[t] /= total;
+    }
+
+    for (int phase = 0; phase < NTSC_PHASES; phase++) {
+        for (int color = 0; color < 64; color++) {
+            for (int pixel = 0; pixel < NTSC_CHUNK_IN; pixel++) {
+                NTSC_build_kernel(ntsc, setup, phase, color, pixel, luma_taps, luma_reach);
+            }
+            // Rounding for the final shift, added once per output
+            NTSC_SEGMENT *own = &ntsc->kernels[phase][NTSC_SEGMENT_INDEX(color, 0, 1)];
+            for (int o = 0; o < NTSC_CHUNK_OUT; o++) {
+                for (int c = 0; c < 3; c++) {
+                    own->out[o][c] += 1 << (NTSC_FRACTION_BITS - 1);
+                }
+            }
+        }
+    }
+
+    ntsc->row = NTSC_select_row();
+    ntsc->threads = POOL_default_workers();
+}
+
+// Filters rows [first, last) of frame
+static void NTSC_rows(const NTSC *ntsc, const uint8_t *frame, unsigned burst, size_t first, size_t last,
+                      NTSC_RowSink sink, void *ctx) {
+    uint8_t in[NTSC_ROW_IN];
+    uint8_t out[NTSC_ROW_OUT * 4];
+    memset(in, NTSC_PAD_COLOR, sizeof(in));
+
+    for (size_t y = first; y < last; y++) {
+        const uint8_t *src = frame + y * PPU_WIDTH;
+        for (size_t x = 0; x < PPU_WIDTH; x++) {
+            in[NTSC_CHUNK_IN + x] = src[x] & 0x3F;
+        }
+        size_t phase = (y + burst) % NTSC_PHASES;
+        ntsc->row(ntsc->kernels[phase], in, out);
+        sink(ctx, y, out);
+    }
+}
+
+void NTSC_filter(const NTSC *ntsc, const uint8_t *frame, unsigned burst, NTSC_RowSink sink, void *ctx) {
+    NTSC_rows(ntsc, frame, burst % NTSC_PHASES, 0, PPU_HEIGHT, sink, ctx);
+}
+
+// Bands
+
+static void NTSC_BANDS_run(NTSC_BANDS *bands, size_t band) {
+    size_t first = PPU_HEIGHT * band / bands->count;
+    size_t last = PPU_HEIGHT * (band + 1) / bands->count;
+    NTSC_rows(bands->ntsc, bands->frame, bands->burst, first, last, bands->sink, bands->ctx);
+}
+
+static void *NTSC_BANDS_worker_main(void *arg) {
+    NTSC_BAND_WORKER *worker = arg;
+    NTSC_BANDS *bands = worker->bands;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&bands->lock);
+    for (;;) {
+        while (bands->generation == seen && !bands->stop) {
+            pthread_cond_wait(&bands->start, &bands->lock);
+        }
+        if (bands->stop) break;
+        seen = bands->generation;
+        pthread_mutex_unlock(&bands->lock);
+
+        NTSC_BANDS_run(bands, worker->band);
+
+        pthread_mutex_lock(&bands->lock);
+        bands->pending -= 1;
+        if (!bands->pending) pthread_cond_signal(&bands->done);
+    }
+    pthread_mutex_unlock(&bands->lock);
+    return NULL;
+}
+
+void NTSC_BANDS_start(NTSC_BANDS *bands, const NTSC *ntsc) {
+    if (!bands || !ntsc) {
+        PANIC("NULL POINTER in NTSC_BANDS_start!");
+    }
+    memset(bands, 0, sizeof(*bands));
+    bands->ntsc = ntsc;
+    size_t count = ntsc->threads ? ntsc->threads : 1;
+    if (count > PPU_HEIGHT) count = PPU_HEIGHT;
+
+    pthread_mutex_init(&bands->lock, NULL);
+    pthread_cond_init(&bands->start, NULL);
+    pthread_cond_init(&bands->done, NULL);
+    bands->count = 1;
+    if (count == 1) return;
+
+    bands->workers = malloc((count - 1) * sizeof(NTSC_BAND_WORKER));
+    if (!bands->workers) {
+        PANIC("Out of memory allocating NTSC band workers!");
+    }
+    // Bands are numbered as the helpers start, the caller's is 0
+    for (size_t i = 0; i < count - 1; i++) {
+        NTSC_BAND_WORKER *worker = &bands->workers[i];
+        worker->bands = bands;
+        worker->band = i + 1;
+        if (pthread_create(&worker->thread, NULL, NTSC_BANDS_worker_main, worker) != 0) break;
+        bands->count += 1;
+    }
+}
+
+void NTSC_BANDS_stop(NTSC_BANDS *bands) {
+    pthread_mutex_lock(&bands->lock);
+    bands->stop = true;
+    pthread_cond_broadcast(&bands->start);
+    pthread_mutex_unlock(&bands->lock);
+    for (size_t i = 0; i + 1 < bands->count; i++) {
+        pthread_join(bands->workers[i].thread, NULL);
+    }
+
+    pthread_cond_destroy(&bands->done);
+    pthread_cond_destroy(&bands->start);
+    pthread_mutex_destroy(&bands->lock);
+    free(bands->workers);
+    bands->workers = NULL;
+    bands->count = 0;
+}
+
+void NTSC_BANDS_filter(NTSC_BANDS *bands, const uint8_t *frame, unsigned burst, NTSC_RowSink sink, void *ctx) {
+    if (bands->count == 1) {
+        NTSC_filter(bands->ntsc, frame, burst, sink, ctx);
+        return;
+    }
+
+    pthread_mutex_lock(&bands->lock);
+    bands->frame = frame;
+    bands->burst = burst % NTSC_PHASES;
+    bands->sink = sink;
+    bands->ctx = ctx;
+    bands->generation += 1;
+    bands->pending = bands->count - 1;
+    pthread_cond_broadcast(&bands->start);
+    pthread_mutex_unlock(&bands->lock);
+
+    NTSC_BANDS_run(bands, 0);
+
+    pthread_mutex_lock(&bands->lock);
+    while (bands->pending) {
+        pthread_cond_wait(&bands->done, &bands->lock);
+    }
+    pthread_mutex_unlock(&bands->lock);
+}
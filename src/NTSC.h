@@ -0,0 +1,121 @@
+#ifndef NTSC_H
+#define NTSC_H
+
+#include <POOL.h>
+#include <PPU.h>
+#include <UTIL.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every 3 input pixels (24 samples of the 21.48 MHz signal, two colour
+// subcarrier cycles) come out as 7 RGBA pixels
+#define NTSC_CHUNK_IN 3
+#define NTSC_CHUNK_OUT 7
+#define NTSC_CHUNKS ((PPU_WIDTH + NTSC_CHUNK_IN - 1) / NTSC_CHUNK_IN)
+#define NTSC_OUT_WIDTH (NTSC_CHUNKS * NTSC_CHUNK_OUT) // 602
+#define NTSC_SAMPLES_PER_PIXEL 8
+// Each scanline starts 4 samples further into the 12 sample subcarrier cycle
+#define NTSC_PHASES 3
+// Padded input row: one chunk of black on both sides
+#define NTSC_ROW_IN ((NTSC_CHUNKS + 2) * NTSC_CHUNK_IN)
+// Output row with room for the last chunk's 8 pixel store
+#define NTSC_ROW_OUT (NTSC_OUT_WIDTH + 1)
+#define NTSC_FRACTION_BITS 3 // kernel entries are fixed point
+#define NTSC_PAD_COLOR 0x0F
+
+// Picture controls, all in -1..1 with 0 for a standard composite picture.
+// artifacts scales how much of the colour carrier the decoder leaves in luma
+// (dot crawl, rainbow edges), fringing how much luma detail ends up decoded as
+// colour, sharpness the luma bandwidth. -1 removes either crosstalk completely.
+typedef struct {
+    double hue;        // -1..1 turns the colours by -180..180 degrees
+    double saturation;
+    double sharpness;
+    double artifacts;
+    double fringing;
+} NTSC_SETUP;
+
+extern const NTSC_SETUP NTSC_COMPOSITE;
+extern const NTSC_SETUP NTSC_SVIDEO;
+extern const NTSC_SETUP NTSC_MONOCHROME;
+
+// What one input pixel adds to the 7 outputs of a chunk, R G B and 0 per
+// output. The 8th output is always 0 so a chunk is two 32 byte vectors.
+typedef struct {
+    int16_t out[8][4];
+} NTSC_SEGMENT;
+
+// Kernels of one burst phase, indexed by NTSC_SEGMENT_INDEX
+#define NTSC_KERNEL_SEGMENTS (64 * NTSC_CHUNK_IN * 3)
+// Segment of colour at position pixel (0-2) of its chunk, for the outputs of
+// the chunk before it (to 0), its own (1) or the one after it (2). The sum for
+// chunk k reads pixels of chunk k - 1 with to 2, chunk k with 1 and k + 1 with 0.
+#define NTSC_SEGMENT_INDEX(color, pixel, to) (((color) * NTSC_CHUNK_IN + (pixel)) * 3 + (to))
+
+// Filters one padded row of palette indices (NTSC_ROW_IN, masked to 0-63)
+// into NTSC_ROW_OUT RGBA pixels, the last one is scratch
+typedef void (*NTSC_RowFunc)(const NTSC_SEGMENT *kernels, const uint8_t *in, uint8_t *out);
+
+// Receives finished RGBA rows (NTSC_OUT_WIDTH pixels), from several threads
+// at once but each row y only once
+typedef void (*NTSC_RowSink)(void *ctx, size_t y, const uint8_t *rgba);
+
+typedef struct {
+    NTSC_SEGMENT kernels[NTSC_PHASES][NTSC_KERNEL_SEGMENTS];
+    NTSC_RowFunc row; // best variant for the host CPU
+    size_t threads;   // bands of NTSC_BANDS, POOL_default_workers by default
+} NTSC;
+
+typedef struct NTSC_BAND_WORKER NTSC_BAND_WORKER;
+
+// Persistent threads that filter a frame in horizontal bands, one set per
+// stream. The caller's thread filters the first band and helpers the others,
+// they sleep in between frames.
+typedef struct {
+    const NTSC *ntsc;
+    size_t count; // bands, helpers + 1
+    NTSC_BAND_WORKER *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start; // a frame was handed out or the helpers are stopping
+    pthread_cond_t done;  // the last helper finished its band
+    uint64_t generation;  // frames handed out
+    size_t pending;       // helpers still filtering the current frame
+    bool stop;
+
+    // The frame being filtered
+    const uint8_t *frame;
+    unsigned burst;
+    NTSC_RowSink sink;
+    void *ctx;
+} NTSC_BANDS;
+
+struct NTSC_BAND_WORKER {
+    NTSC_BANDS *bands;
+    size_t band;
+    pthread_t thread;
+};
+
+// Precomputes the kernels for setup, a filter is read only afterwards and can
+// be shared by any number of streams
+void NTSC_init(NTSC *ntsc, const NTSC_SETUP *setup);
+// Filters a PPU framebuffer on the calling thread. burst (0-2) picks the
+// subcarrier phase of the first line, cycling it from frame to frame makes the
+// artifacts crawl.
+void NTSC_filter(const NTSC *ntsc, const uint8_t *frame, unsigned burst, NTSC_RowSink sink, void *ctx);
+
+// Starts ntsc->threads - 1 helpers. Fewer bands are used if threads can not be
+// created, 1 filters on the caller alone.
+void NTSC_BANDS_start(NTSC_BANDS *bands, const NTSC *ntsc);
+void NTSC_BANDS_stop(NTSC_BANDS *bands);
+// Like NTSC_filter, with the bands' helpers. Rows reach sink from every thread.
+void NTSC_BANDS_filter(NTSC_BANDS *bands, const uint8_t *frame, unsigned burst, NTSC_RowSink sink, void *ctx);
+// Parses "composite", "svideo" or "monochrome", returns false for anything else
+bool NTSC_parse_setup(const char *name, NTSC_SETUP *setup);
+
+void NTSC_row_scalar(const NTSC_SEGMENT *kernels, const uint8_t *in, uint8_t *out);
+NTSC_RowFunc NTSC_select_row(void);
+
+#endif // NTSC_H
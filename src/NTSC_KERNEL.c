@@ -0,0 +1,98 @@
+#include <NTSC.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NTSC_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+// Chunk k of a row is the sum of nine segments: the three pixels before it,
+// its own three and the three after it. Sums wrap in 16 bits like the vector
+// adds do; only the total has to fit, which it does for any real picture.
+
+static void NTSC_gather(const NTSC_SEGMENT *kernels, const uint8_t *pixels, const NTSC_SEGMENT **segments) {
+    for (int j = 0; j < NTSC_CHUNK_IN; j++) {
+        segments[j] = &kernels[NTSC_SEGMENT_INDEX(pixels[j], j, 2)];
+        segments[NTSC_CHUNK_IN + j] = &kernels[NTSC_SEGMENT_INDEX(pixels[NTSC_CHUNK_IN + j], j, 1)];
+        segments[NTSC_CHUNK_IN * 2 + j] = &kernels[NTSC_SEGMENT_INDEX(pixels[NTSC_CHUNK_IN * 2 + j], j, 0)];
+    }
+}
+
+void NTSC_row_scalar(const NTSC_SEGMENT *kernels, const uint8_t *in, uint8_t *out) {
+    const NTSC_SEGMENT *segments[NTSC_CHUNK_IN * 3];
+    for (size_t k = 0; k < NTSC_CHUNKS; k++) {
+        NTSC_gather(kernels, in + k * NTSC_CHUNK_IN, segments);
+        uint8_t *dst = out + k * NTSC_CHUNK_OUT * 4;
+        for (int o = 0; o < NTSC_CHUNK_OUT; o++) {
+            for (int c = 0; c < 3; c++) {
+                uint16_t sum = 0;
+                for (int s = 0; s < NTSC_CHUNK_IN * 3; s++) {
+                    sum += (uint16_t)segments[s]->out[o][c];
+                }
+                int value = (int16_t)sum >> NTSC_FRACTION_BITS;
+                dst[o * 4 + c] = (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+            }
+            dst[o * 4 + 3] = 255;
+        }
+    }
+}
+
+#ifdef NTSC_KERNEL_X86
+// A segment is 8 RGBA outputs of 16 bit lanes. Every chunk stores 8 pixels,
+// the 8th is overwritten by the next chunk or lands in the row's scratch pixel.
+
+__attribute__((target("sse2"))) static void NTSC_row_sse2(const NTSC_SEGMENT *kernels, const uint8_t *in,
+                                                          uint8_t *out) {
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const NTSC_SEGMENT *segments[NTSC_CHUNK_IN * 3];
+    for (size_t k = 0; k < NTSC_CHUNKS; k++) {
+        NTSC_gather(kernels, in + k * NTSC_CHUNK_IN, segments);
+        __m128i sum[4];
+        for (int v = 0; v < 4; v++) {
+            sum[v] = _mm_loadu_si128((const __m128i *)segments[0] + v);
+        }
+        for (int s = 1; s < NTSC_CHUNK_IN * 3; s++) {
+            const __m128i *segment = (const __m128i *)segments[s];
+            for (int v = 0; v < 4; v++) {
+                sum[v] = _mm_add_epi16(sum[v], _mm_loadu_si128(segment + v));
+            }
+        }
+        for (int v = 0; v < 4; v++) {
+            sum[v] = _mm_srai_epi16(sum[v], NTSC_FRACTION_BITS);
+        }
+        __m128i *dst = (__m128i *)(out + k * NTSC_CHUNK_OUT * 4);
+        _mm_storeu_si128(dst, _mm_or_si128(_mm_packus_epi16(sum[0], sum[1]), alpha));
+        _mm_storeu_si128(dst + 1, _mm_or_si128(_mm_packus_epi16(sum[2], sum[3]), alpha));
+    }
+}
+
+// Same with half a segment per vector. The pack works per 128 bit lane, which
+// leaves the 64 bit quarters as pixels 0-1, 4-5, 2-3, 6-7.
+__attribute__((target("avx2"))) static void NTSC_row_avx2(const NTSC_SEGMENT *kernels, const uint8_t *in,
+                                                          uint8_t *out) {
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const NTSC_SEGMENT *segments[NTSC_CHUNK_IN * 3];
+    for (size_t k = 0; k < NTSC_CHUNKS; k++) {
+        NTSC_gather(kernels, in + k * NTSC_CHUNK_IN, segments);
+        __m256i low = _mm256_loadu_si256((const __m256i *)segments[0]);
+        __m256i high = _mm256_loadu_si256((const __m256i *)segments[0] + 1);
+        for (int s = 1; s < NTSC_CHUNK_IN * 3; s++) {
+            const __m256i *segment = (const __m256i *)segments[s];
+            low = _mm256_add_epi16(low, _mm256_loadu_si256(segment));
+            high = _mm256_add_epi16(high, _mm256_loadu_si256(segment + 1));
+        }
+        low = _mm256_srai_epi16(low, NTSC_FRACTION_BITS);
+        high = _mm256_srai_epi16(high, NTSC_FRACTION_BITS);
+        __m256i pixels = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xD8);
+        _mm256_storeu_si256((__m256i *)(out + k * NTSC_CHUNK_OUT * 4), _mm256_or_si256(pixels, alpha));
+    }
+}
+#endif
+
+NTSC_RowFunc NTSC_select_row(void) {
+#ifdef NTSC_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return NTSC_row_avx2;
+    if (__builtin_cpu_supports("sse2")) return NTSC_row_sse2;
+#endif
+    return NTSC_row_scalar;
+}
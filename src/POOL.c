@@ -0,0 +1,95 @@
+#include <POOL.h>
+
+static bool POOL_pop(POOL_DEQUE *deque, size_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->head < deque->tail;
+    if (found) {
+        deque->tail -= 1;
+        *task = deque->tail;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static bool POOL_steal(POOL_DEQUE *deque, size_t *task) {
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->head < deque->tail;
+    if (found) {
+        *task = deque->head;
+        deque->head += 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// No task ever creates new ones, so once every deque is empty the worker is done
+static bool POOL_next_task(POOL *pool, size_t id, size_t *task) {
+    if (POOL_pop(&pool->deques[id], task)) return true;
+
+    for (size_t i = 1; i < pool->worker_count; i++) {
+        size_t victim = (id + i) % pool->worker_count;
+        if (POOL_steal(&pool->deques[victim], task)) return true;
+    }
+    return false;
+}
+
+static void *POOL_worker_main(void *arg) {
+    POOL_WORKER *worker = arg;
+    POOL *pool = worker->pool;
+
+    size_t task;
+    while (POOL_next_task(pool, worker->id, &task)) {
+        pool->func(pool->ctx, task, worker->id);
+    }
+    return NULL;
+}
+
+void POOL_run(size_t task_count, size_t worker_count, POOL_TaskFunc func, void *ctx) {
+    if (!func) {
+        PANIC("NULL POINTER in POOL_run!");
+    }
+    if (worker_count == 0) worker_count = 1;
+    if (worker_count > task_count) worker_count = task_count;
+    if (worker_count == 0) return;
+
+    POOL pool = {
+        .deques = calloc(worker_count, sizeof(POOL_DEQUE)),
+        .workers = calloc(worker_count, sizeof(POOL_WORKER)),
+        .worker_count = worker_count,
+        .func = func,
+        .ctx = ctx,
+    };
+    if (!pool.deques || !pool.workers) {
+        PANIC("Out of memory allocating the thread pool!");
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].head = task_count * i / worker_count;
+        pool.deques[i].tail = task_count * (i + 1) / worker_count;
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id = i;
+    }
+
+    // The calling thread is worker 0
+    for (size_t i = 1; i < worker_count; i++) {
+        if (pthread_create(&pool.workers[i].thread, NULL, POOL_worker_main, &pool.workers[i]) != 0) {
+            PANIC("Could not create worker thread!");
+        }
+    }
+    POOL_worker_main(&pool.workers[0]);
+    for (size_t i = 1; i < worker_count; i++) {
+        pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < worker_count; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    }
+    free(pool.deques);
+    free(pool.workers);
+}
+
+size_t POOL_default_workers(void) {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
@@ -0,0 +1,48 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <UTIL.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef void (*POOL_TaskFunc)(void *ctx, size_t task, size_t worker);
+
+// Tasks [head, tail) still owned by one worker. The owner pops from the tail,
+// idle workers steal from the head so they take the work furthest away from
+// what the owner is busy with.
+typedef struct {
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+} POOL_DEQUE;
+
+typedef struct POOL_WORKER POOL_WORKER;
+
+typedef struct {
+    POOL_DEQUE *deques;
+    POOL_WORKER *workers;
+    size_t worker_count;
+    POOL_TaskFunc func;
+    void *ctx;
+} POOL;
+
+struct POOL_WORKER {
+    POOL *pool;
+    size_t id;
+    pthread_t thread;
+};
+
+// Runs func for every task in [0, task_count) on worker_count threads and
+// returns once all of them are done. Tasks start out split into contiguous
+// blocks, one per worker, and are stolen when a worker runs dry. Tasks must
+// not depend on each other; worker is a stable index < worker_count for
+// per-thread scratch data.
+void POOL_run(size_t task_count, size_t worker_count, POOL_TaskFunc func, void *ctx);
+
+// Online CPU count, at least 1
+size_t POOL_default_workers(void);
+
+#endif // POOL_H
@@ -0,0 +1,540 @@
+#include <PPU.h>
+
+static uint8_t PPU_bus_read(void *ctx, uint16_t addr, bool read_only) {
+    return PPU_read_register(ctx, addr, read_only);
+}
+
+static void PPU_bus_write(void *ctx, uint16_t addr, uint8_t data) {
+    PPU_write_register(ctx, addr, data);
+}
+
+void PPU_init(PPU *ppu, MAPPER *mapper, BUS *bus) {
+    if (!ppu || !mapper || !bus) {
+        PANIC("NULL POINTER in init!");
+    }
+
+    memset(ppu, 0, sizeof(*ppu));
+    ppu->mapper = mapper;
+    ppu->sprites_in_range = PPU_select_sprite_eval();
+    ppu->render = true;
+
+    CART *cart = mapper->cart;
+    ppu->chr_base = cart->chr_rom ? cart->chr_rom : cart->chr_ram;
+    ppu->chr_size = cart->chr_rom ? cart->chr_rom_size : cart->chr_ram_size;
+
+    size_t tiles = ppu->chr_size / PPU_TILE_SIZE;
+    ppu->tile_cache = malloc(tiles * PPU_DECODED_TILE_SIZE);
+    ppu->tile_valid = calloc(tiles, 1);
+    if (!ppu->tile_cache || !ppu->tile_valid) {
+        PANIC("Out of memory allocating the tile cache!");
+    }
+
+    BUS_map_io(bus, 0x2000, 0x2000, PPU_bus_read, PPU_bus_write, ppu);
+
+    PPU_reset(ppu);
+}
+
+void PPU_free(PPU *ppu) {
+    free(ppu->tile_cache);
+    free(ppu->tile_valid);
+    ppu->tile_cache = NULL;
+    ppu->tile_valid = NULL;
+}
+
+void PPU_reset(PPU *ppu) {
+    ppu->ctrl = 0x00;
+    ppu->mask = 0x00;
+    ppu->status = 0x00;
+    ppu->oam_addr = 0x00;
+    ppu->v = 0x0000;
+    ppu->t = 0x0000;
+    ppu->x = 0x00;
+    ppu->w = false;
+    ppu->data_buffer = 0x00;
+    ppu->open_bus = 0x00;
+
+    ppu->scanline = 0;
+    ppu->dot = 0;
+    ppu->frame = 0;
+    ppu->nmi = false;
+    ppu->frame_complete = false;
+    ppu->sprite0_dot = 0;
+}
+
+void PPU_power(PPU *ppu) {
+    memset(ppu->vram, 0, sizeof(ppu->vram));
+    memset(ppu->palette, 0, sizeof(ppu->palette));
+    memset(ppu->oam, 0, sizeof(ppu->oam));
+    memset(ppu->tile_valid, 0, ppu->chr_size / PPU_TILE_SIZE);
+    PPU_reset(ppu);
+}
+
+static inline bool PPU_rendering(PPU *ppu) {
+    return ppu->mask & (PPU_MASK_BG | PPU_MASK_SPRITES);
+}
+
+// Memory access
+
+static inline uint16_t PPU_nametable_index(PPU *ppu, uint16_t addr) {
+    switch (ppu->mapper->mirroring) {
+    case CART_MIRRORING_HORIZONTAL:
+        return ((addr & 0x0800) >> 1) | (addr & 0x03FF);
+    case CART_MIRRORING_VERTICAL:
+        return addr & 0x07FF;
+    case CART_MIRRORING_SINGLE_LOW:
+        return addr & 0x03FF;
+    case CART_MIRRORING_SINGLE_HIGH:
+        return 0x0400 | (addr & 0x03FF);
+    case CART_MIRRORING_FOUR_SCREEN:
+    default:
+        return addr & 0x0FFF;
+    }
+}
+
+static inline uint8_t PPU_palette_index(uint16_t addr) {
+    addr &= 0x1F;
+    // $3F10/$3F14/$3F18/$3F1C mirror the backdrop entries
+    if ((addr & 0x13) == 0x10) addr &= 0x0F;
+    return addr;
+}
+
+static uint8_t PPU_vram_read(PPU *ppu, uint16_t addr) {
+    addr &= 0x3FFF;
+    if (addr < 0x2000) return *PPU_chr(ppu, addr);
+    if (addr < 0x3F00) return ppu->vram[PPU_nametable_index(ppu, addr)];
+    return ppu->palette[PPU_palette_index(addr)];
+}
+
+static void PPU_vram_write(PPU *ppu, uint16_t addr, uint8_t data) {
+    addr &= 0x3FFF;
+    if (addr < 0x2000) {
+        if (!ppu->mapper->chr_writable) return;
+        uint8_t *chr = PPU_chr(ppu, addr);
+        *chr = data;
+        ppu->tile_valid[(chr - ppu->chr_base) / PPU_TILE_SIZE] = 0;
+    } else if (addr < 0x3F00) {
+        ppu->vram[PPU_nametable_index(ppu, addr)] = data;
+    } else {
+        ppu->palette[PPU_palette_index(addr)] = data & 0x3F;
+    }
+}
+
+// Tile cache
+
+void PPU_decode_tile(PPU *ppu, size_t tile) {
+    const uint8_t *src = ppu->chr_base + tile * PPU_TILE_SIZE;
+    uint8_t *dst = ppu->tile_cache + tile * PPU_DECODED_TILE_SIZE;
+
+    for (size_t row = 0; row < 8; row++) {
+        uint8_t low = src[row];
+        uint8_t high = src[row + 8];
+        for (size_t px = 0; px < 8; px++) {
+            size_t bit = 7 - px;
+            dst[row * 8 + px] = ((low >> bit) & 0x01) | (((high >> bit) & 0x01) << 1);
+        }
+    }
+
+    ppu->tile_valid[tile] = 1;
+}
+
+// Scrolling, see https://www.nesdev.org/wiki/PPU_scrolling
+
+static void PPU_increment_y(PPU *ppu) {
+    if ((ppu->v & 0x7000) != 0x7000) {
+        ppu->v += 0x1000;
+        return;
+    }
+
+    ppu->v &= ~0x7000;
+    uint16_t coarse_y = (ppu->v & 0x03E0) >> 5;
+    if (coarse_y == 29) {
+        coarse_y = 0;
+        ppu->v ^= 0x0800;
+    } else if (coarse_y == 31) {
+        coarse_y = 0;
+    } else {
+        coarse_y += 1;
+    }
+    ppu->v = (ppu->v & ~0x03E0) | (coarse_y << 5);
+}
+
+static void PPU_copy_x(PPU *ppu) {
+    ppu->v = (ppu->v & ~0x041F) | (ppu->t & 0x041F);
+}
+
+static void PPU_copy_y(PPU *ppu) {
+    ppu->v = (ppu->v & ~0x7BE0) | (ppu->t & 0x7BE0);
+}
+
+// Rendering
+
+// Fills line with (palette << 2 | pixel) per dot, 0 where the background is
+// transparent. Works on a copy of v, the coarse X increments of the real
+// hardware are overwritten at dot 257 anyway.
+static void PPU_render_background(PPU *ppu, uint8_t *line) {
+    uint8_t tiles[PPU_WIDTH + 8];
+    uint16_t v = ppu->v;
+    uint16_t table = (ppu->ctrl & PPU_CTRL_BG_TABLE) ? 0x1000 : 0x0000;
+    uint16_t fine_y = (v >> 12) & 0x07;
+
+    for (size_t i = 0; i < PPU_WIDTH / 8 + 1; i++) {
+        uint8_t tile = ppu->vram[PPU_nametable_index(ppu, 0x2000 | (v & 0x0FFF))];
+        uint8_t attr = ppu->vram[PPU_nametable_index(ppu, 0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07))];
+        uint8_t shift = ((v >> 4) & 0x04) | (v & 0x02);
+        uint8_t palette = ((attr >> shift) & 0x03) << 2;
+
+        const uint8_t *row = PPU_tile_row(ppu, table + tile * PPU_TILE_SIZE + fine_y);
+        uint8_t *dst = &tiles[i * 8];
+        for (size_t px = 0; px < 8; px++) {
+            dst[px] = row[px] ? (palette | row[px]) : 0;
+        }
+
+        if ((v & 0x001F) == 31) {
+            v = (v & ~0x001F) ^ 0x0400;
+        } else {
+            v += 1;
+        }
+    }
+
+    memcpy(line, &tiles[ppu->x], PPU_WIDTH);
+    if (!(ppu->mask & PPU_MASK_BG_LEFT)) {
+        memset(line, 0, 8);
+    }
+}
+
+// Sprite 0 hit needs both layers opaque and never happens at x = 255
+static void PPU_find_sprite0_hit(PPU *ppu, const uint8_t *bg, const uint8_t *sprites) {
+    if (ppu->sprite0_dot || (ppu->status & PPU_STATUS_SPRITE0_HIT)) return;
+
+    for (size_t x = 0; x < PPU_WIDTH - 1; x++) {
+        if ((sprites[x] & PPU_SPRITE_PIXEL_ZERO) && bg[x]) {
+            ppu->sprite0_dot = x + 2;
+            return;
+        }
+    }
+}
+
+// Render-free scanline: sprite evaluation for the overflow flag, and both
+// layers only on the few lines where sprite 0 can still hit
+static void PPU_evaluate_scanline(PPU *ppu) {
+    if (!(ppu->mask & PPU_MASK_SPRITES)) return;
+
+    int height = (ppu->ctrl & PPU_CTRL_SPRITE_SIZE) ? 16 : 8;
+    uint64_t in_range = ppu->sprites_in_range(ppu->oam, ppu->scanline, height);
+    if (__builtin_popcountll(in_range) > PPU_SPRITES_PER_LINE) {
+        ppu->status |= PPU_STATUS_OVERFLOW;
+    }
+
+    if (!(in_range & 0x01) || !(ppu->mask & PPU_MASK_BG) || ppu->sprite0_dot ||
+        (ppu->status & PPU_STATUS_SPRITE0_HIT)) {
+        return;
+    }
+
+    uint8_t bg[PPU_WIDTH];
+    uint8_t sprites[PPU_WIDTH];
+    PPU_render_background(ppu, bg);
+    PPU_render_sprites(ppu, sprites);
+    PPU_find_sprite0_hit(ppu, bg, sprites);
+}
+
+static void PPU_render_scanline(PPU *ppu) {
+    if (!ppu->render) {
+        PPU_evaluate_scanline(ppu);
+        return;
+    }
+
+    uint8_t *out = ppu->framebuffer[ppu->scanline];
+    uint8_t bg[PPU_WIDTH];
+    uint8_t sprites[PPU_WIDTH];
+
+    if (ppu->mask & PPU_MASK_BG) {
+        PPU_render_background(ppu, bg);
+    } else {
+        memset(bg, 0, sizeof(bg));
+    }
+
+    bool sprite0 = false;
+    if (ppu->mask & PPU_MASK_SPRITES) {
+        sprite0 = PPU_render_sprites(ppu, sprites);
+    } else {
+        memset(sprites, 0, sizeof(sprites));
+    }
+    if (sprite0) {
+        PPU_find_sprite0_hit(ppu, bg, sprites);
+    }
+
+    uint8_t grey = (ppu->mask & PPU_MASK_GREYSCALE) ? 0x30 : 0x3F;
+    for (size_t x = 0; x < PPU_WIDTH; x++) {
+        uint8_t sprite = sprites[x];
+        uint8_t color = bg[x];
+
+        if (sprite && (!color || !(sprite & PPU_SPRITE_PIXEL_BEHIND))) {
+            color = sprite & 0x1F;
+        }
+
+        out[x] = ppu->palette[color] & grey;
+    }
+}
+
+// Timing
+
+// Odd frames skip the last dot of the pre-render line while rendering
+static inline int PPU_next_event_line_end(PPU *ppu) {
+    if (ppu->scanline == PPU_PRERENDER_SCANLINE && (ppu->frame & 1) && PPU_rendering(ppu)) {
+        return PPU_DOTS_PER_SCANLINE - 1;
+    }
+    return PPU_DOTS_PER_SCANLINE;
+}
+
+// Dot of the next thing that happens on the current scanline
+static int PPU_next_event(PPU *ppu) {
+    int dot = ppu->dot;
+    int scanline = ppu->scanline;
+
+    if (scanline < PPU_HEIGHT || scanline == PPU_PRERENDER_SCANLINE) {
+        if (dot < 1) return 1;
+        if (ppu->sprite0_dot > dot) return ppu->sprite0_dot;
+        if (dot < 256) return 256;
+        if (dot < 257) return 257;
+        if (dot < PPU_MAPPER_CLOCK_DOT) return PPU_MAPPER_CLOCK_DOT;
+        if (scanline == PPU_PRERENDER_SCANLINE && dot < 304) return 304;
+        return PPU_next_event_line_end(ppu);
+    }
+
+    if (scanline == PPU_VBLANK_SCANLINE && dot < 1) return 1;
+    return PPU_DOTS_PER_SCANLINE;
+}
+
+static void PPU_end_scanline(PPU *ppu) {
+    ppu->dot = 0;
+    ppu->scanline += 1;
+    if (ppu->scanline == PPU_SCANLINES) {
+        ppu->scanline = 0;
+        ppu->frame += 1;
+    }
+}
+
+static void PPU_event(PPU *ppu) {
+    int dot = ppu->dot;
+    int scanline = ppu->scanline;
+    bool visible = scanline < PPU_HEIGHT;
+    bool prerender = scanline == PPU_PRERENDER_SCANLINE;
+
+    if (scanline == PPU_VBLANK_SCANLINE) {
+        if (dot == 1) {
+            ppu->status |= PPU_STATUS_VBLANK;
+            ppu->frame_complete = true;
+            if (ppu->ctrl & PPU_CTRL_NMI) ppu->nmi = true;
+        } else {
+            PPU_end_scanline(ppu);
+        }
+        return;
+    }
+
+    if (!visible && !prerender) {
+        PPU_end_scanline(ppu);
+        return;
+    }
+
+    if (dot == ppu->sprite0_dot) {
+        ppu->status |= PPU_STATUS_SPRITE0_HIT;
+        ppu->sprite0_dot = 0;
+    }
+
+    switch (dot) {
+    case 1:
+        if (visible) PPU_render_scanline(ppu);
+        if (prerender) ppu->status &= ~(PPU_STATUS_VBLANK | PPU_STATUS_SPRITE0_HIT | PPU_STATUS_OVERFLOW);
+        break;
+    case 256:
+        if (PPU_rendering(ppu)) PPU_increment_y(ppu);
+        break;
+    case 257:
+        if (PPU_rendering(ppu)) PPU_copy_x(ppu);
+        break;
+    case PPU_MAPPER_CLOCK_DOT:
+        if (PPU_rendering(ppu)) MAPPER_clock_scanline(ppu->mapper);
+        break;
+    case 304:
+        if (PPU_rendering(ppu) && prerender) PPU_copy_y(ppu);
+        break;
+    case PPU_DOTS_PER_SCANLINE - 1:
+    case PPU_DOTS_PER_SCANLINE:
+        if (dot == PPU_next_event_line_end(ppu)) PPU_end_scanline(ppu);
+        break;
+    }
+}
+
+void PPU_run(PPU *ppu, size_t dots) {
+    while (dots > 0) {
+        size_t step = PPU_next_event(ppu) - ppu->dot;
+        if (step > dots) {
+            ppu->dot += dots;
+            return;
+        }
+
+        ppu->dot += step;
+        dots -= step;
+        PPU_event(ppu);
+    }
+}
+
+// Dots to run until the one at (scanline, dot) has happened, its next
+// occurrence when the PPU is already there or past it
+static size_t PPU_dots_until(PPU *ppu, int scanline, int dot) {
+    int lines = scanline - ppu->scanline;
+    if (lines < 0 || (lines == 0 && dot <= ppu->dot)) lines += PPU_SCANLINES;
+    size_t dots = (size_t)lines * PPU_DOTS_PER_SCANLINE + dot - ppu->dot;
+    // Passing the end of a shortened pre-render line
+    if (ppu->scanline + lines >= PPU_SCANLINES && PPU_rendering(ppu) && (ppu->frame & 1)) dots -= 1;
+    return dots;
+}
+
+size_t PPU_cycles_until_interrupt(PPU *ppu) {
+    // The mapper clock only matters to boards with a scanline counter
+    bool rendering = PPU_rendering(ppu) && ppu->mapper->scanline;
+    bool counted = ppu->scanline < PPU_HEIGHT || ppu->scanline == PPU_PRERENDER_SCANLINE;
+    int scanline, dot = PPU_MAPPER_CLOCK_DOT;
+    if (rendering && counted && ppu->dot < PPU_MAPPER_CLOCK_DOT) {
+        scanline = ppu->scanline;
+    } else if (rendering && ppu->scanline < PPU_HEIGHT - 1) {
+        scanline = ppu->scanline + 1;
+    } else if (ppu->scanline < PPU_VBLANK_SCANLINE || (ppu->scanline == PPU_VBLANK_SCANLINE && ppu->dot < 1)) {
+        scanline = PPU_VBLANK_SCANLINE;
+        dot = 1;
+    } else if (rendering && ppu->scanline < PPU_PRERENDER_SCANLINE) {
+        scanline = PPU_PRERENDER_SCANLINE;
+    } else if (rendering) {
+        scanline = 0;
+    } else {
+        scanline = PPU_VBLANK_SCANLINE;
+        dot = 1;
+    }
+
+    // The event happens once all of its dots have been run
+    return (PPU_dots_until(ppu, scanline, dot) - 1) / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+size_t PPU_cycles_until_status_change(PPU *ppu) {
+    // VBlank sets its flag, the pre-render line clears all three
+    size_t dots = PPU_dots_until(ppu, PPU_VBLANK_SCANLINE, 1);
+    size_t clear = PPU_dots_until(ppu, PPU_PRERENDER_SCANLINE, 1);
+    if (clear < dots) dots = clear;
+
+    if (ppu->sprite0_dot > ppu->dot && (size_t)(ppu->sprite0_dot - ppu->dot) < dots) {
+        dots = ppu->sprite0_dot - ppu->dot;
+    }
+    // Sprite evaluation at the first dot of a visible line may set the overflow
+    // flag or schedule a sprite 0 hit
+    uint8_t flags = PPU_STATUS_OVERFLOW | PPU_STATUS_SPRITE0_HIT;
+    if ((ppu->mask & PPU_MASK_SPRITES) && (ppu->status & flags) != flags) {
+        int scanline = ppu->scanline + (ppu->dot >= 1);
+        if (scanline >= PPU_HEIGHT) scanline = 0;
+        size_t line = PPU_dots_until(ppu, scanline, 1);
+        if (line < dots) dots = line;
+    }
+
+    return (dots - 1) / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+// Registers
+
+uint8_t PPU_read_register(PPU *ppu, uint16_t addr, bool read_only) {
+    uint8_t data = ppu->open_bus;
+
+    switch (addr & 0x0007) {
+    case 0x0002:
+        data = (ppu->status & 0xE0) | (ppu->open_bus & 0x1F);
+        if (!read_only) {
+            ppu->status &= ~PPU_STATUS_VBLANK;
+            ppu->w = false;
+        }
+        break;
+    case 0x0004:
+        data = ppu->oam[ppu->oam_addr];
+        break;
+    case 0x0007:
+        if (read_only) {
+            data = PPU_vram_read(ppu, ppu->v);
+            break;
+        }
+        if ((ppu->v & 0x3FFF) < 0x3F00) {
+            data = ppu->data_buffer;
+            ppu->data_buffer = PPU_vram_read(ppu, ppu->v);
+        } else {
+            // Palette reads are not buffered, the buffer gets the nametable below
+            data = PPU_vram_read(ppu, ppu->v);
+            ppu->data_buffer = PPU_vram_read(ppu, ppu->v - 0x1000);
+        }
+        ppu->v += (ppu->ctrl & PPU_CTRL_INCREMENT) ? 32 : 1;
+        break;
+    }
+
+    if (!read_only) ppu->open_bus = data;
+    return data;
+}
+
+void PPU_write_register(PPU *ppu, uint16_t addr, uint8_t data) {
+    ppu->open_bus = data;
+
+    switch (addr & 0x0007) {
+    case 0x0000:
+        // Enabling NMI during VBlank fires it immediately
+        if (!(ppu->ctrl & PPU_CTRL_NMI) && (data & PPU_CTRL_NMI) && (ppu->status & PPU_STATUS_VBLANK)) {
+            ppu->nmi = true;
+        }
+        ppu->ctrl = data;
+        ppu->t = (ppu->t & ~0x0C00) | ((data & 0x03) << 10);
+        break;
+    case 0x0001:
+        ppu->mask = data;
+        break;
+    case 0x0003:
+        ppu->oam_addr = data;
+        break;
+    case 0x0004:
+        ppu->oam[ppu->oam_addr] = data;
+        ppu->oam_addr += 1;
+        break;
+    case 0x0005:
+        if (!ppu->w) {
+            ppu->t = (ppu->t & ~0x001F) | (data >> 3);
+            ppu->x = data & 0x07;
+        } else {
+            ppu->t = (ppu->t & ~0x73E0) | ((data & 0x07) << 12) | ((data & 0xF8) << 2);
+        }
+        ppu->w = !ppu->w;
+        break;
+    case 0x0006:
+        if (!ppu->w) {
+            ppu->t = (ppu->t & 0x00FF) | ((data & 0x3F) << 8);
+        } else {
+            ppu->t = (ppu->t & 0xFF00) | data;
+            ppu->v = ppu->t;
+        }
+        ppu->w = !ppu->w;
+        break;
+    case 0x0007:
+        PPU_vram_write(ppu, ppu->v, data);
+        ppu->v += (ppu->ctrl & PPU_CTRL_INCREMENT) ? 32 : 1;
+        break;
+    }
+}
+
+void PPU_oam_dma(PPU *ppu, const uint8_t *page) {
+    for (size_t i = 0; i < PPU_OAM_SIZE; i++) {
+        ppu->oam[(uint8_t)(ppu->oam_addr + i)] = page[i];
+    }
+}
+
+void PPU_save_state(const PPU *ppu, STATE *state) {
+    STATE_write(state, &ppu->ctrl, STATE_RANGE_SIZE(PPU, ctrl, chr_base));
+}
+
+void PPU_load_state(PPU *ppu, STATE *state) {
+    STATE_read(state, &ppu->ctrl, STATE_RANGE_SIZE(PPU, ctrl, chr_base));
+    // Decoded CHR-ROM tiles stay valid
+    if (ppu->mapper->chr_writable) {
+        memset(ppu->tile_valid, 0, ppu->chr_size / PPU_TILE_SIZE);
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef PPU_H
+#define PPU_H
+
+#include <BUS.h>
+#include <MAPPER.h>
+#include <STATE.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PPU_WIDTH 256
+#define PPU_HEIGHT 240
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_SCANLINES 262
+#define PPU_VBLANK_SCANLINE 241
+#define PPU_PRERENDER_SCANLINE 261
+#define PPU_DOTS_PER_CPU_CYCLE 3
+#define PPU_MAPPER_CLOCK_DOT 260 // scanline counters of mappers like the MMC3 are clocked here
+
+#define PPU_VRAM_SIZE 4096 // 2KB on the console, 4KB for four screen carts
+#define PPU_PALETTE_SIZE 32
+#define PPU_OAM_SIZE 256
+
+#define PPU_SPRITE_COUNT 64
+#define PPU_SPRITES_PER_LINE 8
+
+#define PPU_TILE_SIZE 16         // bytes of CHR per 8x8 tile
+#define PPU_DECODED_TILE_SIZE 64 // one byte per pixel
+
+typedef enum {
+    PPU_CTRL_INCREMENT = (1 << 2),   // VRAM address increment 32 instead of 1
+    PPU_CTRL_SPRITE_TABLE = (1 << 3),
+    PPU_CTRL_BG_TABLE = (1 << 4),
+    PPU_CTRL_SPRITE_SIZE = (1 << 5), // 8x16 sprites
+    PPU_CTRL_NMI = (1 << 7)
+} PPU_CTRL;
+
+typedef enum {
+    PPU_MASK_GREYSCALE = (1 << 0),
+    PPU_MASK_BG_LEFT = (1 << 1),
+    PPU_MASK_SPRITE_LEFT = (1 << 2),
+    PPU_MASK_BG = (1 << 3),
+    PPU_MASK_SPRITES = (1 << 4)
+} PPU_MASK;
+
+typedef enum {
+    PPU_STATUS_OVERFLOW = (1 << 5),
+    PPU_STATUS_SPRITE0_HIT = (1 << 6),
+    PPU_STATUS_VBLANK = (1 << 7)
+} PPU_STATUS;
+
+// Sprite line buffer entries: palette index 0x10-0x1F in the low bits, 0 for
+// transparent, plus these flags
+typedef enum {
+    PPU_SPRITE_PIXEL_BEHIND = (1 << 6), // background priority
+    PPU_SPRITE_PIXEL_ZERO = (1 << 7)    // pixel belongs to OAM entry 0
+} PPU_SPRITE_PIXEL;
+
+// Returns one bit per OAM entry whose sprite covers scanline
+typedef uint64_t (*PPU_SpriteEvalFunc)(const uint8_t *oam, int scanline, int height);
+
+typedef struct {
+    MAPPER *mapper;
+    PPU_SpriteEvalFunc sprites_in_range; // best variant for the host CPU
+    // When false visible scanlines only evaluate what the CPU can observe
+    // (sprite 0 hit, sprite overflow) and the framebuffer is left untouched
+    bool render;
+
+    // Everything from ctrl up to oam is saved as one block
+    uint8_t ctrl;
+    uint8_t mask;
+    uint8_t status;
+    uint8_t oam_addr;
+    uint16_t v; // current VRAM address
+    uint16_t t; // temporary VRAM address
+    uint8_t x;  // fine X scroll
+    bool w;     // first/second write toggle of $2005/$2006
+    uint8_t data_buffer;
+    uint8_t open_bus;
+
+    int scanline; // 0-239 visible, 241 VBlank start, 261 pre-render
+    int dot;      // 0-340
+    size_t frame;
+    bool nmi;            // VBlank NMI request, cleared by whoever delivers it
+    bool frame_complete; // set at VBlank start, cleared by whoever consumes the frame
+    int sprite0_dot;     // dot of the pending sprite 0 hit on this scanline, 0 if none
+
+    uint8_t vram[PPU_VRAM_SIZE];
+    uint8_t palette[PPU_PALETTE_SIZE];
+    uint8_t oam[PPU_OAM_SIZE];
+
+    // Pattern table rows decoded to one 2 bit pixel per byte, filled lazily per
+    // tile of the cartridge's CHR memory and invalidated by CHR-RAM writes
+    const uint8_t *chr_base;
+    size_t chr_size;
+    uint8_t *tile_cache;
+    uint8_t *tile_valid;
+
+    // NES palette indices (0-63) of the last rendered frame
+    uint8_t framebuffer[PPU_HEIGHT][PPU_WIDTH];
+} PPU;
+
+// Maps the registers at $2000-$3FFF into bus
+void PPU_init(PPU *ppu, MAPPER *mapper, BUS *bus);
+void PPU_free(PPU *ppu);
+void PPU_reset(PPU *ppu);
+// Reset plus cleared VRAM, palette and OAM
+void PPU_power(PPU *ppu);
+
+// Advances the PPU by dots (3 per CPU cycle), renders each visible scanline
+// at its first dot
+void PPU_run(PPU *ppu, size_t dots);
+// CPU cycles that can pass before the PPU might raise an NMI, complete the
+// frame or clock the mapper's scanline counter (boards that have one), assuming
+// no register accesses
+size_t PPU_cycles_until_interrupt(PPU *ppu);
+// CPU cycles that can pass before a $2002 read might return different flags,
+// assuming no register accesses
+size_t PPU_cycles_until_status_change(PPU *ppu);
+
+uint8_t PPU_read_register(PPU *ppu, uint16_t addr, bool read_only);
+void PPU_write_register(PPU *ppu, uint16_t addr, uint8_t data);
+// Sprite evaluation of all 64 OAM entries at once, the SIMD variants are only
+// compiled on x86 and picked at runtime by PPU_init
+uint64_t PPU_sprites_in_range_scalar(const uint8_t *oam, int scanline, int height);
+PPU_SpriteEvalFunc PPU_select_sprite_eval(void);
+
+typedef struct {
+    const char *name;
+    PPU_SpriteEvalFunc eval;
+} PPU_SPRITE_EVAL;
+
+// The variants the host CPU can run for comparing them, scalar first and the
+// one PPU_select_sprite_eval picks last. Returns how many there are.
+size_t PPU_sprite_eval_variants(const PPU_SPRITE_EVAL **variants);
+// Evaluates and draws the sprites of the current scanline into line, returns
+// true if sprite 0 is among them
+bool PPU_render_sprites(PPU *ppu, uint8_t *line);
+
+void PPU_decode_tile(PPU *ppu, size_t tile);
+
+// Registers, timing and internal memories, the framebuffer is not saved and
+// the tile cache is rebuilt lazily after a load
+void PPU_save_state(const PPU *ppu, STATE *state);
+void PPU_load_state(PPU *ppu, STATE *state);
+
+static inline uint8_t *PPU_chr(PPU *ppu, uint16_t addr) {
+    return &ppu->mapper->chr_pages[addr >> 10][addr & 0x03FF];
+}
+
+// Returns the 8 decoded pixels of the pattern row at PPU address addr
+static inline const uint8_t *PPU_tile_row(PPU *ppu, uint16_t addr) {
+    size_t offset = PPU_chr(ppu, addr) - ppu->chr_base;
+    size_t tile = offset / PPU_TILE_SIZE;
+    if (!ppu->tile_valid[tile]) {
+        PPU_decode_tile(ppu, tile);
+    }
+    return ppu->tile_cache + tile * PPU_DECODED_TILE_SIZE + (offset & 0x07) * 8;
+}
+
+// OAM DMA through $4014, page holds the 256 bytes read from CPU memory
+void PPU_oam_dma(PPU *ppu, const uint8_t *page);
+
+#endif // PPU_H
@@ -0,0 +1,161 @@
+#include <PPU.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PPU_SPRITE_X86
+#include <immintrin.h>
+#endif
+
+// Sprite evaluation: OAM entry i covers scanline if 0 <= scanline - 1 - Y < height,
+// entries with Y >= 239 never do. Each variant returns the matches as a bitmask
+// with bit i for OAM entry i, so the 8 highest priority sprites are the 8
+// lowest set bits.
+
+uint64_t PPU_sprites_in_range_scalar(const uint8_t *oam, int scanline, int height) {
+    uint64_t in_range = 0;
+    for (size_t i = 0; i < PPU_SPRITE_COUNT; i++) {
+        int row = scanline - 1 - oam[i * 4];
+        if (row >= 0 && row < height) {
+            in_range |= (uint64_t)1 << i;
+        }
+    }
+    return in_range;
+}
+
+#ifdef PPU_SPRITE_X86
+// Y sits in the low byte of every 32 bit OAM entry, masking and packing twice
+// gathers 16 Y values into 16 bit lanes for a signed range compare
+__attribute__((target("sse2"))) static uint64_t PPU_sprites_in_range_sse2(const uint8_t *oam, int scanline,
+                                                                          int height) {
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+    const __m128i top = _mm_set1_epi16(scanline - 1);
+    const __m128i below = _mm_set1_epi16(height);
+    const __m128i above = _mm_set1_epi16(-1);
+
+    uint64_t in_range = 0;
+    for (size_t group = 0; group < PPU_SPRITE_COUNT / 16; group++) {
+        const __m128i *src = (const __m128i *)(oam + group * 64);
+        __m128i y0 = _mm_and_si128(_mm_loadu_si128(src + 0), low_byte);
+        __m128i y1 = _mm_and_si128(_mm_loadu_si128(src + 1), low_byte);
+        __m128i y2 = _mm_and_si128(_mm_loadu_si128(src + 2), low_byte);
+        __m128i y3 = _mm_and_si128(_mm_loadu_si128(src + 3), low_byte);
+
+        __m128i row_a = _mm_sub_epi16(top, _mm_packs_epi32(y0, y1));
+        __m128i row_b = _mm_sub_epi16(top, _mm_packs_epi32(y2, y3));
+        __m128i hit_a = _mm_and_si128(_mm_cmpgt_epi16(row_a, above), _mm_cmplt_epi16(row_a, below));
+        __m128i hit_b = _mm_and_si128(_mm_cmpgt_epi16(row_b, above), _mm_cmplt_epi16(row_b, below));
+
+        uint64_t bits = (uint16_t)_mm_movemask_epi8(_mm_packs_epi16(hit_a, hit_b));
+        in_range |= bits << (group * 16);
+    }
+    return in_range;
+}
+
+// Same as SSE2 on 32 entries per step, the packs work per 128 bit lane so the
+// 64 bit quarters are put back in order after each one
+__attribute__((target("avx2"))) static uint64_t PPU_sprites_in_range_avx2(const uint8_t *oam, int scanline,
+                                                                          int height) {
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+    const __m256i top = _mm256_set1_epi16(scanline - 1);
+    const __m256i below = _mm256_set1_epi16(height);
+    const __m256i above = _mm256_set1_epi16(-1);
+
+    uint64_t in_range = 0;
+    for (size_t group = 0; group < PPU_SPRITE_COUNT / 32; group++) {
+        const __m256i *src = (const __m256i *)(oam + group * 128);
+        __m256i y0 = _mm256_and_si256(_mm256_loadu_si256(src + 0), low_byte);
+        __m256i y1 = _mm256_and_si256(_mm256_loadu_si256(src + 1), low_byte);
+        __m256i y2 = _mm256_and_si256(_mm256_loadu_si256(src + 2), low_byte);
+        __m256i y3 = _mm256_and_si256(_mm256_loadu_si256(src + 3), low_byte);
+
+        __m256i y_a = _mm256_permute4x64_epi64(_mm256_packs_epi32(y0, y1), 0xD8);
+        __m256i y_b = _mm256_permute4x64_epi64(_mm256_packs_epi32(y2, y3), 0xD8);
+        __m256i row_a = _mm256_sub_epi16(top, y_a);
+        __m256i row_b = _mm256_sub_epi16(top, y_b);
+        __m256i hit_a = _mm256_and_si256(_mm256_cmpgt_epi16(row_a, above), _mm256_cmpgt_epi16(below, row_a));
+        __m256i hit_b = _mm256_and_si256(_mm256_cmpgt_epi16(row_b, above), _mm256_cmpgt_epi16(below, row_b));
+
+        __m256i hits = _mm256_permute4x64_epi64(_mm256_packs_epi16(hit_a, hit_b), 0xD8);
+        uint64_t bits = (uint32_t)_mm256_movemask_epi8(hits);
+        in_range |= bits << (group * 32);
+    }
+    return in_range;
+}
+#endif
+
+// Every variant needs what the ones before it need
+static const PPU_SPRITE_EVAL PPU_SPRITE_EVALS[] = {
+    {"scalar", PPU_sprites_in_range_scalar},
+#ifdef PPU_SPRITE_X86
+    {"sse2", PPU_sprites_in_range_sse2},
+    {"avx2", PPU_sprites_in_range_avx2},
+#endif
+};
+
+size_t PPU_sprite_eval_variants(const PPU_SPRITE_EVAL **variants) {
+    size_t count = 1;
+#ifdef PPU_SPRITE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) count = 2;
+    if (count == 2 && __builtin_cpu_supports("avx2")) count = 3;
+#endif
+    *variants = PPU_SPRITE_EVALS;
+    return count;
+}
+
+PPU_SpriteEvalFunc PPU_select_sprite_eval(void) {
+    const PPU_SPRITE_EVAL *variants;
+    size_t count = PPU_sprite_eval_variants(&variants);
+    return variants[count - 1].eval;
+}
+
+bool PPU_render_sprites(PPU *ppu, uint8_t *line) {
+    memset(line, 0, PPU_WIDTH);
+
+    int height = (ppu->ctrl & PPU_CTRL_SPRITE_SIZE) ? 16 : 8;
+    uint64_t in_range = ppu->sprites_in_range(ppu->oam, ppu->scanline, height);
+    if (!in_range) return false;
+    bool sprite0 = in_range & 0x01;
+
+    // Only the first 8 sprites are drawn, the hardware overflow bug that also
+    // checks wrong OAM bytes after the 8th match is not emulated
+    if (__builtin_popcountll(in_range) > PPU_SPRITES_PER_LINE) {
+        ppu->status |= PPU_STATUS_OVERFLOW;
+    }
+
+    size_t left = (ppu->mask & PPU_MASK_SPRITE_LEFT) ? 0 : 8;
+
+    for (size_t n = 0; n < PPU_SPRITES_PER_LINE && in_range; n++) {
+        size_t i = __builtin_ctzll(in_range);
+        in_range &= in_range - 1;
+
+        const uint8_t *sprite = &ppu->oam[i * 4];
+        uint8_t tile = sprite[1];
+        uint8_t attr = sprite[2];
+        size_t x = sprite[3];
+        int row = ppu->scanline - 1 - sprite[0];
+
+        if (attr & 0x80) row = height - 1 - row; // vertical flip
+
+        uint16_t addr;
+        if (height == 16) {
+            addr = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4);
+            if (row >= 8) addr += PPU_TILE_SIZE;
+        } else {
+            addr = ((ppu->ctrl & PPU_CTRL_SPRITE_TABLE) ? 0x1000 : 0x0000) | (tile << 4);
+        }
+        const uint8_t *pixels = PPU_tile_row(ppu, addr + (row & 0x07));
+
+        uint8_t flags = 0x10 | ((attr & 0x03) << 2);
+        if (attr & 0x20) flags |= PPU_SPRITE_PIXEL_BEHIND;
+        if (i == 0) flags |= PPU_SPRITE_PIXEL_ZERO;
+        bool flip = attr & 0x40;
+
+        for (size_t px = 0; px < 8 && x + px < PPU_WIDTH; px++) {
+            uint8_t pixel = pixels[flip ? 7 - px : px];
+            // Lower OAM entries win, even if they end up behind the background
+            if (!pixel || line[x + px] || x + px < left) continue;
+            line[x + px] = flags | pixel;
+        }
+    }
+    return sprite0;
+}
@@ -0,0 +1,190 @@
+#include <PPU_THREAD.h>
+#include <sched.h>
+
+#define PPU_THREAD_MASK (PPU_THREAD_QUEUE_SIZE - 1)
+
+// Busy-wait step: spins for a while, then gives the core away in case the
+// other thread needs it
+static void PPU_THREAD_relax(const PPU_THREAD *thread, size_t *spins) {
+    if (++*spins < thread->spins) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+// Called after publishing head, target or stop. The fence pairs with the one
+// in PPU_THREAD_sleep: either this sees sleeping set or the PPU thread sees
+// what was published before it waits.
+static void PPU_THREAD_wake(PPU_THREAD *thread) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&thread->sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&thread->lock);
+        pthread_cond_signal(&thread->wake);
+        pthread_mutex_unlock(&thread->lock);
+    }
+}
+
+// PPU thread side
+
+static void PPU_THREAD_advance(PPU_THREAD *thread, uint64_t cycle) {
+    uint64_t clock = __atomic_load_n(&thread->clock, __ATOMIC_RELAXED);
+    if (cycle > clock) {
+        PPU_run(thread->ppu, (cycle - clock) * PPU_DOTS_PER_CPU_CYCLE);
+        __atomic_store_n(&thread->clock, cycle, __ATOMIC_RELEASE);
+    }
+}
+
+static void PPU_THREAD_apply(PPU_THREAD *thread, const PPU_THREAD_WRITE *write) {
+    PPU *ppu = thread->ppu;
+    if (write->addr == PPU_THREAD_OAM_DMA) {
+        ppu->oam[(uint8_t)(ppu->oam_addr + thread->dma_index)] = write->data;
+        thread->dma_index += 1;
+    } else {
+        PPU_write_register(ppu, write->addr, write->data);
+    }
+}
+
+static bool PPU_THREAD_idle(PPU_THREAD *thread, uint64_t tail) {
+    return __atomic_load_n(&thread->head, __ATOMIC_RELAXED) == tail &&
+           __atomic_load_n(&thread->target, __ATOMIC_RELAXED) <= __atomic_load_n(&thread->clock, __ATOMIC_RELAXED) &&
+           !__atomic_load_n(&thread->stop, __ATOMIC_RELAXED);
+}
+
+static void PPU_THREAD_sleep(PPU_THREAD *thread, uint64_t tail) {
+    pthread_mutex_lock(&thread->lock);
+    __atomic_store_n(&thread->sleeping, true, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (PPU_THREAD_idle(thread, tail)) {
+        pthread_cond_wait(&thread->wake, &thread->lock);
+    }
+    __atomic_store_n(&thread->sleeping, false, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&thread->lock);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static void *PPU_THREAD_main(void *arg) {
+    PPU_THREAD *thread = arg;
+    uint64_t tail = thread->tail;
+    size_t spins = 0;
+
+    for (;;) {
+        // Target first: every write queued before it was published is seen
+        // below, and writes queued after it are not earlier than it
+        uint64_t target = __atomic_load_n(&thread->target, __ATOMIC_ACQUIRE);
+        uint64_t head = __atomic_load_n(&thread->head, __ATOMIC_ACQUIRE);
+        bool busy = tail != head;
+        for (; tail != head; tail++) {
+            const PPU_THREAD_WRITE *write = &thread->queue[tail & PPU_THREAD_MASK];
+            PPU_THREAD_advance(thread, write->cycle);
+            PPU_THREAD_apply(thread, write);
+            __atomic_store_n(&thread->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+        if (target > __atomic_load_n(&thread->clock, __ATOMIC_RELAXED)) {
+            PPU_THREAD_advance(thread, target);
+            busy = true;
+        }
+
+        if (busy) {
+            spins = 0;
+        } else if (__atomic_load_n(&thread->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        } else if (++spins >= thread->spins) {
+            spins = 0;
+            PPU_THREAD_sleep(thread, tail);
+        } else {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+    return NULL;
+}
+
+// CPU thread side
+
+bool PPU_THREAD_start(PPU_THREAD *thread, PPU *ppu, size_t clock) {
+    if (!thread || !ppu) {
+        PANIC("NULL POINTER in PPU_THREAD_start!");
+    }
+
+    thread->ppu = ppu;
+    thread->spins = POOL_default_workers() > 1 ? PPU_THREAD_SPINS : 0;
+    thread->head = 0;
+    thread->target = clock;
+    thread->stop = false;
+    thread->tail = 0;
+    thread->clock = clock;
+    thread->sleeping = false;
+    thread->dma_index = 0;
+    pthread_mutex_init(&thread->lock, NULL);
+    pthread_cond_init(&thread->wake, NULL);
+
+    if (pthread_create(&thread->thread, NULL, PPU_THREAD_main, thread) != 0) {
+        pthread_cond_destroy(&thread->wake);
+        pthread_mutex_destroy(&thread->lock);
+        return false;
+    }
+    return true;
+}
+
+void PPU_THREAD_stop(PPU_THREAD *thread) {
+    __atomic_store_n(&thread->stop, true, __ATOMIC_RELEASE);
+    PPU_THREAD_wake(thread);
+    pthread_join(thread->thread, NULL);
+    pthread_cond_destroy(&thread->wake);
+    pthread_mutex_destroy(&thread->lock);
+}
+
+// Stores one write without publishing it, waiting for room if the queue is full
+static void PPU_THREAD_push(PPU_THREAD *thread, uint64_t head, uint64_t cycle, uint16_t addr, uint8_t data) {
+    if (head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) >= PPU_THREAD_QUEUE_SIZE) {
+        // The PPU thread might have gone to sleep before the full queue was published
+        __atomic_store_n(&thread->head, head, __ATOMIC_RELEASE);
+        PPU_THREAD_wake(thread);
+        size_t spins = 0;
+        while (head - __atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) >= PPU_THREAD_QUEUE_SIZE) {
+            PPU_THREAD_relax(thread, &spins);
+        }
+    }
+
+    PPU_THREAD_WRITE *write = &thread->queue[head & PPU_THREAD_MASK];
+    write->cycle = cycle;
+    write->addr = addr;
+    write->data = data;
+}
+
+void PPU_THREAD_write(PPU_THREAD *thread, size_t cycle, uint16_t addr, uint8_t data) {
+    uint64_t head = thread->head;
+    PPU_THREAD_push(thread, head, cycle, addr, data);
+    __atomic_store_n(&thread->head, head + 1, __ATOMIC_RELEASE);
+    PPU_THREAD_wake(thread);
+}
+
+void PPU_THREAD_oam_dma(PPU_THREAD *thread, size_t cycle, const uint8_t *page) {
+    uint64_t head = thread->head;
+    for (size_t i = 0; i < PPU_OAM_SIZE; i++) {
+        PPU_THREAD_push(thread, head + i, cycle, PPU_THREAD_OAM_DMA, page[i]);
+    }
+    __atomic_store_n(&thread->head, head + PPU_OAM_SIZE, __ATOMIC_RELEASE);
+    PPU_THREAD_wake(thread);
+}
+
+void PPU_THREAD_run_to(PPU_THREAD *thread, size_t cycle) {
+    if (cycle <= thread->target) return;
+    __atomic_store_n(&thread->target, cycle, __ATOMIC_RELEASE);
+    PPU_THREAD_wake(thread);
+}
+
+void PPU_THREAD_sync(PPU_THREAD *thread, size_t cycle) {
+    PPU_THREAD_run_to(thread, cycle);
+
+    uint64_t head = thread->head;
+    size_t spins = 0;
+    while (__atomic_load_n(&thread->tail, __ATOMIC_ACQUIRE) != head ||
+           __atomic_load_n(&thread->clock, __ATOMIC_ACQUIRE) < cycle) {
+        PPU_THREAD_relax(thread, &spins);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef PPU_THREAD_H
+#define PPU_THREAD_H
+
+#include <POOL.h>
+#include <PPU.h>
+#include <UTIL.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PPU_THREAD_QUEUE_SIZE 1024 // entries, a power of two
+// Queue address of one byte of an OAM DMA, the 256 bytes are queued in order
+#define PPU_THREAD_OAM_DMA 0x4014
+// Polls of an empty queue before the PPU thread goes to sleep, and polls of a
+// PPU that is behind before the CPU thread yields its core. Neither spins on a
+// single core, where the thread waited for can not run meanwhile.
+#define PPU_THREAD_SPINS 4096
+
+// A register write the PPU applies once it has been run up to cycle
+typedef struct {
+    uint64_t cycle;
+    uint16_t addr;
+    uint8_t data;
+} PPU_THREAD_WRITE;
+
+// Runs a PPU on its own thread, behind the CPU. The CPU thread (the only
+// producer) queues timestamped register writes and tells the PPU thread how far
+// the CPU got; the PPU thread runs up to each write's cycle, applies it and goes
+// on up to that point. Nothing else of the PPU may be touched by the CPU thread
+// unless PPU_THREAD_sync has just returned.
+typedef struct {
+    PPU *ppu;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    size_t spins; // PPU_THREAD_SPINS, 0 on a single core
+
+    // Written by the CPU thread
+    uint64_t head;   // writes queued
+    uint64_t target; // CPU cycle the PPU may be run up to
+    bool stop;
+    PPU_THREAD_WRITE queue[PPU_THREAD_QUEUE_SIZE];
+
+    // Written by the PPU thread, kept apart from the fields above by the queue
+    uint64_t tail;  // writes applied
+    uint64_t clock; // CPU cycle the PPU has been run up to
+    bool sleeping;
+    uint8_t dma_index; // next OAM byte of a queued DMA
+} PPU_THREAD;
+
+// Starts running ppu, which is currently at CPU cycle clock, on a new thread.
+// Returns false if the thread could not be created.
+bool PPU_THREAD_start(PPU_THREAD *thread, PPU *ppu, size_t clock);
+// Lets the PPU catch up with everything queued, then ends the thread
+void PPU_THREAD_stop(PPU_THREAD *thread);
+
+// The rest is for the CPU thread, cycles never go backwards
+
+// Queues a write to the register at addr ($2000-$3FFF), applied at cycle
+void PPU_THREAD_write(PPU_THREAD *thread, size_t cycle, uint16_t addr, uint8_t data);
+// Queues an OAM DMA of page, applied at cycle
+void PPU_THREAD_oam_dma(PPU_THREAD *thread, size_t cycle, const uint8_t *page);
+// Lets the PPU run up to cycle without waiting for it
+void PPU_THREAD_run_to(PPU_THREAD *thread, size_t cycle);
+// Returns once the PPU has been run up to cycle with every queued write
+// applied. Until the next write or run_to the PPU is the CPU thread's.
+void PPU_THREAD_sync(PPU_THREAD *thread, size_t cycle);
+
+#endif // PPU_THREAD_H
@@ -0,0 +1,178 @@
+#include <CPU.h>
+#include <PROFILE.h>
+#include <math.h>
+
+static uint8_t PROFILE_read(void *ctx, uint16_t addr, bool read_only) {
+    PROFILE *profile = ctx;
+    // Debugger and tracer peeks are not guest accesses
+    if (!read_only) profile->reads[addr] += 1;
+    return BUS_read(profile->target, addr, read_only);
+}
+
+static void PROFILE_write(void *ctx, uint16_t addr, uint8_t data) {
+    PROFILE *profile = ctx;
+    profile->writes[addr] += 1;
+    BUS_write(profile->target, addr, data);
+}
+
+void PROFILE_init(PROFILE *profile) {
+    BUS_init(&profile->bus);
+    BUS_map_io(&profile->bus, 0x0000, RAM_SIZE, PROFILE_read, PROFILE_write, profile);
+    profile->bus.ram_size = 0;
+    profile->target = NULL;
+    PROFILE_clear(profile);
+}
+
+void PROFILE_clear(PROFILE *profile) {
+    memset(profile, 0, offsetof(PROFILE, bus));
+}
+
+BUS *PROFILE_attach(PROFILE *profile, BUS *target) {
+    profile->target = target;
+    return &profile->bus;
+}
+
+static uint64_t PROFILE_page_sum(const uint64_t *counts, size_t page) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BUS_PAGE_SIZE; i++) {
+        sum += counts[page * BUS_PAGE_SIZE + i];
+    }
+    return sum;
+}
+
+// Up to limit addresses ordered by cycles spent, hottest first, kept sorted by
+// insertion in a single pass
+static size_t PROFILE_hot_pcs(const PROFILE *profile, uint16_t *pcs, size_t limit) {
+    size_t count = 0;
+    for (size_t pc = 0; pc < RAM_SIZE; pc++) {
+        uint64_t cycles = profile->pc_cycles[pc];
+        if (!profile->pc_count[pc]) continue;
+        if (count == limit && cycles <= profile->pc_cycles[pcs[count - 1]]) continue;
+
+        size_t i = (count < limit) ? count++ : count - 1;
+        while (i > 0 && profile->pc_cycles[pcs[i - 1]] < cycles) {
+            pcs[i] = pcs[i - 1];
+            i -= 1;
+        }
+        pcs[i] = (uint16_t)pc;
+    }
+    return count;
+}
+
+bool PROFILE_write_json(const PROFILE *profile, FILE *file) {
+    fprintf(file, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"stall_cycles\": %llu,\n",
+            (unsigned long long)profile->instructions, (unsigned long long)profile->cycles,
+            (unsigned long long)profile->stall_cycles);
+
+    fprintf(file, "  \"opcodes\": [");
+    bool first = true;
+    for (size_t op = 0; op < 256; op++) {
+        if (!profile->opcode_count[op]) continue;
+        fprintf(file, "%s\n    {\"opcode\": %zu, \"name\": \"%s\", \"mode\": \"%s\", \"count\": %llu, \"cycles\": %llu}",
+                first ? "" : ",", op, OP_CODE_MATRIX[op].name, OP_CODE_MATRIX[op].am_name,
+                (unsigned long long)profile->opcode_count[op], (unsigned long long)profile->opcode_cycles[op]);
+        first = false;
+    }
+
+    uint16_t pcs[PROFILE_TOP_PCS];
+    size_t count = PROFILE_hot_pcs(profile, pcs, PROFILE_TOP_PCS);
+    fprintf(file, "\n  ],\n  \"hot_pcs\": [");
+    for (size_t i = 0; i < count; i++) {
+        fprintf(file, "%s\n    {\"pc\": %u, \"count\": %llu, \"cycles\": %llu}", i ? "," : "", pcs[i],
+                (unsigned long long)profile->pc_count[pcs[i]], (unsigned long long)profile->pc_cycles[pcs[i]]);
+    }
+
+    fprintf(file, "\n  ],\n  \"pages\": [");
+    first = true;
+    for (size_t page = 0; page < BUS_PAGE_COUNT; page++) {
+        uint64_t reads = PROFILE_page_sum(profile->reads, page);
+        uint64_t writes = PROFILE_page_sum(profile->writes, page);
+        uint64_t executed = PROFILE_page_sum(profile->pc_count, page);
+        if (!reads && !writes && !executed) continue;
+        fprintf(file, "%s\n    {\"page\": %zu, \"reads\": %llu, \"writes\": %llu, \"executed\": %llu}",
+                first ? "" : ",", page, (unsigned long long)reads, (unsigned long long)writes,
+                (unsigned long long)executed);
+        first = false;
+    }
+    fprintf(file, "\n  ]\n}\n");
+
+    return !ferror(file);
+}
+
+bool PROFILE_write_csv(const PROFILE *profile, FILE *file) {
+    fprintf(file, "kind,key,name,count,cycles\n");
+    for (size_t op = 0; op < 256; op++) {
+        if (!profile->opcode_count[op]) continue;
+        fprintf(file, "opcode,%zu,%s %s,%llu,%llu\n", op, OP_CODE_MATRIX[op].name, OP_CODE_MATRIX[op].am_name,
+                (unsigned long long)profile->opcode_count[op], (unsigned long long)profile->opcode_cycles[op]);
+    }
+    for (size_t pc = 0; pc < RAM_SIZE; pc++) {
+        if (!profile->pc_count[pc]) continue;
+        fprintf(file, "pc,%zu,,%llu,%llu\n", pc, (unsigned long long)profile->pc_count[pc],
+                (unsigned long long)profile->pc_cycles[pc]);
+    }
+    for (size_t page = 0; page < BUS_PAGE_COUNT; page++) {
+        uint64_t reads = PROFILE_page_sum(profile->reads, page);
+        uint64_t writes = PROFILE_page_sum(profile->writes, page);
+        if (reads) fprintf(file, "page_read,%zu,,%llu,\n", page, (unsigned long long)reads);
+        if (writes) fprintf(file, "page_write,%zu,,%llu,\n", page, (unsigned long long)writes);
+    }
+    return !ferror(file);
+}
+
+// Maps counts to 0..255 on a log scale relative to the largest count
+static uint8_t PROFILE_scale(uint64_t count, double log_max) {
+    if (!count || log_max <= 0.0) return 0;
+    return (uint8_t)(32.0 + 223.0 * log((double)count + 1.0) / log_max);
+}
+
+static double PROFILE_log_max(const uint64_t *counts) {
+    uint64_t max = 0;
+    for (size_t i = 0; i < RAM_SIZE; i++) {
+        if (counts[i] > max) max = counts[i];
+    }
+    return log((double)max + 1.0);
+}
+
+bool PROFILE_write_heatmap(const PROFILE *profile, FILE *file) {
+    double log_writes = PROFILE_log_max(profile->writes);
+    double log_executed = PROFILE_log_max(profile->pc_count);
+    double log_reads = PROFILE_log_max(profile->reads);
+
+    fprintf(file, "P6\n256 256\n255\n");
+    uint8_t row[256 * 3];
+    for (size_t y = 0; y < 256; y++) {
+        for (size_t x = 0; x < 256; x++) {
+            size_t addr = y * 256 + x;
+            row[x * 3 + 0] = PROFILE_scale(profile->writes[addr], log_writes);
+            row[x * 3 + 1] = PROFILE_scale(profile->pc_count[addr], log_executed);
+            row[x * 3 + 2] = PROFILE_scale(profile->reads[addr], log_reads);
+        }
+        if (fwrite(row, 1, sizeof(row), file) != sizeof(row)) return false;
+    }
+    return true;
+}
+
+typedef bool (*PROFILE_WriteFunc)(const PROFILE *profile, FILE *file);
+
+static bool PROFILE_write_report(const PROFILE *profile, const char *prefix, const char *extension,
+                                 PROFILE_WriteFunc write) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.%s", prefix, extension);
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open profile report '%s'\n", path);
+        return false;
+    }
+    bool ok = write(profile, file);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) fprintf(stderr, "Could not write profile report '%s'\n", path);
+    return ok;
+}
+
+bool PROFILE_write_reports(const PROFILE *profile, const char *prefix) {
+    bool ok = PROFILE_write_report(profile, prefix, "json", PROFILE_write_json);
+    ok = PROFILE_write_report(profile, prefix, "csv", PROFILE_write_csv) && ok;
+    ok = PROFILE_write_report(profile, prefix, "ppm", PROFILE_write_heatmap) && ok;
+    return ok;
+}
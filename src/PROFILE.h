@@ -0,0 +1,60 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <BUS.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROFILE_TOP_PCS 64 // hottest addresses listed in the JSON report
+
+// Execution profile in flat counter arrays. The CPU counts instructions while
+// attached with CPU_set_profile, memory accesses are counted by routing the CPU
+// through bus, a page table of handlers forwarding to the real bus. Nothing is
+// counted and nothing costs anything while the profile is detached.
+typedef struct {
+    uint64_t opcode_count[256];
+    uint64_t opcode_cycles[256];
+    uint64_t pc_count[RAM_SIZE];
+    uint64_t pc_cycles[RAM_SIZE];
+    uint64_t reads[RAM_SIZE];
+    uint64_t writes[RAM_SIZE];
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t stall_cycles; // interrupt entry and other cycles pending before an instruction
+
+    BUS bus;
+    BUS *target;
+} PROFILE;
+
+void PROFILE_init(PROFILE *profile);
+void PROFILE_clear(PROFILE *profile);
+
+// Points the counting bus at target, returns the bus to give the CPU
+BUS *PROFILE_attach(PROFILE *profile, BUS *target);
+
+static inline void PROFILE_instruction(PROFILE *profile, uint16_t pc, uint8_t opcode, size_t cycles,
+                                       size_t stall_cycles) {
+    profile->opcode_count[opcode] += 1;
+    profile->opcode_cycles[opcode] += cycles;
+    profile->pc_count[pc] += 1;
+    profile->pc_cycles[pc] += cycles;
+    profile->instructions += 1;
+    profile->cycles += cycles + stall_cycles;
+    profile->stall_cycles += stall_cycles;
+}
+
+// Reports, all return false on I/O errors
+bool PROFILE_write_json(const PROFILE *profile, FILE *file);
+// One row per non-zero counter: kind,key,name,count,cycles
+bool PROFILE_write_csv(const PROFILE *profile, FILE *file);
+// 256x256 binary PPM, one pixel per address with address = y * 256 + x. Log
+// scaled channels: red for writes, green for executions, blue for reads.
+bool PROFILE_write_heatmap(const PROFILE *profile, FILE *file);
+// Writes <prefix>.json, <prefix>.csv and <prefix>.ppm
+bool PROFILE_write_reports(const PROFILE *profile, const char *prefix);
+
+#endif // PROFILE_H
@@ -0,0 +1,260 @@
+#include <REWIND.h>
+
+// Shorter runs are cheaper as part of a literal
+#define REWIND_MIN_RUN 4
+
+// Tokens are a LEB128 header (length << 1 | is_run) followed by length
+// literal bytes or by the one byte value of the run
+
+static size_t REWIND_put_header(uint8_t *out, size_t length, bool run) {
+    uint64_t header = ((uint64_t)length << 1) | (run ? 1 : 0);
+    size_t pos = 0;
+    while (header >= 0x80) {
+        out[pos++] = (uint8_t)(header | 0x80);
+        header >>= 7;
+    }
+    out[pos++] = (uint8_t)header;
+    return pos;
+}
+
+static size_t REWIND_get_header(const uint8_t *src, size_t src_size, size_t *pos) {
+    uint64_t header = 0;
+    for (size_t shift = 0; *pos < src_size && shift < 64; shift += 7) {
+        uint8_t byte = src[(*pos)++];
+        header |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    return header;
+}
+
+static inline uint8_t REWIND_value(const uint8_t *data, const uint8_t *base, size_t i) {
+    return base ? data[i] ^ base[i] : data[i];
+}
+
+size_t REWIND_rle_bound(size_t size) {
+    return size + size / 64 + 16;
+}
+
+size_t REWIND_rle_encode(const uint8_t *data, const uint8_t *base, size_t size, uint8_t *out) {
+    size_t out_pos = 0;
+    size_t literal = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        uint8_t value = REWIND_value(data, base, pos);
+        size_t run = 1;
+        while (pos + run < size && REWIND_value(data, base, pos + run) == value) {
+            run += 1;
+        }
+
+        if (run < REWIND_MIN_RUN) {
+            pos += run;
+            continue;
+        }
+
+        if (literal < pos) {
+            out_pos += REWIND_put_header(out + out_pos, pos - literal, false);
+            for (size_t i = literal; i < pos; i++) {
+                out[out_pos++] = REWIND_value(data, base, i);
+            }
+        }
+        out_pos += REWIND_put_header(out + out_pos, run, true);
+        out[out_pos++] = value;
+
+        pos += run;
+        literal = pos;
+    }
+
+    if (literal < size) {
+        out_pos += REWIND_put_header(out + out_pos, size - literal, false);
+        for (size_t i = literal; i < size; i++) {
+            out[out_pos++] = REWIND_value(data, base, i);
+        }
+    }
+    return out_pos;
+}
+
+void REWIND_rle_decode(const uint8_t *src, size_t src_size, const uint8_t *base, uint8_t *out, size_t size) {
+    size_t src_pos = 0;
+    size_t pos = 0;
+
+    while (src_pos < src_size) {
+        size_t header = REWIND_get_header(src, src_size, &src_pos);
+        size_t length = header >> 1;
+        if (pos + length > size || src_pos + ((header & 1) ? 1 : length) > src_size) {
+            PANIC("Corrupt rewind record!");
+        }
+
+        if (header & 1) {
+            uint8_t value = src[src_pos++];
+            if (base) {
+                for (size_t i = 0; i < length; i++) {
+                    out[pos + i] = base[pos + i] ^ value;
+                }
+            } else {
+                memset(out + pos, value, length);
+            }
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                out[pos + i] = REWIND_value(src + src_pos, base ? base + pos : NULL, i);
+            }
+            src_pos += length;
+        }
+        pos += length;
+    }
+
+    if (pos != size) {
+        PANIC("Corrupt rewind record!");
+    }
+}
+
+void REWIND_init(REWIND *rewind, const NES *nes, size_t buffer_size, size_t max_frames, size_t keyframe_interval) {
+    if (!rewind || !nes) {
+        PANIC("NULL POINTER in init!");
+    }
+
+    memset(rewind, 0, sizeof(*rewind));
+    rewind->state_size = NES_state_size(nes);
+    rewind->keyframe_interval = keyframe_interval ? keyframe_interval : 1;
+    rewind->max_frames = max_frames ? max_frames : 1;
+    rewind->ring_size = buffer_size;
+
+    rewind->keyframe = malloc(rewind->state_size);
+    rewind->state = malloc(rewind->state_size);
+    rewind->encoded = malloc(REWIND_rle_bound(rewind->state_size));
+    rewind->ring = malloc(rewind->ring_size);
+    rewind->entries = calloc(rewind->max_frames, sizeof(REWIND_ENTRY));
+    if (!rewind->keyframe || !rewind->state || !rewind->encoded || !rewind->ring || !rewind->entries) {
+        PANIC("Out of memory allocating the rewind buffer!");
+    }
+}
+
+void REWIND_free(REWIND *rewind) {
+    free(rewind->keyframe);
+    free(rewind->state);
+    free(rewind->encoded);
+    free(rewind->ring);
+    free(rewind->entries);
+    memset(rewind, 0, sizeof(*rewind));
+}
+
+void REWIND_clear(REWIND *rewind) {
+    rewind->write_pos = 0;
+    rewind->first = 0;
+    rewind->count = 0;
+    rewind->since_keyframe = 0;
+}
+
+static REWIND_ENTRY *REWIND_entry(REWIND *rewind, size_t index) {
+    return &rewind->entries[(rewind->first + index) % rewind->max_frames];
+}
+
+// Drops the oldest keyframe and every delta depending on it
+static void REWIND_drop_oldest(REWIND *rewind) {
+    do {
+        rewind->first = (rewind->first + 1) % rewind->max_frames;
+        rewind->count -= 1;
+    } while (rewind->count && !REWIND_entry(rewind, 0)->keyframe);
+
+    if (!rewind->count) REWIND_clear(rewind);
+}
+
+static bool REWIND_overlaps(const REWIND_ENTRY *entry, size_t offset, size_t size) {
+    return entry->offset < offset + size && offset < entry->offset + entry->size;
+}
+
+// Frees room for a record of size bytes and returns its offset. Records are
+// never split, the end of the ring is skipped if the record does not fit.
+static size_t REWIND_make_room(REWIND *rewind, size_t size) {
+    size_t offset = rewind->write_pos;
+    size_t skipped = 0;
+    if (offset + size > rewind->ring_size) {
+        skipped = rewind->ring_size - offset;
+        offset = 0;
+    }
+
+    // The oldest entries always follow write_pos in the ring
+    while (rewind->count) {
+        const REWIND_ENTRY *oldest = REWIND_entry(rewind, 0);
+        bool full = rewind->count == rewind->max_frames;
+        bool in_skipped = skipped && REWIND_overlaps(oldest, rewind->write_pos, skipped);
+        if (!full && !in_skipped && !REWIND_overlaps(oldest, offset, size)) break;
+        REWIND_drop_oldest(rewind);
+    }
+    return offset;
+}
+
+void REWIND_push(REWIND *rewind, const NES *nes) {
+    if (!NES_save_state(nes, rewind->state, rewind->state_size)) {
+        PANIC("Savestate size changed while rewinding!");
+    }
+
+    bool keyframe = rewind->count == 0 || rewind->since_keyframe + 1 >= rewind->keyframe_interval;
+    size_t size = REWIND_rle_encode(rewind->state, keyframe ? NULL : rewind->keyframe, rewind->state_size,
+                                    rewind->encoded);
+    if (size > rewind->ring_size) {
+        PANIC("Rewind buffer is too small for a single keyframe!");
+    }
+    size_t offset = REWIND_make_room(rewind, size);
+
+    // Making room dropped the keyframe this delta is based on
+    if (!keyframe && rewind->count == 0) {
+        keyframe = true;
+        size = REWIND_rle_encode(rewind->state, NULL, rewind->state_size, rewind->encoded);
+        if (size > rewind->ring_size) {
+            PANIC("Rewind buffer is too small for a single keyframe!");
+        }
+        offset = REWIND_make_room(rewind, size);
+    }
+
+    memcpy(rewind->ring + offset, rewind->encoded, size);
+    *REWIND_entry(rewind, rewind->count) = (REWIND_ENTRY){offset, size, keyframe};
+    rewind->count += 1;
+    rewind->write_pos = offset + size;
+
+    if (keyframe) {
+        memcpy(rewind->keyframe, rewind->state, rewind->state_size);
+        rewind->since_keyframe = 0;
+    } else {
+        rewind->since_keyframe += 1;
+    }
+}
+
+bool REWIND_pop(REWIND *rewind, NES *nes) {
+    if (!rewind->count) {
+        return false;
+    }
+
+    REWIND_ENTRY entry = *REWIND_entry(rewind, rewind->count - 1);
+    rewind->count -= 1;
+
+    if (entry.keyframe) {
+        REWIND_rle_decode(rewind->ring + entry.offset, entry.size, NULL, rewind->state, rewind->state_size);
+    } else {
+        REWIND_rle_decode(rewind->ring + entry.offset, entry.size, rewind->keyframe, rewind->state,
+                          rewind->state_size);
+    }
+    if (!NES_load_state(nes, rewind->state, rewind->state_size)) {
+        PANIC("Rewind record does not match the console!");
+    }
+
+    // Once the keyframe itself is popped the next deltas need the one before it
+    if (entry.keyframe) {
+        rewind->since_keyframe = 0;
+        size_t key = rewind->count;
+        while (key > 0 && !REWIND_entry(rewind, key - 1)->keyframe) {
+            key -= 1;
+        }
+        if (key > 0) {
+            REWIND_ENTRY *keyframe = REWIND_entry(rewind, key - 1);
+            REWIND_rle_decode(rewind->ring + keyframe->offset, keyframe->size, NULL, rewind->keyframe,
+                              rewind->state_size);
+            rewind->since_keyframe = rewind->count - key;
+        }
+    } else {
+        rewind->since_keyframe -= 1;
+    }
+
+    rewind->write_pos = rewind->count ? entry.offset : 0;
+    return true;
+}
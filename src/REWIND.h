@@ -0,0 +1,63 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <NES.h>
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    size_t offset; // into the record ring
+    size_t size;
+    bool keyframe;
+} REWIND_ENTRY;
+
+// History of savestates in a fixed amount of memory. Every keyframe_interval
+// frames a full state is stored, the frames in between as the XOR against
+// that keyframe. All records are run-length coded, XOR deltas are almost all
+// zero runs. Records live in one byte ring; when it is full the oldest
+// keyframe is dropped together with its deltas.
+typedef struct {
+    size_t state_size;
+    size_t keyframe_interval;
+
+    uint8_t *keyframe; // raw keyframe the newest deltas are based on
+    uint8_t *state;    // scratch for the state being pushed or restored
+    uint8_t *encoded;  // scratch for one encoded record, worst case size
+
+    uint8_t *ring;
+    size_t ring_size;
+    size_t write_pos;
+
+    REWIND_ENTRY *entries;
+    size_t max_frames;
+    size_t first; // index of the oldest entry
+    size_t count;
+    size_t since_keyframe; // entries pushed after the newest keyframe
+} REWIND;
+
+// buffer_size bytes of compressed history, at most max_frames entries
+void REWIND_init(REWIND *rewind, const NES *nes, size_t buffer_size, size_t max_frames, size_t keyframe_interval);
+void REWIND_free(REWIND *rewind);
+void REWIND_clear(REWIND *rewind);
+
+// Records the current state, call once per frame
+void REWIND_push(REWIND *rewind, const NES *nes);
+// Restores the newest recorded state and removes it, returns false if the
+// history is empty
+bool REWIND_pop(REWIND *rewind, NES *nes);
+
+static inline size_t REWIND_frames(const REWIND *rewind) {
+    return rewind->count;
+}
+
+// Run-length coding used for the records, exposed for tools. Encoding a
+// delta XORs data against base first, decoding XORs the result back onto
+// base; base may be NULL for plain data. encode needs REWIND_rle_bound bytes.
+size_t REWIND_rle_bound(size_t size);
+size_t REWIND_rle_encode(const uint8_t *data, const uint8_t *base, size_t size, uint8_t *out);
+void REWIND_rle_decode(const uint8_t *src, size_t src_size, const uint8_t *base, uint8_t *out, size_t size);
+
+#endif // REWIND_H
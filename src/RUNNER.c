@@ -0,0 +1,212 @@
+#include <RUNNER.h>
+#include <errno.h>
+#include <time.h>
+
+static double RUNNER_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static char *RUNNER_strdup(const char *str) {
+    size_t size = strlen(str) + 1;
+    char *copy = malloc(size);
+    if (!copy) {
+        PANIC("Out of memory copying a manifest entry!");
+    }
+    return memcpy(copy, str, size);
+}
+
+static RUNNER_JOB *RUNNER_push_job(RUNNER *runner) {
+    if (runner->job_count == runner->capacity) {
+        runner->capacity = runner->capacity ? runner->capacity * 2 : 64;
+        runner->jobs = realloc(runner->jobs, runner->capacity * sizeof(RUNNER_JOB));
+        if (!runner->jobs) {
+            PANIC("Out of memory growing the job list!");
+        }
+    }
+    RUNNER_JOB *job = &runner->jobs[runner->job_count++];
+    memset(job, 0, sizeof(*job));
+    return job;
+}
+
+bool RUNNER_load_manifest(RUNNER *runner, const char *path) {
+    memset(runner, 0, sizeof(*runner));
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Could not open manifest '%s'\n", path);
+        return false;
+    }
+
+    char line[RUNNER_LINE_SIZE];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_number += 1;
+        // A cut off line would be read as two entries
+        if (!strchr(line, '\n') && !feof(file)) {
+            fprintf(stderr, "%s:%zu: line longer than %d bytes\n", path, line_number, RUNNER_LINE_SIZE - 1);
+            fclose(file);
+            RUNNER_free(runner);
+            return false;
+        }
+
+        char *save = NULL;
+        char *rom = strtok_r(line, " \t\r\n", &save);
+        if (!rom || rom[0] == '#') continue;
+        char *movie = strtok_r(NULL, " \t\r\n", &save);
+        char *frames = strtok_r(NULL, " \t\r\n", &save);
+
+        RUNNER_JOB *job = RUNNER_push_job(runner);
+        job->rom_path = RUNNER_strdup(rom);
+        if (movie && strcmp(movie, "-") != 0) {
+            job->movie_path = RUNNER_strdup(movie);
+        }
+        if (frames) {
+            // strtoul takes signs and wraps "-1" around, only plain digits are a count
+            char *end = frames;
+            if (frames[0] >= '0' && frames[0] <= '9') {
+                errno = 0;
+                unsigned long count = strtoul(frames, &end, 10);
+                if (errno == ERANGE || count > RUNNER_MAX_FRAMES) end = frames;
+                job->frames = count;
+            }
+            if (end == frames || *end != '\0') {
+                fprintf(stderr, "%s:%zu: bad frame count '%s'\n", path, line_number, frames);
+                fclose(file);
+                RUNNER_free(runner);
+                return false;
+            }
+        }
+    }
+    fclose(file);
+
+    runner->render_interval = 1;
+    runner->results = calloc(runner->job_count ? runner->job_count : 1, sizeof(RUNNER_RESULT));
+    if (!runner->results) {
+        PANIC("Out of memory allocating job results!");
+    }
+    return true;
+}
+
+void RUNNER_free(RUNNER *runner) {
+    for (size_t i = 0; i < runner->job_count; i++) {
+        free(runner->jobs[i].rom_path);
+        free(runner->jobs[i].movie_path);
+        free(runner->jobs[i].video_target);
+        if (runner->results) free(runner->results[i].hashes);
+    }
+    free(runner->jobs);
+    free(runner->results);
+    memset(runner, 0, sizeof(*runner));
+}
+
+void RUNNER_set_video(RUNNER *runner, const char *prefix, VIDEO_FORMAT format, const NTSC *ntsc) {
+    static const char *const extensions[VIDEO_FORMAT_COUNT] = {".rgba", ".rgb", ".y4m"};
+    bool shm = strncmp(prefix, VIDEO_SHM_PREFIX, strlen(VIDEO_SHM_PREFIX)) == 0;
+
+    for (size_t i = 0; i < runner->job_count; i++) {
+        RUNNER_JOB *job = &runner->jobs[i];
+        const char *extension = shm ? "" : extensions[format];
+        size_t size = strlen(prefix) + strlen(extension) + 24;
+        free(job->video_target);
+        job->video_target = malloc(size);
+        if (!job->video_target) {
+            PANIC("Out of memory naming a video target!");
+        }
+        snprintf(job->video_target, size, "%s%zu%s", prefix, i, extension);
+        job->video_format = format;
+        job->video_ntsc = ntsc;
+    }
+}
+
+typedef struct {
+    RUNNER_RESULT *result;
+    VIDEO *video; // NULL without capture
+} RUNNER_FRAME_CTX;
+
+static void RUNNER_record_hash(void *ctx, NES *nes, size_t frame) {
+    RUNNER_FRAME_CTX *frame_ctx = ctx;
+    RUNNER_RESULT *result = frame_ctx->result;
+    result->hashes[result->hash_count++] = (RUNNER_FRAME_HASH){frame, NES_frame_hash(nes)};
+    if (frame_ctx->video) VIDEO_submit(frame_ctx->video, &nes->ppu.framebuffer[0][0]);
+}
+
+void RUNNER_run_job(const RUNNER_JOB *job, size_t render_interval, RUNNER_RESULT *result) {
+    memset(result, 0, sizeof(*result));
+    double start = RUNNER_now();
+
+    MOVIE movie = {0};
+    if (job->movie_path && !MOVIE_load(&movie, job->movie_path)) {
+        return;
+    }
+
+    size_t frames = job->frames;
+    if (frames == 0) {
+        frames = job->movie_path ? movie.frame_count : RUNNER_DEFAULT_FRAMES;
+    }
+
+    if (frames > SIZE_MAX / sizeof(RUNNER_FRAME_HASH)) {
+        fprintf(stderr, "Job '%s' has too many frames to record\n", job->rom_path);
+        MOVIE_free(&movie);
+        return;
+    }
+
+    NES *nes = malloc(sizeof(NES));
+    result->hashes = malloc((frames ? frames : 1) * sizeof(RUNNER_FRAME_HASH));
+    if (!nes || !result->hashes) {
+        PANIC("Out of memory allocating a job!");
+    }
+
+    VIDEO video;
+    RUNNER_FRAME_CTX frame_ctx = {result, NULL};
+    if (job->video_target && VIDEO_open(&video, job->video_target, job->video_format, VIDEO_DEFAULT_BUFFERS,
+                                           job->video_ntsc)) {
+        frame_ctx.video = &video;
+    }
+
+    if ((!job->video_target || frame_ctx.video) && NES_init(nes, job->rom_path)) {
+        MOVIE_play(&movie, nes, 0, frames, render_interval, RUNNER_record_hash, &frame_ctx);
+        result->ok = true;
+        result->frames = frames;
+        result->cycles = nes->cpu.clock_counter;
+        NES_free(nes);
+    }
+    if (frame_ctx.video) {
+        VIDEO_close(&video);
+        result->video_frames = video.frames;
+        result->video_dropped = video.dropped;
+    }
+
+    free(nes);
+    MOVIE_free(&movie);
+    result->wall_time = RUNNER_now() - start;
+}
+
+static void RUNNER_task(void *ctx, size_t task, size_t worker) {
+    RUNNER *runner = ctx;
+    RUNNER_run_job(&runner->jobs[task], runner->render_interval, &runner->results[task]);
+}
+
+void RUNNER_run(RUNNER *runner, size_t worker_count) {
+    POOL_run(runner->job_count, worker_count, RUNNER_task, runner);
+}
+
+void RUNNER_print_results(const RUNNER *runner, FILE *file, FILE *hash_file) {
+    fprintf(file, "job\tstatus\tframes\tcycles\twall_ms\tfinal_hash\trom\tmovie\n");
+    for (size_t i = 0; i < runner->job_count; i++) {
+        const RUNNER_JOB *job = &runner->jobs[i];
+        const RUNNER_RESULT *result = &runner->results[i];
+        uint64_t final_hash = result->hash_count ? result->hashes[result->hash_count - 1].hash : 0;
+
+        fprintf(file, "%zu\t%s\t%zu\t%zu\t%.3f\t%016llx\t%s\t%s\n", i, result->ok ? "ok" : "failed",
+                result->frames, result->cycles, result->wall_time * 1000.0, (unsigned long long)final_hash,
+                job->rom_path, job->movie_path ? job->movie_path : "-");
+
+        if (!hash_file) continue;
+        for (size_t h = 0; h < result->hash_count; h++) {
+            fprintf(hash_file, "%zu\t%zu\t%016llx\n", i, result->hashes[h].frame,
+                    (unsigned long long)result->hashes[h].hash);
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <MOVIE.h>
+#include <NES.h>
+#include <POOL.h>
+#include <UTIL.h>
+#include <VIDEO.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNNER_DEFAULT_FRAMES 60
+#define RUNNER_LINE_SIZE 4096
+#define RUNNER_MAX_FRAMES 5184000 // a day at 60 fps, bounds the per-job hash buffer
+
+typedef struct {
+    char *rom_path;
+    char *movie_path;   // NULL runs without input
+    size_t frames;      // 0 runs for the length of the movie
+    char *video_target; // NULL captures nothing, see VIDEO_open
+    VIDEO_FORMAT video_format;
+    const NTSC *video_ntsc; // optional filter, shared by all jobs
+} RUNNER_JOB;
+
+typedef struct {
+    size_t frame;
+    uint64_t hash;
+} RUNNER_FRAME_HASH;
+
+typedef struct {
+    bool ok;
+    size_t frames;
+    size_t cycles;
+    double wall_time;          // seconds
+    RUNNER_FRAME_HASH *hashes; // one per rendered frame
+    size_t hash_count;
+    uint64_t video_frames;     // rendered frames written to video_target
+    uint64_t video_dropped;
+} RUNNER_RESULT;
+
+// A batch of independent jobs. Every job builds its own NES and MOVIE, so any
+// number of them can run on separate threads at once.
+typedef struct {
+    RUNNER_JOB *jobs;
+    RUNNER_RESULT *results;
+    size_t job_count;
+    size_t capacity;
+    size_t render_interval; // see MOVIE_play, 1 renders and hashes every frame
+} RUNNER;
+
+// Manifest lines are "rom [movie|-] [frames]", blank lines and lines starting
+// with '#' are skipped. frames is a decimal count up to RUNNER_MAX_FRAMES and
+// lines must be shorter than RUNNER_LINE_SIZE. Returns false and prints the
+// reason to stderr on errors.
+bool RUNNER_load_manifest(RUNNER *runner, const char *path);
+void RUNNER_free(RUNNER *runner);
+// Captures the rendered frames of job i to "<prefix><i>.<format>", or to the
+// shared memory segment "<prefix><i>" for a "shm:" prefix, through ntsc if set
+void RUNNER_set_video(RUNNER *runner, const char *prefix, VIDEO_FORMAT format, const NTSC *ntsc);
+
+void RUNNER_run_job(const RUNNER_JOB *job, size_t render_interval, RUNNER_RESULT *result);
+// Runs all jobs on a work stealing pool of worker_count threads
+void RUNNER_run(RUNNER *runner, size_t worker_count);
+
+// One tab separated line per job, optionally every rendered frame's hash to hash_file
+void RUNNER_print_results(const RUNNER *runner, FILE *file, FILE *hash_file);
+
+#endif // RUNNER_H
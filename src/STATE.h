@@ -0,0 +1,39 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Cursor over a savestate blob. Every module saves its plain state fields as
+// one block, so a save or load is a handful of memcpys. Writes past size only
+// advance pos, which lets a dry run with size 0 measure a blob.
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t pos;
+} STATE;
+
+static inline void STATE_write(STATE *state, const void *src, size_t size) {
+    if (state->pos + size <= state->size) {
+        memcpy(state->data + state->pos, src, size);
+    }
+    state->pos += size;
+}
+
+static inline void STATE_read(STATE *state, void *dst, size_t size) {
+    if (state->pos + size > state->size) {
+        PANIC("Savestate read past the end of the blob!");
+    }
+    memcpy(dst, state->data + state->pos, size);
+    state->pos += size;
+}
+
+// Block of fields [first, end of struct) or [first, last) of *ptr
+#define STATE_BLOCK_SIZE(type, first) (sizeof(type) - offsetof(type, first))
+#define STATE_RANGE_SIZE(type, first, last) (offsetof(type, last) - offsetof(type, first))
+
+#endif // STATE_H
@@ -0,0 +1,194 @@
+#include <CPU.h>
+#include <TRACE.h>
+
+void TRACE_init(TRACE *trace, size_t capacity) {
+    // Past the largest power of two the rounding below would wrap to 0
+    if (capacity > SIZE_MAX / 2 + 1) {
+        PANIC_FMT("Trace capacity %zu is too large!", capacity);
+    }
+    size_t rounded = 1;
+    while (rounded < capacity) rounded <<= 1;
+
+    trace->records = calloc(rounded, sizeof(TRACE_RECORD));
+    if (!trace->records) {
+        PANIC("Out of memory allocating the trace buffer!");
+    }
+    trace->capacity = rounded;
+    trace->total = 0;
+    trace->panic_path = NULL;
+}
+
+void TRACE_free(TRACE *trace) {
+    free(trace->records);
+    trace->records = NULL;
+    trace->capacity = 0;
+    trace->total = 0;
+}
+
+void TRACE_clear(TRACE *trace) {
+    trace->total = 0;
+}
+
+size_t TRACE_count(const TRACE *trace) {
+    return trace->total < trace->capacity ? trace->total : trace->capacity;
+}
+
+const TRACE_RECORD *TRACE_get(const TRACE *trace, size_t index) {
+    size_t first = trace->total - TRACE_count(trace);
+    return &trace->records[(first + index) & (trace->capacity - 1)];
+}
+
+bool TRACE_dump(const TRACE *trace, FILE *file) {
+    size_t count = TRACE_count(trace);
+    TRACE_FILE_HEADER header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TRACE_RECORD), 0, count, trace->total};
+    if (fwrite(&header, sizeof(header), 1, file) != 1) return false;
+
+    // At most two contiguous runs, the tail of the ring then its head
+    size_t first = (trace->total - count) & (trace->capacity - 1);
+    size_t run = count < trace->capacity - first ? count : trace->capacity - first;
+    if (fwrite(trace->records + first, sizeof(TRACE_RECORD), run, file) != run) return false;
+    if (fwrite(trace->records, sizeof(TRACE_RECORD), count - run, file) != count - run) return false;
+    return true;
+}
+
+bool TRACE_dump_file(const TRACE *trace, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Could not open trace file '%s'\n", path);
+        return false;
+    }
+    bool ok = TRACE_dump(trace, file);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) fprintf(stderr, "Could not write trace file '%s'\n", path);
+    return ok;
+}
+
+bool TRACE_load_file(TRACE *trace, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Could not open trace file '%s'\n", path);
+        return false;
+    }
+
+    TRACE_FILE_HEADER header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION || header.record_size != sizeof(TRACE_RECORD)) {
+        fprintf(stderr, "'%s' is not a version %d trace file\n", path, TRACE_VERSION);
+        fclose(file);
+        return false;
+    }
+
+    // The count is only believed as far as the file backs it
+    long end;
+    if (fseek(file, 0, SEEK_END) != 0 || (end = ftell(file)) < 0 || fseek(file, sizeof(header), SEEK_SET) != 0) {
+        fprintf(stderr, "Could not read trace file '%s'\n", path);
+        fclose(file);
+        return false;
+    }
+    uint64_t available = ((uint64_t)end - sizeof(header)) / sizeof(TRACE_RECORD);
+    size_t count = header.count < available ? header.count : available;
+
+    TRACE_init(trace, count ? count : 1);
+    size_t read = fread(trace->records, sizeof(TRACE_RECORD), count, file);
+    fclose(file);
+    if (read != header.count) {
+        fprintf(stderr, "'%s' is truncated, %zu of %llu records\n", path, read, (unsigned long long)header.count);
+    }
+    trace->total = read;
+    return true;
+}
+
+static void TRACE_panic_hook(void *ctx) {
+    TRACE *trace = ctx;
+    if (TRACE_dump_file(trace, trace->panic_path)) {
+        fprintf(stderr, "Dumped the last %zu instructions to '%s'\n", TRACE_count(trace), trace->panic_path);
+    }
+}
+
+void TRACE_dump_on_panic(TRACE *trace, const char *path) {
+    trace->panic_path = path;
+    panic_set_hook(path ? TRACE_panic_hook : NULL, trace);
+}
+
+// Addressing modes of the opcode list as something a switch can use
+typedef enum {
+    TRACE_AM_IMP,
+    TRACE_AM_IMM,
+    TRACE_AM_ZP0,
+    TRACE_AM_ZPX,
+    TRACE_AM_ZPY,
+    TRACE_AM_ABS,
+    TRACE_AM_ABX,
+    TRACE_AM_ABY,
+    TRACE_AM_IND,
+    TRACE_AM_IZX,
+    TRACE_AM_IZY,
+    TRACE_AM_REL,
+} TRACE_AM;
+
+// clang-format off
+#define TRACE_AM_ENTRY(code, op, am, cyc) [code] = TRACE_AM_##am,
+static const uint8_t TRACE_AMS[256] = {CPU_OP_CODE_LIST(TRACE_AM_ENTRY)};
+// clang-format on
+
+static const uint8_t TRACE_AM_SIZES[] = {
+    [TRACE_AM_IMP] = 1, [TRACE_AM_IMM] = 2, [TRACE_AM_ZP0] = 2, [TRACE_AM_ZPX] = 2,
+    [TRACE_AM_ZPY] = 2, [TRACE_AM_ABS] = 3, [TRACE_AM_ABX] = 3, [TRACE_AM_ABY] = 3,
+    [TRACE_AM_IND] = 3, [TRACE_AM_IZX] = 2, [TRACE_AM_IZY] = 2, [TRACE_AM_REL] = 2,
+};
+
+// nestest marks everything outside the documented instruction set with '*'
+static bool TRACE_is_unofficial(uint8_t opcode) {
+    const char *name = OP_CODE_MATRIX[opcode].name;
+    if (strcmp(name, "NOP") == 0) return opcode != 0xEA;
+    if (strcmp(name, "SBC") == 0) return opcode == 0xEB;
+    return strcmp(name, "LAX") == 0 || strcmp(name, "SAX") == 0 || strcmp(name, "DCP") == 0 ||
+           strcmp(name, "ISB") == 0 || strcmp(name, "SLO") == 0 || strcmp(name, "RLA") == 0 ||
+           strcmp(name, "SRE") == 0 || strcmp(name, "RRA") == 0 || strcmp(name, "XXX") == 0;
+}
+
+void TRACE_format(const TRACE_RECORD *record, char *out, size_t size) {
+    uint8_t opcode = record->opcode;
+    TRACE_AM am = TRACE_AMS[opcode];
+    // BRK decodes as IMM to skip its padding byte, but is written without one
+    size_t length = (opcode == 0x00) ? 1 : TRACE_AM_SIZES[am];
+    uint8_t low = record->operand[0];
+    uint16_t word = low | (record->operand[1] << 8);
+
+    char bytes[16];
+    if (length == 1) {
+        snprintf(bytes, sizeof(bytes), "%02X", opcode);
+    } else if (length == 2) {
+        snprintf(bytes, sizeof(bytes), "%02X %02X", opcode, low);
+    } else {
+        snprintf(bytes, sizeof(bytes), "%02X %02X %02X", opcode, low, record->operand[1]);
+    }
+
+    char operand[16] = "";
+    switch (length == 1 ? TRACE_AM_IMP : am) {
+    case TRACE_AM_IMP:
+        // Accumulator forms of the shifts
+        if (opcode == 0x0A || opcode == 0x2A || opcode == 0x4A || opcode == 0x6A) strcpy(operand, "A");
+        break;
+    case TRACE_AM_IMM: snprintf(operand, sizeof(operand), "#$%02X", low); break;
+    case TRACE_AM_ZP0: snprintf(operand, sizeof(operand), "$%02X", low); break;
+    case TRACE_AM_ZPX: snprintf(operand, sizeof(operand), "$%02X,X", low); break;
+    case TRACE_AM_ZPY: snprintf(operand, sizeof(operand), "$%02X,Y", low); break;
+    case TRACE_AM_ABS: snprintf(operand, sizeof(operand), "$%04X", word); break;
+    case TRACE_AM_ABX: snprintf(operand, sizeof(operand), "$%04X,X", word); break;
+    case TRACE_AM_ABY: snprintf(operand, sizeof(operand), "$%04X,Y", word); break;
+    case TRACE_AM_IND: snprintf(operand, sizeof(operand), "($%04X)", word); break;
+    case TRACE_AM_IZX: snprintf(operand, sizeof(operand), "($%02X,X)", low); break;
+    case TRACE_AM_IZY: snprintf(operand, sizeof(operand), "($%02X),Y", low); break;
+    case TRACE_AM_REL:
+        snprintf(operand, sizeof(operand), "$%04X", (uint16_t)(record->pc + 2 + (int8_t)low));
+        break;
+    }
+
+    char text[32];
+    snprintf(text, sizeof(text), "%s%s%s", OP_CODE_MATRIX[opcode].name, operand[0] ? " " : "", operand);
+
+    snprintf(out, size, "%04X  %-8s %c%-32sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu", record->pc, bytes,
+             TRACE_is_unofficial(opcode) ? '*' : ' ', text, record->a, record->x, record->y, record->status,
+             record->sp, (unsigned long long)TRACE_record_cycle(record));
+}
@@ -0,0 +1,80 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <UTIL.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC 0x4352544E // "NTRC"
+#define TRACE_VERSION 1
+#define TRACE_DEFAULT_CAPACITY (1 << 20)
+
+// State before one instruction, 16 bytes. The cycle count is 48 bits wide,
+// about three months of emulated time.
+typedef struct {
+    uint32_t cycle_low;
+    uint16_t cycle_high;
+    uint16_t pc;
+    uint8_t opcode;
+    uint8_t operand[2];
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t status;
+} TRACE_RECORD;
+
+// Ring of the most recent records. The CPU records into it while attached with
+// CPU_set_trace, capacity is a power of two so the slot is a mask away.
+typedef struct {
+    TRACE_RECORD *records;
+    size_t capacity;
+    size_t total; // records ever written, the oldest kept is total - capacity
+    const char *panic_path;
+} TRACE;
+
+// Dump files start with this header followed by count records, oldest first,
+// all in host byte order
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t total;
+} TRACE_FILE_HEADER;
+
+// Capacity is rounded up to a power of two
+void TRACE_init(TRACE *trace, size_t capacity);
+void TRACE_free(TRACE *trace);
+void TRACE_clear(TRACE *trace);
+
+static inline TRACE_RECORD *TRACE_next(TRACE *trace) {
+    return &trace->records[trace->total++ & (trace->capacity - 1)];
+}
+
+static inline uint64_t TRACE_record_cycle(const TRACE_RECORD *record) {
+    return ((uint64_t)record->cycle_high << 32) | record->cycle_low;
+}
+
+// Records currently held, and the i-th of them counting from the oldest
+size_t TRACE_count(const TRACE *trace);
+const TRACE_RECORD *TRACE_get(const TRACE *trace, size_t index);
+
+// Writes the held records as a dump file, returns false on I/O errors
+bool TRACE_dump(const TRACE *trace, FILE *file);
+bool TRACE_dump_file(const TRACE *trace, const char *path);
+// Reads a dump file into a freshly initialised trace
+bool TRACE_load_file(TRACE *trace, const char *path);
+
+// Dumps the trace to path when this thread PANICs, path must stay valid
+void TRACE_dump_on_panic(TRACE *trace, const char *path);
+
+// Formats a record like a nestest.log line. Memory is not part of the trace, so
+// the "= xx" operand values and the PPU column are left out.
+void TRACE_format(const TRACE_RECORD *record, char *out, size_t size);
+
+#endif // TRACE_H
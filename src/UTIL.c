@@ -4,4 +4,19 @@ void print_backtrace() {
     void *buffer[10];
     int nptrs = backtrace(buffer, 10);
     backtrace_symbols_fd(buffer, nptrs, STDERR_FILENO);
-}
\ No newline at end of file
+}
+
+static __thread PANIC_HookFunc panic_hook = NULL;
+static __thread void *panic_hook_ctx = NULL;
+
+void panic_set_hook(PANIC_HookFunc hook, void *ctx) {
+    panic_hook = hook;
+    panic_hook_ctx = ctx;
+}
+
+void panic_run_hook(void) {
+    // Clear first so a PANIC inside the hook cannot recurse
+    PANIC_HookFunc hook = panic_hook;
+    panic_hook = NULL;
+    if (hook) hook(panic_hook_ctx);
+}
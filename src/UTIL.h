@@ -2,12 +2,30 @@
 #define UTIL_H
 
 #include <execinfo.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#define HASH_FNV_OFFSET 0xCBF29CE484222325ULL
+#define HASH_FNV_PRIME 0x100000001B3ULL
+
 void print_backtrace();
 
+// Called by PANIC before aborting, e.g. to dump the execution trace. Hooks are
+// per thread so every emulator instance of a batch run can register its own.
+typedef void (*PANIC_HookFunc)(void *ctx);
+void panic_set_hook(PANIC_HookFunc hook, void *ctx);
+void panic_run_hook(void);
+
+// 64 bit FNV-1a, start with hash = HASH_FNV_OFFSET and chain calls
+static inline uint64_t hash_fnv1a(uint64_t hash, const uint8_t *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * HASH_FNV_PRIME;
+    }
+    return hash;
+}
+
 // Writes message to stderr, file name, file number,
 // If possible it tries to get backtrace info
 // Aborts the process, causing a core dump if possible
@@ -16,6 +34,7 @@ void print_backtrace();
         fprintf(stderr, "PANIC at %s:%d: '%s'", __FILE__, __LINE__, msg); \
         fprintf(stderr, "\n");                                            \
         print_backtrace();                                                \
+        panic_run_hook();                                                 \
         abort();                                                          \
     } while (0)
 
@@ -25,6 +44,7 @@ void print_backtrace();
         fprintf(stderr, (format), __VA_ARGS__);                  \
         fprintf(stderr, "\n");                                   \
         print_backtrace();                                       \
+        panic_run_hook();                                        \
         abort();                                                 \
     } while (0)
 
@@ -0,0 +1,314 @@
+#include <VIDEO.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Standard 2C02 colours, R G B for each of the 64 palette indices
+static const uint8_t VIDEO_NES_RGB[64][3] = {
+    {84, 84, 84},    {0, 30, 116},    {8, 16, 144},    {48, 0, 136},    {68, 0, 100},    {92, 0, 48},
+    {84, 4, 0},      {60, 24, 0},     {32, 42, 0},     {8, 58, 0},      {0, 64, 0},      {0, 60, 0},
+    {0, 50, 60},     {0, 0, 0},       {0, 0, 0},       {0, 0, 0},       {152, 150, 152}, {8, 76, 196},
+    {48, 50, 236},   {92, 30, 228},   {136, 20, 176},  {160, 20, 100},  {152, 34, 32},   {120, 60, 0},
+    {84, 90, 0},     {40, 114, 0},    {8, 124, 0},     {0, 118, 40},    {0, 102, 120},   {0, 0, 0},
+    {0, 0, 0},       {0, 0, 0},       {236, 238, 236}, {76, 154, 236},  {120, 124, 236}, {176, 98, 236},
+    {228, 84, 236},  {236, 88, 180},  {236, 106, 100}, {212, 136, 32},  {160, 170, 0},   {116, 196, 0},
+    {76, 208, 32},   {56, 204, 108},  {56, 180, 204},  {60, 60, 60},    {0, 0, 0},       {0, 0, 0},
+    {236, 238, 236}, {168, 204, 236}, {188, 188, 236}, {212, 178, 236}, {236, 174, 236}, {236, 174, 212},
+    {236, 180, 176}, {228, 196, 144}, {204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180},
+    {160, 214, 228}, {160, 162, 160}, {0, 0, 0},       {0, 0, 0},
+};
+
+static const char *const VIDEO_FORMAT_NAMES[VIDEO_FORMAT_COUNT] = {"rgba32", "rgb24", "y4m"};
+
+static uint8_t VIDEO_clamp(double value) {
+    long rounded = lround(value);
+    return (uint8_t)(rounded < 0 ? 0 : rounded > 255 ? 255 : rounded);
+}
+
+void VIDEO_init_palette(VIDEO_PALETTE *palette, VIDEO_FORMAT format) {
+    for (int i = 0; i < 64; i++) {
+        double r = VIDEO_NES_RGB[i][0], g = VIDEO_NES_RGB[i][1], b = VIDEO_NES_RGB[i][2];
+        if (format == VIDEO_FORMAT_Y4M) {
+            palette->channel[0][i] = VIDEO_clamp(16.0 + (65.738 * r + 129.057 * g + 25.064 * b) / 256.0);
+            palette->channel[1][i] = VIDEO_clamp(128.0 + (-37.945 * r - 74.494 * g + 112.439 * b) / 256.0);
+            palette->channel[2][i] = VIDEO_clamp(128.0 + (112.439 * r - 94.154 * g - 18.285 * b) / 256.0);
+        } else {
+            palette->channel[0][i] = VIDEO_NES_RGB[i][0];
+            palette->channel[1][i] = VIDEO_NES_RGB[i][1];
+            palette->channel[2][i] = VIDEO_NES_RGB[i][2];
+        }
+        palette->channel[3][i] = 255;
+    }
+}
+
+bool VIDEO_parse_format(const char *name, VIDEO_FORMAT *format) {
+    for (int i = 0; i < VIDEO_FORMAT_COUNT; i++) {
+        if (strcmp(name, VIDEO_FORMAT_NAMES[i]) == 0) {
+            *format = (VIDEO_FORMAT)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t VIDEO_frame_size(VIDEO_FORMAT format, size_t width) {
+    return width * PPU_HEIGHT * (format == VIDEO_FORMAT_RGBA32 ? 4 : 3);
+}
+
+static size_t VIDEO_gcd(size_t a, size_t b) {
+    while (b) {
+        size_t rest = a % b;
+        a = b;
+        b = rest;
+    }
+    return a;
+}
+
+// Sinks
+
+static bool VIDEO_open_shm(VIDEO *video, const char *name) {
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open shared memory '%s'\n", name);
+        return false;
+    }
+
+    size_t size = sizeof(VIDEO_SHM_HEADER) + VIDEO_SHM_SLOTS * video->frame_size;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map %zu bytes of shared memory '%s'\n", size, name);
+        return false;
+    }
+
+    video->shm = map;
+    video->shm_size = size;
+    *video->shm = (VIDEO_SHM_HEADER){
+        VIDEO_SHM_MAGIC, video->format, (uint32_t)video->width, PPU_HEIGHT, (uint32_t)video->frame_size,
+        VIDEO_SHM_SLOTS, 0,
+    };
+    return true;
+}
+
+static bool VIDEO_open_file(VIDEO *video, const char *target) {
+    if (target[0] == '|') {
+        video->file = popen(target + 1, "w");
+        video->pipe = true;
+    } else {
+        video->file = fopen(target, "wb");
+    }
+    if (!video->file) {
+        fprintf(stderr, "Could not open '%s' for video output\n", target);
+        return false;
+    }
+
+    video->out = malloc(video->frame_size);
+    if (!video->out) {
+        PANIC("Out of memory allocating the video output frame!");
+    }
+    if (video->format == VIDEO_FORMAT_Y4M) {
+        // NES pixels are 8:7, the filter's are narrower by its stretch
+        size_t aspect_num = 8 * PPU_WIDTH, aspect_den = 7 * video->width;
+        size_t gcd = VIDEO_gcd(aspect_num, aspect_den);
+        fprintf(video->file, "YUV4MPEG2 W%zu H%d F%d:%d Ip A%zu:%zu C444\n", video->width, PPU_HEIGHT, VIDEO_RATE_NUM,
+                VIDEO_RATE_DEN, aspect_num / gcd, aspect_den / gcd);
+    }
+    return true;
+}
+
+static void VIDEO_close_sink(VIDEO *video) {
+    if (video->file) {
+        if (video->pipe) {
+            pclose(video->file);
+        } else {
+            fclose(video->file);
+        }
+        video->file = NULL;
+    }
+    // The segment itself stays for readers, shm_unlink is up to them
+    if (video->shm) {
+        munmap(video->shm, video->shm_size);
+        video->shm = NULL;
+    }
+    free(video->out);
+    video->out = NULL;
+}
+
+// Worker side
+
+typedef struct {
+    const VIDEO *video;
+    uint8_t *dst;
+} VIDEO_NTSC_ROWS;
+
+static void VIDEO_ntsc_row(void *ctx, size_t y, const uint8_t *rgba) {
+    const VIDEO_NTSC_ROWS *rows = ctx;
+    rows->video->pack(rows->video->format, rgba, rows->dst, y, rows->video->width);
+}
+
+static void VIDEO_convert_frame(VIDEO *video, const uint8_t *frame, uint8_t *dst) {
+    if (video->ntsc) {
+        // Only the worker writes frames, reading it without the lock is fine
+        VIDEO_NTSC_ROWS rows = {video, dst};
+        NTSC_BANDS_filter(&video->bands, frame, (unsigned)(video->frames % NTSC_PHASES), VIDEO_ntsc_row, &rows);
+    } else {
+        video->convert(&video->palette, video->format, frame, dst, VIDEO_FRAME_PIXELS);
+    }
+}
+
+static bool VIDEO_write_frame(VIDEO *video, const uint8_t *frame) {
+    if (video->shm) {
+        uint64_t frames = video->shm->frames;
+        uint8_t *slot = (uint8_t *)(video->shm + 1) + (frames % VIDEO_SHM_SLOTS) * video->frame_size;
+        VIDEO_convert_frame(video, frame, slot);
+        __atomic_store_n(&video->shm->frames, frames + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    VIDEO_convert_frame(video, frame, video->out);
+    if (video->format == VIDEO_FORMAT_Y4M && fputs("FRAME\n", video->file) < 0) {
+        return false;
+    }
+    return fwrite(video->out, 1, video->frame_size, video->file) == video->frame_size;
+}
+
+static void *VIDEO_worker_main(void *arg) {
+    VIDEO *video = arg;
+
+    pthread_mutex_lock(&video->lock);
+    for (;;) {
+        while (!video->ready_count && !video->stop) {
+            pthread_cond_wait(&video->wake, &video->lock);
+        }
+        if (!video->ready_count) break;
+
+        size_t buffer = video->ready[video->ready_head];
+        video->ready_head = (video->ready_head + 1) % video->buffer_count;
+        video->ready_count -= 1;
+        video->busy = true;
+        pthread_mutex_unlock(&video->lock);
+
+        bool ok = VIDEO_write_frame(video, video->buffers + buffer * VIDEO_FRAME_PIXELS);
+
+        pthread_mutex_lock(&video->lock);
+        if (ok) {
+            video->frames += 1;
+        } else if (!video->failed) {
+            video->failed = true;
+            fprintf(stderr, "Video: writing a frame failed, dropping the rest\n");
+        }
+        video->free_list[video->free_count++] = buffer;
+        video->busy = false;
+        pthread_cond_broadcast(&video->done);
+    }
+    pthread_mutex_unlock(&video->lock);
+    return NULL;
+}
+
+// Emulation side
+
+bool VIDEO_open(VIDEO *video, const char *target, VIDEO_FORMAT format, size_t buffers, const NTSC *ntsc) {
+    if (!video || !target) {
+        PANIC("NULL POINTER in VIDEO_open!");
+    }
+    if (format >= VIDEO_FORMAT_COUNT) {
+        PANIC_FMT("Invalid video format %d!", (int)format);
+    }
+
+    memset(video, 0, sizeof(*video));
+    video->format = format;
+    video->ntsc = ntsc;
+    video->width = ntsc ? NTSC_OUT_WIDTH : PPU_WIDTH;
+    video->frame_size = VIDEO_frame_size(format, video->width);
+    video->convert = VIDEO_select_convert();
+    video->pack = VIDEO_select_pack();
+    VIDEO_init_palette(&video->palette, format);
+
+    size_t prefix = strlen(VIDEO_SHM_PREFIX);
+    bool opened = strncmp(target, VIDEO_SHM_PREFIX, prefix) == 0 ? VIDEO_open_shm(video, target + prefix)
+                                                                  : VIDEO_open_file(video, target);
+    if (!opened) return false;
+
+    video->buffer_count = buffers < 2 ? 2 : buffers;
+    video->buffers = malloc(video->buffer_count * VIDEO_FRAME_PIXELS);
+    video->free_list = malloc(video->buffer_count * sizeof(size_t));
+    video->ready = malloc(video->buffer_count * sizeof(size_t));
+    if (!video->buffers || !video->free_list || !video->ready) {
+        PANIC("Out of memory allocating video buffers!");
+    }
+    for (size_t i = 0; i < video->buffer_count; i++) {
+        video->free_list[i] = i;
+    }
+    video->free_count = video->buffer_count;
+
+    if (ntsc) NTSC_BANDS_start(&video->bands, ntsc);
+    pthread_mutex_init(&video->lock, NULL);
+    pthread_cond_init(&video->wake, NULL);
+    pthread_cond_init(&video->done, NULL);
+    if (pthread_create(&video->thread, NULL, VIDEO_worker_main, video) != 0) {
+        fprintf(stderr, "Could not start the video thread\n");
+        if (ntsc) NTSC_BANDS_stop(&video->bands);
+        pthread_cond_destroy(&video->done);
+        pthread_cond_destroy(&video->wake);
+        pthread_mutex_destroy(&video->lock);
+        VIDEO_close_sink(video);
+        free(video->buffers);
+        free(video->free_list);
+        free(video->ready);
+        return false;
+    }
+    return true;
+}
+
+void VIDEO_close(VIDEO *video) {
+    pthread_mutex_lock(&video->lock);
+    video->stop = true;
+    pthread_cond_signal(&video->wake);
+    pthread_mutex_unlock(&video->lock);
+    pthread_join(video->thread, NULL);
+    if (video->ntsc) NTSC_BANDS_stop(&video->bands);
+
+    pthread_cond_destroy(&video->done);
+    pthread_cond_destroy(&video->wake);
+    pthread_mutex_destroy(&video->lock);
+    VIDEO_close_sink(video);
+    free(video->buffers);
+    free(video->free_list);
+    free(video->ready);
+    video->buffers = NULL;
+    video->free_list = NULL;
+    video->ready = NULL;
+}
+
+bool VIDEO_submit(VIDEO *video, const uint8_t *frame) {
+    pthread_mutex_lock(&video->lock);
+    bool take = video->free_count && !video->failed;
+    size_t buffer = take ? video->free_list[--video->free_count] : 0;
+    if (!take) video->dropped += 1;
+    pthread_mutex_unlock(&video->lock);
+    if (!take) return false;
+
+    // The copy happens outside the lock, the buffer is no one else's meanwhile
+    memcpy(video->buffers + buffer * VIDEO_FRAME_PIXELS, frame, VIDEO_FRAME_PIXELS);
+
+    pthread_mutex_lock(&video->lock);
+    video->ready[(video->ready_head + video->ready_count) % video->buffer_count] = buffer;
+    video->ready_count += 1;
+    pthread_cond_signal(&video->wake);
+    pthread_mutex_unlock(&video->lock);
+    return true;
+}
+
+void VIDEO_flush(VIDEO *video) {
+    pthread_mutex_lock(&video->lock);
+    while (video->ready_count || video->busy) {
+        pthread_cond_wait(&video->done, &video->lock);
+    }
+    // The worker is idle until the next submit
+    if (video->file) fflush(video->file);
+    pthread_mutex_unlock(&video->lock);
+}
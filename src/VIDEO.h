@@ -0,0 +1,131 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <NTSC.h>
+#include <PPU.h>
+#include <UTIL.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define VIDEO_FRAME_PIXELS (PPU_WIDTH * PPU_HEIGHT)
+#define VIDEO_DEFAULT_BUFFERS 3 // triple buffering
+#define VIDEO_SHM_PREFIX "shm:"
+#define VIDEO_SHM_MAGIC 0x5645534EU // "NESV"
+#define VIDEO_SHM_SLOTS 3
+// NTSC NES frame rate, 39375000 / 655171 = 60.0988 Hz
+#define VIDEO_RATE_NUM 39375000
+#define VIDEO_RATE_DEN 655171
+
+typedef enum {
+    VIDEO_FORMAT_RGBA32, // R, G, B, 255 per pixel
+    VIDEO_FORMAT_RGB24,
+    VIDEO_FORMAT_Y4M,    // YUV4MPEG2 stream with 4:4:4 planes, BT.601 limited range
+    VIDEO_FORMAT_COUNT
+} VIDEO_FORMAT;
+
+// One byte per NES colour (0-63) for each output channel, R G B A or Y U V.
+// 64 entries are four 16 byte tables, what a byte shuffle looks up at once.
+typedef struct {
+    uint8_t channel[4][64];
+} VIDEO_PALETTE;
+
+// Converts pixels palette indices from src into dst in format. For Y4M dst gets
+// the three planes of pixels bytes each, one after the other.
+typedef void (*VIDEO_ConvertFunc)(const VIDEO_PALETTE *palette, VIDEO_FORMAT format, const uint8_t *src, uint8_t *dst,
+                                  size_t pixels);
+
+// Stores row y of width RGBA pixels into a frame of that width in format
+typedef void (*VIDEO_PackFunc)(VIDEO_FORMAT format, const uint8_t *rgba, uint8_t *dst, size_t y, size_t width);
+
+// Header at the start of a shared memory sink, followed by VIDEO_SHM_SLOTS
+// frames of frame_size bytes. frames counts the frames published so far, the
+// latest one is in slot (frames - 1) % slots. It is stored with release order
+// after its slot is complete; a reader copies a slot and checks that frames
+// did not move on by slots or more meanwhile.
+typedef struct {
+    uint32_t magic;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame_size;
+    uint32_t slots;
+    uint64_t frames;
+} VIDEO_SHM_HEADER;
+
+// Streams frames to a sink from a worker thread. The emulation thread copies
+// each finished palette index frame into a free buffer of the pool and goes on,
+// conversion and I/O happen on the worker. When the worker is so far behind
+// that every buffer is still queued the frame is dropped, never waited for.
+typedef struct {
+    VIDEO_FORMAT format;
+    VIDEO_PALETTE palette;
+    VIDEO_ConvertFunc convert; // best variant for the host CPU
+    const NTSC *ntsc;          // replaces the palette lookup when set
+    NTSC_BANDS bands;          // the filter's threads for this stream
+    VIDEO_PackFunc pack;       // stores the filter's rows
+    size_t width;              // PPU_WIDTH, NTSC_OUT_WIDTH through the filter
+    size_t frame_size;         // bytes of one converted frame
+
+    // Sink: a file, FIFO or pipe to a command, or a shared memory segment
+    FILE *file;
+    bool pipe; // file came from popen
+    VIDEO_SHM_HEADER *shm;
+    size_t shm_size;
+    uint8_t *out; // converted frame on its way to file
+
+    // Pool of palette index frames. Buffers are free, queued in ready (oldest
+    // first) or being converted by the worker.
+    uint8_t *buffers;
+    size_t buffer_count;
+    size_t *free_list;
+    size_t free_count;
+    size_t *ready;
+    size_t ready_head;
+    size_t ready_count;
+    bool busy; // the worker holds a buffer
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // a frame was queued or the sink is closing
+    pthread_cond_t done; // the worker gave a buffer back
+    bool stop;
+    bool failed; // a write failed, later frames are dropped
+
+    uint64_t frames;  // frames written out
+    uint64_t dropped; // frames not taken because the pool was exhausted
+} VIDEO;
+
+// Opens target for frames in format and starts the worker with buffers palette
+// index buffers (at least 2). target is a file or FIFO path, "|command" for a
+// pipe into command's stdin (e.g. "|ffmpeg -i - out.mkv" for Y4M), or
+// "shm:/name" for a POSIX shared memory segment. With ntsc frames go through
+// that filter (NTSC_OUT_WIDTH wide) in ntsc->threads bands, whose threads live
+// as long as the stream. The filter must outlive the stream. Returns
+// false and prints the reason to stderr if the sink can not be opened.
+bool VIDEO_open(VIDEO *video, const char *target, VIDEO_FORMAT format, size_t buffers, const NTSC *ntsc);
+// Writes out everything queued, then closes the sink
+void VIDEO_close(VIDEO *video);
+// Queues a PPU framebuffer (VIDEO_FRAME_PIXELS palette indices), returns false
+// if it was dropped. Never waits for the worker.
+bool VIDEO_submit(VIDEO *video, const uint8_t *frame);
+// Returns once every queued frame has been written out
+void VIDEO_flush(VIDEO *video);
+
+// Parses "rgba32", "rgb24" or "y4m", returns false for anything else
+bool VIDEO_parse_format(const char *name, VIDEO_FORMAT *format);
+// Bytes of one PPU_HEIGHT high frame of width pixels in format
+size_t VIDEO_frame_size(VIDEO_FORMAT format, size_t width);
+// Channel tables of the standard 2C02 palette for format
+void VIDEO_init_palette(VIDEO_PALETTE *palette, VIDEO_FORMAT format);
+
+void VIDEO_convert_scalar(const VIDEO_PALETTE *palette, VIDEO_FORMAT format, const uint8_t *src, uint8_t *dst,
+                          size_t pixels);
+VIDEO_ConvertFunc VIDEO_select_convert(void);
+void VIDEO_pack_row_scalar(VIDEO_FORMAT format, const uint8_t *rgba, uint8_t *dst, size_t y, size_t width);
+VIDEO_PackFunc VIDEO_select_pack(void);
+
+#endif // VIDEO_H
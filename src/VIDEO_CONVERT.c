@@ -0,0 +1,382 @@
+#include <VIDEO.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VIDEO_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+// Palette lookups. Every variant handles what it can in whole vectors and
+// leaves the remaining pixels to the scalar loop, which writes the same bytes.
+
+static void VIDEO_convert_range(const VIDEO_PALETTE *palette, VIDEO_FORMAT format, const uint8_t *src, uint8_t *dst,
+                                size_t start, size_t pixels) {
+    const uint8_t(*channel)[64] = palette->channel;
+    for (size_t i = start; i < pixels; i++) {
+        uint8_t index = src[i] & 0x3F;
+        switch (format) {
+        case VIDEO_FORMAT_RGBA32:
+            dst[i * 4 + 0] = channel[0][index];
+            dst[i * 4 + 1] = channel[1][index];
+            dst[i * 4 + 2] = channel[2][index];
+            dst[i * 4 + 3] = channel[3][index];
+            break;
+        case VIDEO_FORMAT_RGB24:
+            dst[i * 3 + 0] = channel[0][index];
+            dst[i * 3 + 1] = channel[1][index];
+            dst[i * 3 + 2] = channel[2][index];
+            break;
+        default:
+            dst[i] = channel[0][index];
+            dst[pixels + i] = channel[1][index];
+            dst[pixels * 2 + i] = channel[2][index];
+            break;
+        }
+    }
+}
+
+void VIDEO_convert_scalar(const VIDEO_PALETTE *palette, VIDEO_FORMAT format, const uint8_t *src, uint8_t *dst,
+                          size_t pixels) {
+    VIDEO_convert_range(palette, format, src, dst, 0, pixels);
+}
+
+#ifdef VIDEO_CONVERT_X86
+// A byte shuffle looks up 16 entries and zeroes lanes whose control byte has
+// bit 7 set. Index ^ (16 * k) is below 16 only for indices in table k, adding
+// 0x70 with saturation keeps those in 0x70-0x7F and pushes all others to 0x80
+// and above, so ORing the four shuffles gives the 64 entry lookup. The controls
+// depend on the indices alone and are shared by all channels.
+
+// Widest RGB24 store is 16 bytes for 12 written, the rest is overwritten by the
+// next store. Vector loops stop early enough for that to stay inside dst.
+#define VIDEO_RGB24_SLACK 2
+
+__attribute__((target("ssse3"))) static inline void VIDEO_controls_ssse3(const uint8_t *src, __m128i *controls) {
+    __m128i index = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), _mm_set1_epi8(0x3F));
+    for (int k = 0; k < 4; k++) {
+        controls[k] = _mm_adds_epu8(_mm_xor_si128(index, _mm_set1_epi8((char)(16 * k))), _mm_set1_epi8(0x70));
+    }
+}
+
+__attribute__((target("ssse3"))) static inline __m128i VIDEO_lookup_ssse3(const uint8_t *table,
+                                                                           const __m128i *controls) {
+    __m128i result = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)table), controls[0]);
+    for (int k = 1; k < 4; k++) {
+        __m128i part = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(table + 16 * k)), controls[k]);
+        result = _mm_or_si128(result, part);
+    }
+    return result;
+}
+
+// 16 pixels as four vectors of 4 RGBA pixels each
+__attribute__((target("ssse3"))) static inline void VIDEO_rgba_ssse3(const VIDEO_PALETTE *palette,
+                                                                      const __m128i *controls, __m128i *out) {
+    __m128i r = VIDEO_lookup_ssse3(palette->channel[0], controls);
+    __m128i g = VIDEO_lookup_ssse3(palette->channel[1], controls);
+    __m128i b = VIDEO_lookup_ssse3(palette->channel[2], controls);
+    __m128i a = VIDEO_lookup_ssse3(palette->channel[3], controls);
+    __m128i rg_lo = _mm_unpacklo_epi8(r, g);
+    __m128i rg_hi = _mm_unpackhi_epi8(r, g);
+    __m128i ba_lo = _mm_unpacklo_epi8(b, a);
+    __m128i ba_hi = _mm_unpackhi_epi8(b, a);
+    out[0] = _mm_unpacklo_epi16(rg_lo, ba_lo);
+    out[1] = _mm_unpackhi_epi16(rg_lo, ba_lo);
+    out[2] = _mm_unpacklo_epi16(rg_hi, ba_hi);
+    out[3] = _mm_unpackhi_epi16(rg_hi, ba_hi);
+}
+
+__attribute__((target("ssse3"))) static void VIDEO_convert_ssse3(const VIDEO_PALETTE *palette, VIDEO_FORMAT format,
+                                                                  const uint8_t *src, uint8_t *dst, size_t pixels) {
+    const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    __m128i controls[4];
+    __m128i out[4];
+
+    switch (format) {
+    case VIDEO_FORMAT_RGBA32:
+        for (; i + 16 <= pixels; i += 16) {
+            VIDEO_controls_ssse3(src + i, controls);
+            VIDEO_rgba_ssse3(palette, controls, out);
+            for (int j = 0; j < 4; j++) {
+                _mm_storeu_si128((__m128i *)(dst + i * 4 + j * 16), out[j]);
+            }
+        }
+        break;
+    case VIDEO_FORMAT_RGB24:
+        for (; i + 16 + VIDEO_RGB24_SLACK <= pixels; i += 16) {
+            VIDEO_controls_ssse3(src + i, controls);
+            VIDEO_rgba_ssse3(palette, controls, out);
+            for (int j = 0; j < 4; j++) {
+                _mm_storeu_si128((__m128i *)(dst + i * 3 + j * 12), _mm_shuffle_epi8(out[j], drop_alpha));
+            }
+        }
+        break;
+    default:
+        for (; i + 16 <= pixels; i += 16) {
+            VIDEO_controls_ssse3(src + i, controls);
+            for (int c = 0; c < 3; c++) {
+                _mm_storeu_si128((__m128i *)(dst + pixels * c + i), VIDEO_lookup_ssse3(palette->channel[c], controls));
+            }
+        }
+        break;
+    }
+    VIDEO_convert_range(palette, format, src, dst, i, pixels);
+}
+
+// Same on 32 pixels per step. Shuffles and unpacks work per 128 bit lane, the
+// tables are repeated in both lanes and the RGBA quarters put back in order.
+
+__attribute__((target("avx2"))) static inline void VIDEO_controls_avx2(const uint8_t *src, __m256i *controls) {
+    __m256i index = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)src), _mm256_set1_epi8(0x3F));
+    for (int k = 0; k < 4; k++) {
+        controls[k] =
+            _mm256_adds_epu8(_mm256_xor_si256(index, _mm256_set1_epi8((char)(16 * k))), _mm256_set1_epi8(0x70));
+    }
+}
+
+__attribute__((target("avx2"))) static inline __m256i VIDEO_lookup_avx2(const uint8_t *table,
+                                                                         const __m256i *controls) {
+    __m256i result = _mm256_setzero_si256();
+    for (int k = 0; k < 4; k++) {
+        __m256i lanes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(table + 16 * k)));
+        result = _mm256_or_si256(result, _mm256_shuffle_epi8(lanes, controls[k]));
+    }
+    return result;
+}
+
+// 32 pixels as four vectors of 8 RGBA pixels each
+__attribute__((target("avx2"))) static inline void VIDEO_rgba_avx2(const VIDEO_PALETTE *palette,
+                                                                    const __m256i *controls, __m256i *out) {
+    __m256i r = VIDEO_lookup_avx2(palette->channel[0], controls);
+    __m256i g = VIDEO_lookup_avx2(palette->channel[1], controls);
+    __m256i b = VIDEO_lookup_avx2(palette->channel[2], controls);
+    __m256i a = VIDEO_lookup_avx2(palette->channel[3], controls);
+    __m256i rg_lo = _mm256_unpacklo_epi8(r, g);
+    __m256i rg_hi = _mm256_unpackhi_epi8(r, g);
+    __m256i ba_lo = _mm256_unpacklo_epi8(b, a);
+    __m256i ba_hi = _mm256_unpackhi_epi8(b, a);
+    // Pixels 0-3 | 16-19, 4-7 | 20-23, 8-11 | 24-27 and 12-15 | 28-31
+    __m256i q0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);
+    __m256i q1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);
+    __m256i q2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);
+    __m256i q3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);
+    out[0] = _mm256_permute2x128_si256(q0, q1, 0x20);
+    out[1] = _mm256_permute2x128_si256(q2, q3, 0x20);
+    out[2] = _mm256_permute2x128_si256(q0, q1, 0x31);
+    out[3] = _mm256_permute2x128_si256(q2, q3, 0x31);
+}
+
+__attribute__((target("avx2"))) static void VIDEO_convert_avx2(const VIDEO_PALETTE *palette, VIDEO_FORMAT format,
+                                                                const uint8_t *src, uint8_t *dst, size_t pixels) {
+    const __m256i drop_alpha = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5,
+                                                6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t i = 0;
+    __m256i controls[4];
+    __m256i out[4];
+
+    switch (format) {
+    case VIDEO_FORMAT_RGBA32:
+        for (; i + 32 <= pixels; i += 32) {
+            VIDEO_controls_avx2(src + i, controls);
+            VIDEO_rgba_avx2(palette, controls, out);
+            for (int j = 0; j < 4; j++) {
+                _mm256_storeu_si256((__m256i *)(dst + i * 4 + j * 32), out[j]);
+            }
+        }
+        break;
+    case VIDEO_FORMAT_RGB24:
+        for (; i + 32 + VIDEO_RGB24_SLACK <= pixels; i += 32) {
+            VIDEO_controls_avx2(src + i, controls);
+            VIDEO_rgba_avx2(palette, controls, out);
+            for (int j = 0; j < 4; j++) {
+                __m256i packed = _mm256_shuffle_epi8(out[j], drop_alpha);
+                _mm_storeu_si128((__m128i *)(dst + i * 3 + j * 24), _mm256_castsi256_si128(packed));
+                _mm_storeu_si128((__m128i *)(dst + i * 3 + j * 24 + 12), _mm256_extracti128_si256(packed, 1));
+            }
+        }
+        break;
+    default:
+        for (; i + 32 <= pixels; i += 32) {
+            VIDEO_controls_avx2(src + i, controls);
+            for (int c = 0; c < 3; c++) {
+                _mm256_storeu_si256((__m256i *)(dst + pixels * c + i),
+                                    VIDEO_lookup_avx2(palette->channel[c], controls));
+            }
+        }
+        break;
+    }
+    VIDEO_convert_range(palette, format, src, dst, i, pixels);
+}
+#endif
+
+// Filtered rows come in as RGBA. Y4M uses the BT.601 limited range matrix at
+// 7 bit precision, which fits the signed byte weights of a multiply-add.
+#define VIDEO_Y_WEIGHTS 33, 64, 13
+#define VIDEO_U_WEIGHTS -19, -37, 56
+#define VIDEO_V_WEIGHTS 56, -47, -9
+
+static uint8_t VIDEO_weigh(const uint8_t *rgba, int r, int g, int b, int offset) {
+    return (uint8_t)(((r * rgba[0] + g * rgba[1] + b * rgba[2] + 64) >> 7) + offset);
+}
+
+static void VIDEO_pack_range(VIDEO_FORMAT format, const uint8_t *rgba, uint8_t *dst, size_t y, size_t width,
+                             size_t start) {
+    size_t plane = width * PPU_HEIGHT;
+    if (format == VIDEO_FORMAT_RGBA32) {
+        memcpy(dst + (y * width + start) * 4, rgba + start * 4, (width - start) * 4);
+        return;
+    }
+    for (size_t x = start; x < width; x++) {
+        const uint8_t *pixel = rgba + x * 4;
+        if (format == VIDEO_FORMAT_RGB24) {
+            memcpy(dst + (y * width + x) * 3, pixel, 3);
+        } else {
+            dst[y * width + x] = VIDEO_weigh(pixel, VIDEO_Y_WEIGHTS, 16);
+            dst[plane + y * width + x] = VIDEO_weigh(pixel, VIDEO_U_WEIGHTS, 128);
+            dst[plane * 2 + y * width + x] = VIDEO_weigh(pixel, VIDEO_V_WEIGHTS, 128);
+        }
+    }
+}
+
+void VIDEO_pack_row_scalar(VIDEO_FORMAT format, const uint8_t *rgba, uint8_t *dst, size_t y, size_t width) {
+    VIDEO_pack_range(format, rgba, dst, y, width, 0);
+}
+
+#ifdef VIDEO_CONVERT_X86
+// Weighted sum of the channels of 16 RGBA pixels as 16 bytes: multiply-add
+// pairs (R, G) and (B, A), add the pairs, round, shift and offset
+__attribute__((target("ssse3"))) static inline __m128i VIDEO_weigh_ssse3(const __m128i *pixels, __m128i weights,
+                                                                          int offset) {
+    const __m128i round = _mm_set1_epi16(64);
+    const __m128i bias = _mm_set1_epi16((short)offset);
+    __m128i sums[2];
+    for (int h = 0; h < 2; h++) {
+        __m128i low = _mm_maddubs_epi16(pixels[h * 2], weights);
+        __m128i high = _mm_maddubs_epi16(pixels[h * 2 + 1], weights);
+        __m128i sum = _mm_add_epi16(_mm_hadd_epi16(low, high), round);
+        sums[h] = _mm_add_epi16(_mm_srai_epi16(sum, 7), bias);
+    }
+    return _mm_packus_epi16(sums[0], sums[1]);
+}
+
+__attribute__((target("ssse3"))) static void VIDEO_pack_row_ssse3(VIDEO_FORMAT format, const uint8_t *rgba,
+                                                                   uint8_t *dst, size_t y, size_t width) {
+    const __m128i drop_alpha = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t x = 0;
+    __m128i pixels[4];
+
+    switch (format) {
+    case VIDEO_FORMAT_RGBA32:
+        break;
+    case VIDEO_FORMAT_RGB24:
+        for (; x + 16 + VIDEO_RGB24_SLACK <= width; x += 16) {
+            for (int j = 0; j < 4; j++) {
+                __m128i packed = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgba + x * 4) + j), drop_alpha);
+                _mm_storeu_si128((__m128i *)(dst + (y * width + x) * 3 + j * 12), packed);
+            }
+        }
+        break;
+    default: {
+        const __m128i y_weights = _mm_setr_epi8(VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0,
+                                                VIDEO_Y_WEIGHTS, 0);
+        const __m128i u_weights = _mm_setr_epi8(VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0,
+                                                VIDEO_U_WEIGHTS, 0);
+        const __m128i v_weights = _mm_setr_epi8(VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0,
+                                                VIDEO_V_WEIGHTS, 0);
+        size_t plane = width * PPU_HEIGHT;
+        uint8_t *row = dst + y * width;
+        for (; x + 16 <= width; x += 16) {
+            for (int j = 0; j < 4; j++) {
+                pixels[j] = _mm_loadu_si128((const __m128i *)(rgba + x * 4) + j);
+            }
+            _mm_storeu_si128((__m128i *)(row + x), VIDEO_weigh_ssse3(pixels, y_weights, 16));
+            _mm_storeu_si128((__m128i *)(row + plane + x), VIDEO_weigh_ssse3(pixels, u_weights, 128));
+            _mm_storeu_si128((__m128i *)(row + plane * 2 + x), VIDEO_weigh_ssse3(pixels, v_weights, 128));
+        }
+        break;
+    }
+    }
+    VIDEO_pack_range(format, rgba, dst, y, width, x);
+}
+
+// Same on 32 pixels. Horizontal adds and packs stay within 128 bit lanes, which
+// leaves groups of 4 pixels in the order 0 2 4 6 1 3 5 7.
+__attribute__((target("avx2"))) static inline __m256i VIDEO_weigh_avx2(const __m256i *pixels, __m256i weights,
+                                                                        int offset) {
+    const __m256i round = _mm256_set1_epi16(64);
+    const __m256i bias = _mm256_set1_epi16((short)offset);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i sums[2];
+    for (int h = 0; h < 2; h++) {
+        __m256i low = _mm256_maddubs_epi16(pixels[h * 2], weights);
+        __m256i high = _mm256_maddubs_epi16(pixels[h * 2 + 1], weights);
+        __m256i sum = _mm256_add_epi16(_mm256_hadd_epi16(low, high), round);
+        sums[h] = _mm256_add_epi16(_mm256_srai_epi16(sum, 7), bias);
+    }
+    return _mm256_permutevar8x32_epi32(_mm256_packus_epi16(sums[0], sums[1]), order);
+}
+
+__attribute__((target("avx2"))) static void VIDEO_pack_row_avx2(VIDEO_FORMAT format, const uint8_t *rgba,
+                                                                 uint8_t *dst, size_t y, size_t width) {
+    const __m256i drop_alpha = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1, 0, 1, 2, 4, 5,
+                                                6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    size_t x = 0;
+    __m256i pixels[4];
+
+    switch (format) {
+    case VIDEO_FORMAT_RGBA32:
+        break;
+    case VIDEO_FORMAT_RGB24:
+        for (; x + 32 + VIDEO_RGB24_SLACK <= width; x += 32) {
+            uint8_t *out = dst + (y * width + x) * 3;
+            for (int j = 0; j < 4; j++) {
+                __m256i packed =
+                    _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(rgba + x * 4) + j), drop_alpha);
+                _mm_storeu_si128((__m128i *)(out + j * 24), _mm256_castsi256_si128(packed));
+                _mm_storeu_si128((__m128i *)(out + j * 24 + 12), _mm256_extracti128_si256(packed, 1));
+            }
+        }
+        break;
+    default: {
+        const __m256i y_weights = _mm256_setr_epi8(VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0,
+                                                   VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0,
+                                                   VIDEO_Y_WEIGHTS, 0, VIDEO_Y_WEIGHTS, 0);
+        const __m256i u_weights = _mm256_setr_epi8(VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0,
+                                                   VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0,
+                                                   VIDEO_U_WEIGHTS, 0, VIDEO_U_WEIGHTS, 0);
+        const __m256i v_weights = _mm256_setr_epi8(VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0,
+                                                   VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0,
+                                                   VIDEO_V_WEIGHTS, 0, VIDEO_V_WEIGHTS, 0);
+        size_t plane = width * PPU_HEIGHT;
+        uint8_t *row = dst + y * width;
+        for (; x + 32 <= width; x += 32) {
+            for (int j = 0; j < 4; j++) {
+                pixels[j] = _mm256_loadu_si256((const __m256i *)(rgba + x * 4) + j);
+            }
+            _mm256_storeu_si256((__m256i *)(row + x), VIDEO_weigh_avx2(pixels, y_weights, 16));
+            _mm256_storeu_si256((__m256i *)(row + plane + x), VIDEO_weigh_avx2(pixels, u_weights, 128));
+            _mm256_storeu_si256((__m256i *)(row + plane * 2 + x), VIDEO_weigh_avx2(pixels, v_weights, 128));
+        }
+        break;
+    }
+    }
+    VIDEO_pack_range(format, rgba, dst, y, width, x);
+}
+#endif
+
+VIDEO_ConvertFunc VIDEO_select_convert(void) {
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return VIDEO_convert_avx2;
+    if (__builtin_cpu_supports("ssse3")) return VIDEO_convert_ssse3;
+#endif
+    return VIDEO_convert_scalar;
+}
+
+VIDEO_PackFunc VIDEO_select_pack(void) {
+#ifdef VIDEO_CONVERT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return VIDEO_pack_row_avx2;
+    if (__builtin_cpu_supports("ssse3")) return VIDEO_pack_row_ssse3;
+#endif
+    return VIDEO_pack_row_scalar;
+}
@@ -0,0 +1,55 @@
+#ifndef TEST_ROM_H
+#define TEST_ROM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Synthetic NROM images for the benchmarks and conformance tests, so they do
+// not depend on ROMs that are not part of the repository
+
+#define TEST_ROM_PRG_SIZE 0x4000
+#define TEST_ROM_CHR_SIZE 0x2000
+
+// Writes size bytes of image to a new file named after the mkstemp template
+// path, for images built by hand. Returns false on failure.
+static bool TEST_ROM_save(char *path, const uint8_t *image, size_t size) {
+    int fd = mkstemp(path);
+    if (fd < 0) return false;
+    bool ok = write(fd, image, size) == (ssize_t)size;
+    close(fd);
+    return ok;
+}
+
+// Writes a 16KB PRG / 8KB CHR NROM image with code at $C000 and the given
+// vectors to a new file named after the mkstemp template path. The CHR is a
+// fixed pattern so every tile draws something. Returns false on failure.
+static bool TEST_ROM_write(char *path, const uint8_t *code, size_t size, uint16_t nmi, uint16_t reset,
+                           uint16_t irq) {
+    static uint8_t image[16 + TEST_ROM_PRG_SIZE + TEST_ROM_CHR_SIZE];
+    if (size > TEST_ROM_PRG_SIZE - 6) return false;
+    memset(image, 0, sizeof(image));
+    memcpy(image, "NES\x1A", 4);
+    image[4] = 1; // 16KB PRG
+    image[5] = 1; // 8KB CHR
+
+    uint8_t *prg = image + 16;
+    memcpy(prg, code, size);
+    prg[0x3FFA] = nmi & 0xFF;
+    prg[0x3FFB] = nmi >> 8;
+    prg[0x3FFC] = reset & 0xFF;
+    prg[0x3FFD] = reset >> 8;
+    prg[0x3FFE] = irq & 0xFF;
+    prg[0x3FFF] = irq >> 8;
+
+    uint8_t *chr = prg + TEST_ROM_PRG_SIZE;
+    for (size_t i = 0; i < TEST_ROM_CHR_SIZE; i++) {
+        chr[i] = (uint8_t)(i * 37 + (i >> 4));
+    }
+
+    return TEST_ROM_save(path, image, sizeof(image));
+}
+
+#endif // TEST_ROM_H
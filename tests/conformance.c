@@ -0,0 +1,2466 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <BLOCK.h>
+#include <BUS.h>
+#include <CPU.h>
+#include <JIT.h>
+#include <MOVIE.h>
+#include <NES.h>
+#include <NTSC.h>
+#include <REWIND.h>
+#include <RUNNER.h>
+#include <TEST_ROM.h>
+#include <TRACE.h>
+#include <VIDEO.h>
+
+// ctest treats this exit code as a skipped test, used when a test image is absent
+#define CONFORMANCE_SKIP 77
+
+#define CONFORMANCE_LINE_SIZE 256
+#define CONFORMANCE_KLAUS_ORIGIN 0x0400
+#define CONFORMANCE_KLAUS_SUCCESS 0x3469
+#define CONFORMANCE_KLAUS_MAX_CYCLES 200000000
+#define CONFORMANCE_KLAUS_JIT_SLICE 1000 // compiled loops spin until their budget runs out
+#define CONFORMANCE_JIT_STEPS 200000
+#define CONFORMANCE_JIT_CODE 0x8000
+#define CONFORMANCE_JIT_CODE_SIZE 0x1000
+#define CONFORMANCE_JIT_IO 0x4000
+#define CONFORMANCE_PPU_THREAD_FRAMES 300
+#define CONFORMANCE_IDLE_SKIP_FRAMES 120
+#define CONFORMANCE_REWIND_WARMUP 400 // frames
+#define CONFORMANCE_REWIND_ROUNDS 60
+#define CONFORMANCE_REWIND_BURST 16 // most frames pushed in a row
+#define CONFORMANCE_REWIND_NOISE 0x0400 // RAM the synthetic PPU ROM leaves alone
+#define CONFORMANCE_REWIND_NOISE_SIZE 0x0400
+#define CONFORMANCE_REWIND_RLE_ROUNDS 200
+#define CONFORMANCE_REWIND_RLE_SIZE 8192
+#define CONFORMANCE_SAVESTATE_START 90 // frames before the savestate, the RAM routine moves in the ones after
+#define CONFORMANCE_SAVESTATE_FRAMES 60
+#define CONFORMANCE_SPRITE_EVAL_ROUNDS 256
+#define CONFORMANCE_MOVIE_FRAMES 300
+#define CONFORMANCE_TRACE_SHORT 8 // records in the test dump files
+#define CONFORMANCE_FLAGS_ROUNDS 200000
+#define CONFORMANCE_FLAGS_MEM 0x0200 // zero page and stack, the reference keeps its own copy
+#define CONFORMANCE_FLAGS_ZP 0x10
+#define CONFORMANCE_FLAGS_CODE 0x0200
+#define CONFORMANCE_FLAGS_BRANCH 0x0300 // one of each branch
+#define CONFORMANCE_FLAGS_BRANCH_OFFSET 0x10
+#define CONFORMANCE_VIDEO_GUARD 64 // bytes past a converted frame that must stay untouched
+#define CONFORMANCE_VIDEO_FRAMES 8
+#define CONFORMANCE_NTSC_ROWS 64
+#define CONFORMANCE_NTSC_BANDS 4
+
+// One line of the nestest golden log, the disassembly and PPU columns are ignored
+typedef struct {
+    uint16_t pc;
+    uint8_t bytes[3];
+    size_t byte_count;
+    REG reg;
+    size_t cycles;
+} CONFORMANCE_TRACE;
+
+// How the savestate test runs the CPU
+typedef enum {
+    CONFORMANCE_SAVESTATE_INTERPRETER,
+    CONFORMANCE_SAVESTATE_BLOCKS,
+    CONFORMANCE_SAVESTATE_JIT,
+    CONFORMANCE_SAVESTATE_CPU_COUNT
+} CONFORMANCE_SAVESTATE_CPU;
+
+static double CONFORMANCE_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void CONFORMANCE_report(const char *name, size_t instructions, size_t cycles, double wall_time) {
+    if (wall_time <= 0.0) wall_time = 1e-9;
+    printf("%s: %zu instructions, %zu cycles in %.3f ms, %.2f emulated MHz, %.0f instructions/s\n", name,
+           instructions, cycles, wall_time * 1000.0, (double)cycles / wall_time / 1e6,
+           (double)instructions / wall_time);
+}
+
+static bool CONFORMANCE_parse_field(const char *line, const char *key, int base, unsigned long *value) {
+    const char *field = strstr(line, key);
+    if (!field) return false;
+    char *end;
+    *value = strtoul(field + strlen(key), &end, base);
+    return end != field + strlen(key);
+}
+
+static bool CONFORMANCE_parse_line(const char *line, CONFORMANCE_TRACE *trace) {
+    unsigned long pc, a, x, y, p, sp, cycles;
+    if (sscanf(line, "%4lx", &pc) != 1) return false;
+    if (!CONFORMANCE_parse_field(line, "A:", 16, &a) || !CONFORMANCE_parse_field(line, "X:", 16, &x) ||
+        !CONFORMANCE_parse_field(line, "Y:", 16, &y) || !CONFORMANCE_parse_field(line, "P:", 16, &p) ||
+        !CONFORMANCE_parse_field(line, "SP:", 16, &sp) || !CONFORMANCE_parse_field(line, "CYC:", 10, &cycles)) {
+        return false;
+    }
+
+    // Instruction bytes sit in fixed columns 6, 9 and 12
+    trace->byte_count = 0;
+    for (size_t i = 0; i < 3; i++) {
+        unsigned int byte;
+        size_t column = 6 + i * 3;
+        if (strlen(line) <= column + 1 || line[column] == ' ' || sscanf(line + column, "%2x", &byte) != 1) break;
+        trace->bytes[trace->byte_count++] = (uint8_t)byte;
+    }
+
+    trace->pc = (uint16_t)pc;
+    trace->reg = (REG){.A = a, .X = x, .Y = y, .SP = sp, .PC = (uint16_t)pc, .STATUS = p};
+    trace->cycles = cycles;
+    return true;
+}
+
+static void CONFORMANCE_capture(NES *nes, size_t byte_count, CONFORMANCE_TRACE *trace) {
+    CPU *cpu = &nes->cpu;
+    trace->pc = cpu->reg.PC;
+    trace->byte_count = byte_count;
+    for (size_t i = 0; i < byte_count; i++) {
+        trace->bytes[i] = BUS_read(&nes->bus, cpu->reg.PC + i, true);
+    }
+    trace->reg = cpu->reg;
+    trace->reg.STATUS = CPU_get_status(cpu);
+    // Cycles left over from reset/interrupts are part of the log's count
+    trace->cycles = cpu->clock_counter + cpu->cycles;
+}
+
+static void CONFORMANCE_format(const CONFORMANCE_TRACE *trace, char *out, size_t size) {
+    char bytes[16] = "";
+    for (size_t i = 0; i < trace->byte_count; i++) {
+        snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ", trace->bytes[i]);
+    }
+    snprintf(out, size, "%04X  %-9s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%zu", trace->pc, bytes, trace->reg.A,
+             trace->reg.X, trace->reg.Y, trace->reg.STATUS, trace->reg.SP, trace->cycles);
+}
+
+static bool CONFORMANCE_trace_equal(const CONFORMANCE_TRACE *a, const CONFORMANCE_TRACE *b) {
+    return a->pc == b->pc && a->byte_count == b->byte_count && memcmp(a->bytes, b->bytes, a->byte_count) == 0 &&
+           a->reg.A == b->reg.A && a->reg.X == b->reg.X && a->reg.Y == b->reg.Y && a->reg.SP == b->reg.SP &&
+           a->reg.STATUS == b->reg.STATUS && a->cycles == b->cycles;
+}
+
+// Attaches a recompiler that compiles every block on its first entry, returns
+// false when it is not built in
+static bool CONFORMANCE_jit_attach(CPU *cpu, JIT *jit) {
+    if (!JIT_init(jit, JIT_DEFAULT_ARENA_SIZE)) return false;
+    jit->hot_threshold = 1;
+    CPU_set_jit(cpu, jit);
+    return true;
+}
+
+// Prints how much ran in compiled code and fails a run in which nothing did
+static int CONFORMANCE_jit_detach(const char *name, CPU *cpu, JIT *jit, int status) {
+    printf("%s: %.1f%% of cycles in compiled code, %llu blocks compiled\n", name,
+           cpu->clock_counter ? 100.0 * (double)jit->cycles / (double)cpu->clock_counter : 0.0,
+           (unsigned long long)jit->compiles);
+    if (status == EXIT_SUCCESS && jit->cycles == 0) {
+        fprintf(stderr, "%s: nothing ran in compiled code\n", name);
+        status = EXIT_FAILURE;
+    }
+    CPU_set_jit(cpu, NULL);
+    JIT_free(jit);
+    return status;
+}
+
+// Runs nestest.nes from $C000 (automation mode) and compares the CPU state before
+// every instruction against the golden log. With the recompiler attached a
+// compiled block runs several log lines at once, and the state is compared
+// wherever a block ends.
+static int CONFORMANCE_nestest(const char *rom_path, const char *log_path, bool use_jit) {
+    const char *name = use_jit ? "nestest_jit" : "nestest";
+    FILE *log = fopen(log_path, "r");
+    if (!log) {
+        fprintf(stderr, "%s: golden log '%s' not found, skipping\n", name, log_path);
+        return CONFORMANCE_SKIP;
+    }
+    FILE *rom = fopen(rom_path, "rb");
+    if (!rom) {
+        fprintf(stderr, "%s: ROM '%s' not found, skipping\n", name, rom_path);
+        fclose(log);
+        return CONFORMANCE_SKIP;
+    }
+    fclose(rom);
+
+    NES *nes = malloc(sizeof(NES));
+    if (!nes) {
+        PANIC("Out of memory allocating the console!");
+    }
+    if (!NES_init(nes, rom_path)) {
+        free(nes);
+        fclose(log);
+        return EXIT_FAILURE;
+    }
+    nes->cpu.reg.PC = 0xC000;
+    CPU_set_status(&nes->cpu, CPU_FLAGS_U | CPU_FLAGS_I);
+    JIT jit;
+    if (use_jit && !CONFORMANCE_jit_attach(&nes->cpu, &jit)) {
+        fprintf(stderr, "%s: recompiler not available, skipping\n", name);
+        NES_free(nes);
+        free(nes);
+        fclose(log);
+        return CONFORMANCE_SKIP;
+    }
+
+    char line[CONFORMANCE_LINE_SIZE];
+    size_t line_number = 0;
+    size_t instructions = 0;
+    size_t start_cycles = nes->cpu.clock_counter;
+    int status = EXIT_SUCCESS;
+    double start = CONFORMANCE_now();
+
+    while (fgets(line, sizeof(line), log)) {
+        line_number += 1;
+
+        CONFORMANCE_TRACE expected, actual;
+        if (!CONFORMANCE_parse_line(line, &expected)) continue;
+        CONFORMANCE_capture(nes, expected.byte_count, &actual);
+        if (use_jit && expected.cycles < actual.cycles) {
+            instructions += 1; // ran inside the last block
+            continue;
+        }
+
+        if (!CONFORMANCE_trace_equal(&expected, &actual)) {
+            char want[CONFORMANCE_LINE_SIZE], got[CONFORMANCE_LINE_SIZE];
+            CONFORMANCE_format(&expected, want, sizeof(want));
+            CONFORMANCE_format(&actual, got, sizeof(got));
+            fprintf(stderr, "%s: mismatch at %s:%zu\n  expected %s\n  actual   %s\n", name, log_path, line_number,
+                    want, got);
+            status = EXIT_FAILURE;
+            break;
+        }
+
+        NES_step(nes);
+        instructions += 1;
+    }
+    double wall_time = CONFORMANCE_now() - start;
+
+    if (status == EXIT_SUCCESS) {
+        // nestest leaves the codes of the first failed official/unofficial test here
+        uint8_t official = BUS_read(&nes->bus, 0x0002, true);
+        uint8_t unofficial = BUS_read(&nes->bus, 0x0003, true);
+        if (official || unofficial) {
+            fprintf(stderr, "%s: result codes $02=%02X $03=%02X\n", name, official, unofficial);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    CONFORMANCE_report(name, instructions, nes->cpu.clock_counter - start_cycles, wall_time);
+    if (use_jit) status = CONFORMANCE_jit_detach(name, &nes->cpu, &jit, status);
+    printf("%s: %s after %zu log lines\n", name, status == EXIT_SUCCESS ? "passed" : "FAILED", line_number);
+
+    NES_free(nes);
+    free(nes);
+    fclose(log);
+    return status;
+}
+
+// Runs Klaus Dormann's 6502_functional_test.bin mapped flat over the whole
+// address space. The test traps in a jump-to-self loop, on success that loop
+// is at success_addr. With the recompiler attached an interpreted copy of the
+// machine follows it, registers are compared after every compiled block and
+// memory at the end.
+static int CONFORMANCE_klaus(const char *bin_path, uint16_t success_addr, bool use_jit) {
+    const char *name = use_jit ? "klaus_jit" : "klaus";
+    FILE *file = fopen(bin_path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: binary '%s' not found, skipping\n", name, bin_path);
+        return CONFORMANCE_SKIP;
+    }
+
+    BUS *bus = malloc(sizeof(BUS));
+    CPU *cpu = malloc(sizeof(CPU));
+    BUS *reference_bus = malloc(sizeof(BUS));
+    CPU *reference = malloc(sizeof(CPU));
+    if (!bus || !cpu || !reference_bus || !reference) {
+        PANIC("Out of memory allocating the flat machine!");
+    }
+    BUS_init(bus);
+    size_t size = fread(bus->ram, 1, RAM_SIZE, file);
+    fclose(file);
+    if (size != RAM_SIZE) {
+        fprintf(stderr, "%s: '%s' is %zu bytes, expected a full 64KB image\n", name, bin_path, size);
+        free(reference);
+        free(reference_bus);
+        free(cpu);
+        free(bus);
+        return EXIT_FAILURE;
+    }
+    BUS_init(reference_bus);
+    memcpy(reference_bus->ram, bus->ram, RAM_SIZE);
+
+    CPU *machines[2] = {cpu, reference};
+    BUS *buses[2] = {bus, reference_bus};
+    for (size_t i = 0; i < 2; i++) {
+        CPU_init(machines[i], buses[i]);
+        machines[i]->decimal_mode = true;
+        machines[i]->reg.PC = CONFORMANCE_KLAUS_ORIGIN;
+        CPU_set_status(machines[i], CPU_FLAGS_U | CPU_FLAGS_I);
+    }
+    // Run from the block cache like the NES does, the test modifies its own code
+    BLOCK_CACHE cache;
+    BLOCK_CACHE_init(&cache, BLOCK_DEFAULT_CAPACITY);
+    CPU_set_block_cache(cpu, &cache);
+    JIT jit;
+    if (use_jit && !CONFORMANCE_jit_attach(cpu, &jit)) {
+        fprintf(stderr, "%s: recompiler not available, skipping\n", name);
+        BLOCK_CACHE_free(&cache);
+        free(reference);
+        free(reference_bus);
+        free(cpu);
+        free(bus);
+        return CONFORMANCE_SKIP;
+    }
+
+    int status = EXIT_SUCCESS;
+    size_t instructions = 0;
+    double start = CONFORMANCE_now();
+    uint16_t pc;
+    do {
+        pc = cpu->reg.PC;
+        if (!use_jit) {
+            CPU_step(cpu);
+            instructions += 1;
+            continue;
+        }
+
+        CPU_step_until(cpu, cpu->clock_counter + CONFORMANCE_KLAUS_JIT_SLICE);
+        while (reference->clock_counter < cpu->clock_counter) {
+            CPU_step(reference);
+            instructions += 1;
+        }
+        if (reference->clock_counter != cpu->clock_counter ||
+            memcmp(&reference->reg, &cpu->reg, sizeof(REG)) != 0 ||
+            CPU_get_status(reference) != CPU_get_status(cpu)) {
+            fprintf(stderr,
+                    "%s: diverged after the block at $%04X\n"
+                    "  expected PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%zu\n"
+                    "  actual   PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%zu\n",
+                    name, pc, reference->reg.PC, reference->reg.A, reference->reg.X, reference->reg.Y,
+                    CPU_get_status(reference), reference->reg.SP, reference->clock_counter, cpu->reg.PC, cpu->reg.A,
+                    cpu->reg.X, cpu->reg.Y, CPU_get_status(cpu), cpu->reg.SP, cpu->clock_counter);
+            status = EXIT_FAILURE;
+            break;
+        }
+        // A compiled loop comes back to where it started without being a
+        // trap, the trap is a single instruction that does
+        if (cpu->reg.PC == pc) {
+            CPU_step(cpu);
+            CPU_step(reference);
+            instructions += 1;
+        }
+    } while (cpu->reg.PC != pc && cpu->clock_counter < CONFORMANCE_KLAUS_MAX_CYCLES);
+    double wall_time = CONFORMANCE_now() - start;
+
+    if (status == EXIT_SUCCESS && use_jit && memcmp(bus->ram, reference_bus->ram, RAM_SIZE) != 0) {
+        fprintf(stderr, "%s: memory differs from the interpreted run\n", name);
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS && pc != success_addr) status = EXIT_FAILURE;
+    CONFORMANCE_report(name, instructions, cpu->clock_counter, wall_time);
+    if (use_jit) status = CONFORMANCE_jit_detach(name, cpu, &jit, status);
+    if (status == EXIT_SUCCESS) {
+        printf("%s: passed, trapped at $%04X\n", name, pc);
+    } else {
+        printf("%s: FAILED, trapped at $%04X (success is $%04X)\n", name, pc, success_addr);
+        CPU_print_registers(cpu);
+    }
+
+    BLOCK_CACHE_free(&cache);
+    free(reference);
+    free(reference_bus);
+    free(cpu);
+    free(bus);
+    return status;
+}
+
+// One flat machine of the JIT lockstep test, with a page of I/O whose reads
+// depend on everything read and written before
+typedef struct {
+    BUS bus;
+    CPU cpu;
+    uint32_t io_state;
+} CONFORMANCE_MACHINE;
+
+static uint8_t CONFORMANCE_io_read(void *ctx, uint16_t addr, bool read_only) {
+    CONFORMANCE_MACHINE *machine = ctx;
+    if (!read_only) machine->io_state = machine->io_state * 1103515245u + 12345u + addr;
+    return (uint8_t)(machine->io_state >> 16);
+}
+
+static void CONFORMANCE_io_write(void *ctx, uint16_t addr, uint8_t data) {
+    CONFORMANCE_MACHINE *machine = ctx;
+    machine->io_state = machine->io_state * 31u + data + addr;
+}
+
+static bool CONFORMANCE_jit_unwanted(uint8_t opcode) {
+    const char *name = OP_CODE_MATRIX[opcode].name;
+    return strcmp(name, "BRK") == 0 || strcmp(name, "RTI") == 0 || strcmp(name, "XXX") == 0 ||
+           strcmp(name, "DCP") == 0 || strcmp(name, "ISB") == 0 || strcmp(name, "SLO") == 0 ||
+           strcmp(name, "RLA") == 0 || strcmp(name, "SRE") == 0 || strcmp(name, "RRA") == 0;
+}
+
+// Random code that loops, calls, modifies itself and touches the I/O page
+static void CONFORMANCE_jit_program(uint8_t *ram) {
+    for (size_t i = 0; i < RAM_SIZE; i++) {
+        ram[i] = (uint8_t)rand();
+    }
+    uint16_t addr = CONFORMANCE_JIT_CODE;
+    while (addr < CONFORMANCE_JIT_CODE + CONFORMANCE_JIT_CODE_SIZE - 3) {
+        uint8_t opcode = (uint8_t)rand();
+        // Instructions the recompiler leaves to the interpreter stay rare
+        if (CONFORMANCE_jit_unwanted(opcode) && rand() % 10) continue;
+        const OP_CODE_MATRIX_ENTRY *entry = &OP_CODE_MATRIX[opcode];
+
+        uint16_t operand;
+        int kind = rand() % 100;
+        if (kind < 55) {
+            operand = 0x0200 + rand() % 0x0600; // RAM
+        } else if (kind < 70) {
+            operand = CONFORMANCE_JIT_CODE + rand() % CONFORMANCE_JIT_CODE_SIZE; // own code
+        } else if (kind < 80) {
+            operand = CONFORMANCE_JIT_IO + rand() % 0x100;
+        } else if (kind < 90) {
+            operand = 0x0100 + rand() % 0x100; // stack
+        } else {
+            operand = (uint16_t)rand();
+        }
+        if (entry->op == CPU_JMP || entry->op == CPU_JSR) {
+            operand = CONFORMANCE_JIT_CODE + rand() % CONFORMANCE_JIT_CODE_SIZE;
+        }
+
+        ram[addr] = opcode;
+        if (entry->am == CPU_AM_REL) {
+            ram[addr + 1] = (uint8_t)(rand() % 81 - 40);
+        } else {
+            ram[addr + 1] = operand & 0xFF;
+            ram[addr + 2] = operand >> 8;
+        }
+        addr += (entry->am == CPU_AM_IMP) ? 1 : 2;
+        if (entry->am == CPU_AM_ABS || entry->am == CPU_AM_ABX || entry->am == CPU_AM_ABY ||
+            entry->am == CPU_AM_IND) {
+            addr += 1;
+        }
+    }
+    for (uint16_t vector = 0xFFFA; vector != 0; vector += 2) {
+        uint16_t target = CONFORMANCE_JIT_CODE + rand() % CONFORMANCE_JIT_CODE_SIZE;
+        ram[vector] = target & 0xFF;
+        ram[vector + 1] = target >> 8;
+    }
+}
+
+static void CONFORMANCE_jit_machine(CONFORMANCE_MACHINE *machine, const uint8_t *ram, bool decimal_mode) {
+    BUS_init(&machine->bus);
+    memcpy(machine->bus.ram, ram, RAM_SIZE);
+    BUS_map_io(&machine->bus, CONFORMANCE_JIT_IO, BUS_PAGE_SIZE, CONFORMANCE_io_read, CONFORMANCE_io_write, machine);
+    machine->io_state = 1;
+    CPU_init(&machine->cpu, &machine->bus);
+    machine->cpu.decimal_mode = decimal_mode;
+    machine->cpu.reg.PC = CONFORMANCE_JIT_CODE;
+    CPU_set_status(&machine->cpu, CPU_FLAGS_U | CPU_FLAGS_I);
+}
+
+// Runs random programs with the recompiler and through the interpreter, and
+// compares the two machines whenever the compiled one finished a block
+static int CONFORMANCE_jit(unsigned seed, size_t programs) {
+    JIT jit;
+    if (!JIT_init(&jit, JIT_DEFAULT_ARENA_SIZE)) {
+        fprintf(stderr, "jit: recompiler not available, skipping\n");
+        return CONFORMANCE_SKIP;
+    }
+    jit.hot_threshold = 2;
+
+    CONFORMANCE_MACHINE *expected = malloc(sizeof(CONFORMANCE_MACHINE));
+    CONFORMANCE_MACHINE *actual = malloc(sizeof(CONFORMANCE_MACHINE));
+    uint8_t *ram = malloc(RAM_SIZE);
+    if (!expected || !actual || !ram) {
+        PANIC("Out of memory allocating the lockstep machines!");
+    }
+
+    int status = EXIT_SUCCESS;
+    size_t cycles = 0;
+    double start = CONFORMANCE_now();
+    for (size_t program = 0; program < programs && status == EXIT_SUCCESS; program++) {
+        srand(seed + (unsigned)program);
+        CONFORMANCE_jit_program(ram);
+        bool decimal_mode = program & 1;
+        CONFORMANCE_jit_machine(expected, ram, decimal_mode);
+        CONFORMANCE_jit_machine(actual, ram, decimal_mode);
+        CPU_set_jit(&actual->cpu, &jit);
+
+        for (size_t step = 0; step < CONFORMANCE_JIT_STEPS; step++) {
+            CPU *want = &expected->cpu, *got = &actual->cpu;
+            uint16_t pc = got->reg.PC;
+            CPU_step_until(got, got->clock_counter + 1 + rand() % 120);
+            while (want->clock_counter < got->clock_counter) {
+                CPU_step(want);
+            }
+
+            bool same = want->clock_counter == got->clock_counter && memcmp(&want->reg, &got->reg, sizeof(REG)) == 0 &&
+                        CPU_get_status(want) == CPU_get_status(got) &&
+                        expected->io_state == actual->io_state &&
+                        memcmp(expected->bus.ram, actual->bus.ram, RAM_SIZE) == 0;
+            if (!same) {
+                fprintf(stderr,
+                        "jit: program %zu diverged at step %zu from $%04X\n"
+                        "  expected PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%zu\n"
+                        "  actual   PC:%04X A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%zu\n",
+                        program, step, pc, want->reg.PC, want->reg.A, want->reg.X, want->reg.Y, CPU_get_status(want),
+                        want->reg.SP, want->clock_counter, got->reg.PC, got->reg.A, got->reg.X, got->reg.Y,
+                        CPU_get_status(got), got->reg.SP, got->clock_counter);
+                status = EXIT_FAILURE;
+                break;
+            }
+
+            // Interrupt lines change in between blocks, an asserted IRQ stays
+            // up until it is toggled again
+            int event = rand() % 1000;
+            if (event == 0) {
+                CPU_nmi(want);
+                CPU_nmi(got);
+            } else if (event == 1) {
+                bool asserted = !(want->irq_lines & CPU_IRQ_MAPPER);
+                CPU_set_irq(want, CPU_IRQ_MAPPER, asserted);
+                CPU_set_irq(got, CPU_IRQ_MAPPER, asserted);
+            }
+        }
+        cycles += actual->cpu.clock_counter;
+        CPU_set_jit(&actual->cpu, NULL);
+    }
+    double wall_time = CONFORMANCE_now() - start;
+
+    printf("jit: %zu cycles, %.1f%% in compiled code, %llu blocks compiled in %.3f ms\n", cycles,
+           cycles ? 100.0 * (double)jit.cycles / (double)cycles : 0.0, (unsigned long long)jit.compiles,
+           wall_time * 1000.0);
+    if (status == EXIT_SUCCESS && jit.cycles == 0) {
+        fprintf(stderr, "jit: nothing ran in compiled code\n");
+        status = EXIT_FAILURE;
+    }
+    printf("jit: %s\n", status == EXIT_SUCCESS ? "passed" : "FAILED");
+
+    JIT_free(&jit);
+    free(ram);
+    free(actual);
+    free(expected);
+    return status;
+}
+
+// Synthetic NROM program for the PPU thread test: puts a routine in RAM at
+// $0300 that copies a byte of the program to $13, waits for VBlank, loads the
+// palette, enables NMI and rendering, then polls $2002 for VBlank, calls the
+// routine and points it at another byte every 64 frames, reads the controller,
+// moves the sprites in RAM and times the sprite 0 hit while the frame renders.
+// The NMI handler puts sprite 0 on line 24, does OAM DMA, writes the nametable
+// through $2006/$2007 and scrolls.
+static const uint8_t CONFORMANCE_PPU_ROM_CODE[] = {
+    0x78,             // C000 SEI
+    0xD8,             // C001 CLD
+    0xA2, 0xFF,       // C002 LDX #$FF
+    0x9A,             // C004 TXS
+    0xA9, 0xAD,       // C005 LDA #$AD
+    0x8D, 0x00, 0x03, // C007 STA $0300
+    0xA9, 0x00,       // C00A LDA #$00
+    0x8D, 0x01, 0x03, // C00C STA $0301
+    0xA9, 0xC0,       // C00F LDA #$C0
+    0x8D, 0x02, 0x03, // C011 STA $0302
+    0xA9, 0x85,       // C014 LDA #$85
+    0x8D, 0x03, 0x03, // C016 STA $0303
+    0xA9, 0x13,       // C019 LDA #$13
+    0x8D, 0x04, 0x03, // C01B STA $0304
+    0xA9, 0x60,       // C01E LDA #$60
+    0x8D, 0x05, 0x03, // C020 STA $0305
+    0x2C, 0x02, 0x20, // C023 BIT $2002
+    0x10, 0xFB,       // C026 BPL $C023
+    0x2C, 0x02, 0x20, // C028 BIT $2002
+    0x10, 0xFB,       // C02B BPL $C028
+    0xA9, 0x3F,       // C02D LDA #$3F
+    0x8D, 0x06, 0x20, // C02F STA $2006
+    0xA9, 0x00,       // C032 LDA #$00
+    0x8D, 0x06, 0x20, // C034 STA $2006
+    0xA2, 0x00,       // C037 LDX #$00
+    0x8A,             // C039 TXA
+    0x8D, 0x07, 0x20, // C03A STA $2007
+    0xE8,             // C03D INX
+    0xE0, 0x20,       // C03E CPX #$20
+    0xD0, 0xF7,       // C040 BNE $C039
+    0xA9, 0x90,       // C042 LDA #$90
+    0x8D, 0x00, 0x20, // C044 STA $2000
+    0xA9, 0x1E,       // C047 LDA #$1E
+    0x8D, 0x01, 0x20, // C049 STA $2001
+    0x2C, 0x02, 0x20, // C04C BIT $2002
+    0x10, 0xFB,       // C04F BPL $C04C
+    0x20, 0x00, 0x03, // C051 JSR $0300
+    0xA5, 0x10,       // C054 LDA $10
+    0x29, 0x3F,       // C056 AND #$3F
+    0xD0, 0x05,       // C058 BNE $C05F
+    0xA5, 0x10,       // C05A LDA $10
+    0x8D, 0x01, 0x03, // C05C STA $0301
+    0xA9, 0x01,       // C05F LDA #$01
+    0x8D, 0x16, 0x40, // C061 STA $4016
+    0xA9, 0x00,       // C064 LDA #$00
+    0x8D, 0x16, 0x40, // C066 STA $4016
+    0xAD, 0x16, 0x40, // C069 LDA $4016
+    0x29, 0x01,       // C06C AND #$01
+    0x18,             // C06E CLC
+    0x65, 0x11,       // C06F ADC $11
+    0x85, 0x11,       // C071 STA $11
+    0xA2, 0x00,       // C073 LDX #$00
+    0xBD, 0x00, 0x02, // C075 LDA $0200,X
+    0x65, 0x11,       // C078 ADC $11
+    0x9D, 0x00, 0x02, // C07A STA $0200,X
+    0xE8,             // C07D INX
+    0xD0, 0xF5,       // C07E BNE $C075
+    0xA0, 0x00,       // C080 LDY #$00
+    0x2C, 0x02, 0x20, // C082 BIT $2002
+    0x70, 0x03,       // C085 BVS $C08A
+    0xC8,             // C087 INY
+    0xD0, 0xF8,       // C088 BNE $C082
+    0x84, 0x12,       // C08A STY $12
+    0x4C, 0x4C, 0xC0, // C08C JMP $C04C
+    0x48,             // C08F PHA (NMI)
+    0xA9, 0x18,       // C090 LDA #$18
+    0x8D, 0x00, 0x02, // C092 STA $0200
+    0xA9, 0x02,       // C095 LDA #$02
+    0x8D, 0x14, 0x40, // C097 STA $4014
+    0xA9, 0x20,       // C09A LDA #$20
+    0x8D, 0x06, 0x20, // C09C STA $2006
+    0xA5, 0x10,       // C09F LDA $10
+    0x8D, 0x06, 0x20, // C0A1 STA $2006
+    0x8D, 0x07, 0x20, // C0A4 STA $2007
+    0xE6, 0x10,       // C0A7 INC $10
+    0xA5, 0x10,       // C0A9 LDA $10
+    0x8D, 0x05, 0x20, // C0AB STA $2005
+    0x8D, 0x05, 0x20, // C0AE STA $2005
+    0xA9, 0x90,       // C0B1 LDA #$90
+    0x8D, 0x00, 0x20, // C0B3 STA $2000
+    0x68,             // C0B6 PLA
+    0x40,             // C0B7 RTI
+    0x40,             // C0B8 RTI (IRQ)
+};
+#define CONFORMANCE_PPU_ROM_NMI 0xC08F
+#define CONFORMANCE_PPU_ROM_RESET 0xC000
+#define CONFORMANCE_PPU_ROM_IRQ 0xC0B8
+
+// Loads the synthetic PPU test ROM into nes, name prefixes the messages
+static bool CONFORMANCE_open_ppu_rom(NES *nes, const char *name) {
+    char path[] = "/tmp/nes_ppu_rom_XXXXXX";
+    if (!TEST_ROM_write(path, CONFORMANCE_PPU_ROM_CODE, sizeof(CONFORMANCE_PPU_ROM_CODE), CONFORMANCE_PPU_ROM_NMI,
+                        CONFORMANCE_PPU_ROM_RESET, CONFORMANCE_PPU_ROM_IRQ)) {
+        fprintf(stderr, "%s: could not write the synthetic ROM\n", name);
+        return false;
+    }
+    bool loaded = NES_init(nes, path);
+    // The cartridge keeps its own mapping of the file
+    unlink(path);
+    return loaded;
+}
+
+// Runs a ROM with the PPU on the CPU's thread and on its own side by side, with
+// the same input and a savestate round trip on the threaded one. Every frame
+// has to come out the same. Without rom_path the synthetic ROM is used.
+static int CONFORMANCE_ppu_thread(const char *rom_path, size_t frames) {
+    char path[] = "/tmp/nes_ppu_thread_XXXXXX";
+    if (!rom_path) {
+        if (!TEST_ROM_write(path, CONFORMANCE_PPU_ROM_CODE, sizeof(CONFORMANCE_PPU_ROM_CODE),
+                            CONFORMANCE_PPU_ROM_NMI, CONFORMANCE_PPU_ROM_RESET, CONFORMANCE_PPU_ROM_IRQ)) {
+            fprintf(stderr, "ppu_thread: could not write the synthetic ROM\n");
+            return EXIT_FAILURE;
+        }
+    } else {
+        FILE *rom = fopen(rom_path, "rb");
+        if (!rom) {
+            fprintf(stderr, "ppu_thread: ROM '%s' not found, skipping\n", rom_path);
+            return CONFORMANCE_SKIP;
+        }
+        fclose(rom);
+    }
+
+    NES *want = malloc(sizeof(NES));
+    NES *got = malloc(sizeof(NES));
+    if (!want || !got) {
+        PANIC("Out of memory allocating the consoles!");
+    }
+    bool loaded = NES_init(want, rom_path ? rom_path : path);
+    if (loaded && !NES_init(got, rom_path ? rom_path : path)) {
+        NES_free(want);
+        loaded = false;
+    }
+    // The cartridges keep their own mapping of the file
+    if (!rom_path) unlink(path);
+    if (!loaded) {
+        free(want);
+        free(got);
+        return EXIT_FAILURE;
+    }
+
+    int status = EXIT_SUCCESS;
+    size_t state_size = NES_state_size(got);
+    uint8_t *state = malloc(state_size);
+    if (!state) {
+        PANIC("Out of memory allocating the savestate!");
+    }
+    if (!NES_set_ppu_thread(got, true)) {
+        fprintf(stderr, "ppu_thread: could not start the PPU thread\n");
+        status = EXIT_FAILURE;
+    }
+
+    for (size_t frame = 0; frame < frames && status == EXIT_SUCCESS; frame++) {
+        // Start now and then, otherwise a changing pattern of buttons
+        uint8_t buttons = (frame / 30) % 7 == 3 ? NES_BUTTON_START : (uint8_t)(frame * 37 >> 3);
+        want->controller[0] = buttons;
+        got->controller[0] = buttons;
+
+        // Every so often the threaded console runs a frame, goes back and
+        // runs it again
+        if (frame % 50 == 25) {
+            NES_save_state(got, state, state_size);
+            NES_run_frame(got);
+            if (!NES_load_state(got, state, state_size)) {
+                fprintf(stderr, "ppu_thread: savestate did not load\n");
+                status = EXIT_FAILURE;
+                break;
+            }
+        }
+        NES_run_frame(want);
+        NES_run_frame(got);
+
+        if (NES_frame_hash(want) != NES_frame_hash(got) || want->cpu.clock_counter != got->cpu.clock_counter ||
+            memcmp(want->bus.ram, got->bus.ram, want->bus.ram_size) != 0 ||
+            want->audio_samples != got->audio_samples ||
+            memcmp(want->audio, got->audio, want->audio_samples * sizeof(want->audio[0])) != 0) {
+            fprintf(stderr, "ppu_thread: frame %zu differs (cycle %zu, threaded %zu)\n", frame,
+                    want->cpu.clock_counter, got->cpu.clock_counter);
+            status = EXIT_FAILURE;
+        }
+    }
+    if (status == EXIT_SUCCESS) {
+        printf("ppu_thread: %zu frames identical\n", frames);
+    }
+
+    free(state);
+    NES_free(got);
+    NES_free(want);
+    free(got);
+    free(want);
+    return status;
+}
+
+// Synthetic NROM program for the idle loop test: loops a DMC sample, enables
+// NMI and rendering, then starts OAM DMA and polls a RAM flag set by the NMI
+// handler. The sample fetches stall the CPU while it polls, the handler
+// records the low byte of every PC it interrupted.
+static const uint8_t CONFORMANCE_IDLE_ROM_CODE[] = {
+    0x78,             // C000 SEI
+    0xD8,             // C001 CLD
+    0xA2, 0xFF,       // C002 LDX #$FF
+    0x9A,             // C004 TXS
+    0x2C, 0x02, 0x20, // C005 BIT $2002
+    0x10, 0xFB,       // C008 BPL $C005
+    0x2C, 0x02, 0x20, // C00A BIT $2002
+    0x10, 0xFB,       // C00D BPL $C00A
+    0xA9, 0x4F,       // C00F LDA #$4F
+    0x8D, 0x10, 0x40, // C011 STA $4010
+    0xA9, 0x00,       // C014 LDA #$00
+    0x8D, 0x12, 0x40, // C016 STA $4012
+    0xA9, 0x01,       // C019 LDA #$01
+    0x8D, 0x13, 0x40, // C01B STA $4013
+    0xA9, 0x10,       // C01E LDA #$10
+    0x8D, 0x15, 0x40, // C020 STA $4015
+    0xA9, 0x80,       // C023 LDA #$80
+    0x8D, 0x00, 0x20, // C025 STA $2000
+    0xA9, 0x1E,       // C028 LDA #$1E
+    0x8D, 0x01, 0x20, // C02A STA $2001
+    0xA9, 0x02,       // C02D LDA #$02
+    0x8D, 0x14, 0x40, // C02F STA $4014
+    0xA5, 0x20,       // C032 LDA $20
+    0xF0, 0xFC,       // C034 BEQ $C032
+    0xA9, 0x00,       // C036 LDA #$00
+    0x85, 0x20,       // C038 STA $20
+    0xE6, 0x21,       // C03A INC $21
+    0x4C, 0x2D, 0xC0, // C03C JMP $C02D
+    0x48,             // C03F PHA (NMI)
+    0x8A,             // C040 TXA
+    0x48,             // C041 PHA
+    0xE6, 0x20,       // C042 INC $20
+    0xE6, 0x22,       // C044 INC $22
+    0xBA,             // C046 TSX
+    0xBD, 0x04, 0x01, // C047 LDA $0104,X
+    0xA6, 0x22,       // C04A LDX $22
+    0x9D, 0x00, 0x03, // C04C STA $0300,X
+    0x68,             // C04F PLA
+    0xAA,             // C050 TAX
+    0x68,             // C051 PLA
+    0x40,             // C052 RTI
+    0x40,             // C053 RTI (IRQ)
+};
+#define CONFORMANCE_IDLE_ROM_NMI 0xC03F
+#define CONFORMANCE_IDLE_ROM_RESET 0xC000
+#define CONFORMANCE_IDLE_ROM_IRQ 0xC053
+
+// Runs the idle loop ROM with polling loops skipped and without, every frame
+// has to come out the same and some cycles have to have been skipped
+static int CONFORMANCE_idle_skip(size_t frames) {
+    char path[] = "/tmp/nes_idle_skip_XXXXXX";
+    if (!TEST_ROM_write(path, CONFORMANCE_IDLE_ROM_CODE, sizeof(CONFORMANCE_IDLE_ROM_CODE), CONFORMANCE_IDLE_ROM_NMI,
+                        CONFORMANCE_IDLE_ROM_RESET, CONFORMANCE_IDLE_ROM_IRQ)) {
+        fprintf(stderr, "idle_skip: could not write the synthetic ROM\n");
+        return EXIT_FAILURE;
+    }
+
+    NES *want = malloc(sizeof(NES));
+    NES *got = malloc(sizeof(NES));
+    if (!want || !got) {
+        PANIC("Out of memory allocating the consoles!");
+    }
+    bool loaded = NES_init(want, path);
+    if (loaded && !NES_init(got, path)) {
+        NES_free(want);
+        loaded = false;
+    }
+    unlink(path);
+    if (!loaded) {
+        free(want);
+        free(got);
+        return EXIT_FAILURE;
+    }
+    want->skip_idle_loops = false;
+    got->skip_idle_loops = true;
+
+    int status = EXIT_SUCCESS;
+    for (size_t frame = 0; frame < frames && status == EXIT_SUCCESS; frame++) {
+        NES_run_frame(want);
+        NES_run_frame(got);
+        if (NES_frame_hash(want) != NES_frame_hash(got) || want->cpu.clock_counter != got->cpu.clock_counter ||
+            memcmp(&want->cpu.reg, &got->cpu.reg, sizeof(REG)) != 0 ||
+            CPU_get_status(&want->cpu) != CPU_get_status(&got->cpu) ||
+            memcmp(want->bus.ram, got->bus.ram, want->bus.ram_size) != 0 ||
+            want->audio_samples != got->audio_samples ||
+            memcmp(want->audio, got->audio, want->audio_samples * sizeof(want->audio[0])) != 0) {
+            fprintf(stderr, "idle_skip: frame %zu differs (cycle %zu, skipping %zu)\n", frame,
+                    want->cpu.clock_counter, got->cpu.clock_counter);
+            status = EXIT_FAILURE;
+        }
+    }
+    if (status == EXIT_SUCCESS && got->idle_cycles == 0) {
+        fprintf(stderr, "idle_skip: no cycles were skipped\n");
+        status = EXIT_FAILURE;
+    }
+    if (status == EXIT_SUCCESS) {
+        printf("idle_skip: %zu frames identical, %llu cycles skipped\n", frames,
+               (unsigned long long)got->idle_cycles);
+    }
+
+    NES_free(got);
+    NES_free(want);
+    free(got);
+    free(want);
+    return status;
+}
+
+// Random buffers with literals and runs, through the coder with and without a
+// base to XOR against
+static bool CONFORMANCE_rewind_rle(void) {
+    uint8_t *data = malloc(CONFORMANCE_REWIND_RLE_SIZE);
+    uint8_t *base = malloc(CONFORMANCE_REWIND_RLE_SIZE);
+    uint8_t *decoded = malloc(CONFORMANCE_REWIND_RLE_SIZE);
+    uint8_t *encoded = malloc(REWIND_rle_bound(CONFORMANCE_REWIND_RLE_SIZE));
+    if (!data || !base || !decoded || !encoded) {
+        PANIC("Out of memory allocating the coder buffers!");
+    }
+
+    bool ok = true;
+    for (size_t round = 0; ok && round < CONFORMANCE_REWIND_RLE_ROUNDS; round++) {
+        size_t size = round == 0 ? 0 : (size_t)rand() % (CONFORMANCE_REWIND_RLE_SIZE + 1);
+        for (size_t i = 0; i < size;) {
+            // Runs long enough for multi-byte headers now and then
+            size_t length = 1 + (size_t)rand() % (rand() % 8 == 0 ? 1024 : 8);
+            uint8_t value = (uint8_t)rand();
+            bool run = rand() & 1;
+            for (size_t j = 0; j < length && i < size; j++, i++) {
+                data[i] = run ? value : (uint8_t)rand();
+                base[i] = rand() % 4 == 0 ? (uint8_t)rand() : data[i];
+            }
+        }
+
+        for (int delta = 0; ok && delta < 2; delta++) {
+            const uint8_t *with = delta ? base : NULL;
+            size_t encoded_size = REWIND_rle_encode(data, with, size, encoded);
+            if (encoded_size > REWIND_rle_bound(size)) {
+                fprintf(stderr, "rewind: %zu bytes coded into %zu, over the bound\n", size, encoded_size);
+                ok = false;
+                break;
+            }
+            memset(decoded, 0xA5, size);
+            REWIND_rle_decode(encoded, encoded_size, with, decoded, size);
+            if (memcmp(decoded, data, size) != 0) {
+                fprintf(stderr, "rewind: %zu bytes %s did not decode to the input\n", size,
+                        delta ? "against a base" : "without a base");
+                ok = false;
+            }
+        }
+    }
+
+    free(encoded);
+    free(decoded);
+    free(base);
+    free(data);
+    return ok;
+}
+
+// Records of the ring have to start with a keyframe, lie inside the ring
+// without overlapping and end where the next one is written
+static bool CONFORMANCE_rewind_layout(const REWIND *rewind) {
+    size_t end = 0;
+    for (size_t i = 0; i < rewind->count; i++) {
+        const REWIND_ENTRY *entry = &rewind->entries[(rewind->first + i) % rewind->max_frames];
+        if ((i == 0 && !entry->keyframe) || entry->offset + entry->size > rewind->ring_size) return false;
+        for (size_t j = 0; j < i; j++) {
+            const REWIND_ENTRY *other = &rewind->entries[(rewind->first + j) % rewind->max_frames];
+            if (entry->offset < other->offset + other->size && other->offset < entry->offset + entry->size) {
+                return false;
+            }
+        }
+        end = entry->offset + entry->size;
+    }
+    // Popping a record that wrapped around leaves the ring to write at 0
+    return rewind->write_pos == end || rewind->write_pos == 0;
+}
+
+// Pushes and pops frames in random bursts with a ring of ring_size bytes and
+// checks every popped state against the one saved when it was pushed. The
+// ring has to wrap and drop old frames along the way.
+static bool CONFORMANCE_rewind_ring(NES *nes, uint8_t *history, size_t ring_size, size_t max_frames,
+                                    size_t keyframe_interval, bool force_keyframes) {
+    size_t state_size = NES_state_size(nes);
+    uint8_t *state = malloc(state_size);
+    if (!state) {
+        PANIC("Out of memory allocating the savestate!");
+    }
+    REWIND rewind;
+    REWIND_init(&rewind, nes, ring_size, max_frames, keyframe_interval);
+
+    bool ok = true;
+    size_t depth = 0; // pushed frames not popped yet, the newest count of them are in the ring
+    size_t wraps = 0, drops = 0, forced = 0;
+    for (size_t round = 0; ok && round < CONFORMANCE_REWIND_ROUNDS; round++) {
+        size_t pushes = 1 + (size_t)rand() % CONFORMANCE_REWIND_BURST;
+        for (size_t i = 0; i < pushes; i++) {
+            nes->controller[0] = (uint8_t)rand();
+            NES_run_frame(nes);
+            // Noise in RAM the program does not use makes records of very
+            // different sizes, so the ring also skips its end with live
+            // records in it
+            size_t noise = (size_t)rand() % CONFORMANCE_REWIND_NOISE_SIZE;
+            for (size_t j = 0; j < CONFORMANCE_REWIND_NOISE_SIZE; j++) {
+                nes->bus.ram[CONFORMANCE_REWIND_NOISE + j] = j < noise ? (uint8_t)rand() : 0;
+            }
+            NES_save_state(nes, history + depth * state_size, state_size);
+            depth += 1;
+
+            size_t count = REWIND_frames(&rewind);
+            size_t write_pos = rewind.write_pos;
+            bool delta = count && rewind.since_keyframe + 1 < rewind.keyframe_interval;
+            REWIND_push(&rewind, nes);
+            const REWIND_ENTRY *newest = &rewind.entries[(rewind.first + rewind.count - 1) % rewind.max_frames];
+            wraps += newest->offset < write_pos;
+            drops += REWIND_frames(&rewind) <= count;
+            forced += delta && newest->keyframe;
+            if (!CONFORMANCE_rewind_layout(&rewind)) {
+                fprintf(stderr, "rewind: ring %zu is inconsistent after a push\n", ring_size);
+                ok = false;
+                break;
+            }
+        }
+
+        // The last round empties the history and one more pop finds nothing
+        size_t pops = round + 1 == CONFORMANCE_REWIND_ROUNDS ? depth + 1 : (size_t)rand() % (pushes + 2);
+        for (size_t i = 0; ok && i < pops; i++) {
+            bool expected = REWIND_frames(&rewind) > 0;
+            if (REWIND_pop(&rewind, nes) != expected) {
+                fprintf(stderr, "rewind: pop with %zu frames returned %s\n", REWIND_frames(&rewind),
+                        expected ? "false" : "true");
+                ok = false;
+                break;
+            }
+            if (!expected) continue;
+            depth -= 1;
+            NES_save_state(nes, state, state_size);
+            if (memcmp(state, history + depth * state_size, state_size) != 0) {
+                fprintf(stderr, "rewind: state %zu came back different (ring %zu, interval %zu)\n", depth, ring_size,
+                        keyframe_interval);
+                ok = false;
+            }
+            if (!CONFORMANCE_rewind_layout(&rewind)) {
+                fprintf(stderr, "rewind: ring %zu is inconsistent after a pop\n", ring_size);
+                ok = false;
+            }
+        }
+    }
+    if (ok && (!wraps || !drops || (force_keyframes && !forced))) {
+        fprintf(stderr, "rewind: ring %zu never %s\n", ring_size,
+                !wraps ? "wrapped" : !drops ? "dropped a frame" : "forced a keyframe");
+        ok = false;
+    }
+
+    REWIND_free(&rewind);
+    free(state);
+    return ok;
+}
+
+// The rewind coder and ring on the synthetic PPU ROM, with rings a few
+// keyframes large
+static int CONFORMANCE_rewind(unsigned seed) {
+    srand(seed);
+    NES *nes = malloc(sizeof(NES));
+    if (!nes) {
+        PANIC("Out of memory allocating the console!");
+    }
+    if (!CONFORMANCE_open_ppu_rom(nes, "rewind")) {
+        free(nes);
+        return EXIT_FAILURE;
+    }
+
+    size_t state_size = NES_state_size(nes);
+    uint8_t *history = malloc(CONFORMANCE_REWIND_ROUNDS * CONFORMANCE_REWIND_BURST * state_size);
+    uint8_t *encoded = malloc(REWIND_rle_bound(state_size));
+    if (!history || !encoded) {
+        PANIC("Out of memory allocating the rewind history!");
+    }
+    // Keyframes grow while the program fills the nametable, they are measured
+    // once it is done
+    for (size_t frame = 0; frame < CONFORMANCE_REWIND_WARMUP; frame++) {
+        NES_run_frame(nes);
+    }
+    // The largest keyframe has all of the noise
+    for (size_t i = 0; i < CONFORMANCE_REWIND_NOISE_SIZE; i++) {
+        nes->bus.ram[CONFORMANCE_REWIND_NOISE + i] = (uint8_t)rand();
+    }
+    NES_save_state(nes, history, state_size);
+    size_t keyframe = REWIND_rle_encode(history, NULL, state_size, encoded);
+
+    bool ok = CONFORMANCE_rewind_rle();
+    // A few frames a keyframe, a ring that only holds one and a half keyframes
+    // so deltas lose theirs, only keyframes so small ones are left at the end
+    // of the ring, and an entry table that fills before the ring
+    ok = ok && CONFORMANCE_rewind_ring(nes, history, keyframe * 4, 32, 4, false);
+    ok = ok && CONFORMANCE_rewind_ring(nes, history, keyframe * 3 / 2, 64, 16, true);
+    ok = ok && CONFORMANCE_rewind_ring(nes, history, keyframe * 3 / 2, 64, 1, false);
+    ok = ok && CONFORMANCE_rewind_ring(nes, history, keyframe * 4, 5, 3, false);
+    printf("rewind: %s (keyframes of %zu bytes)\n", ok ? "passed" : "FAILED", keyframe);
+
+    free(encoded);
+    free(history);
+    NES_free(nes);
+    free(nes);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// What a savestate test remembers of every frame
+typedef struct {
+    uint64_t frame; // NES_frame_hash
+    uint64_t ram;
+    uint64_t reg; // registers, status and cycle counter
+    uint64_t state; // the whole savestate
+} CONFORMANCE_FRAME;
+
+static void CONFORMANCE_savestate_frame(NES *nes, size_t frame, uint8_t *state, size_t state_size,
+                                        CONFORMANCE_FRAME *out) {
+    nes->controller[0] = (frame / 20) % 5 == 2 ? NES_BUTTON_START : (uint8_t)(frame * 73 >> 2);
+    NES_run_frame(nes);
+    uint8_t status = CPU_get_status(&nes->cpu);
+    out->frame = NES_frame_hash(nes);
+    out->ram = hash_fnv1a(HASH_FNV_OFFSET, nes->bus.ram, nes->bus.ram_size);
+    out->reg = hash_fnv1a(HASH_FNV_OFFSET, (const uint8_t *)&nes->cpu.reg, sizeof(REG));
+    out->reg = hash_fnv1a(out->reg, &status, 1);
+    out->reg = hash_fnv1a(out->reg, (const uint8_t *)&nes->cpu.clock_counter, sizeof(nes->cpu.clock_counter));
+    NES_save_state(nes, state, state_size);
+    out->state = hash_fnv1a(HASH_FNV_OFFSET, state, state_size);
+}
+
+// Runs the frames after a savestate again on nes, which has just loaded it
+static bool CONFORMANCE_savestate_replay(const char *name, NES *nes, const CONFORMANCE_FRAME *want, uint8_t *state,
+                                         size_t state_size) {
+    for (size_t frame = 0; frame < CONFORMANCE_SAVESTATE_FRAMES; frame++) {
+        CONFORMANCE_FRAME got;
+        CONFORMANCE_savestate_frame(nes, CONFORMANCE_SAVESTATE_START + frame, state, state_size, &got);
+        if (memcmp(&got, &want[frame], sizeof(got)) != 0) {
+            fprintf(stderr, "savestate: %s frame %zu after loading differs in the %s\n", name, frame,
+                    got.frame != want[frame].frame ? "picture"
+                    : got.ram != want[frame].ram   ? "RAM"
+                    : got.reg != want[frame].reg   ? "registers"
+                                                   : "savestate");
+            return false;
+        }
+    }
+    return true;
+}
+
+// Blobs with a wrong header or size have to be turned down without touching
+// the console
+static bool CONFORMANCE_savestate_reject(NES *nes, const uint8_t *saved, uint8_t *blob, uint8_t *state,
+                                         size_t state_size) {
+    uint8_t *before = malloc(state_size);
+    if (!before) {
+        PANIC("Out of memory allocating the savestate!");
+    }
+    NES_save_state(nes, before, state_size);
+
+    bool ok = true;
+    for (int broken = 0; ok && broken < 5; broken++) {
+        memcpy(blob, saved, state_size);
+        NES_STATE_HEADER header;
+        memcpy(&header, blob, sizeof(header));
+        size_t size = state_size;
+        const char *what = "";
+        switch (broken) {
+        case 0: header.magic ^= 1, what = "magic"; break;
+        case 1: header.version += 1, what = "version"; break;
+        case 2: header.rom_hash ^= 1, what = "ROM hash"; break;
+        case 3: header.size -= 1, what = "size in the header"; break;
+        default: size -= 1, what = "size"; break;
+        }
+        memcpy(blob, &header, sizeof(header));
+        if (NES_load_state(nes, blob, size)) {
+            fprintf(stderr, "savestate: a blob with the wrong %s loaded\n", what);
+            ok = false;
+        }
+        NES_save_state(nes, state, state_size);
+        if (memcmp(state, before, state_size) != 0) {
+            fprintf(stderr, "savestate: a blob with the wrong %s changed the console\n", what);
+            ok = false;
+        }
+    }
+    free(before);
+    return ok;
+}
+
+// Saves the synthetic PPU ROM mid-game, runs on and records every frame, then
+// loads the blob into the same console and into a fresh one and runs the same
+// frames again. Both have to match, with the interpreter, the decoded block
+// cache and the recompiler running the CPU.
+static bool CONFORMANCE_savestate_mode(CONFORMANCE_SAVESTATE_CPU mode) {
+    static const char *names[] = {"interpreter", "block cache", "recompiler"};
+    const char *name = names[mode];
+    NES *nes = malloc(sizeof(NES));
+    NES *fresh = malloc(sizeof(NES));
+    if (!nes || !fresh) {
+        PANIC("Out of memory allocating the consoles!");
+    }
+    if (!CONFORMANCE_open_ppu_rom(nes, "savestate")) {
+        free(fresh);
+        free(nes);
+        return false;
+    }
+    if (!CONFORMANCE_open_ppu_rom(fresh, "savestate")) {
+        NES_free(nes);
+        free(fresh);
+        free(nes);
+        return false;
+    }
+
+    JIT jit;
+    if (mode == CONFORMANCE_SAVESTATE_INTERPRETER) {
+        CPU_set_block_cache(&nes->cpu, NULL);
+    } else if (mode == CONFORMANCE_SAVESTATE_JIT && !CONFORMANCE_jit_attach(&nes->cpu, &jit)) {
+        printf("savestate: recompiler not available, skipping it\n");
+        NES_free(fresh);
+        NES_free(nes);
+        free(fresh);
+        free(nes);
+        return true;
+    }
+
+    size_t state_size = NES_state_size(nes);
+    uint8_t *saved = malloc(state_size);
+    uint8_t *state = malloc(state_size);
+    uint8_t *blob = malloc(state_size);
+    CONFORMANCE_FRAME *want = malloc(CONFORMANCE_SAVESTATE_FRAMES * sizeof(CONFORMANCE_FRAME));
+    if (!saved || !state || !blob || !want) {
+        PANIC("Out of memory allocating the savestates!");
+    }
+
+    for (size_t frame = 0; frame < CONFORMANCE_SAVESTATE_START; frame++) {
+        CONFORMANCE_FRAME ignored;
+        CONFORMANCE_savestate_frame(nes, frame, state, state_size, &ignored);
+    }
+    NES_save_state(nes, saved, state_size);
+    for (size_t frame = 0; frame < CONFORMANCE_SAVESTATE_FRAMES; frame++) {
+        CONFORMANCE_savestate_frame(nes, CONFORMANCE_SAVESTATE_START + frame, state, state_size, &want[frame]);
+    }
+
+    bool ok = CONFORMANCE_savestate_reject(nes, saved, blob, state, state_size);
+    if (ok && (!NES_load_state(nes, saved, state_size) || !NES_load_state(fresh, saved, state_size))) {
+        fprintf(stderr, "savestate: %s blob did not load\n", name);
+        ok = false;
+    }
+    if (ok) {
+        // Saving right after loading gives the same blob back
+        NES_save_state(nes, state, state_size);
+        if (memcmp(state, saved, state_size) != 0) {
+            fprintf(stderr, "savestate: %s blob changed on a round trip\n", name);
+            ok = false;
+        }
+    }
+    ok = ok && CONFORMANCE_savestate_replay(name, nes, want, state, state_size);
+    ok = ok && CONFORMANCE_savestate_replay(name, fresh, want, state, state_size);
+    if (mode == CONFORMANCE_SAVESTATE_JIT) {
+        ok = CONFORMANCE_jit_detach("savestate", &nes->cpu, &jit, ok ? EXIT_SUCCESS : EXIT_FAILURE) == EXIT_SUCCESS;
+    }
+    printf("savestate: %s %s\n", name, ok ? "passed" : "FAILED");
+
+    free(want);
+    free(blob);
+    free(state);
+    free(saved);
+    NES_free(fresh);
+    NES_free(nes);
+    free(fresh);
+    free(nes);
+    return ok;
+}
+
+static int CONFORMANCE_savestate(void) {
+    bool ok = true;
+    for (int mode = 0; mode < CONFORMANCE_SAVESTATE_CPU_COUNT; mode++) {
+        ok = CONFORMANCE_savestate_mode((CONFORMANCE_SAVESTATE_CPU)mode) && ok;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Every sprite evaluation variant against the scalar one on random OAM, with
+// Y values around the visible range, every scanline and both sprite heights
+static int CONFORMANCE_sprite_eval(unsigned seed) {
+    srand(seed);
+    const PPU_SPRITE_EVAL *variants;
+    size_t count = PPU_sprite_eval_variants(&variants);
+    uint8_t oam[PPU_SPRITE_COUNT * 4];
+
+    bool ok = true;
+    for (size_t round = 0; ok && round < CONFORMANCE_SPRITE_EVAL_ROUNDS; round++) {
+        for (size_t i = 0; i < sizeof(oam); i++) {
+            oam[i] = (uint8_t)rand();
+        }
+        // Mostly on screen, some just past it, and now and then all at once
+        uint8_t crowd = (uint8_t)rand();
+        for (size_t i = 0; i < PPU_SPRITE_COUNT; i++) {
+            int pick = rand() % 8;
+            oam[i * 4] = pick == 0 ? (uint8_t)(0xEF + rand() % 17) : pick == 1 ? crowd : (uint8_t)(rand() % 240);
+            if (round % 16 == 0) oam[i * 4] = crowd;
+        }
+
+        for (int height = 8; ok && height <= 16; height += 8) {
+            for (int scanline = 0; ok && scanline < PPU_SCANLINES; scanline++) {
+                uint64_t want = PPU_sprites_in_range_scalar(oam, scanline, height);
+                for (size_t v = 1; v < count; v++) {
+                    uint64_t got = variants[v].eval(oam, scanline, height);
+                    if (got != want) {
+                        fprintf(stderr, "sprite_eval: %s on scanline %d, height %d: %016llX, scalar %016llX\n",
+                                variants[v].name, scanline, height, (unsigned long long)got,
+                                (unsigned long long)want);
+                        ok = false;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    printf("sprite_eval: %s,", ok ? "passed" : "FAILED");
+    for (size_t v = 0; v < count; v++) {
+        printf(" %s", variants[v].name);
+    }
+    printf("\n");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void CONFORMANCE_movie_count(void *ctx, NES *nes, size_t frame) {
+    (void)nes;
+    (void)frame;
+    *(size_t *)ctx += 1;
+}
+
+// MOVIE_save and MOVIE_load give back the same frames, and a hand written
+// FM2 log with header lines parses to the buttons it shows
+static bool CONFORMANCE_movie_fm2(const MOVIE *movie) {
+    char path[] = "/tmp/nes_movie_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "movie: could not create a temporary file\n");
+        return false;
+    }
+    close(fd);
+
+    MOVIE loaded;
+    bool ok = MOVIE_save(movie, path) && MOVIE_load(&loaded, path);
+    if (ok) {
+        if (loaded.frame_count != movie->frame_count ||
+            memcmp(loaded.frames, movie->frames, movie->frame_count * sizeof(MOVIE_FRAME)) != 0) {
+            fprintf(stderr, "movie: %zu frames saved, %zu loaded differently\n", movie->frame_count,
+                    loaded.frame_count);
+            ok = false;
+        }
+        MOVIE_free(&loaded);
+    }
+
+    static const char fm2[] = "version 3\n"
+                              "romFilename test\n"
+                              "comment subject |1|RLDUTSBA|\n"
+                              "|0|.......A|        |\n"
+                              "|1|R..U.S..|..D..S.A|\n"
+                              "|2|RLDUTSBA|\n";
+    static const MOVIE_FRAME want[] = {
+        {{NES_BUTTON_A, 0}, 0},
+        {{NES_BUTTON_RIGHT | NES_BUTTON_UP | NES_BUTTON_SELECT, NES_BUTTON_DOWN | NES_BUTTON_SELECT | NES_BUTTON_A},
+         MOVIE_COMMAND_RESET},
+        {{0xFF, 0}, MOVIE_COMMAND_POWER},
+    };
+    FILE *file = ok ? fopen(path, "w") : NULL;
+    if (file) {
+        fputs(fm2, file);
+        fclose(file);
+        if (MOVIE_load(&loaded, path)) {
+            if (loaded.frame_count != sizeof(want) / sizeof(want[0]) ||
+                memcmp(loaded.frames, want, sizeof(want)) != 0) {
+                fprintf(stderr, "movie: the FM2 log parsed to the wrong frames\n");
+                ok = false;
+            }
+            MOVIE_free(&loaded);
+        } else {
+            ok = false;
+        }
+    } else {
+        ok = false;
+    }
+    unlink(path);
+    return ok;
+}
+
+// Plays a movie with resets and a power cycle on the synthetic PPU ROM once
+// rendering every frame and once only the last, both have to end in the same
+// state and picture
+static int CONFORMANCE_movie(unsigned seed) {
+    srand(seed);
+    MOVIE movie = {0};
+    for (size_t frame = 0; frame < CONFORMANCE_MOVIE_FRAMES; frame++) {
+        uint8_t buttons[NES_CONTROLLER_PORTS];
+        for (size_t port = 0; port < NES_CONTROLLER_PORTS; port++) {
+            buttons[port] = rand() % 4 ? (uint8_t)rand() : 0;
+        }
+        uint8_t commands = frame == CONFORMANCE_MOVIE_FRAMES / 3       ? MOVIE_COMMAND_RESET
+                           : frame == CONFORMANCE_MOVIE_FRAMES * 2 / 3 ? MOVIE_COMMAND_POWER
+                                                                       : 0;
+        MOVIE_append(&movie, buttons, commands);
+    }
+    bool ok = CONFORMANCE_movie_fm2(&movie);
+
+    NES *every = malloc(sizeof(NES));
+    NES *last = malloc(sizeof(NES));
+    if (!every || !last) {
+        PANIC("Out of memory allocating the consoles!");
+    }
+    if (!CONFORMANCE_open_ppu_rom(every, "movie")) {
+        free(last);
+        free(every);
+        MOVIE_free(&movie);
+        return EXIT_FAILURE;
+    }
+    if (!CONFORMANCE_open_ppu_rom(last, "movie")) {
+        NES_free(every);
+        free(last);
+        free(every);
+        MOVIE_free(&movie);
+        return EXIT_FAILURE;
+    }
+
+    size_t rendered_every = 0, rendered_last = 0;
+    MOVIE_play(&movie, every, 0, movie.frame_count, 1, CONFORMANCE_movie_count, &rendered_every);
+    MOVIE_play(&movie, last, 0, movie.frame_count, 0, CONFORMANCE_movie_count, &rendered_last);
+    if (rendered_every != movie.frame_count || rendered_last != 1) {
+        fprintf(stderr, "movie: %zu and %zu frames rendered\n", rendered_every, rendered_last);
+        ok = false;
+    }
+
+    // Fast-forward skips audio synthesis, the resampler's phase and filter
+    // carry all of its history, so they are left out of the comparison
+    BLIP_clear(&every->apu.blip);
+    BLIP_clear(&last->apu.blip);
+    size_t state_size = NES_state_size(every);
+    uint8_t *want = malloc(state_size);
+    uint8_t *got = malloc(state_size);
+    if (!want || !got) {
+        PANIC("Out of memory allocating the savestates!");
+    }
+    NES_save_state(every, want, state_size);
+    NES_save_state(last, got, state_size);
+    if (NES_frame_hash(every) != NES_frame_hash(last) || memcmp(want, got, state_size) != 0) {
+        fprintf(stderr, "movie: fast-forward ended differently (cycle %zu, rendered %zu)\n",
+                last->cpu.clock_counter, every->cpu.clock_counter);
+        ok = false;
+    }
+    printf("movie: %s\n", ok ? "passed" : "FAILED");
+
+    free(got);
+    free(want);
+    NES_free(last);
+    NES_free(every);
+    free(last);
+    free(every);
+    MOVIE_free(&movie);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A hand-built image of file_size bytes, the header followed by zeros, and
+// what CART_load and NES_init have to make of it
+typedef struct {
+    const char *name;
+    uint8_t header[CART_HEADER_SIZE];
+    size_t file_size;
+    bool loads;
+    size_t prg_ram_size;
+    size_t chr_ram_size;
+    bool boots;
+} CONFORMANCE_CART_CASE;
+
+#define CONFORMANCE_CART_NROM (CART_HEADER_SIZE + CART_PRG_BANK_SIZE + CART_CHR_BANK_SIZE)
+
+static const CONFORMANCE_CART_CASE CONFORMANCE_CART_CASES[] = {
+    {"iNES NROM", {'N', 'E', 'S', 0x1A, 1, 1}, CONFORMANCE_CART_NROM, true, 8192, 0, true},
+    {"iNES MMC1 with CHR-RAM", {'N', 'E', 'S', 0x1A, 2, 0, 0x10}, CART_HEADER_SIZE + 2 * CART_PRG_BANK_SIZE, true,
+     8192, 8192, true},
+    {"NES 2.0 MMC1 without PRG-RAM", {'N', 'E', 'S', 0x1A, 1, 1, 0x10, 0x08}, CONFORMANCE_CART_NROM, true, 0, 0,
+     true},
+    {"NES 2.0 trainer without PRG-RAM", {'N', 'E', 'S', 0x1A, 1, 1, 0x04, 0x08},
+     CONFORMANCE_CART_NROM + CART_TRAINER_SIZE, true, 8192, 0, true},
+    {"NES 2.0 odd RAM sizes", {'N', 'E', 'S', 0x1A, 1, 0, 0x10, 0x08, 0, 0, 0x01, 0x03},
+     CART_HEADER_SIZE + CART_PRG_BANK_SIZE, true, 256, 1024, true},
+    {"NES 2.0 exponent sizes", {'N', 'E', 'S', 0x1A, 14 << 2, 13 << 2, 0, 0x08, 0, 0xFF}, CONFORMANCE_CART_NROM, true,
+     0, 0, true},
+    {"unsupported mapper", {'N', 'E', 'S', 0x1A, 1, 1, 0xF0}, CONFORMANCE_CART_NROM, true, 8192, 0, false},
+    {"short header", {'N', 'E', 'S', 0x1A, 1, 1}, CART_HEADER_SIZE - 1, false, 0, 0, false},
+    {"bad magic", {'N', 'E', 'S', 0x00, 1, 1}, CONFORMANCE_CART_NROM, false, 0, 0, false},
+    {"no PRG-ROM", {'N', 'E', 'S', 0x1A, 0, 1}, CART_HEADER_SIZE + CART_CHR_BANK_SIZE, false, 0, 0, false},
+    {"truncated CHR-ROM", {'N', 'E', 'S', 0x1A, 1, 1}, CONFORMANCE_CART_NROM - 1, false, 0, 0, false},
+    {"truncated PRG-ROM", {'N', 'E', 'S', 0x1A, 2, 0}, CART_HEADER_SIZE + CART_PRG_BANK_SIZE, false, 0, 0, false},
+    {"truncated trainer", {'N', 'E', 'S', 0x1A, 1, 0, 0x04}, CART_HEADER_SIZE + 100, false, 0, 0, false},
+    {"huge bank count", {'N', 'E', 'S', 0x1A, 0xFF, 0xFF, 0, 0x08, 0, 0xEE}, CONFORMANCE_CART_NROM, false, 0, 0,
+     false},
+    {"huge exponent", {'N', 'E', 'S', 0x1A, 0xFF, 1, 0, 0x08, 0, 0x0F}, CONFORMANCE_CART_NROM, false, 0, 0, false},
+    {"huge CHR exponent", {'N', 'E', 'S', 0x1A, 1, 0xFF, 0, 0x08, 0, 0xF0}, CONFORMANCE_CART_NROM, false, 0, 0,
+     false},
+    {"PRG-ROM not whole banks", {'N', 'E', 'S', 0x1A, (12 << 2) | 1, 1, 0, 0x08, 0, 0x0F},
+     CART_HEADER_SIZE + 3 * 4096 + CART_CHR_BANK_SIZE, false, 0, 0, false},
+    {"CHR-ROM not whole banks", {'N', 'E', 'S', 0x1A, 1, 9 << 2, 0, 0x08, 0, 0xF0},
+     CART_HEADER_SIZE + CART_PRG_BANK_SIZE + 512, false, 0, 0, false},
+};
+
+// Loads a hand-built image for each header case. Rejected files have to leave
+// the cartridge empty, accepted ones get the expected RAM and have to boot.
+static int CONFORMANCE_cart(void) {
+    size_t max_size = 0;
+    for (size_t i = 0; i < sizeof(CONFORMANCE_CART_CASES) / sizeof(CONFORMANCE_CART_CASES[0]); i++) {
+        if (CONFORMANCE_CART_CASES[i].file_size > max_size) max_size = CONFORMANCE_CART_CASES[i].file_size;
+    }
+    uint8_t *image = malloc(max_size);
+    NES *nes = malloc(sizeof(NES));
+    if (!image || !nes) {
+        PANIC("Out of memory allocating the cartridge images!");
+    }
+
+    static const CART empty;
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(CONFORMANCE_CART_CASES) / sizeof(CONFORMANCE_CART_CASES[0]); i++) {
+        const CONFORMANCE_CART_CASE *test = &CONFORMANCE_CART_CASES[i];
+        memset(image, 0, test->file_size);
+        memcpy(image, test->header, test->file_size < CART_HEADER_SIZE ? test->file_size : CART_HEADER_SIZE);
+        char path[] = "/tmp/nes_cart_XXXXXX";
+        if (!TEST_ROM_save(path, image, test->file_size)) {
+            fprintf(stderr, "cart: could not write the '%s' image\n", test->name);
+            ok = false;
+            break;
+        }
+
+        CART cart;
+        bool loaded = CART_load(&cart, path);
+        size_t prg_ram_size = cart.prg_ram_size;
+        size_t chr_ram_size = cart.chr_ram_size;
+        bool passed = loaded == test->loads && prg_ram_size == test->prg_ram_size &&
+                      chr_ram_size == test->chr_ram_size && (cart.prg_ram != NULL) == (prg_ram_size != 0) &&
+                      (cart.chr_ram != NULL) == (chr_ram_size != 0);
+        if (loaded) CART_unload(&cart);
+        // Nothing of a rejected file stays mapped or allocated
+        passed = passed && memcmp(&cart, &empty, sizeof(CART)) == 0;
+
+        bool booted = NES_init(nes, path);
+        unlink(path);
+        passed = passed && booted == test->boots;
+        if (booted) {
+            NES_run_frame(nes);
+            NES_free(nes);
+        }
+
+        if (!passed) {
+            fprintf(stderr, "cart: '%s' %s, PRG-RAM %zu CHR-RAM %zu\n", test->name,
+                    loaded ? (booted ? "booted" : "loaded") : "rejected", prg_ram_size, chr_ram_size);
+            ok = false;
+        }
+    }
+    printf("cart: %s\n", ok ? "passed" : "FAILED");
+
+    free(nes);
+    free(image);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// A one line manifest, whether RUNNER_load_manifest has to accept it and the
+// frame count of its job if so
+typedef struct {
+    const char *line;
+    bool loads;
+    size_t frames;
+} CONFORMANCE_MANIFEST_CASE;
+
+static const CONFORMANCE_MANIFEST_CASE CONFORMANCE_MANIFEST_CASES[] = {
+    {"game.nes\n", true, 0},
+    {"game.nes - 120\n", true, 120},
+    {"game.nes run.fm2 5184000", true, RUNNER_MAX_FRAMES},
+    {"game.nes - 5184001\n", false, 0},
+    {"game.nes - -1\n", false, 0},
+    {"game.nes - +5\n", false, 0},
+    {"game.nes - 18446744073709551617\n", false, 0},
+    {"game.nes - 12x\n", false, 0},
+    {"game.nes - x\n", false, 0},
+};
+
+// Writes text as a manifest and loads it, the frame count is that of its first job
+static bool CONFORMANCE_manifest_load(const char *text, size_t size, size_t *job_count, size_t *frames) {
+    char path[] = "/tmp/nes_manifest_XXXXXX";
+    if (!TEST_ROM_save(path, (const uint8_t *)text, size)) {
+        PANIC("Could not write a test manifest!");
+    }
+    RUNNER runner;
+    bool loaded = RUNNER_load_manifest(&runner, path);
+    unlink(path);
+    if (!loaded) return false;
+    *job_count = runner.job_count;
+    *frames = runner.job_count ? runner.jobs[0].frames : 0;
+    RUNNER_free(&runner);
+    return true;
+}
+
+// Frame counts in runner manifests, negative, huge and malformed ones have to
+// be rejected, and so do lines too long for the line buffer
+static int CONFORMANCE_manifest(void) {
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(CONFORMANCE_MANIFEST_CASES) / sizeof(CONFORMANCE_MANIFEST_CASES[0]); i++) {
+        const CONFORMANCE_MANIFEST_CASE *test = &CONFORMANCE_MANIFEST_CASES[i];
+        size_t job_count = 0;
+        size_t frames = 0;
+        bool loaded = CONFORMANCE_manifest_load(test->line, strlen(test->line), &job_count, &frames);
+        if (loaded != test->loads || (loaded && (job_count != 1 || frames != test->frames))) {
+            fprintf(stderr, "manifest: '%.*s' %s with %zu jobs, %zu frames\n", (int)strcspn(test->line, "\n"),
+                    test->line, loaded ? "loaded" : "rejected", job_count, frames);
+            ok = false;
+        }
+    }
+
+    // The longest line that fits, then one byte more
+    char *text = malloc(RUNNER_LINE_SIZE + 1);
+    if (!text) {
+        PANIC("Out of memory allocating a test manifest!");
+    }
+    for (size_t length = RUNNER_LINE_SIZE - 1; length <= RUNNER_LINE_SIZE; length++) {
+        memset(text, 'a', length - 1);
+        text[length - 1] = '\n';
+        size_t job_count = 0;
+        size_t frames = 0;
+        bool loaded = CONFORMANCE_manifest_load(text, length, &job_count, &frames);
+        if (loaded != (length < RUNNER_LINE_SIZE) || (loaded && job_count != 1)) {
+            fprintf(stderr, "manifest: %zu byte line %s with %zu jobs\n", length, loaded ? "loaded" : "rejected",
+                    job_count);
+            ok = false;
+        }
+    }
+    printf("manifest: %s\n", ok ? "passed" : "FAILED");
+
+    free(text);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// TRACE_format against the opening lines of nestest.log with the PPU column
+// taken out, then lines in the same layout for what those do not reach
+static const struct {
+    TRACE_RECORD record;
+    const char *line;
+} CONFORMANCE_TRACE_LINES[] = {
+    {{7, 0, 0xC000, 0x4C, {0xF5, 0xC5}, 0x00, 0x00, 0x00, 0xFD, 0x24},
+     "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7"},
+    {{10, 0, 0xC5F5, 0xA2, {0x00, 0x00}, 0x00, 0x00, 0x00, 0xFD, 0x24},
+     "C5F5  A2 00     LDX #$00                        A:00 X:00 Y:00 P:24 SP:FD CYC:10"},
+    {{18, 0, 0xC5FD, 0x20, {0x2D, 0xC7}, 0x00, 0x00, 0x00, 0xFD, 0x26},
+     "C5FD  20 2D C7  JSR $C72D                       A:00 X:00 Y:00 P:26 SP:FD CYC:18"},
+    {{24, 0, 0xC72D, 0xEA, {0x00, 0x00}, 0x00, 0x00, 0x00, 0xFB, 0x26},
+     "C72D  EA        NOP                             A:00 X:00 Y:00 P:26 SP:FB CYC:24"},
+    {{26, 0, 0xC72E, 0x38, {0x00, 0x00}, 0x00, 0x00, 0x00, 0xFB, 0x26},
+     "C72E  38        SEC                             A:00 X:00 Y:00 P:26 SP:FB CYC:26"},
+    {{28, 0, 0xC72F, 0xB0, {0x04, 0x00}, 0x00, 0x00, 0x00, 0xFB, 0x27},
+     "C72F  B0 04     BCS $C735                       A:00 X:00 Y:00 P:27 SP:FB CYC:28"},
+    {{31, 0, 0xC735, 0xEA, {0x00, 0x00}, 0x00, 0x00, 0x00, 0xFB, 0x27},
+     "C735  EA        NOP                             A:00 X:00 Y:00 P:27 SP:FB CYC:31"},
+    {{33, 0, 0xC736, 0x18, {0x00, 0x00}, 0x00, 0x00, 0x00, 0xFB, 0x27},
+     "C736  18        CLC                             A:00 X:00 Y:00 P:27 SP:FB CYC:33"},
+    {{35, 0, 0xC737, 0xB0, {0x03, 0x00}, 0x00, 0x00, 0x00, 0xFB, 0x26},
+     "C737  B0 03     BCS $C73C                       A:00 X:00 Y:00 P:26 SP:FB CYC:35"},
+    {{37, 0, 0xC739, 0x4C, {0x42, 0xC7}, 0x00, 0x00, 0x00, 0xFB, 0x26},
+     "C739  4C 42 C7  JMP $C742                       A:00 X:00 Y:00 P:26 SP:FB CYC:37"},
+    {{5, 0, 0xC000, 0x4A, {0x00, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C000  4A        LSR A                           A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC001, 0xEB, {0x10, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C001  EB 10    *SBC #$10                        A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC003, 0xB1, {0x33, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C003  B1 33     LDA ($33),Y                     A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC005, 0xA1, {0x80, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C005  A1 80     LDA ($80,X)                     A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC007, 0x6C, {0x00, 0x02}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C007  6C 00 02  JMP ($0200)                     A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC00A, 0xB6, {0x10, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C00A  B6 10     LDX $10,Y                       A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC00C, 0xB9, {0x00, 0x03}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C00C  B9 00 03  LDA $0300,Y                     A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC00F, 0xA3, {0x40, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C00F  A3 40    *LAX ($40,X)                     A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC011, 0x04, {0xA9, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C011  04 A9    *NOP $A9                         A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 0, 0xC72F, 0xD0, {0xFE, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "C72F  D0 FE     BNE $C72F                       A:9C X:01 Y:7F P:E5 SP:F3 CYC:5"},
+    {{5, 1, 0xE000, 0x00, {0x12, 0x00}, 0x9C, 0x01, 0x7F, 0xF3, 0xE5},
+     "E000  00        BRK                             A:9C X:01 Y:7F P:E5 SP:F3 CYC:4294967301"},
+};
+
+// Writes a dump file claiming count records but holding only stored of them,
+// loads it and checks that exactly the stored ones come back
+static bool CONFORMANCE_trace_short(uint64_t count, size_t stored) {
+    uint8_t image[sizeof(TRACE_FILE_HEADER) + CONFORMANCE_TRACE_SHORT * sizeof(TRACE_RECORD)];
+    TRACE_FILE_HEADER header = {TRACE_MAGIC, TRACE_VERSION, sizeof(TRACE_RECORD), 0, count, count};
+    memcpy(image, &header, sizeof(header));
+    for (size_t i = 0; i < stored; i++) {
+        memcpy(image + sizeof(header) + i * sizeof(TRACE_RECORD), &CONFORMANCE_TRACE_LINES[i].record,
+               sizeof(TRACE_RECORD));
+    }
+
+    char path[] = "/tmp/nes_trace_XXXXXX";
+    if (!TEST_ROM_save(path, image, sizeof(header) + stored * sizeof(TRACE_RECORD))) {
+        PANIC("Could not write a test trace!");
+    }
+    TRACE trace;
+    bool loaded = TRACE_load_file(&trace, path);
+    unlink(path);
+    bool ok = loaded && TRACE_count(&trace) == stored;
+    for (size_t i = 0; ok && i < stored; i++) {
+        ok = memcmp(TRACE_get(&trace, i), &CONFORMANCE_TRACE_LINES[i].record, sizeof(TRACE_RECORD)) == 0;
+    }
+    if (loaded) TRACE_free(&trace);
+    if (!ok) fprintf(stderr, "trace: %zu records claiming to be %llu\n", stored, (unsigned long long)count);
+    return ok;
+}
+
+// Formatting against nestest.log, a dump round trip through a wrapped ring,
+// and dump files whose header claims more records than they hold
+static int CONFORMANCE_trace(void) {
+    const size_t line_count = sizeof(CONFORMANCE_TRACE_LINES) / sizeof(CONFORMANCE_TRACE_LINES[0]);
+    bool ok = true;
+    for (size_t i = 0; i < line_count; i++) {
+        char line[CONFORMANCE_LINE_SIZE];
+        TRACE_format(&CONFORMANCE_TRACE_LINES[i].record, line, sizeof(line));
+        if (strcmp(line, CONFORMANCE_TRACE_LINES[i].line) != 0) {
+            fprintf(stderr, "trace: got  '%s'\ntrace: want '%s'\n", line, CONFORMANCE_TRACE_LINES[i].line);
+            ok = false;
+        }
+    }
+
+    TRACE trace;
+    TRACE_init(&trace, CONFORMANCE_TRACE_SHORT);
+    for (size_t i = 0; i < line_count; i++) {
+        *TRACE_next(&trace) = CONFORMANCE_TRACE_LINES[i].record;
+    }
+    char path[] = "/tmp/nes_trace_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        PANIC("Could not create a test trace!");
+    }
+    close(fd);
+    TRACE loaded;
+    bool round_trip = TRACE_dump_file(&trace, path) && TRACE_load_file(&loaded, path);
+    unlink(path);
+    if (round_trip) {
+        round_trip = TRACE_count(&loaded) == TRACE_count(&trace);
+        for (size_t i = 0; round_trip && i < TRACE_count(&trace); i++) {
+            round_trip = memcmp(TRACE_get(&loaded, i), TRACE_get(&trace, i), sizeof(TRACE_RECORD)) == 0;
+        }
+        TRACE_free(&loaded);
+    }
+    if (!round_trip) fprintf(stderr, "trace: dump round trip differs\n");
+    ok = ok && round_trip;
+    TRACE_free(&trace);
+
+    ok = CONFORMANCE_trace_short(CONFORMANCE_TRACE_SHORT, CONFORMANCE_TRACE_SHORT - 3) && ok;
+    ok = CONFORMANCE_trace_short((uint64_t)1 << 40, CONFORMANCE_TRACE_SHORT) && ok;
+    ok = CONFORMANCE_trace_short(UINT64_MAX, 2) && ok;
+    ok = CONFORMANCE_trace_short(UINT64_MAX, 0) && ok;
+    printf("trace: %s\n", ok ? "passed" : "FAILED");
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Instructions the flag test runs, by how their operand is encoded
+typedef enum {
+    CONFORMANCE_FLAGS_IMP,
+    CONFORMANCE_FLAGS_IMM,
+    CONFORMANCE_FLAGS_ZP0, // always CONFORMANCE_FLAGS_ZP
+} CONFORMANCE_FLAGS_MODE;
+
+typedef struct {
+    uint8_t opcode;
+    CONFORMANCE_FLAGS_MODE mode;
+} CONFORMANCE_FLAGS_OP;
+
+static const CONFORMANCE_FLAGS_OP CONFORMANCE_FLAGS_OPS[] = {
+    {0x69, CONFORMANCE_FLAGS_IMM}, {0xE9, CONFORMANCE_FLAGS_IMM}, {0xEB, CONFORMANCE_FLAGS_IMM},
+    {0x29, CONFORMANCE_FLAGS_IMM}, {0x09, CONFORMANCE_FLAGS_IMM}, {0x49, CONFORMANCE_FLAGS_IMM},
+    {0xC9, CONFORMANCE_FLAGS_IMM}, {0xE0, CONFORMANCE_FLAGS_IMM}, {0xC0, CONFORMANCE_FLAGS_IMM},
+    {0xA9, CONFORMANCE_FLAGS_IMM}, {0xA2, CONFORMANCE_FLAGS_IMM}, {0xA0, CONFORMANCE_FLAGS_IMM},
+    {0x65, CONFORMANCE_FLAGS_ZP0}, {0xE5, CONFORMANCE_FLAGS_ZP0}, {0x24, CONFORMANCE_FLAGS_ZP0},
+    {0x06, CONFORMANCE_FLAGS_ZP0}, {0x46, CONFORMANCE_FLAGS_ZP0}, {0x26, CONFORMANCE_FLAGS_ZP0},
+    {0x66, CONFORMANCE_FLAGS_ZP0}, {0xE6, CONFORMANCE_FLAGS_ZP0}, {0xC6, CONFORMANCE_FLAGS_ZP0},
+    {0xA7, CONFORMANCE_FLAGS_ZP0}, {0xC7, CONFORMANCE_FLAGS_ZP0}, {0xE7, CONFORMANCE_FLAGS_ZP0},
+    {0x07, CONFORMANCE_FLAGS_ZP0}, {0x27, CONFORMANCE_FLAGS_ZP0}, {0x47, CONFORMANCE_FLAGS_ZP0},
+    {0x67, CONFORMANCE_FLAGS_ZP0}, {0x0A, CONFORMANCE_FLAGS_IMP}, {0x4A, CONFORMANCE_FLAGS_IMP},
+    {0x2A, CONFORMANCE_FLAGS_IMP}, {0x6A, CONFORMANCE_FLAGS_IMP}, {0xE8, CONFORMANCE_FLAGS_IMP},
+    {0xC8, CONFORMANCE_FLAGS_IMP}, {0xCA, CONFORMANCE_FLAGS_IMP}, {0x88, CONFORMANCE_FLAGS_IMP},
+    {0xAA, CONFORMANCE_FLAGS_IMP}, {0xA8, CONFORMANCE_FLAGS_IMP}, {0x8A, CONFORMANCE_FLAGS_IMP},
+    {0x98, CONFORMANCE_FLAGS_IMP}, {0xBA, CONFORMANCE_FLAGS_IMP}, {0x9A, CONFORMANCE_FLAGS_IMP},
+    {0x18, CONFORMANCE_FLAGS_IMP}, {0x38, CONFORMANCE_FLAGS_IMP}, {0xB8, CONFORMANCE_FLAGS_IMP},
+    {0xD8, CONFORMANCE_FLAGS_IMP}, {0xF8, CONFORMANCE_FLAGS_IMP}, {0x68, CONFORMANCE_FLAGS_IMP},
+    {0x28, CONFORMANCE_FLAGS_IMP},
+};
+
+// BPL, BMI, BVC, BVS, BCC, BCS, BNE and BEQ with the flag each one tests
+static const struct {
+    uint8_t opcode;
+    uint8_t flag;
+    bool when_set;
+} CONFORMANCE_FLAGS_BRANCHES[] = {
+    {0x10, CPU_FLAGS_N, false}, {0x30, CPU_FLAGS_N, true}, {0x50, CPU_FLAGS_V, false}, {0x70, CPU_FLAGS_V, true},
+    {0x90, CPU_FLAGS_C, false}, {0xB0, CPU_FLAGS_C, true}, {0xD0, CPU_FLAGS_Z, false}, {0xF0, CPU_FLAGS_Z, true},
+};
+
+// A 6502 that keeps P as one byte and sets every flag as it goes, written
+// from the data sheet rather than from CPU.c
+typedef struct {
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t p;
+    bool decimal_mode;
+    uint8_t mem[CONFORMANCE_FLAGS_MEM]; // zero page and stack
+} CONFORMANCE_FLAGS_REF;
+
+static void CONFORMANCE_flags_set(CONFORMANCE_FLAGS_REF *ref, uint8_t flag, bool set) {
+    ref->p = set ? (ref->p | flag) : (ref->p & ~flag);
+}
+
+static uint8_t CONFORMANCE_flags_nz(CONFORMANCE_FLAGS_REF *ref, uint8_t value) {
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_N, value & 0x80);
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_Z, value == 0);
+    return value;
+}
+
+static bool CONFORMANCE_flags_decimal(const CONFORMANCE_FLAGS_REF *ref) {
+    return ref->decimal_mode && (ref->p & CPU_FLAGS_D);
+}
+
+// Decimal mode follows sequences 1 to 3 of the 6502.org decimal mode
+// tutorial, Z always comes from the binary sum
+static void CONFORMANCE_flags_adc(CONFORMANCE_FLAGS_REF *ref, uint8_t m) {
+    int carry = ref->p & CPU_FLAGS_C;
+    int sum = ref->a + m + carry;
+    if (!CONFORMANCE_flags_decimal(ref)) {
+        CONFORMANCE_flags_set(ref, CPU_FLAGS_V, (~(ref->a ^ m) & (ref->a ^ sum)) & 0x80);
+        CONFORMANCE_flags_set(ref, CPU_FLAGS_C, sum > 0xFF);
+        ref->a = CONFORMANCE_flags_nz(ref, (uint8_t)sum);
+        return;
+    }
+
+    int low = (ref->a & 0x0F) + (m & 0x0F) + carry;
+    if (low >= 0x0A) low = ((low + 0x06) & 0x0F) + 0x10;
+    int high = (ref->a & 0xF0) + (m & 0xF0) + low;
+    int signed_high = (int8_t)(ref->a & 0xF0) + (int8_t)(m & 0xF0) + low;
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_Z, (uint8_t)sum == 0);
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_N, signed_high & 0x80);
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_V, signed_high < -128 || signed_high > 127);
+    if (high >= 0xA0) high += 0x60;
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_C, high >= 0x100);
+    ref->a = (uint8_t)high;
+}
+
+static void CONFORMANCE_flags_sbc(CONFORMANCE_FLAGS_REF *ref, uint8_t m) {
+    int carry = ref->p & CPU_FLAGS_C;
+    int diff = ref->a - m - (1 - carry);
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_V, ((ref->a ^ m) & (ref->a ^ diff)) & 0x80);
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_C, diff >= 0);
+    CONFORMANCE_flags_nz(ref, (uint8_t)diff);
+    if (!CONFORMANCE_flags_decimal(ref)) {
+        ref->a = (uint8_t)diff;
+        return;
+    }
+
+    int low = (ref->a & 0x0F) - (m & 0x0F) + carry - 1;
+    if (low < 0) low = ((low - 0x06) & 0x0F) - 0x10;
+    int high = (ref->a & 0xF0) - (m & 0xF0) + low;
+    if (high < 0) high -= 0x60;
+    ref->a = (uint8_t)high;
+}
+
+static void CONFORMANCE_flags_compare(CONFORMANCE_FLAGS_REF *ref, uint8_t reg, uint8_t m) {
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_C, reg >= m);
+    CONFORMANCE_flags_nz(ref, (uint8_t)(reg - m));
+}
+
+static uint8_t CONFORMANCE_flags_shift(CONFORMANCE_FLAGS_REF *ref, uint8_t value, bool left, bool rotate) {
+    uint8_t carry_in = (rotate && (ref->p & CPU_FLAGS_C)) ? (left ? 0x01 : 0x80) : 0x00;
+    CONFORMANCE_flags_set(ref, CPU_FLAGS_C, left ? value & 0x80 : value & 0x01);
+    value = left ? (uint8_t)(value << 1) : (uint8_t)(value >> 1);
+    return CONFORMANCE_flags_nz(ref, value | carry_in);
+}
+
+static uint8_t CONFORMANCE_flags_pull(CONFORMANCE_FLAGS_REF *ref) {
+    ref->sp++;
+    return ref->mem[0x0100 + ref->sp];
+}
+
+static void CONFORMANCE_flags_ref_step(CONFORMANCE_FLAGS_REF *ref, uint8_t opcode, uint8_t operand) {
+    uint8_t *zp = &ref->mem[CONFORMANCE_FLAGS_ZP];
+    switch (opcode) {
+    case 0x69: CONFORMANCE_flags_adc(ref, operand); break;
+    case 0x65: CONFORMANCE_flags_adc(ref, *zp); break;
+    case 0xE9:
+    case 0xEB: CONFORMANCE_flags_sbc(ref, operand); break;
+    case 0xE5: CONFORMANCE_flags_sbc(ref, *zp); break;
+    case 0x29: ref->a = CONFORMANCE_flags_nz(ref, ref->a & operand); break;
+    case 0x09: ref->a = CONFORMANCE_flags_nz(ref, ref->a | operand); break;
+    case 0x49: ref->a = CONFORMANCE_flags_nz(ref, ref->a ^ operand); break;
+    case 0xC9: CONFORMANCE_flags_compare(ref, ref->a, operand); break;
+    case 0xE0: CONFORMANCE_flags_compare(ref, ref->x, operand); break;
+    case 0xC0: CONFORMANCE_flags_compare(ref, ref->y, operand); break;
+    case 0xA9: ref->a = CONFORMANCE_flags_nz(ref, operand); break;
+    case 0xA2: ref->x = CONFORMANCE_flags_nz(ref, operand); break;
+    case 0xA0: ref->y = CONFORMANCE_flags_nz(ref, operand); break;
+    case 0x24:
+        CONFORMANCE_flags_set(ref, CPU_FLAGS_Z, (ref->a & *zp) == 0);
+        CONFORMANCE_flags_set(ref, CPU_FLAGS_N, *zp & 0x80);
+        CONFORMANCE_flags_set(ref, CPU_FLAGS_V, *zp & 0x40);
+        break;
+    case 0x06: *zp = CONFORMANCE_flags_shift(ref, *zp, true, false); break;
+    case 0x46: *zp = CONFORMANCE_flags_shift(ref, *zp, false, false); break;
+    case 0x26: *zp = CONFORMANCE_flags_shift(ref, *zp, true, true); break;
+    case 0x66: *zp = CONFORMANCE_flags_shift(ref, *zp, false, true); break;
+    case 0xE6: *zp = CONFORMANCE_flags_nz(ref, *zp + 1); break;
+    case 0xC6: *zp = CONFORMANCE_flags_nz(ref, *zp - 1); break;
+    case 0xA7: ref->a = ref->x = CONFORMANCE_flags_nz(ref, *zp); break;
+    case 0xC7:
+        (*zp)--;
+        CONFORMANCE_flags_compare(ref, ref->a, *zp);
+        break;
+    case 0xE7:
+        (*zp)++;
+        CONFORMANCE_flags_sbc(ref, *zp);
+        break;
+    case 0x07:
+        *zp = CONFORMANCE_flags_shift(ref, *zp, true, false);
+        ref->a = CONFORMANCE_flags_nz(ref, ref->a | *zp);
+        break;
+    case 0x27:
+        *zp = CONFORMANCE_flags_shift(ref, *zp, true, true);
+        ref->a = CONFORMANCE_flags_nz(ref, ref->a & *zp);
+        break;
+    case 0x47:
+        *zp = CONFORMANCE_flags_shift(ref, *zp, false, false);
+        ref->a = CONFORMANCE_flags_nz(ref, ref->a ^ *zp);
+        break;
+    case 0x67:
+        *zp = CONFORMANCE_flags_shift(ref, *zp, false, true);
+        CONFORMANCE_flags_adc(ref, *zp);
+        break;
+    case 0x0A: ref->a = CONFORMANCE_flags_shift(ref, ref->a, true, false); break;
+    case 0x4A: ref->a = CONFORMANCE_flags_shift(ref, ref->a, false, false); break;
+    case 0x2A: ref->a = CONFORMANCE_flags_shift(ref, ref->a, true, true); break;
+    case 0x6A: ref->a = CONFORMANCE_flags_shift(ref, ref->a, false, true); break;
+    case 0xE8: ref->x = CONFORMANCE_flags_nz(ref, ref->x + 1); break;
+    case 0xC8: ref->y = CONFORMANCE_flags_nz(ref, ref->y + 1); break;
+    case 0xCA: ref->x = CONFORMANCE_flags_nz(ref, ref->x - 1); break;
+    case 0x88: ref->y = CONFORMANCE_flags_nz(ref, ref->y - 1); break;
+    case 0xAA: ref->x = CONFORMANCE_flags_nz(ref, ref->a); break;
+    case 0xA8: ref->y = CONFORMANCE_flags_nz(ref, ref->a); break;
+    case 0x8A: ref->a = CONFORMANCE_flags_nz(ref, ref->x); break;
+    case 0x98: ref->a = CONFORMANCE_flags_nz(ref, ref->y); break;
+    case 0xBA: ref->x = CONFORMANCE_flags_nz(ref, ref->sp); break;
+    case 0x9A: ref->sp = ref->x; break;
+    case 0x18: CONFORMANCE_flags_set(ref, CPU_FLAGS_C, false); break;
+    case 0x38: CONFORMANCE_flags_set(ref, CPU_FLAGS_C, true); break;
+    case 0xB8: CONFORMANCE_flags_set(ref, CPU_FLAGS_V, false); break;
+    case 0xD8: CONFORMANCE_flags_set(ref, CPU_FLAGS_D, false); break;
+    case 0xF8: CONFORMANCE_flags_set(ref, CPU_FLAGS_D, true); break;
+    case 0x68: ref->a = CONFORMANCE_flags_nz(ref, CONFORMANCE_flags_pull(ref)); break;
+    case 0x28: ref->p = (CONFORMANCE_flags_pull(ref) & ~CPU_FLAGS_B) | CPU_FLAGS_U; break;
+    default: PANIC_FMT("No flag reference for opcode $%02X!", opcode);
+    }
+}
+
+static bool CONFORMANCE_flags_match(const CPU *cpu, const CONFORMANCE_FLAGS_REF *ref, const char *what) {
+    uint8_t status = CPU_get_status(cpu);
+    const REG *reg = &cpu->reg;
+    const uint8_t *ram = cpu->bus->ram;
+    if (reg->A == ref->a && reg->X == ref->x && reg->Y == ref->y && reg->SP == ref->sp && status == ref->p &&
+        memcmp(ram, ref->mem, CONFORMANCE_FLAGS_MEM) == 0) {
+        return true;
+    }
+    fprintf(stderr, "flags: %s A:%02X X:%02X Y:%02X SP:%02X P:%02X, expected A:%02X X:%02X Y:%02X SP:%02X P:%02X\n",
+            what, reg->A, reg->X, reg->Y, reg->SP, status, ref->a, ref->x, ref->y, ref->sp, ref->p);
+    return false;
+}
+
+// Runs the instructions from CONFORMANCE_FLAGS_CODE on both CPUs, then checks
+// every branch and what PHP pushes against the flags the reference ended with
+static bool CONFORMANCE_flags_case(CPU *cpu, CONFORMANCE_FLAGS_REF *ref, const CONFORMANCE_FLAGS_OP *ops,
+                                   const uint8_t *operands, size_t count) {
+    uint8_t *ram = cpu->bus->ram;
+    memcpy(ram, ref->mem, CONFORMANCE_FLAGS_MEM);
+    cpu->reg.A = ref->a;
+    cpu->reg.X = ref->x;
+    cpu->reg.Y = ref->y;
+    cpu->reg.SP = ref->sp;
+    cpu->reg.PC = CONFORMANCE_FLAGS_CODE;
+    cpu->decimal_mode = ref->decimal_mode;
+    CPU_set_status(cpu, ref->p);
+
+    uint16_t addr = CONFORMANCE_FLAGS_CODE;
+    for (size_t i = 0; i < count; i++) {
+        ram[addr++] = ops[i].opcode;
+        if (ops[i].mode == CONFORMANCE_FLAGS_IMM) ram[addr++] = operands[i];
+        if (ops[i].mode == CONFORMANCE_FLAGS_ZP0) ram[addr++] = CONFORMANCE_FLAGS_ZP;
+    }
+    ram[addr] = 0x08; // PHP
+
+    char what[64];
+    for (size_t i = 0; i < count; i++) {
+        CPU_step(cpu);
+        CONFORMANCE_flags_ref_step(ref, ops[i].opcode, operands[i]);
+        snprintf(what, sizeof(what), "after $%02X (%s)", ops[i].opcode, OP_CODE_MATRIX[ops[i].opcode].name);
+        if (!CONFORMANCE_flags_match(cpu, ref, what)) return false;
+    }
+
+    for (size_t i = 0; i < sizeof(CONFORMANCE_FLAGS_BRANCHES) / sizeof(CONFORMANCE_FLAGS_BRANCHES[0]); i++) {
+        CPU branch = *cpu;
+        branch.reg.PC = CONFORMANCE_FLAGS_BRANCH + 2 * i;
+        CPU_step(&branch);
+        bool taken = branch.reg.PC == CONFORMANCE_FLAGS_BRANCH + 2 * i + 2 + CONFORMANCE_FLAGS_BRANCH_OFFSET;
+        bool want = ((ref->p & CONFORMANCE_FLAGS_BRANCHES[i].flag) != 0) == CONFORMANCE_FLAGS_BRANCHES[i].when_set;
+        if (taken != want) {
+            fprintf(stderr, "flags: %s %s with P:%02X\n", OP_CODE_MATRIX[CONFORMANCE_FLAGS_BRANCHES[i].opcode].name,
+                    taken ? "taken" : "not taken", ref->p);
+            return false;
+        }
+    }
+
+    CPU_step(cpu);
+    uint8_t pushed = ram[0x0100 + (uint8_t)(ref->sp)];
+    if (pushed != (ref->p | CPU_FLAGS_B | CPU_FLAGS_U)) {
+        fprintf(stderr, "flags: PHP pushed %02X with P:%02X\n", pushed, ref->p);
+        return false;
+    }
+    return true;
+}
+
+static void CONFORMANCE_flags_random(CONFORMANCE_FLAGS_REF *ref) {
+    ref->a = (uint8_t)rand();
+    ref->x = (uint8_t)rand();
+    ref->y = (uint8_t)rand();
+    ref->sp = (uint8_t)rand();
+    ref->p = (uint8_t)((rand() & ~CPU_FLAGS_B) | CPU_FLAGS_U);
+    ref->decimal_mode = rand() & 1;
+    // What PLA and PLP pull, before and after a TXS
+    ref->mem[CONFORMANCE_FLAGS_ZP] = (uint8_t)rand();
+    ref->mem[0x0100 + (uint8_t)(ref->sp + 1)] = (uint8_t)rand();
+    ref->mem[0x0100 + (uint8_t)(ref->sp + 2)] = (uint8_t)rand();
+    ref->mem[0x0100 + (uint8_t)(ref->x + 1)] = (uint8_t)rand();
+    ref->mem[0x0100 + (uint8_t)(ref->x + 2)] = (uint8_t)rand();
+}
+
+// Compares the lazily evaluated N, Z, C and V against an eager reference:
+// random pairs where the first instruction leaves flags for the second to
+// combine or read, then ADC and SBC over every A, operand and carry, in
+// binary and in decimal mode
+static int CONFORMANCE_flags(unsigned seed) {
+    srand(seed);
+    BUS *bus = malloc(sizeof(BUS));
+    CPU *cpu = malloc(sizeof(CPU));
+    CONFORMANCE_FLAGS_REF *ref = malloc(sizeof(CONFORMANCE_FLAGS_REF));
+    if (!bus || !cpu || !ref) {
+        PANIC("Out of memory allocating the flag test CPU!");
+    }
+    for (size_t i = 0; i < CONFORMANCE_FLAGS_MEM; i++) {
+        ref->mem[i] = (uint8_t)rand();
+    }
+    BUS_init(bus);
+    CPU_init(cpu, bus);
+    for (size_t i = 0; i < sizeof(CONFORMANCE_FLAGS_BRANCHES) / sizeof(CONFORMANCE_FLAGS_BRANCHES[0]); i++) {
+        bus->ram[CONFORMANCE_FLAGS_BRANCH + 2 * i] = CONFORMANCE_FLAGS_BRANCHES[i].opcode;
+        bus->ram[CONFORMANCE_FLAGS_BRANCH + 2 * i + 1] = CONFORMANCE_FLAGS_BRANCH_OFFSET;
+    }
+
+    const size_t op_count = sizeof(CONFORMANCE_FLAGS_OPS) / sizeof(CONFORMANCE_FLAGS_OPS[0]);
+    bool ok = true;
+    for (size_t round = 0; ok && round < CONFORMANCE_FLAGS_ROUNDS; round++) {
+        CONFORMANCE_flags_random(ref);
+        CONFORMANCE_FLAGS_OP ops[2] = {CONFORMANCE_FLAGS_OPS[rand() % op_count],
+                                       CONFORMANCE_FLAGS_OPS[rand() % op_count]};
+        uint8_t operands[2] = {(uint8_t)rand(), (uint8_t)rand()};
+        ok = CONFORMANCE_flags_case(cpu, ref, ops, operands, 2);
+    }
+
+    static const CONFORMANCE_FLAGS_OP arithmetic[] = {{0x69, CONFORMANCE_FLAGS_IMM}, {0xE9, CONFORMANCE_FLAGS_IMM}};
+    for (size_t op = 0; ok && op < 2; op++) {
+        for (unsigned input = 0; ok && input < 4 * 0x10000; input++) {
+            CONFORMANCE_flags_random(ref);
+            uint8_t operand = (uint8_t)input;
+            ref->a = (uint8_t)(input >> 8);
+            ref->decimal_mode = input >> 17;
+            ref->p = (ref->p & ~CPU_FLAGS_C) | ((input >> 16) & CPU_FLAGS_C);
+            if (ref->decimal_mode) ref->p |= CPU_FLAGS_D;
+            ok = CONFORMANCE_flags_case(cpu, ref, &arithmetic[op], &operand, 1);
+        }
+    }
+    printf("flags: %s\n", ok ? "passed" : "FAILED");
+
+    free(ref);
+    free(cpu);
+    free(bus);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static bool CONFORMANCE_video_kernels(VIDEO_ConvertFunc convert, VIDEO_FORMAT format, uint8_t *src, uint8_t *want,
+                                      uint8_t *got) {
+    VIDEO_PALETTE palette;
+    VIDEO_init_palette(&palette, format);
+    size_t sizes[] = {0, 1, 15, 16, 17, 18, 31, 32, 33, 34, 35, 47, 63, 64, 65, 66, 97, 255, 256, VIDEO_FRAME_PIXELS};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t pixels = sizes[s];
+        size_t bytes = pixels * (format == VIDEO_FORMAT_RGBA32 ? 4 : 3);
+        // Indices above 63 have to be masked like the PPU's are
+        for (size_t i = 0; i < pixels; i++) {
+            src[i] = (uint8_t)rand();
+        }
+        memset(want, 0xA5, bytes + CONFORMANCE_VIDEO_GUARD);
+        memset(got, 0xA5, bytes + CONFORMANCE_VIDEO_GUARD);
+        VIDEO_convert_scalar(&palette, format, src, want, pixels);
+        convert(&palette, format, src, got, pixels);
+        if (memcmp(want, got, bytes + CONFORMANCE_VIDEO_GUARD) != 0) {
+            fprintf(stderr, "video: format %d differs from scalar for %zu pixels\n", (int)format, pixels);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Submits frames to a file sink and checks what ends up in it. The first frames
+// wait for the worker, the rest go in back to back and may be dropped, but only
+// if they are counted as such.
+static bool CONFORMANCE_video_file(VIDEO_FORMAT format, uint8_t *frames, uint8_t *want, uint8_t *got) {
+    char path[] = "/tmp/nes_video_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "video: could not create a temporary file\n");
+        return false;
+    }
+    close(fd);
+
+    VIDEO video;
+    bool ok = VIDEO_open(&video, path, format, VIDEO_DEFAULT_BUFFERS, NULL);
+    size_t frame_size = VIDEO_frame_size(format, PPU_WIDTH);
+    bool taken[CONFORMANCE_VIDEO_FRAMES] = {false};
+    uint64_t written = 0, dropped = 0;
+    if (ok) {
+        for (size_t f = 0; f < CONFORMANCE_VIDEO_FRAMES; f++) {
+            taken[f] = VIDEO_submit(&video, frames + f * VIDEO_FRAME_PIXELS);
+            if (f < CONFORMANCE_VIDEO_FRAMES / 2) VIDEO_flush(&video);
+        }
+        VIDEO_flush(&video);
+        written = video.frames;
+        dropped = video.dropped;
+        VIDEO_close(&video);
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (ok && (!file || written + dropped != CONFORMANCE_VIDEO_FRAMES || written < CONFORMANCE_VIDEO_FRAMES / 2)) {
+        fprintf(stderr, "video: %llu frames written and %llu dropped of %d\n", (unsigned long long)written,
+                (unsigned long long)dropped, CONFORMANCE_VIDEO_FRAMES);
+        ok = false;
+    }
+
+    char line[CONFORMANCE_LINE_SIZE];
+    if (ok && format == VIDEO_FORMAT_Y4M &&
+        (!fgets(line, sizeof(line), file) || strncmp(line, "YUV4MPEG2 W256 H240 ", 20) != 0)) {
+        fprintf(stderr, "video: bad Y4M header\n");
+        ok = false;
+    }
+    VIDEO_PALETTE palette;
+    VIDEO_init_palette(&palette, format);
+    for (size_t f = 0; ok && f < CONFORMANCE_VIDEO_FRAMES; f++) {
+        if (!taken[f]) continue;
+        if (format == VIDEO_FORMAT_Y4M && (!fgets(line, sizeof(line), file) || strcmp(line, "FRAME\n") != 0)) {
+            fprintf(stderr, "video: missing Y4M frame header before frame %zu\n", f);
+            ok = false;
+            break;
+        }
+        VIDEO_convert_scalar(&palette, format, frames + f * VIDEO_FRAME_PIXELS, want, VIDEO_FRAME_PIXELS);
+        if (fread(got, 1, frame_size, file) != frame_size || memcmp(want, got, frame_size) != 0) {
+            fprintf(stderr, "video: frame %zu of format %d was not written as converted\n", f, (int)format);
+            ok = false;
+        }
+    }
+    if (ok && fgetc(file) != EOF) {
+        fprintf(stderr, "video: trailing bytes after the last frame\n");
+        ok = false;
+    }
+
+    if (file) fclose(file);
+    remove(path);
+    return ok;
+}
+
+static bool CONFORMANCE_video_shm(uint8_t *frames, uint8_t *want) {
+    char name[64];
+    snprintf(name, sizeof(name), "/nes_video_%ld", (long)getpid());
+    char target[80];
+    snprintf(target, sizeof(target), "%s%s", VIDEO_SHM_PREFIX, name);
+
+    VIDEO video;
+    if (!VIDEO_open(&video, target, VIDEO_FORMAT_RGBA32, VIDEO_DEFAULT_BUFFERS, NULL)) return false;
+    for (size_t f = 0; f < CONFORMANCE_VIDEO_FRAMES; f++) {
+        VIDEO_submit(&video, frames + f * VIDEO_FRAME_PIXELS);
+        VIDEO_flush(&video);
+    }
+
+    const VIDEO_SHM_HEADER *header = video.shm;
+    size_t last = CONFORMANCE_VIDEO_FRAMES - 1;
+    const uint8_t *slot = (const uint8_t *)(header + 1) + (last % header->slots) * header->frame_size;
+    VIDEO_PALETTE palette;
+    VIDEO_init_palette(&palette, VIDEO_FORMAT_RGBA32);
+    VIDEO_convert_scalar(&palette, VIDEO_FORMAT_RGBA32, frames + last * VIDEO_FRAME_PIXELS, want, VIDEO_FRAME_PIXELS);
+
+    bool ok = header->magic == VIDEO_SHM_MAGIC && header->frames == CONFORMANCE_VIDEO_FRAMES &&
+              header->frame_size == VIDEO_frame_size(VIDEO_FORMAT_RGBA32, PPU_WIDTH) &&
+              memcmp(slot, want, header->frame_size) == 0;
+    if (!ok) {
+        fprintf(stderr, "video: shared memory sink does not hold the last frame\n");
+    }
+    VIDEO_close(&video);
+    shm_unlink(name);
+    return ok;
+}
+
+// Checks the vector palette conversion against the scalar one for every format
+// and buffer tail, then frames through the file and shared memory sinks
+static int CONFORMANCE_video(unsigned seed) {
+    srand(seed);
+    uint8_t *frames = malloc(CONFORMANCE_VIDEO_FRAMES * VIDEO_FRAME_PIXELS);
+    uint8_t *want = malloc(VIDEO_frame_size(VIDEO_FORMAT_RGBA32, PPU_WIDTH) + CONFORMANCE_VIDEO_GUARD);
+    uint8_t *got = malloc(VIDEO_frame_size(VIDEO_FORMAT_RGBA32, PPU_WIDTH) + CONFORMANCE_VIDEO_GUARD);
+    if (!frames || !want || !got) {
+        PANIC("Out of memory allocating video frames!");
+    }
+
+    VIDEO_ConvertFunc convert = VIDEO_select_convert();
+    bool ok = true;
+    for (int format = 0; ok && format < VIDEO_FORMAT_COUNT; format++) {
+        ok = CONFORMANCE_video_kernels(convert, (VIDEO_FORMAT)format, frames, want, got);
+    }
+    for (size_t i = 0; i < CONFORMANCE_VIDEO_FRAMES * VIDEO_FRAME_PIXELS; i++) {
+        frames[i] = (uint8_t)(rand() & 0x3F);
+    }
+    for (int format = 0; ok && format < VIDEO_FORMAT_COUNT; format++) {
+        ok = CONFORMANCE_video_file((VIDEO_FORMAT)format, frames, want, got);
+    }
+    ok = ok && CONFORMANCE_video_shm(frames, want);
+    printf("video: %s (%s kernels)\n", ok ? "passed" : "FAILED",
+           convert == VIDEO_convert_scalar ? "scalar" : "vector");
+
+    free(got);
+    free(want);
+    free(frames);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void CONFORMANCE_ntsc_pad(uint8_t *in, const uint8_t *row) {
+    memset(in, NTSC_PAD_COLOR, NTSC_ROW_IN);
+    for (size_t x = 0; x < PPU_WIDTH; x++) {
+        in[NTSC_CHUNK_IN + x] = row[x] & 0x3F;
+    }
+}
+
+static void CONFORMANCE_ntsc_store(void *ctx, size_t y, const uint8_t *rgba) {
+    VIDEO_pack_row_scalar(VIDEO_FORMAT_RGBA32, rgba, ctx, y, NTSC_OUT_WIDTH);
+}
+
+// Vector rows against scalar ones for every preset and burst phase
+static bool CONFORMANCE_ntsc_rows(NTSC *ntsc, const char *preset, uint8_t *row) {
+    uint8_t in[NTSC_ROW_IN];
+    uint8_t want[NTSC_ROW_OUT * 4], got[NTSC_ROW_OUT * 4];
+    for (size_t r = 0; r < CONFORMANCE_NTSC_ROWS; r++) {
+        // Random pixels, runs of one colour and single pixel stripes
+        for (size_t x = 0; x < PPU_WIDTH; x++) {
+            row[x] = r % 3 == 0 ? (uint8_t)rand() : r % 3 == 1 ? (uint8_t)(r + x / 16) : (x & 1) ? 0x30 : 0x0F;
+        }
+        CONFORMANCE_ntsc_pad(in, row);
+        const NTSC_SEGMENT *kernels = ntsc->kernels[r % NTSC_PHASES];
+        NTSC_row_scalar(kernels, in, want);
+        ntsc->row(kernels, in, got);
+        if (memcmp(want, got, NTSC_OUT_WIDTH * 4) != 0) {
+            fprintf(stderr, "ntsc: %s row %zu differs from scalar\n", preset, r);
+            return false;
+        }
+        for (size_t x = 0; x < NTSC_OUT_WIDTH; x++) {
+            if (want[x * 4 + 3] != 255) {
+                fprintf(stderr, "ntsc: %s row %zu pixel %zu is not opaque\n", preset, r, x);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Without crosstalk a flat colour stays flat away from the edges, without
+// saturation everything is grey
+static bool CONFORMANCE_ntsc_flat(NTSC *ntsc, const char *preset, uint8_t *row) {
+    bool monochrome = strcmp(preset, "monochrome") == 0;
+    uint8_t in[NTSC_ROW_IN], out[NTSC_ROW_OUT * 4];
+    for (int color = 0; color < 64; color++) {
+        memset(row, color, PPU_WIDTH);
+        CONFORMANCE_ntsc_pad(in, row);
+        for (int phase = 0; phase < NTSC_PHASES; phase++) {
+            NTSC_row_scalar(ntsc->kernels[phase], in, out);
+            for (size_t x = NTSC_CHUNK_OUT * 2; x < NTSC_OUT_WIDTH - NTSC_CHUNK_OUT * 2; x++) {
+                for (int c = 0; c < 3; c++) {
+                    int value = out[x * 4 + c];
+                    int expected = monochrome ? out[x * 4] : out[NTSC_CHUNK_OUT * 2 * 4 + c];
+                    if (abs(value - expected) > 1) {
+                        fprintf(stderr, "ntsc: %s colour %02X is not flat at pixel %zu\n", preset, color, x);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Selected row packing against scalar at widths with and without a vector
+// tail, on the last row so a stray store shows up in the guard bytes
+static bool CONFORMANCE_ntsc_pack(uint8_t *want, uint8_t *got, size_t size) {
+    static const size_t widths[] = {NTSC_OUT_WIDTH, 256, 77, 1};
+    uint8_t rgba[NTSC_OUT_WIDTH * 4];
+    VIDEO_PackFunc pack = VIDEO_select_pack();
+    for (size_t i = 0; i < sizeof(rgba); i++) {
+        rgba[i] = (uint8_t)rand();
+    }
+    for (int format = 0; format < VIDEO_FORMAT_COUNT; format++) {
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+            memset(want, 0xA5, size);
+            memset(got, 0xA5, size);
+            VIDEO_pack_row_scalar((VIDEO_FORMAT)format, rgba, want, PPU_HEIGHT - 1, widths[w]);
+            pack((VIDEO_FORMAT)format, rgba, got, PPU_HEIGHT - 1, widths[w]);
+            if (memcmp(want, got, size) != 0) {
+                fprintf(stderr, "ntsc: packing %zu pixels as format %d differs from scalar\n", widths[w], format);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Filters through each vector and band layout, the picture has to come out the
+// same, also as a filtered video stream
+static int CONFORMANCE_ntsc(unsigned seed) {
+    srand(seed);
+    NTSC *ntsc = malloc(sizeof(NTSC));
+    uint8_t *frame = malloc(VIDEO_FRAME_PIXELS);
+    size_t frame_size = VIDEO_frame_size(VIDEO_FORMAT_RGBA32, NTSC_OUT_WIDTH);
+    uint8_t *want = malloc(frame_size);
+    uint8_t *got = malloc(frame_size);
+    if (!ntsc || !frame || !want || !got) {
+        PANIC("Out of memory allocating NTSC frames!");
+    }
+
+    static const char *const presets[] = {"composite", "svideo", "monochrome"};
+    bool ok = true;
+    for (size_t p = 0; ok && p < sizeof(presets) / sizeof(presets[0]); p++) {
+        NTSC_SETUP setup;
+        NTSC_parse_setup(presets[p], &setup);
+        NTSC_init(ntsc, &setup);
+        ok = CONFORMANCE_ntsc_rows(ntsc, presets[p], frame);
+        if (ok && setup.artifacts <= -1.0 && setup.fringing <= -1.0) {
+            ok = CONFORMANCE_ntsc_flat(ntsc, presets[p], frame);
+        }
+    }
+    ok = ok && CONFORMANCE_ntsc_pack(want, got, frame_size);
+
+    NTSC_init(ntsc, &NTSC_COMPOSITE);
+    for (size_t i = 0; i < VIDEO_FRAME_PIXELS; i++) {
+        frame[i] = (uint8_t)rand();
+    }
+    // The same helpers filter one frame per burst phase, the last one is 0
+    ntsc->threads = CONFORMANCE_NTSC_BANDS;
+    NTSC_BANDS bands;
+    NTSC_BANDS_start(&bands, ntsc);
+    for (int burst = NTSC_PHASES - 1; burst >= 0; burst--) {
+        NTSC_filter(ntsc, frame, (unsigned)burst, CONFORMANCE_ntsc_store, want);
+        NTSC_BANDS_filter(&bands, frame, (unsigned)burst, CONFORMANCE_ntsc_store, got);
+        if (ok && memcmp(want, got, frame_size) != 0) {
+            fprintf(stderr, "ntsc: filtering in %zu bands changed the picture\n", bands.count);
+            ok = false;
+        }
+    }
+    NTSC_BANDS_stop(&bands);
+
+    // First frame of a stream has burst phase 0, like want
+    char path[] = "/tmp/nes_ntsc_XXXXXX";
+    int fd = mkstemp(path);
+    VIDEO video;
+    if (ok && (fd < 0 || !VIDEO_open(&video, path, VIDEO_FORMAT_RGBA32, VIDEO_DEFAULT_BUFFERS, ntsc))) {
+        ok = false;
+    } else if (ok) {
+        VIDEO_submit(&video, frame);
+        VIDEO_close(&video);
+        FILE *file = fopen(path, "rb");
+        if (!file || fread(got, 1, frame_size, file) != frame_size || fgetc(file) != EOF ||
+            memcmp(want, got, frame_size) != 0) {
+            fprintf(stderr, "ntsc: filtered video frame was not written as filtered\n");
+            ok = false;
+        }
+        if (file) fclose(file);
+    }
+    if (fd >= 0) {
+        close(fd);
+        remove(path);
+    }
+    printf("ntsc: %s (%s rows)\n", ok ? "passed" : "FAILED", ntsc->row == NTSC_row_scalar ? "scalar" : "vector");
+
+    free(got);
+    free(want);
+    free(frame);
+    free(ntsc);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void CONFORMANCE_usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s nestest|nestest_jit <nestest.nes> <nestest.log>\n"
+            "       %s klaus|klaus_jit <6502_functional_test.bin> [success_addr_hex]\n"
+            "       %s jit [seed] [programs]\n"
+            "       %s ppu_thread [rom.nes|-] [frames]\n"
+            "       %s idle_skip [frames]\n"
+            "       %s rewind [seed]\n"
+            "       %s savestate\n"
+            "       %s sprite_eval [seed]\n"
+            "       %s movie [seed]\n"
+            "       %s flags [seed]\n"
+            "       %s cart\n"
+            "       %s manifest\n"
+            "       %s trace\n"
+            "       %s video [seed]\n"
+            "       %s ntsc [seed]\n",
+            name, name, name, name, name, name, name, name, name, name, name, name, name,
+            name, name);
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 4 && (strcmp(argv[1], "nestest") == 0 || strcmp(argv[1], "nestest_jit") == 0)) {
+        return CONFORMANCE_nestest(argv[2], argv[3], strcmp(argv[1], "nestest_jit") == 0);
+    }
+    if (argc >= 3 && (strcmp(argv[1], "klaus") == 0 || strcmp(argv[1], "klaus_jit") == 0)) {
+        uint16_t success_addr = CONFORMANCE_KLAUS_SUCCESS;
+        if (argc >= 4) success_addr = (uint16_t)strtoul(argv[3], NULL, 16);
+        return CONFORMANCE_klaus(argv[2], success_addr, strcmp(argv[1], "klaus_jit") == 0);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "jit") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        size_t programs = (argc >= 4) ? strtoul(argv[3], NULL, 10) : 8;
+        return CONFORMANCE_jit(seed, programs);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "ppu_thread") == 0) {
+        const char *rom_path = (argc >= 3 && strcmp(argv[2], "-") != 0) ? argv[2] : NULL;
+        size_t frames = (argc >= 4) ? strtoul(argv[3], NULL, 10) : CONFORMANCE_PPU_THREAD_FRAMES;
+        return CONFORMANCE_ppu_thread(rom_path, frames);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "idle_skip") == 0) {
+        size_t frames = (argc >= 3) ? strtoul(argv[2], NULL, 10) : CONFORMANCE_IDLE_SKIP_FRAMES;
+        return CONFORMANCE_idle_skip(frames);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "rewind") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        return CONFORMANCE_rewind(seed);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "savestate") == 0) {
+        return CONFORMANCE_savestate();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "sprite_eval") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        return CONFORMANCE_sprite_eval(seed);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "movie") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        return CONFORMANCE_movie(seed);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "flags") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        return CONFORMANCE_flags(seed);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "cart") == 0) {
+        return CONFORMANCE_cart();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "manifest") == 0) {
+        return CONFORMANCE_manifest();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "trace") == 0) {
+        return CONFORMANCE_trace();
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "video") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        return CONFORMANCE_video(seed);
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "ntsc") == 0) {
+        unsigned seed = (argc >= 3) ? (unsigned)strtoul(argv[2], NULL, 10) : 1;
+        return CONFORMANCE_ntsc(seed);
+    }
+
+    CONFORMANCE_usage(argv[0]);
+    return EXIT_FAILURE;
+}
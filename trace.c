@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <TRACE.h>
+
+// Decodes an execution trace dump to nestest.log style text
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace.bin> [last_n]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    TRACE trace;
+    if (!TRACE_load_file(&trace, argv[1])) {
+        return EXIT_FAILURE;
+    }
+
+    size_t count = TRACE_count(&trace);
+    size_t first = 0;
+    if (argc > 2) {
+        size_t last = strtoul(argv[2], NULL, 10);
+        if (last < count) first = count - last;
+    }
+
+    char line[128];
+    for (size_t i = first; i < count; i++) {
+        TRACE_format(TRACE_get(&trace, i), line, sizeof(line));
+        puts(line);
+    }
+
+    TRACE_free(&trace);
+    return EXIT_SUCCESS;
+}